@@ -19,11 +19,15 @@
 #include <glib.h>
 
 #include "app.h"
-#include "config.h"
+#include "core.h"
 
 #include "server-menu.h"
-#include "temp-menu.h"
-#include "psu-menu.h"
+#include "group-menu.h"
+#include "upload-dialog.h"
+#include "preview-window.h"
+#include "search-window.h"
+#include "webcam-wall.h"
+#include "tray-icon.h"
 
 #include "octoprint/client.h"
 #include "octoprint/socket.h"
@@ -32,20 +36,34 @@ struct _OPDeskApp {
     GtkApplication parent_inst;
 
     GtkStatusIcon *tray_icon;
-    GIcon *notification_icon;
+    // draws fleet progress and problems on tray_icon, NULL if menu.dynamicIcon is off
+    OPDeskTrayIcon *dynamic_icon;
 
     GtkWidget *menu_root;
-    GList *server_menus;
+    GList *group_menus;
     GtkWidget *quit_mi;
 
-    char *config_path;
+    guint tooltip_source;
+
+    OPDeskOptions options;
+    // the servers and everything else that isn't UI
+    OPDeskCore *core;
+
+    // only one at a time, NULL once closed
+    GtkWidget *search_window;
+    GtkWidget *webcam_wall;
 };
 
 G_DEFINE_TYPE(OPDeskApp, opdesk_app, GTK_TYPE_APPLICATION);
 
 
 static void on_tray_menu_map(GtkWidget *menu, OPDeskApp *app) {
-    
+    // group labels summarize their servers, only worth updating when they can be seen
+    GList *group = app->group_menus;
+    while(group) {
+        opdesk_group_menu_refresh_label(group->data);
+        group = group->next;
+    }
 }
 
 static void on_menu_quit(GtkWidget *widget, OPDeskApp *app) {
@@ -64,14 +82,19 @@ static void opdesk_app_activate(OPDeskApp *app, gpointer user_data) {
     
 }
 
-static void opdesk_app_server_status_updated(OPDeskServerMenu *menu, OPDeskApp *app) {
-    gint server_cnt = g_list_length(app->server_menus);
+static gboolean opdesk_app_update_tooltip(OPDeskApp *app) {
+    app->tooltip_source = 0;
+    gint64 start = g_get_monotonic_time();
+
+    GList *servers = opdesk_core_get_servers(app->core);
+    gint server_cnt = g_list_length(servers);
     const char **statuses = g_malloc0_n(server_cnt+1, sizeof(char*));
 
-    GList *server = app->server_menus;
+    GList *server = servers;
     gint i = 0;
     while(server) {
-        statuses[i++] = opdesk_server_menu_get_status_markup(server->data);
+        const char *status = opdesk_server_get_status_markup(server->data);
+        if(status) statuses[i++] = status;
         server = server->next;
     }
 
@@ -83,6 +106,140 @@ static void opdesk_app_server_status_updated(OPDeskServerMenu *menu, OPDeskApp *
     gtk_status_icon_set_tooltip_markup(GTK_STATUS_ICON(app->tray_icon), new_status);
     #pragma GCC diagnostic pop
     g_free(new_status);
+
+    if(app->dynamic_icon) opdesk_tray_icon_update(app->dynamic_icon, servers);
+
+    OPDeskMetrics *metrics = opdesk_core_get_metrics(app->core);
+    if(metrics) octoprint_histogram_observe(opdesk_metrics_get_ui_histogram(metrics), g_get_monotonic_time() - start);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void opdesk_app_server_status_updated(OPDeskServer *server, OPDeskApp *app) {
+    // many servers can update at once, rebuild the tooltip once they're done
+    if(app->tooltip_source) return;
+    app->tooltip_source = g_idle_add(G_SOURCE_FUNC(opdesk_app_update_tooltip), app);
+}
+
+static gint opdesk_app_handle_local_options(OPDeskApp *app, GVariantDict *options, gpointer user_data) {
+    return opdesk_options_handle_local(&app->options, G_APPLICATION(app));
+}
+
+static void on_fleet_menu_activate(GtkWidget *item, OPDeskApp *app) {
+    const char *action = g_object_get_data(G_OBJECT(item), "fleet-action");
+    GVariant *target = g_object_get_data(G_OBJECT(item), "fleet-target");
+
+    if(g_strcmp0(action, "fleet-psu-off")==0) {
+        GtkWidget *dialog = gtk_message_dialog_new(NULL, 0, GTK_MESSAGE_WARNING, GTK_BUTTONS_YES_NO,
+            "Are you sure you want to turn off every printer in %s? Any prints in progress will be ruined and won't be recoverable.",
+            *g_variant_get_string(target, NULL) ? g_variant_get_string(target, NULL) : "the fleet");
+        gint response = gtk_dialog_run(GTK_DIALOG(dialog));
+        gtk_widget_destroy(dialog);
+        if(response!=GTK_RESPONSE_YES) return;
+    }
+
+    g_action_group_activate_action(G_ACTION_GROUP(app), action, target);
+}
+
+static GtkWidget *fleet_menu_item_new(OPDeskApp *app, const char *label, const char *action, GVariant *target) {
+    GtkWidget *item = gtk_menu_item_new_with_label(label);
+    g_object_set_data_full(G_OBJECT(item), "fleet-action", g_strdup(action), g_free);
+    g_object_set_data_full(G_OBJECT(item), "fleet-target", g_variant_ref_sink(target), (GDestroyNotify)g_variant_unref);
+    g_signal_connect(item, "activate", G_CALLBACK(on_fleet_menu_activate), app);
+
+    return item;
+}
+
+static void on_fleet_upload_menu_activate(GtkWidget *item, OPDeskApp *app) {
+    const char *group = g_object_get_data(G_OBJECT(item), "fleet-group");
+
+    char *title = g_strdup_printf("Upload to %s", *group ? group : "all printers");
+    GtkWidget *dialog = opdesk_upload_dialog_new(title);
+    g_free(title);
+    gtk_file_chooser_set_local_only(GTK_FILE_CHOOSER(dialog), TRUE);
+
+    if(gtk_dialog_run(GTK_DIALOG(dialog))==GTK_RESPONSE_ACCEPT) {
+        char *uri = gtk_file_chooser_get_uri(GTK_FILE_CHOOSER(dialog));
+        g_action_group_activate_action(G_ACTION_GROUP(app), "fleet-upload",
+            g_variant_new("(ssb)", group, uri, opdesk_upload_dialog_get_print(dialog)));
+        g_free(uri);
+    }
+
+    gtk_widget_destroy(dialog);
+}
+
+static void on_preview_menu_activate(GtkWidget *item, OPDeskApp *app) {
+    GtkWidget *dialog = gtk_file_chooser_dialog_new("Preview G-code", NULL, GTK_FILE_CHOOSER_ACTION_OPEN,
+        "_Cancel", GTK_RESPONSE_CANCEL, "_Open", GTK_RESPONSE_ACCEPT, NULL);
+    gtk_file_chooser_set_local_only(GTK_FILE_CHOOSER(dialog), TRUE);
+
+    GtkFileFilter *gcode = gtk_file_filter_new();
+    gtk_file_filter_set_name(gcode, "G-code");
+    gtk_file_filter_add_pattern(gcode, "*.gcode");
+    gtk_file_filter_add_pattern(gcode, "*.gco");
+    gtk_file_filter_add_pattern(gcode, "*.g");
+    gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(dialog), gcode);
+
+    if(gtk_dialog_run(GTK_DIALOG(dialog))==GTK_RESPONSE_ACCEPT) {
+        GFile *file = gtk_file_chooser_get_file(GTK_FILE_CHOOSER(dialog));
+        gtk_widget_show_all(GTK_WIDGET(opdesk_preview_window_new_for_file(file)));
+        g_object_unref(file);
+    }
+
+    gtk_widget_destroy(dialog);
+}
+
+static void on_search_menu_activate(GtkWidget *item, OPDeskApp *app) {
+    if(!app->search_window) {
+        app->search_window = GTK_WIDGET(opdesk_search_window_new(opdesk_core_get_file_index(app->core)));
+        g_object_add_weak_pointer(G_OBJECT(app->search_window), (gpointer*)&app->search_window);
+        gtk_widget_show_all(app->search_window);
+    }
+    gtk_window_present(GTK_WINDOW(app->search_window));
+}
+
+static void on_webcam_wall_menu_activate(GtkWidget *item, OPDeskApp *app) {
+    if(!app->webcam_wall) {
+        app->webcam_wall = GTK_WIDGET(opdesk_webcam_wall_new(opdesk_core_get_config(app->core), opdesk_core_get_servers(app->core)));
+        g_object_add_weak_pointer(G_OBJECT(app->webcam_wall), (gpointer*)&app->webcam_wall);
+        gtk_widget_show_all(app->webcam_wall);
+    }
+    gtk_window_present(GTK_WINDOW(app->webcam_wall));
+}
+
+// the fleet commands for a group, or all printers if group is ""
+static GtkWidget *opdesk_app_build_fleet_menu(OPDeskApp *app, const char *group) {
+    GtkWidget *menu = gtk_menu_new();
+
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), fleet_menu_item_new(app, "Turn PSUs ON", "fleet-psu-on", g_variant_new_string(group)));
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), fleet_menu_item_new(app, "Turn PSUs OFF", "fleet-psu-off", g_variant_new_string(group)));
+
+    GtkWidget *preheat = gtk_menu_item_new_with_label("Preheat");
+    GtkWidget *preheat_menu = gtk_menu_new();
+    gtk_menu_item_set_submenu(GTK_MENU_ITEM(preheat), preheat_menu);
+    for(GList *preset = opdesk_fleet_get_presets(opdesk_core_get_fleet(app->core)); preset; preset = preset->next) {
+        gtk_menu_shell_append(GTK_MENU_SHELL(preheat_menu), fleet_menu_item_new(app, preset->data, "fleet-preheat", g_variant_new("(ss)", group, preset->data)));
+    }
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), preheat);
+
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), fleet_menu_item_new(app, "Cool down", "fleet-cooldown", g_variant_new_string(group)));
+
+    GtkWidget *upload = gtk_menu_item_new_with_label("Upload G-code...");
+    g_object_set_data_full(G_OBJECT(upload), "fleet-group", g_strdup(group), g_free);
+    g_signal_connect(upload, "activate", G_CALLBACK(on_fleet_upload_menu_activate), app);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), upload);
+
+    if(opdesk_fleet_get_macros(opdesk_core_get_fleet(app->core))) {
+        GtkWidget *macros = gtk_menu_item_new_with_label("Macros");
+        GtkWidget *macros_menu = gtk_menu_new();
+        gtk_menu_item_set_submenu(GTK_MENU_ITEM(macros), macros_menu);
+        for(GList *macro = opdesk_fleet_get_macros(opdesk_core_get_fleet(app->core)); macro; macro = macro->next) {
+            gtk_menu_shell_append(GTK_MENU_SHELL(macros_menu), fleet_menu_item_new(app, macro->data, "fleet-macro", g_variant_new("(ss)", group, macro->data)));
+        }
+        gtk_menu_shell_append(GTK_MENU_SHELL(menu), macros);
+    }
+
+    return menu;
 }
 
 static void opdesk_app_startup(OPDeskApp *app, gpointer user_data) {
@@ -93,8 +250,6 @@ static void opdesk_app_startup(OPDeskApp *app, gpointer user_data) {
     g_message("      OctoPrint Desktop Application Startup         ");
     g_message("----------------------------------------------------");
 
-    app->notification_icon = g_themed_icon_new("octoprint-tentacle");
-
     g_message("Setting up application");
 
     // hold the application open without a window
@@ -111,35 +266,78 @@ static void opdesk_app_startup(OPDeskApp *app, gpointer user_data) {
 
     /* tray icon menu */
     app->menu_root = gtk_menu_new();
-
-    
+    g_signal_connect(app->menu_root, "map", G_CALLBACK(on_tray_menu_map), app);
 
     g_signal_connect(app->tray_icon, "activate", G_CALLBACK(on_tray_icon_click), app);
 
-    const char *home_dir = g_get_home_dir();
-    const char *conf_name = ".op-desktop.json";
-    char *conf_path = g_build_path(G_DIR_SEPARATOR_S, home_dir, conf_name, NULL);   
-    if (app->config_path) {
-        g_free(conf_path);
-        conf_path = app->config_path;
+    app->core = opdesk_core_new(G_APPLICATION(app), app->options.config_path);
+    opdesk_core_add_actions(app->core, G_ACTION_MAP(app));
+    OPDeskAppConfig *config = opdesk_core_get_config(app->core);
+    OPDeskFleet *fleet = opdesk_core_get_fleet(app->core);
+
+    if(opdesk_app_config_get_boolean(config, "menu.dynamicIcon", TRUE)) app->dynamic_icon = opdesk_tray_icon_new(app->tray_icon);
+
+    guint idle_timeout = opdesk_app_config_get_int(config, "menu.idleTimeout", 60);
+
+    // group menus are placed where the first server of the group would have been
+    GHashTable *groups = g_hash_table_new(g_str_hash, g_str_equal);
+
+    GList *servers = opdesk_core_get_servers(app->core);
+    for(GList *s = servers; s; s = s->next) {
+        OPDeskServer *server = s->data;
+        g_signal_connect(server, "status-updated", G_CALLBACK(opdesk_app_server_status_updated), app);
+
+        const char *group_name = opdesk_config_get_group(opdesk_server_get_config(server));
+        if(group_name) {
+            OPDeskGroupMenu *group = g_hash_table_lookup(groups, group_name);
+            if(!group) {
+                group = opdesk_group_menu_new(group_name, idle_timeout);
+                gtk_menu_shell_append(GTK_MENU_SHELL(app->menu_root), GTK_WIDGET(group));
+                g_hash_table_insert(groups, (gpointer)opdesk_group_menu_get_name(group), group);
+                app->group_menus = g_list_append(app->group_menus, group);
+            }
+            opdesk_group_menu_add_server(group, server);
+        } else {
+            OPDeskServerMenu *smi = opdesk_server_menu_new(server, idle_timeout);
+            gtk_menu_shell_append(GTK_MENU_SHELL(app->menu_root), GTK_WIDGET(smi));
+        }
     }
-
-    g_message("Loading config from %s", conf_path);
-    GList *servers = opdesk_config_load_from_file(conf_path);
-    
-    while(servers) {
-        OPDeskServerMenu *smi = opdesk_server_menu_new(servers->data);
-        gtk_menu_shell_append(GTK_MENU_SHELL(app->menu_root), GTK_WIDGET(smi));
-        g_signal_connect(smi, "status-updated", G_CALLBACK(opdesk_app_server_status_updated), app);
-        app->server_menus = g_list_append(app->server_menus, smi);
-        servers = servers->next;
+    g_hash_table_destroy(groups);
+
+    if(g_list_length(servers) > 1) {
+        GtkWidget *fleet_sep = gtk_separator_menu_item_new();
+        gtk_menu_shell_append(GTK_MENU_SHELL(app->menu_root), fleet_sep);
+
+        GtkWidget *fleet_mi = gtk_menu_item_new_with_label("All Printers");
+        gtk_menu_shell_append(GTK_MENU_SHELL(app->menu_root), fleet_mi);
+        gtk_menu_item_set_submenu(GTK_MENU_ITEM(fleet_mi), opdesk_app_build_fleet_menu(app, ""));
+
+        for(GList *group = opdesk_fleet_get_groups(fleet); group; group = group->next) {
+            char *lbl = g_strdup_printf("All of %s", (char*)group->data);
+            GtkWidget *group_mi = gtk_menu_item_new_with_label(lbl);
+            g_free(lbl);
+            gtk_menu_shell_append(GTK_MENU_SHELL(app->menu_root), group_mi);
+            gtk_menu_item_set_submenu(GTK_MENU_ITEM(group_mi), opdesk_app_build_fleet_menu(app, group->data));
+        }
     }
-    servers = g_list_first(servers);
-    g_list_free(servers);
 
     GtkWidget *sep = gtk_separator_menu_item_new();
     gtk_menu_shell_append(GTK_MENU_SHELL(app->menu_root), sep);
 
+    GtkWidget *search_mi = gtk_menu_item_new_with_label("Find File...");
+    gtk_menu_shell_append(GTK_MENU_SHELL(app->menu_root), search_mi);
+    g_signal_connect(search_mi, "activate", G_CALLBACK(on_search_menu_activate), app);
+
+    if(servers) {
+        GtkWidget *wall_mi = gtk_menu_item_new_with_label("Webcams...");
+        gtk_menu_shell_append(GTK_MENU_SHELL(app->menu_root), wall_mi);
+        g_signal_connect(wall_mi, "activate", G_CALLBACK(on_webcam_wall_menu_activate), app);
+    }
+
+    GtkWidget *preview_mi = gtk_menu_item_new_with_label("Preview G-code...");
+    gtk_menu_shell_append(GTK_MENU_SHELL(app->menu_root), preview_mi);
+    g_signal_connect(preview_mi, "activate", G_CALLBACK(on_preview_menu_activate), app);
+
     app->quit_mi = gtk_menu_item_new_with_label("Quit");
     gtk_menu_shell_append(GTK_MENU_SHELL(app->menu_root), app->quit_mi);
     g_signal_connect(app->quit_mi, "activate", G_CALLBACK(on_menu_quit), app);
@@ -148,8 +346,15 @@ static void opdesk_app_startup(OPDeskApp *app, gpointer user_data) {
 }
 
 static void opdesk_app_shutdown(OPDeskApp *app, gpointer user_data) {
-    g_object_unref(app->notification_icon);
+    if(app->tooltip_source) g_source_remove(app->tooltip_source);
+    if(app->dynamic_icon) g_object_unref(app->dynamic_icon);
+    if(app->search_window) gtk_widget_destroy(app->search_window);
+    if(app->webcam_wall) gtk_widget_destroy(app->webcam_wall);
     gtk_widget_destroy(GTK_WIDGET(app->menu_root));
+    for(GList *server = opdesk_core_get_servers(app->core); server; server = server->next) {
+        g_signal_handlers_disconnect_by_data(server->data, app);
+    }
+    g_clear_object(&app->core);
 
     g_message("----------------------------------------------------");
     g_message("       OctoPrint Desktop Application Shutdown       ");
@@ -160,18 +365,9 @@ static void opdesk_app_init(OPDeskApp *app) {
     g_signal_connect(app, "activate", G_CALLBACK(opdesk_app_activate), NULL);
     g_signal_connect(app, "startup", G_CALLBACK(opdesk_app_startup), NULL);
     g_signal_connect(app, "shutdown", G_CALLBACK(opdesk_app_shutdown), NULL);
+    g_signal_connect(app, "handle-local-options", G_CALLBACK(opdesk_app_handle_local_options), NULL);
 
-    const GOptionEntry options[] = {
-        {
-            .long_name = "config",
-            .description = "Configuration file path",
-            .arg = G_OPTION_ARG_STRING,
-            .arg_data = &app->config_path,
-        },
-        {NULL}
-    };
-
-    g_application_add_main_option_entries(G_APPLICATION(app), options);
+    opdesk_options_add_entries(&app->options, G_APPLICATION(app));
 }
 
 static void opdesk_app_dispose(GObject *object) {
@@ -181,7 +377,8 @@ static void opdesk_app_dispose(GObject *object) {
 
 static void opdesk_app_finalize(GObject *object) {
     OPDeskApp *self = OPDESK_APP_APPLICATION(object);
-    g_list_free(self->server_menus);
+    g_list_free(self->group_menus);
+    opdesk_options_clear(&self->options);
     G_OBJECT_CLASS(opdesk_app_parent_class)->finalize(object);
 }
 
@@ -5,10 +5,12 @@
 
 #include <stdarg.h>
 #include "config.h"
+#include "event-rules.h"
 
 #define PRINTER_NAME_DEFAULT     "3d printer"
 #define OCTOPRINT_URL_DEFAULT    "http://octopi.local"
 #define OCTOPRINT_APIKEY_DEFAULT "invalidapikey"
+#define HTTP_CACHE_SIZE_DEFAULT  512 // KiB
 
 #define STATUS_NOTCONNECTED_DEFAULT "{printer-name}\nNot connected to OctoPrint"
 #define STATUS_OFFLINE_DEFAULT      "{printer-name}\nPrinter offline"
@@ -25,6 +27,7 @@ struct _OPDeskConfig {
     gchar *printer_name;
     gchar *octoprint_url;
     gchar *octoprint_api_key;
+    gchar *group;
 
     struct {
         char *not_connected;
@@ -37,7 +40,24 @@ struct _OPDeskConfig {
         char *printing;
     } status_templates;
 
-    GHashTable *event_notifications;
+    OPDeskEventRules *event_rules;
+
+    struct {
+        gsize max_size;
+        GHashTable *ttls; // path prefix -> seconds
+    } http_cache;
+
+    GHashTable *macros; // name -> G-code lines (GStrv)
+    GList *macro_names; // config order, owned by macros
+
+    // override what OctoPrint's webcam settings say, NULL to use them
+    struct {
+        char *snapshot_url;
+        char *stream_url;
+    } webcam;
+
+    // OctoPrint-MQTT's publish.baseTopic, NULL for its default
+    char *mqtt_base_topic;
 };
 
 G_DEFINE_TYPE (OPDeskConfig, opdesk_config, G_TYPE_OBJECT)
@@ -49,41 +69,6 @@ typedef enum {
 
 static guint obj_signals[N_SIGNALS] = { 0, };
 
-struct OPDeskConfigEventNotification {
-    char *event;
-    GNotificationPriority priority;
-    char *template;
-};
-typedef struct OPDeskConfigEventNotification OPDeskConfigEventNotification;
-
-static OPDeskConfigEventNotification *opdesk_config_event_notification_new(const char *event, const gchar *priority, const char *template) {
-    OPDeskConfigEventNotification *note = g_malloc0(sizeof(OPDeskConfigEventNotification));
-
-    GNotificationPriority p;
-
-    if(g_strcmp0(priority, "low")==0) p = G_NOTIFICATION_PRIORITY_LOW;
-    else if (g_strcmp0(priority, "high")==0) p = G_NOTIFICATION_PRIORITY_HIGH;
-    else if (g_strcmp0(priority, "normal")==0) p = G_NOTIFICATION_PRIORITY_NORMAL;
-    else if (g_strcmp0(priority, "urgent")==0) p = G_NOTIFICATION_PRIORITY_URGENT;
-    else {
-        g_warning("Unknown notification priority: %s", priority);
-        p = G_NOTIFICATION_PRIORITY_NORMAL;
-    }
-
-    note->event = g_strdup(event);
-    note->template = g_strdup(template);
-    note->priority = p;
-
-    return note;
-}
-
-static void opdesk_config_event_notification_free(OPDeskConfigEventNotification *data) {
-    g_free(data->event);
-    g_free(data->template);
-    g_free(data);
-}
-
-
 static void opdesk_config_dispose(GObject *object) {
 
     G_OBJECT_CLASS(opdesk_config_parent_class)->dispose(object);
@@ -95,6 +80,7 @@ static void opdesk_config_finalize(GObject *object) {
     g_free(self->printer_name);
     g_free(self->octoprint_url);
     g_free(self->octoprint_api_key);
+    g_free(self->group);
 
     g_free(self->status_templates.not_connected);
     g_free(self->status_templates.offline);
@@ -105,7 +91,14 @@ static void opdesk_config_finalize(GObject *object) {
     g_free(self->status_templates.paused);
     g_free(self->status_templates.printing);
 
-    g_hash_table_destroy(self->event_notifications);
+    opdesk_event_rules_free(self->event_rules);
+    g_hash_table_destroy(self->http_cache.ttls);
+    g_list_free(self->macro_names);
+    g_hash_table_destroy(self->macros);
+
+    g_free(self->webcam.snapshot_url);
+    g_free(self->webcam.stream_url);
+    g_free(self->mqtt_base_topic);
     
     G_OBJECT_CLASS(opdesk_config_parent_class)->finalize(object);
 }
@@ -146,7 +139,33 @@ static void opdesk_config_init(OPDeskConfig *config) {
     config->status_templates.paused = g_strdup(STATUS_PAUSED_DEFAULT);
     config->status_templates.printing = g_strdup(STATUS_PRINTING_DEFAULT);
 
-    config->event_notifications = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (void(*)(void*))opdesk_config_event_notification_free);
+    config->event_rules = opdesk_event_rules_new();
+
+    config->http_cache.max_size = HTTP_CACHE_SIZE_DEFAULT * 1024;
+    config->http_cache.ttls = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    // the plugin list is requested once per plugin checked on every connect
+    g_hash_table_insert(config->http_cache.ttls, g_strdup("/plugin/pluginmanager/plugins"), GUINT_TO_POINTER(30));
+
+    config->macros = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_strfreev);
+}
+
+// a macro is either an array of lines or a single string with one command per line
+static gchar **load_macro_lines(JsonNode *node) {
+    if(JSON_NODE_HOLDS_VALUE(node) && json_node_get_value_type(node)==G_TYPE_STRING) {
+        return g_strsplit(json_node_get_string(node), "\n", -1);
+    }
+
+    if(!JSON_NODE_HOLDS_ARRAY(node)) return NULL;
+
+    JsonArray *arr = json_node_get_array(node);
+    guint len = json_array_get_length(arr);
+    gchar **lines = g_new0(gchar*, len + 1);
+    guint n = 0;
+    for(guint l=0;l<len;l++) {
+        const char *line = json_array_get_string_element(arr, l);
+        if(line) lines[n++] = g_strdup(line);
+    }
+    return lines;
 }
 
 OPDeskConfig *opdesk_config_new() {
@@ -159,6 +178,8 @@ gboolean opdesk_config_load_from_json(OPDeskConfig *config, JsonObject *conf) {
     load_if_present_string(conf, "printerName", config->printer_name);
     load_if_present_string(conf, "octoprintURL", config->octoprint_url);
     load_if_present_string(conf, "apiKey", config->octoprint_api_key);
+    load_if_present_string(conf, "group", config->group);
+    load_if_present_string(conf, "mqttBaseTopic", config->mqtt_base_topic);
 
     if(json_object_has_member(conf, "statusText")) {
         JsonObject *status_text = json_object_get_object_member(conf, "statusText");
@@ -179,58 +200,178 @@ gboolean opdesk_config_load_from_json(OPDeskConfig *config, JsonObject *conf) {
         GList *event_ele = event_ele_first;
         while(event_ele) {
             JsonObject *event_conf = json_node_get_object(event_ele->data);
-            const gchar *event = json_object_get_string_member(event_conf, "event");
-            const gchar *template = json_object_get_string_member(event_conf, "template");
-            const gchar *priority = json_object_get_string_member(event_conf, "priority");
-            OPDeskConfigEventNotification *notification = opdesk_config_event_notification_new(event, priority, template);
-            g_hash_table_insert(config->event_notifications, g_strdup(event), notification);
+            opdesk_event_rules_add_from_json(config->event_rules, event_conf);
             event_ele = event_ele->next;
         }
         g_list_free(event_ele_first);
     }
 
-    
-    
+    if(json_object_has_member(conf, "httpCache")) {
+        JsonObject *http_cache = json_object_get_object_member(conf, "httpCache");
+        if(json_object_has_member(http_cache, "maxSize")) config->http_cache.max_size = json_object_get_int_member(http_cache, "maxSize") * 1024;
+        if(json_object_has_member(http_cache, "ttl")) {
+            JsonObject *ttls = json_object_get_object_member(http_cache, "ttl");
+            GList *paths_first = json_object_get_members(ttls);
+            GList *path = paths_first;
+            while(path) {
+                gint64 ttl = json_object_get_int_member(ttls, path->data);
+                g_hash_table_insert(config->http_cache.ttls, g_strdup(path->data), GUINT_TO_POINTER(ttl > 0 ? ttl : 0));
+                path = path->next;
+            }
+            g_list_free(paths_first);
+        }
+    }
+
+    if(json_object_has_member(conf, "macros")) {
+        JsonObject *macros = json_object_get_object_member(conf, "macros");
+        GList *names_first = json_object_get_members(macros);
+        for(GList *name = names_first; name; name = name->next) {
+            gchar **lines = load_macro_lines(json_object_get_member(macros, name->data));
+            if(!lines) {
+                g_warning("Macro %s should be a string or an array of strings, ignoring", (char*)name->data);
+                continue;
+            }
+            if(g_hash_table_contains(config->macros, name->data)) {
+                // insert keeps the existing key, which macro_names points at
+                g_hash_table_insert(config->macros, g_strdup(name->data), lines);
+            } else {
+                char *key = g_strdup(name->data);
+                g_hash_table_insert(config->macros, key, lines);
+                config->macro_names = g_list_append(config->macro_names, key);
+            }
+        }
+        g_list_free(names_first);
+    }
+
+    if(json_object_has_member(conf, "webcam")) {
+        JsonObject *webcam = json_object_get_object_member(conf, "webcam");
+        load_if_present_string(webcam, "snapshotUrl", config->webcam.snapshot_url);
+        load_if_present_string(webcam, "streamUrl", config->webcam.stream_url);
+    }
+
    return TRUE;
 }
 
-GList *opdesk_config_load_from_file(const char *file_path) {
+struct _OPDeskAppConfig {
+    GObject parent_instance;
+
+    GList *servers;
+
+    // application wide settings, the root object of the config file (if it is one)
+    JsonObject *settings;
+};
+
+G_DEFINE_TYPE (OPDeskAppConfig, opdesk_app_config, G_TYPE_OBJECT)
+
+static void opdesk_app_config_finalize(GObject *object) {
+    OPDeskAppConfig *self = OPDESK_APP_CONFIG(object);
+
+    g_list_free_full(self->servers, g_object_unref);
+    if(self->settings) json_object_unref(self->settings);
+
+    G_OBJECT_CLASS(opdesk_app_config_parent_class)->finalize(object);
+}
+
+static void opdesk_app_config_class_init(OPDeskAppConfigClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->finalize = opdesk_app_config_finalize;
+}
+
+static void opdesk_app_config_init(OPDeskAppConfig *config) {
+
+}
+
+static GList *load_server_list(JsonArray *arr) {
     GList *servers = NULL;
+    GList *server_list = json_array_get_elements(arr);
+    GList *server = server_list;
+    while(server) {
+        OPDeskConfig *c = opdesk_config_new();
+        JsonObject *o = json_node_get_object(server->data);
+        opdesk_config_load_from_json(c, o);
+        servers = g_list_append(servers, c);
+        server = server->next;
+    }
+    g_list_free(server_list);
+
+    return servers;
+}
+
+OPDeskAppConfig *opdesk_app_config_load_from_file(const char *file_path) {
+    OPDeskAppConfig *config = g_object_new(OPDESK_TYPE_APP_CONFIG, NULL);
 
     GError *error = NULL;
     JsonParser *parser = json_parser_new();
 
     if(!json_parser_load_from_file(parser, file_path, &error)) {
         g_critical("Couldn't load configuration from %s: %s", file_path, error->message);
-        return FALSE;
+        g_error_free(error);
+        g_object_unref(parser);
+        return config;
     }
 
     JsonNode *root = json_parser_get_root(parser);
 
     if(JSON_NODE_HOLDS_ARRAY(root)) {
-        JsonArray *arr = json_node_get_array(root);
-        GList *server_list = json_array_get_elements(arr);
-        GList *server = server_list;
-        while(server) {
+        config->servers = load_server_list(json_node_get_array(root));
+    } else if (JSON_NODE_HOLDS_OBJECT(root)) {
+        JsonObject *o = json_node_get_object(root);
+        config->settings = json_object_ref(o);
+
+        if(json_object_has_member(o, "servers")) {
+            // { <application settings>, "servers": [ <server>, ... ] }
+            config->servers = load_server_list(json_object_get_array_member(o, "servers"));
+        } else {
             OPDeskConfig *c = opdesk_config_new();
-            JsonObject *o = json_node_get_object(server->data);
             opdesk_config_load_from_json(c, o);
-            servers = g_list_append(servers, c);
-            server = server->next;
+            config->servers = g_list_append(config->servers, c);
         }
-        g_list_free(server_list);
-    } else if (JSON_NODE_HOLDS_OBJECT(root)) {
-        OPDeskConfig *c = opdesk_config_new();
-        JsonObject *o = json_node_get_object(root);
-        opdesk_config_load_from_json(c, o);
-        servers = g_list_append(servers, c);
     } else {
         g_critical("Couldn't load configuration from %s: root node must be an array or object.", file_path);
     }
 
     g_object_unref(parser);
 
-    return servers;
+    return config;
+}
+
+GList *opdesk_app_config_get_servers(OPDeskAppConfig *config) {
+    return config->servers;
+}
+
+static JsonNode *opdesk_app_config_get_value(OPDeskAppConfig *config, const char *const path) {
+    JsonNode *node = opdesk_json_object_get_path(config->settings, path);
+    if(node && !JSON_NODE_HOLDS_VALUE(node)) return NULL;
+
+    return node;
+}
+
+gint64 opdesk_app_config_get_int(OPDeskAppConfig *config, const char *const path, gint64 default_value) {
+    JsonNode *node = opdesk_app_config_get_value(config, path);
+    return node ? json_node_get_int(node) : default_value;
+}
+
+gdouble opdesk_app_config_get_double(OPDeskAppConfig *config, const char *const path, gdouble default_value) {
+    JsonNode *node = opdesk_app_config_get_value(config, path);
+    return node ? json_node_get_double(node) : default_value;
+}
+
+gboolean opdesk_app_config_get_boolean(OPDeskAppConfig *config, const char *const path, gboolean default_value) {
+    JsonNode *node = opdesk_app_config_get_value(config, path);
+    return node ? json_node_get_boolean(node) : default_value;
+}
+
+const char *opdesk_app_config_get_string(OPDeskAppConfig *config, const char *const path, const char *default_value) {
+    JsonNode *node = opdesk_app_config_get_value(config, path);
+    return node ? json_node_get_string(node) : default_value;
+}
+
+JsonArray *opdesk_app_config_get_array(OPDeskAppConfig *config, const char *const path) {
+    JsonNode *node = opdesk_json_object_get_path(config->settings, path);
+    if(!node || !JSON_NODE_HOLDS_ARRAY(node)) return NULL;
+
+    return json_node_get_array(node);
 }
 
 #define change_and_emit(config, var, val, name) g_free(var); var = g_strdup(val); g_signal_emit(config, obj_signals[CHANGED], 0, name)
@@ -258,6 +399,10 @@ void opdesk_config_set_octoprint_api_key(OPDeskConfig *config, const char *api_k
     change_and_emit(config, config->octoprint_api_key, api_key, "octoprint_api_key");
 }
 
+const char *opdesk_config_get_group(OPDeskConfig *config) {
+    return config->group;
+}
+
 const char *opdesk_config_get_status_template(OPDeskConfig *config, OPDeskConfigStatusTemplateType template_type) {
     switch(template_type) {
     case STATUS_TEMPLATE_NOT_CONNECTED: return config->status_templates.not_connected;
@@ -272,20 +417,34 @@ const char *opdesk_config_get_status_template(OPDeskConfig *config, OPDeskConfig
     }
 }
 
-gboolean opdesk_config_has_event_notification(OPDeskConfig *config, const char *const event_name) {
-    return g_hash_table_contains(config->event_notifications, event_name);
+gsize opdesk_config_get_http_cache_size(OPDeskConfig *config) {
+    return config->http_cache.max_size;
+}
+
+GHashTable *opdesk_config_get_http_cache_ttls(OPDeskConfig *config) {
+    return config->http_cache.ttls;
+}
+
+OPDeskEventRules *opdesk_config_get_event_rules(OPDeskConfig *config) {
+    return config->event_rules;
+}
+
+const char *opdesk_config_get_webcam_snapshot_url(OPDeskConfig *config) {
+    return config->webcam.snapshot_url;
 }
 
-const char *opdesk_config_get_event_notification_template(OPDeskConfig *config, const char *const event_name) {
-    if (!opdesk_config_has_event_notification(config, event_name)) return NULL;
+const char *opdesk_config_get_webcam_stream_url(OPDeskConfig *config) {
+    return config->webcam.stream_url;
+}
 
-    OPDeskConfigEventNotification *notify = g_hash_table_lookup(config->event_notifications, event_name);
-    return notify->template;
+const char *opdesk_config_get_mqtt_base_topic(OPDeskConfig *config) {
+    return config->mqtt_base_topic ? config->mqtt_base_topic : "octoPrint/";
 }
 
-GNotificationPriority opdesk_config_get_event_notification_priority(OPDeskConfig *config, const char *const event_name) {
-    if (!opdesk_config_has_event_notification(config, event_name)) return -1;
+GList *opdesk_config_get_macro_names(OPDeskConfig *config) {
+    return config->macro_names;
+}
 
-    OPDeskConfigEventNotification *notify = g_hash_table_lookup(config->event_notifications, event_name);
-    return notify->priority;
-}
\ No newline at end of file
+const char *const *opdesk_config_get_macro(OPDeskConfig *config, const char *const name) {
+    return g_hash_table_lookup(config->macros, name);
+}
@@ -1,13 +1,12 @@
 #pragma once
 #include <glib-object.h>
+#include "event-rules.h"
 
 G_BEGIN_DECLS
 
 #define OPDESK_TYPE_CONFIG opdesk_config_get_type()
 G_DECLARE_FINAL_TYPE (OPDeskConfig, opdesk_config, OPDESK, CONFIG, GObject)
 
-GList *opdesk_config_load_from_file(const char *file_path);
-
 const char *opdesk_config_get_printer_name(OPDeskConfig *config);
 void opdesk_config_set_printer_name(OPDeskConfig *config, const char *printer_name);
 
@@ -17,6 +16,9 @@ void opdesk_config_set_octoprint_url(OPDeskConfig *config, const char *url);
 const char *opdesk_config_get_octoprint_api_key(OPDeskConfig *config);
 void opdesk_config_set_octoprint_api_key(OPDeskConfig *config, const char *api_key);
 
+/* NULL if the server isn't in a menu group */
+const char *opdesk_config_get_group(OPDeskConfig *config);
+
 enum OPDeskConfigStatusTemplateType {
     STATUS_TEMPLATE_NOT_CONNECTED,
     STATUS_TEMPLATE_OFFLINE,
@@ -31,8 +33,39 @@ typedef enum OPDeskConfigStatusTemplateType OPDeskConfigStatusTemplateType;
 
 const char *opdesk_config_get_status_template(OPDeskConfig *config, OPDeskConfigStatusTemplateType template_type);
 
-gboolean opdesk_config_has_event_notification(OPDeskConfig *config, const char *const event_name);
-const char *opdesk_config_get_event_notification_template(OPDeskConfig *config, const char *const event_name);
-GNotificationPriority opdesk_config_get_event_notification_priority(OPDeskConfig *config, const char *const event_name);
+OPDeskEventRules *opdesk_config_get_event_rules(OPDeskConfig *config);
+
+/* in bytes, 0 disables the cache */
+gsize opdesk_config_get_http_cache_size(OPDeskConfig *config);
+/* path prefix -> seconds (GUINT_TO_POINTER) a cached response is used without revalidating */
+GHashTable *opdesk_config_get_http_cache_ttls(OPDeskConfig *config);
+
+/* G-code macro names in config order, owned by the config */
+GList *opdesk_config_get_macro_names(OPDeskConfig *config);
+/* NULL terminated lines, template variables not yet expanded. NULL if there is no such macro */
+const char *const *opdesk_config_get_macro(OPDeskConfig *config, const char *const name);
+
+/* NULL to use the URLs from OctoPrint's webcam settings */
+const char *opdesk_config_get_webcam_snapshot_url(OPDeskConfig *config);
+const char *opdesk_config_get_webcam_stream_url(OPDeskConfig *config);
+
+/* topics under this are the printer's when ingesting from MQTT, "octoPrint/" unless set */
+const char *opdesk_config_get_mqtt_base_topic(OPDeskConfig *config);
+
+/* Application wide settings and the server configurations */
+#define OPDESK_TYPE_APP_CONFIG opdesk_app_config_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskAppConfig, opdesk_app_config, OPDESK, APP_CONFIG, GObject)
+
+OPDeskAppConfig *opdesk_app_config_load_from_file(const char *file_path);
+
+GList *opdesk_app_config_get_servers(OPDeskAppConfig *config);
+
+/* setting paths are dotted, ie. "notifications.window" */
+gint64 opdesk_app_config_get_int(OPDeskAppConfig *config, const char *const path, gint64 default_value);
+gdouble opdesk_app_config_get_double(OPDeskAppConfig *config, const char *const path, gdouble default_value);
+gboolean opdesk_app_config_get_boolean(OPDeskAppConfig *config, const char *const path, gboolean default_value);
+const char *opdesk_app_config_get_string(OPDeskAppConfig *config, const char *const path, const char *default_value);
+/* NULL if the setting isn't present or isn't an array */
+JsonArray *opdesk_app_config_get_array(OPDeskAppConfig *config, const char *const path);
 
 G_END_DECLS
\ No newline at end of file
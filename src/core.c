@@ -0,0 +1,373 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-core"
+#include <glib.h>
+
+#include "core.h"
+#include "timelapse-manager.h"
+#include "gcode-analyzer.h"
+#include "dbus-service.h"
+#include "metrics.h"
+#include "relay.h"
+#include "mqtt-ingest.h"
+
+#define IO_THREADS_DEFAULT_MAX 4
+
+struct _OPDeskCore {
+    GObject parent_instance;
+
+    OPDeskAppConfig *config;
+    OPDeskNotificationScheduler *notification_scheduler;
+    OPDeskFleet *fleet;
+    OPDeskFileIndex *file_index;
+    OPDeskTimelapseManager *timelapse_manager;
+    OPDeskDBusService *dbus_service;
+    OPDeskMetrics *metrics;
+    OPDeskRelayServer *relay_server;
+    OPDeskRelayClient *relay_client;
+    OPDeskMQTTIngest *mqtt_ingest;
+    GPtrArray *io_threads;
+    GList *servers;
+};
+
+G_DEFINE_TYPE (OPDeskCore, opdesk_core, G_TYPE_OBJECT)
+
+static void opdesk_core_dispose(GObject *object) {
+    OPDeskCore *self = OPDESK_CORE(object);
+
+    // before the servers, these stop downloads from and signals about them
+    g_clear_object(&self->dbus_service);
+    g_clear_object(&self->metrics);
+    g_clear_object(&self->relay_server);
+    g_clear_object(&self->relay_client);
+    g_clear_object(&self->mqtt_ingest);
+    g_clear_object(&self->timelapse_manager);
+    g_list_free_full(self->servers, g_object_unref);
+    self->servers = NULL;
+    // after the sockets on them
+    g_clear_pointer(&self->io_threads, g_ptr_array_unref);
+    g_clear_object(&self->fleet);
+    g_clear_object(&self->file_index);
+    g_clear_object(&self->notification_scheduler);
+    g_clear_object(&self->config);
+
+    G_OBJECT_CLASS(opdesk_core_parent_class)->dispose(object);
+}
+
+static void opdesk_core_class_init(OPDeskCoreClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_core_dispose;
+}
+
+static void opdesk_core_init(OPDeskCore *core) {
+}
+
+OPDeskCore *opdesk_core_new(GApplication *app, const char *config_path) {
+    OPDeskCore *core = g_object_new(OPDESK_TYPE_CORE, NULL);
+
+    char *default_path = NULL;
+    if(!config_path) config_path = default_path = g_build_path(G_DIR_SEPARATOR_S, g_get_home_dir(), ".op-desktop.json", NULL);
+
+    g_message("Loading config from %s", config_path);
+    core->config = opdesk_app_config_load_from_file(config_path);
+    g_free(default_path);
+
+    core->notification_scheduler = opdesk_notification_scheduler_new(app, core->config);
+    core->fleet = opdesk_fleet_new(core->config, core->notification_scheduler);
+    core->file_index = opdesk_file_index_new();
+    core->timelapse_manager = opdesk_timelapse_manager_new(core->config);
+
+    GList *configs = opdesk_app_config_get_servers(core->config);
+    core->metrics = opdesk_metrics_new(core->config, g_list_length(configs));
+
+    // downstream of a relay or from MQTT, the state comes from there instead of each OctoPrint's socket
+    gboolean relayed = opdesk_app_config_get_string(core->config, "relay.url", NULL)!=NULL;
+    gboolean from_mqtt = !relayed && opdesk_app_config_get_string(core->config, "mqtt.host", NULL)!=NULL;
+
+    // websockets and their parsing are spread over these, 0 keeps them on the main context
+    guint n_io_threads = relayed || from_mqtt ? 0 : opdesk_app_config_get_int(core->config, "ioThreads", MIN(g_get_num_processors(), IO_THREADS_DEFAULT_MAX));
+    n_io_threads = MIN(n_io_threads, g_list_length(configs));
+    core->io_threads = g_ptr_array_new_with_free_func(g_object_unref);
+    for(guint t=0;t<n_io_threads;t++) {
+        char *name = g_strdup_printf("opdesk-io-%u", t);
+        g_ptr_array_add(core->io_threads, octoprint_io_thread_new(name));
+        g_free(name);
+    }
+
+    guint n = 0;
+    for(GList *config = configs; config; config = config->next, n++) {
+        OctoPrintIOThread *io_thread = n_io_threads ? g_ptr_array_index(core->io_threads, n % n_io_threads) : NULL;
+        OPDeskServer *server = relayed || from_mqtt ? opdesk_server_new_fed(config->data, core->notification_scheduler)
+                                       : opdesk_server_new(config->data, core->notification_scheduler, core->file_index, io_thread);
+        core->servers = g_list_append(core->servers, server);
+        if(core->metrics) opdesk_metrics_add_server(core->metrics, server);
+        opdesk_fleet_add_server(core->fleet, server);
+        opdesk_timelapse_manager_add_server(core->timelapse_manager, server);
+    }
+
+    if(relayed) core->relay_client = opdesk_relay_client_new(core->config, core->servers);
+    else core->relay_server = opdesk_relay_server_new(core->config, core->servers);
+    if(from_mqtt) core->mqtt_ingest = opdesk_mqtt_ingest_new(core->config, core->servers);
+
+    // not on Windows, or without a session bus
+    GDBusConnection *connection = g_application_get_dbus_connection(app);
+    if(connection) core->dbus_service = opdesk_dbus_service_new(connection, core->config, core->servers, G_ACTION_GROUP(app));
+
+    return core;
+}
+
+OPDeskAppConfig *opdesk_core_get_config(OPDeskCore *core) {
+    return core->config;
+}
+
+OPDeskNotificationScheduler *opdesk_core_get_notification_scheduler(OPDeskCore *core) {
+    return core->notification_scheduler;
+}
+
+OPDeskFleet *opdesk_core_get_fleet(OPDeskCore *core) {
+    return core->fleet;
+}
+
+OPDeskFileIndex *opdesk_core_get_file_index(OPDeskCore *core) {
+    return core->file_index;
+}
+
+OPDeskMetrics *opdesk_core_get_metrics(OPDeskCore *core) {
+    return core->metrics;
+}
+
+GList *opdesk_core_get_servers(OPDeskCore *core) {
+    return core->servers;
+}
+
+OPDeskServer *opdesk_core_find_server(OPDeskCore *core, const char *const name) {
+    // "" is the only server
+    if(!*name) return g_list_length(core->servers)==1 ? core->servers->data : NULL;
+
+    for(GList *server = core->servers; server; server = server->next) {
+        if(g_strcmp0(name, opdesk_config_get_printer_name(opdesk_server_get_config(server->data)))==0) return server->data;
+    }
+    return NULL;
+}
+
+static void on_fleet_action(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    OPDeskCore *core = user_data;
+    const char *name = g_action_get_name(G_ACTION(action));
+    const char *group = NULL;
+    const char *argument = NULL;
+    OPDeskFleetCommand command;
+
+    if(g_variant_is_of_type(parameter, G_VARIANT_TYPE("(ss)"))) {
+        g_variant_get(parameter, "(&s&s)", &group, &argument);
+        if(g_strcmp0(name, "fleet-preheat")==0) command = OPDESK_FLEET_PREHEAT;
+        else if(g_strcmp0(name, "fleet-macro")==0) command = OPDESK_FLEET_MACRO;
+        else command = OPDESK_FLEET_GCODE;
+    } else {
+        group = g_variant_get_string(parameter, NULL);
+        if(g_strcmp0(name, "fleet-psu-on")==0) command = OPDESK_FLEET_PSU_ON;
+        else if(g_strcmp0(name, "fleet-psu-off")==0) command = OPDESK_FLEET_PSU_OFF;
+        else command = OPDESK_FLEET_COOLDOWN;
+    }
+
+    opdesk_fleet_run(core->fleet, group, command, argument);
+}
+
+static void on_upload_action(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    OPDeskCore *core = user_data;
+    const char *printer, *uri;
+    gboolean print;
+    g_variant_get(parameter, "(&s&sb)", &printer, &uri, &print);
+
+    OPDeskServer *server = opdesk_core_find_server(core, printer);
+    if(!server) {
+        g_warning("Can't upload %s, unknown printer '%s'. Use --printer when more than one is configured", uri, printer);
+        return;
+    }
+
+    GFile *file = g_file_new_for_uri(uri);
+    opdesk_server_upload_file(server, file, print);
+    g_object_unref(file);
+}
+
+static void on_fleet_upload_action(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    OPDeskCore *core = user_data;
+    const char *group, *uri;
+    gboolean print;
+    g_variant_get(parameter, "(&s&sb)", &group, &uri, &print);
+
+    GFile *file = g_file_new_for_uri(uri);
+    GError *err = NULL;
+    if(!opdesk_fleet_upload(core->fleet, group, file, print, &err)) {
+        g_warning("Unable to upload %s: %s", uri, err->message);
+        g_error_free(err);
+    }
+    g_object_unref(file);
+}
+
+void opdesk_core_add_actions(OPDeskCore *core, GActionMap *map) {
+    const GActionEntry actions[] = {
+        // group is "" for all printers
+        { .name = "fleet-psu-on", .activate = on_fleet_action, .parameter_type = "s" },
+        { .name = "fleet-psu-off", .activate = on_fleet_action, .parameter_type = "s" },
+        { .name = "fleet-cooldown", .activate = on_fleet_action, .parameter_type = "s" },
+        { .name = "fleet-preheat", .activate = on_fleet_action, .parameter_type = "(ss)" },
+        { .name = "fleet-macro", .activate = on_fleet_action, .parameter_type = "(ss)" },
+        // ad-hoc, newline separated commands
+        { .name = "fleet-gcode", .activate = on_fleet_action, .parameter_type = "(ss)" },
+        // printer name ("" if there's only one), file URI, print once uploaded
+        { .name = "upload", .activate = on_upload_action, .parameter_type = "(ssb)" },
+        // group name ("" for all printers), file URI, print once uploaded
+        { .name = "fleet-upload", .activate = on_fleet_upload_action, .parameter_type = "(ssb)" },
+    };
+
+    g_action_map_add_action_entries(map, actions, G_N_ELEMENTS(actions), core);
+}
+
+void opdesk_options_add_entries(OPDeskOptions *options, GApplication *app) {
+    const GOptionEntry entries[] = {
+        {
+            .long_name = "config",
+            .description = "Configuration file path",
+            .arg = G_OPTION_ARG_STRING,
+            .arg_data = &options->config_path,
+        },
+        {
+            .long_name = "headless",
+            .description = "Run without a tray icon or any other UI, no display is needed",
+            .arg = G_OPTION_ARG_NONE,
+            .arg_data = &options->headless,
+        },
+        {
+            .long_name = "status",
+            .description = "Print the state of every printer from the running instance and exit",
+            .arg = G_OPTION_ARG_NONE,
+            .arg_data = &options->status,
+        },
+        {
+            .long_name = "analyze",
+            .description = "Print the estimated time, filament, layers and size of a G-code file and exit",
+            .arg = G_OPTION_ARG_FILENAME,
+            .arg_data = &options->analyze_path,
+            .arg_description = "FILE",
+        },
+        {
+            .long_name = "upload",
+            .description = "Upload a G-code file to a printer, running instances will do the upload",
+            .arg = G_OPTION_ARG_FILENAME,
+            .arg_data = &options->upload_path,
+            .arg_description = "FILE",
+        },
+        {
+            .long_name = "printer",
+            .description = "Printer name to upload to, not needed if only one is configured",
+            .arg = G_OPTION_ARG_STRING,
+            .arg_data = &options->upload_printer,
+            .arg_description = "NAME",
+        },
+        {
+            .long_name = "group",
+            .description = "Upload to every printer in a group",
+            .arg = G_OPTION_ARG_STRING,
+            .arg_data = &options->upload_group,
+            .arg_description = "NAME",
+        },
+        {
+            .long_name = "all",
+            .description = "Upload to every printer",
+            .arg = G_OPTION_ARG_NONE,
+            .arg_data = &options->upload_all,
+        },
+        {
+            .long_name = "print",
+            .description = "Start printing the uploaded file",
+            .arg = G_OPTION_ARG_NONE,
+            .arg_data = &options->upload_print,
+        },
+        {NULL}
+    };
+
+    g_application_add_main_option_entries(app, entries);
+}
+
+// --analyze runs in this process only, it doesn't need a config or a running instance
+static gint opdesk_options_analyze(OPDeskOptions *options) {
+    GError *err = NULL;
+    OPDeskGCodeAnalysis *analysis = opdesk_gcode_analyze_file(options->analyze_path, NULL, &err);
+    if(!analysis) {
+        g_printerr("Unable to analyze %s: %s\n", options->analyze_path, err->message);
+        g_error_free(err);
+        return 1;
+    }
+
+    char *summary = opdesk_gcode_analysis_to_string(analysis);
+    g_print("%s\n%s\n", options->analyze_path, summary);
+    g_free(summary);
+    g_free(analysis);
+
+    return 0;
+}
+
+gint opdesk_options_handle_local(OPDeskOptions *options, GApplication *app) {
+    if(options->analyze_path) return opdesk_options_analyze(options);
+    if(options->status) return opdesk_dbus_print_status();
+    if(!options->upload_path) return -1;
+
+    // the primary instance has a different working directory
+    GFile *file = g_file_new_for_commandline_arg(options->upload_path);
+    char *uri = g_file_get_uri(file);
+    g_object_unref(file);
+
+    const char *action;
+    GVariant *parameter;
+    if(options->upload_group || options->upload_all) {
+        action = "fleet-upload";
+        parameter = g_variant_ref_sink(g_variant_new("(ssb)", options->upload_all ? "" : options->upload_group, uri, options->upload_print));
+    } else {
+        action = "upload";
+        parameter = g_variant_ref_sink(g_variant_new("(ssb)", options->upload_printer ? options->upload_printer : "", uri, options->upload_print));
+    }
+    g_free(uri);
+
+    // the app is non-unique, a running instance is found through its D-Bus service instead
+    gint ret = opdesk_dbus_activate_action(action, parameter);
+    if(ret >= 0) {
+        g_variant_unref(parameter);
+        return ret;
+    }
+
+    // this is the first instance, do it here and keep running
+    GError *err = NULL;
+    if(!g_application_register(app, NULL, &err)) {
+        g_warning("Unable to register application: %s", err->message);
+        g_error_free(err);
+        g_variant_unref(parameter);
+        return 1;
+    }
+    g_action_group_activate_action(G_ACTION_GROUP(app), action, parameter);
+    g_variant_unref(parameter);
+    return -1;
+}
+
+void opdesk_options_clear(OPDeskOptions *options) {
+    g_clear_pointer(&options->config_path, g_free);
+    g_clear_pointer(&options->analyze_path, g_free);
+    g_clear_pointer(&options->upload_path, g_free);
+    g_clear_pointer(&options->upload_printer, g_free);
+    g_clear_pointer(&options->upload_group, g_free);
+}
@@ -0,0 +1,72 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gio/gio.h>
+
+#include "config.h"
+#include "notification-scheduler.h"
+#include "server.h"
+#include "fleet.h"
+#include "file-index.h"
+#include "metrics.h"
+
+G_BEGIN_DECLS
+
+/* Command line options, shared by the tray application and --headless */
+typedef struct {
+    char *config_path;
+    char *analyze_path;
+    gboolean headless;
+    gboolean status;
+
+    // --upload, sent to a running instance as the upload action over D-Bus
+    char *upload_path;
+    char *upload_printer;
+    char *upload_group;
+    gboolean upload_all;
+    gboolean upload_print;
+} OPDeskOptions;
+
+void opdesk_options_add_entries(OPDeskOptions *options, GApplication *app);
+/* For "handle-local-options": runs --analyze and --status and forwards --upload. -1 to continue starting up */
+gint opdesk_options_handle_local(OPDeskOptions *options, GApplication *app);
+void opdesk_options_clear(OPDeskOptions *options);
+
+/* Everything that runs without a display: the config, a server per printer and the fleet, file index,
+   timelapse downloads and notifications shared between them. No GTK is used here or below, the
+   tray UI is a view on top of it and --headless runs it on its own. */
+#define OPDESK_TYPE_CORE opdesk_core_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskCore, opdesk_core, OPDESK, CORE, GObject)
+
+/* config_path NULL for ~/.op-desktop.json. The servers start connecting right away */
+OPDeskCore *opdesk_core_new(GApplication *app, const char *config_path);
+
+OPDeskAppConfig *opdesk_core_get_config(OPDeskCore *core);
+OPDeskNotificationScheduler *opdesk_core_get_notification_scheduler(OPDeskCore *core);
+OPDeskFleet *opdesk_core_get_fleet(OPDeskCore *core);
+OPDeskFileIndex *opdesk_core_get_file_index(OPDeskCore *core);
+/* NULL unless metrics.port is set */
+OPDeskMetrics *opdesk_core_get_metrics(OPDeskCore *core);
+/* OPDeskServer in config order, owned by the core */
+GList *opdesk_core_get_servers(OPDeskCore *core);
+/* by printer name, "" is the only server if there's just one */
+OPDeskServer *opdesk_core_find_server(OPDeskCore *core, const char *const name);
+
+/* the upload, fleet-upload and fleet-* actions, see README */
+void opdesk_core_add_actions(OPDeskCore *core, GActionMap *map);
+
+G_END_DECLS
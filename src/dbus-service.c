@@ -0,0 +1,376 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-dbus"
+#include <glib.h>
+
+#include "dbus-service.h"
+#include "server.h"
+
+#define MAX_SIGNAL_RATE_DEFAULT 4
+#define STATUS_TIMEOUT_MS 2000
+
+static const char introspection_xml[] =
+    "<node>"
+    "  <interface name='" OPDESK_DBUS_INTERFACE "'>"
+    "    <property name='Printers' type='a{sa{sv}}' access='read'/>"
+    "    <signal name='StateChanged'>"
+    "      <arg name='changes' type='a{sa{sv}}'/>"
+    "    </signal>"
+    "  </interface>"
+    "</node>";
+
+struct _OPDeskDBusService {
+    GObject parent_instance;
+
+    GDBusConnection *connection;
+    GDBusNodeInfo *node_info;
+    guint registration_id;
+    guint actions_id;
+    guint name_id;
+
+    GList *servers;
+    // OPDeskServer -> a{sv} last sent in StateChanged
+    GHashTable *published;
+    GHashTable *dirty;
+
+    gint64 min_interval;
+    gint64 last_emit;
+    guint flush_source;
+};
+
+G_DEFINE_TYPE (OPDeskDBusService, opdesk_dbus_service, G_TYPE_OBJECT)
+
+static void opdesk_dbus_service_dispose(GObject *object) {
+    OPDeskDBusService *self = OPDESK_DBUS_SERVICE(object);
+
+    if(self->flush_source) g_source_remove(self->flush_source);
+    self->flush_source = 0;
+
+    for(GList *server = self->servers; server; server = server->next) {
+        g_signal_handlers_disconnect_by_data(server->data, self);
+    }
+    g_list_free(self->servers);
+    self->servers = NULL;
+
+    if(self->name_id) g_bus_unown_name(self->name_id);
+    self->name_id = 0;
+    if(self->registration_id) g_dbus_connection_unregister_object(self->connection, self->registration_id);
+    self->registration_id = 0;
+    if(self->actions_id) g_dbus_connection_unexport_action_group(self->connection, self->actions_id);
+    self->actions_id = 0;
+    g_clear_object(&self->connection);
+
+    G_OBJECT_CLASS(opdesk_dbus_service_parent_class)->dispose(object);
+}
+
+static void opdesk_dbus_service_finalize(GObject *object) {
+    OPDeskDBusService *self = OPDESK_DBUS_SERVICE(object);
+
+    g_hash_table_destroy(self->published);
+    g_hash_table_destroy(self->dirty);
+    if(self->node_info) g_dbus_node_info_unref(self->node_info);
+
+    G_OBJECT_CLASS(opdesk_dbus_service_parent_class)->finalize(object);
+}
+
+static void opdesk_dbus_service_class_init(OPDeskDBusServiceClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_dbus_service_dispose;
+    object_class->finalize = opdesk_dbus_service_finalize;
+}
+
+static void opdesk_dbus_service_init(OPDeskDBusService *service) {
+    service->published = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_variant_unref);
+    service->dirty = g_hash_table_new(g_direct_hash, g_direct_equal);
+}
+
+static const char *server_name(OPDeskServer *server) {
+    return opdesk_config_get_printer_name(opdesk_server_get_config(server));
+}
+
+// a{sv}, the keys are documented in the README
+static GVariant *server_state(OPDeskServer *server) {
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+
+    const char *group = opdesk_config_get_group(opdesk_server_get_config(server));
+    const char *file = opdesk_server_get_print_filename(server);
+
+    g_variant_builder_add(&builder, "{sv}", "group", g_variant_new_string(group ? group : ""));
+    g_variant_builder_add(&builder, "{sv}", "connected", g_variant_new_boolean(opdesk_server_is_connected(server)));
+    g_variant_builder_add(&builder, "{sv}", "operational", g_variant_new_boolean(opdesk_server_is_operational(server)));
+    g_variant_builder_add(&builder, "{sv}", "printing", g_variant_new_boolean(opdesk_server_is_printing(server)));
+    g_variant_builder_add(&builder, "{sv}", "paused", g_variant_new_boolean(opdesk_server_is_paused(server)));
+    g_variant_builder_add(&builder, "{sv}", "error", g_variant_new_boolean(opdesk_server_has_error(server)));
+    g_variant_builder_add(&builder, "{sv}", "progress", g_variant_new_double(opdesk_server_get_print_progress(server)));
+    g_variant_builder_add(&builder, "{sv}", "timeLeft", g_variant_new_int64(opdesk_server_get_time_left(server)));
+    g_variant_builder_add(&builder, "{sv}", "file", g_variant_new_string(file ? file : ""));
+
+    // heater name -> (actual, target)
+    GVariantBuilder temps;
+    g_variant_builder_init(&temps, G_VARIANT_TYPE("a{s(dd)}"));
+    GList *names = opdesk_server_get_temp_names(server);
+    for(GList *name = names; name; name = name->next) {
+        float actual, target;
+        opdesk_server_get_temp(server, name->data, &actual, &target);
+        g_variant_builder_add(&temps, "{s(dd)}", name->data, (gdouble)actual, (gdouble)target);
+    }
+    g_list_free(names);
+    g_variant_builder_add(&builder, "{sv}", "temps", g_variant_builder_end(&temps));
+
+    return g_variant_builder_end(&builder);
+}
+
+static GVariant *opdesk_dbus_service_get_printers(OPDeskDBusService *service) {
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sa{sv}}"));
+    for(GList *server = service->servers; server; server = server->next) {
+        g_variant_builder_add(&builder, "{s@a{sv}}", server_name(server->data), server_state(server->data));
+    }
+    return g_variant_builder_end(&builder);
+}
+
+static gboolean opdesk_dbus_service_flush(OPDeskDBusService *service) {
+    service->flush_source = 0;
+
+    GVariantBuilder changes;
+    g_variant_builder_init(&changes, G_VARIANT_TYPE("a{sa{sv}}"));
+    gboolean any = FALSE;
+
+    // in config order, so signals are stable
+    for(GList *l = service->servers; l; l = l->next) {
+        OPDeskServer *server = l->data;
+        if(!g_hash_table_contains(service->dirty, server)) continue;
+
+        GVariant *state = g_variant_ref_sink(server_state(server));
+        GVariant *fields = opdesk_server_state_diff(state, g_hash_table_lookup(service->published, server));
+        if(fields) {
+            g_variant_builder_add(&changes, "{s@a{sv}}", server_name(server), fields);
+            g_hash_table_replace(service->published, server, g_variant_ref(state));
+            any = TRUE;
+        }
+        g_variant_unref(state);
+    }
+    g_hash_table_remove_all(service->dirty);
+
+    if(!any) {
+        g_variant_builder_clear(&changes);
+        return G_SOURCE_REMOVE;
+    }
+
+    GError *err = NULL;
+    if(!g_dbus_connection_emit_signal(service->connection, NULL, OPDESK_DBUS_PATH, OPDESK_DBUS_INTERFACE, "StateChanged",
+                                      g_variant_new("(@a{sa{sv}})", g_variant_builder_end(&changes)), &err)) {
+        g_warning("Unable to emit StateChanged: %s", err->message);
+        g_error_free(err);
+    }
+    service->last_emit = g_get_monotonic_time();
+
+    return G_SOURCE_REMOVE;
+}
+
+// servers report many small updates a second, they're collected and sent together
+static void opdesk_dbus_service_server_changed(OPDeskServer *server, OPDeskDBusService *service) {
+    g_hash_table_add(service->dirty, server);
+    if(service->flush_source) return;
+
+    gint64 wait = service->last_emit + service->min_interval - g_get_monotonic_time();
+    service->flush_source = g_timeout_add(MAX(wait, 0) / 1000, G_SOURCE_FUNC(opdesk_dbus_service_flush), service);
+}
+
+static GVariant *handle_get_property(GDBusConnection *connection, const gchar *sender, const gchar *object_path, const gchar *interface_name, const gchar *property_name, GError **error, gpointer user_data) {
+    OPDeskDBusService *service = user_data;
+
+    if(g_strcmp0(property_name, "Printers")==0) return opdesk_dbus_service_get_printers(service);
+
+    g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY, "No property %s", property_name);
+    return NULL;
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+    .get_property = handle_get_property,
+};
+
+static void on_name_acquired(GDBusConnection *connection, const gchar *name, gpointer user_data) {
+    g_message("Printer state available on the session bus as %s", name);
+}
+
+static void on_name_lost(GDBusConnection *connection, const gchar *name, gpointer user_data) {
+    // the object is still there at this connection's unique name
+    g_message("Unable to own %s, another instance is probably running", name);
+}
+
+OPDeskDBusService *opdesk_dbus_service_new(GDBusConnection *connection, OPDeskAppConfig *config, GList *servers, GActionGroup *actions) {
+    OPDeskDBusService *service = g_object_new(OPDESK_TYPE_DBUS_SERVICE, NULL);
+
+    gdouble max_rate = opdesk_app_config_get_double(config, "dbus.maxSignalRate", MAX_SIGNAL_RATE_DEFAULT);
+    service->min_interval = max_rate > 0 ? G_USEC_PER_SEC / max_rate : G_USEC_PER_SEC / MAX_SIGNAL_RATE_DEFAULT;
+    service->connection = g_object_ref(connection);
+    service->node_info = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+
+    GError *err = NULL;
+    service->registration_id = g_dbus_connection_register_object(connection, OPDESK_DBUS_PATH, service->node_info->interfaces[0],
+                                                                 &interface_vtable, service, NULL, &err);
+    if(!service->registration_id) {
+        g_warning("Unable to register %s: %s", OPDESK_DBUS_PATH, err->message);
+        g_error_free(err);
+        g_object_unref(service);
+        return NULL;
+    }
+
+    // the app is non-unique so GApplication doesn't do this, --upload from another process needs them
+    service->actions_id = g_dbus_connection_export_action_group(connection, OPDESK_DBUS_PATH, actions, &err);
+    if(!service->actions_id) {
+        g_warning("Unable to export actions on %s: %s", OPDESK_DBUS_PATH, err->message);
+        g_clear_error(&err);
+    }
+
+    service->servers = g_list_copy(servers);
+    for(GList *server = service->servers; server; server = server->next) {
+        g_signal_connect(server->data, "state-updated", G_CALLBACK(opdesk_dbus_service_server_changed), service);
+        g_hash_table_insert(service->published, server->data, g_variant_ref_sink(server_state(server->data)));
+    }
+
+    service->name_id = g_bus_own_name_on_connection(connection, OPDESK_DBUS_NAME, G_BUS_NAME_OWNER_FLAGS_DO_NOT_QUEUE,
+                                                    on_name_acquired, on_name_lost, service, NULL);
+
+    return service;
+}
+
+static void print_printer_status(const char *name, GVariant *state) {
+    gboolean connected = FALSE, printing = FALSE, paused = FALSE, error = FALSE, operational = FALSE;
+    gdouble progress = -1;
+    gint64 time_left = -1;
+    const char *file = "";
+
+    g_variant_lookup(state, "connected", "b", &connected);
+    g_variant_lookup(state, "operational", "b", &operational);
+    g_variant_lookup(state, "printing", "b", &printing);
+    g_variant_lookup(state, "paused", "b", &paused);
+    g_variant_lookup(state, "error", "b", &error);
+    g_variant_lookup(state, "progress", "d", &progress);
+    g_variant_lookup(state, "timeLeft", "x", &time_left);
+    g_variant_lookup(state, "file", "&s", &file);
+
+    GString *line = g_string_new(name);
+    g_string_append(line, ": ");
+    if(!connected) g_string_append(line, "Offline");
+    else if(error) g_string_append(line, "Error");
+    else if(paused) g_string_append(line, "Paused");
+    else if(printing) g_string_append(line, "Printing");
+    else if(operational) g_string_append(line, "Ready");
+    else g_string_append(line, "Not connected to printer");
+
+    if(progress >= 0) {
+        g_string_append_printf(line, " %s %.0f%%", file, progress * 100);
+        if(time_left >= 0) g_string_append_printf(line, ", %" G_GINT64_FORMAT ":%02" G_GINT64_FORMAT " left", time_left / 3600, (time_left / 60) % 60);
+    }
+
+    GVariant *temps = g_variant_lookup_value(state, "temps", G_VARIANT_TYPE("a{s(dd)}"));
+    if(temps) {
+        GVariantIter iter;
+        const char *heater;
+        gdouble actual, target;
+        g_variant_iter_init(&iter, temps);
+        while(g_variant_iter_next(&iter, "{&s(dd)}", &heater, &actual, &target)) {
+            g_string_append_printf(line, ", %s %.0f/%.0f", heater, actual, target);
+        }
+        g_variant_unref(temps);
+    }
+
+    g_print("%s\n", line->str);
+    g_string_free(line, TRUE);
+}
+
+gint opdesk_dbus_print_status(void) {
+    GError *err = NULL;
+    GDBusConnection *connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &err);
+    if(!connection) {
+        g_printerr("Unable to connect to the session bus: %s\n", err->message);
+        g_error_free(err);
+        return 1;
+    }
+
+    GVariant *reply = g_dbus_connection_call_sync(connection, OPDESK_DBUS_NAME, OPDESK_DBUS_PATH, "org.freedesktop.DBus.Properties", "Get",
+                                                  g_variant_new("(ss)", OPDESK_DBUS_INTERFACE, "Printers"), G_VARIANT_TYPE("(v)"),
+                                                  G_DBUS_CALL_FLAGS_NO_AUTO_START, STATUS_TIMEOUT_MS, NULL, &err);
+    g_object_unref(connection);
+    if(!reply) {
+        if(g_error_matches(err, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN) || g_error_matches(err, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER)) {
+            g_printerr("OctoPrint-Desktop isn't running\n");
+        } else {
+            g_printerr("Unable to get the printer status: %s\n", err->message);
+        }
+        g_error_free(err);
+        return 1;
+    }
+
+    GVariant *printers;
+    g_variant_get(reply, "(v)", &printers);
+
+    GVariantIter iter;
+    const char *name;
+    GVariant *state;
+    g_variant_iter_init(&iter, printers);
+    while(g_variant_iter_next(&iter, "{&s@a{sv}}", &name, &state)) {
+        print_printer_status(name, state);
+        g_variant_unref(state);
+    }
+
+    g_variant_unref(printers);
+    g_variant_unref(reply);
+    return 0;
+}
+
+gint opdesk_dbus_activate_action(const char *name, GVariant *parameter) {
+    g_variant_ref_sink(parameter);
+
+    GError *err = NULL;
+    GDBusConnection *connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &err);
+    if(!connection) {
+        // nothing to forward to, and nothing to find a running instance on
+        g_debug("No session bus: %s", err->message);
+        g_error_free(err);
+        g_variant_unref(parameter);
+        return -1;
+    }
+
+    GVariantBuilder parameters;
+    g_variant_builder_init(&parameters, G_VARIANT_TYPE("av"));
+    g_variant_builder_add(&parameters, "v", parameter);
+    GVariant *reply = g_dbus_connection_call_sync(connection, OPDESK_DBUS_NAME, OPDESK_DBUS_PATH, "org.gtk.Actions", "Activate",
+                                                  g_variant_new("(sava{sv})", name, &parameters, NULL), NULL,
+                                                  G_DBUS_CALL_FLAGS_NO_AUTO_START, STATUS_TIMEOUT_MS, NULL, &err);
+    g_object_unref(connection);
+    g_variant_unref(parameter);
+
+    if(reply) {
+        g_variant_unref(reply);
+        return 0;
+    }
+
+    gint ret = 1;
+    if(g_error_matches(err, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN) || g_error_matches(err, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER)) {
+        ret = -1;
+    } else {
+        g_printerr("Unable to send %s to the running instance: %s\n", name, err->message);
+    }
+    g_error_free(err);
+    return ret;
+}
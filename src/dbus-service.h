@@ -0,0 +1,45 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gio/gio.h>
+
+#include "config.h"
+
+G_BEGIN_DECLS
+
+#define OPDESK_DBUS_NAME "io.github.the-eg.octoprint-desktop"
+#define OPDESK_DBUS_PATH "/io/github/the_eg/octoprint_desktop/fleet"
+#define OPDESK_DBUS_INTERFACE "io.github.the_eg.OctoPrintDesktop.Fleet"
+
+/* The state of every printer on the session bus, so scripts and status bars don't need to poll the servers.
+   The Printers property holds everything, the StateChanged signal only the fields that changed and it's
+   emitted at most dbus.maxSignalRate times a second, see README */
+#define OPDESK_TYPE_DBUS_SERVICE opdesk_dbus_service_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskDBusService, opdesk_dbus_service, OPDESK, DBUS_SERVICE, GObject)
+
+/* servers is a list of OPDeskServer, they must outlive the service. actions (the application's) are exported
+   on the same path for opdesk_dbus_activate_action. NULL if the object can't be registered */
+OPDeskDBusService *opdesk_dbus_service_new(GDBusConnection *connection, OPDeskAppConfig *config, GList *servers, GActionGroup *actions);
+
+/* --status: prints the state from a running instance. Only talks to the session bus, returns an exit code */
+gint opdesk_dbus_print_status(void);
+
+/* Activates an action on the running instance, ie. --upload. parameter is consumed if floating.
+   0 once it's sent, -1 if no instance is running, otherwise 1 after printing why */
+gint opdesk_dbus_activate_action(const char *name, GVariant *parameter);
+
+G_END_DECLS
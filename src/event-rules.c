@@ -0,0 +1,364 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-event-rules"
+#include <glib.h>
+#include <string.h>
+
+#include "event-rules.h"
+
+typedef enum {
+    CONDITION_EQ,
+    CONDITION_NE,
+    CONDITION_LT,
+    CONDITION_LE,
+    CONDITION_GT,
+    CONDITION_GE,
+    CONDITION_EXISTS,
+    CONDITION_MISSING
+} OPDeskEventRuleConditionOp;
+
+typedef enum {
+    CONDITION_VALUE_NONE,
+    CONDITION_VALUE_STRING,
+    CONDITION_VALUE_NUMBER,
+    CONDITION_VALUE_BOOLEAN
+} OPDeskEventRuleConditionValueType;
+
+struct OPDeskEventRuleCondition {
+    gchar **path;
+    OPDeskEventRuleConditionOp op;
+
+    OPDeskEventRuleConditionValueType value_type;
+    char *str_value;
+    gdouble num_value;
+    gboolean bool_value;
+};
+typedef struct OPDeskEventRuleCondition OPDeskEventRuleCondition;
+
+struct _OPDeskEventRule {
+    char *event;
+    char *id;
+    char *template;
+    GNotificationPriority priority;
+
+    GPtrArray *conditions;
+
+    gint64 cooldown;
+    gint64 last_fired;
+};
+
+struct _OPDeskEventRules {
+    // GQuark(event type) -> GPtrArray of OPDeskEventRule
+    GHashTable *by_event;
+};
+
+static void opdesk_event_rule_condition_free(OPDeskEventRuleCondition *cond) {
+    g_strfreev(cond->path);
+    g_free(cond->str_value);
+    g_free(cond);
+}
+
+static void opdesk_event_rule_free(OPDeskEventRule *rule) {
+    g_free(rule->event);
+    g_free(rule->id);
+    g_free(rule->template);
+    g_ptr_array_unref(rule->conditions);
+    g_free(rule);
+}
+
+static GNotificationPriority parse_priority(const gchar *priority) {
+    if(g_strcmp0(priority, "low")==0) return G_NOTIFICATION_PRIORITY_LOW;
+    else if (g_strcmp0(priority, "high")==0) return G_NOTIFICATION_PRIORITY_HIGH;
+    else if (g_strcmp0(priority, "normal")==0) return G_NOTIFICATION_PRIORITY_NORMAL;
+    else if (g_strcmp0(priority, "urgent")==0) return G_NOTIFICATION_PRIORITY_URGENT;
+
+    g_warning("Unknown notification priority: %s", priority);
+    return G_NOTIFICATION_PRIORITY_NORMAL;
+}
+
+static gboolean parse_condition_op(const gchar *op, OPDeskEventRuleConditionOp *ret) {
+    if(g_strcmp0(op, "==")==0)           *ret = CONDITION_EQ;
+    else if(g_strcmp0(op, "!=")==0)      *ret = CONDITION_NE;
+    else if(g_strcmp0(op, "<")==0)       *ret = CONDITION_LT;
+    else if(g_strcmp0(op, "<=")==0)      *ret = CONDITION_LE;
+    else if(g_strcmp0(op, ">")==0)       *ret = CONDITION_GT;
+    else if(g_strcmp0(op, ">=")==0)      *ret = CONDITION_GE;
+    else if(g_strcmp0(op, "exists")==0)  *ret = CONDITION_EXISTS;
+    else if(g_strcmp0(op, "missing")==0) *ret = CONDITION_MISSING;
+    else return FALSE;
+
+    return TRUE;
+}
+
+static OPDeskEventRuleCondition *opdesk_event_rule_condition_new_from_json(JsonObject *conf) {
+    const gchar *field = json_object_get_string_member_with_default(conf, "field", NULL);
+    const gchar *op = json_object_get_string_member_with_default(conf, "op", "==");
+
+    if(!field) {
+        g_warning("Event notification condition is missing 'field', ignoring it");
+        return NULL;
+    }
+
+    OPDeskEventRuleCondition *cond = g_malloc0(sizeof(OPDeskEventRuleCondition));
+    if(!parse_condition_op(op, &cond->op)) {
+        g_warning("Unknown event notification condition operator: %s, ignoring condition on %s", op, field);
+        g_free(cond);
+        return NULL;
+    }
+    cond->path = g_strsplit(field, ".", -1);
+
+    JsonNode *value = json_object_get_member(conf, "value");
+    if(value && JSON_NODE_HOLDS_VALUE(value)) {
+        GType vt = json_node_get_value_type(value);
+        if(vt==G_TYPE_STRING) {
+            cond->value_type = CONDITION_VALUE_STRING;
+            cond->str_value = g_strdup(json_node_get_string(value));
+        } else if(vt==G_TYPE_BOOLEAN) {
+            cond->value_type = CONDITION_VALUE_BOOLEAN;
+            cond->bool_value = json_node_get_boolean(value);
+        } else {
+            cond->value_type = CONDITION_VALUE_NUMBER;
+            cond->num_value = json_node_get_double(value);
+        }
+    } else if(cond->op!=CONDITION_EXISTS && cond->op!=CONDITION_MISSING) {
+        g_warning("Event notification condition on %s has no usable 'value', ignoring it", field);
+        opdesk_event_rule_condition_free(cond);
+        return NULL;
+    }
+
+    return cond;
+}
+
+OPDeskEventRules *opdesk_event_rules_new() {
+    OPDeskEventRules *rules = g_malloc0(sizeof(OPDeskEventRules));
+    rules->by_event = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (void(*)(void*))g_ptr_array_unref);
+    return rules;
+}
+
+void opdesk_event_rules_free(OPDeskEventRules *rules) {
+    g_hash_table_destroy(rules->by_event);
+    g_free(rules);
+}
+
+gboolean opdesk_event_rules_add_from_json(OPDeskEventRules *rules, JsonObject *rule_conf) {
+    const gchar *event = json_object_get_string_member_with_default(rule_conf, "event", NULL);
+    const gchar *template = json_object_get_string_member_with_default(rule_conf, "template", NULL);
+    const gchar *priority = json_object_get_string_member_with_default(rule_conf, "priority", "normal");
+
+    if(!event || !template) {
+        g_warning("Event notifications need both 'event' and 'template', ignoring entry");
+        return FALSE;
+    }
+
+    GQuark event_q = g_quark_from_string(event);
+    GPtrArray *event_rules = g_hash_table_lookup(rules->by_event, GUINT_TO_POINTER(event_q));
+    if(!event_rules) {
+        event_rules = g_ptr_array_new_with_free_func((void(*)(void*))opdesk_event_rule_free);
+        g_hash_table_insert(rules->by_event, GUINT_TO_POINTER(event_q), event_rules);
+    }
+
+    OPDeskEventRule *rule = g_malloc0(sizeof(OPDeskEventRule));
+    rule->event = g_strdup(event);
+    rule->template = g_strdup(template);
+    rule->priority = parse_priority(priority);
+    rule->conditions = g_ptr_array_new_with_free_func((void(*)(void*))opdesk_event_rule_condition_free);
+    rule->cooldown = (gint64)(json_object_get_double_member_with_default(rule_conf, "cooldown", 0) * G_USEC_PER_SEC);
+
+    // the notification id is fixed per rule, so repeats of the same rule replace each other
+    if(event_rules->len) rule->id = g_strdup_printf("event-%s-%u", event, event_rules->len);
+    else rule->id = g_strdup_printf("event-%s", event);
+
+    if(json_object_has_member(rule_conf, "conditions")) {
+        JsonArray *conditions = json_object_get_array_member(rule_conf, "conditions");
+        GList *cond_ele_first = json_array_get_elements(conditions);
+        GList *cond_ele = cond_ele_first;
+        while(cond_ele) {
+            if(JSON_NODE_HOLDS_OBJECT(cond_ele->data)) {
+                OPDeskEventRuleCondition *cond = opdesk_event_rule_condition_new_from_json(json_node_get_object(cond_ele->data));
+                if(cond) g_ptr_array_add(rule->conditions, cond);
+            }
+            cond_ele = cond_ele->next;
+        }
+        g_list_free(cond_ele_first);
+    }
+
+    g_ptr_array_add(event_rules, rule);
+
+    g_debug("Event notification rule for %s: %u condition(s), %" G_GINT64_FORMAT "s cooldown", event, rule->conditions->len, rule->cooldown / G_USEC_PER_SEC);
+
+    return TRUE;
+}
+
+GPtrArray *opdesk_event_rules_lookup(OPDeskEventRules *rules, const char *const event_type) {
+    // an event type that was never interned can't have any rules
+    GQuark event_q = g_quark_try_string(event_type);
+    if(!event_q) return NULL;
+
+    return g_hash_table_lookup(rules->by_event, GUINT_TO_POINTER(event_q));
+}
+
+static JsonNode *json_node_get_path_v(JsonNode *node, gchar **path) {
+    for(gchar **part = path; node && *part; part++) {
+        if(JSON_NODE_HOLDS_OBJECT(node)) {
+            JsonObject *obj = json_node_get_object(node);
+            node = json_object_get_member(obj, *part);
+        } else if(JSON_NODE_HOLDS_ARRAY(node)) {
+            JsonArray *arr = json_node_get_array(node);
+            gchar *end = NULL;
+            guint64 index = g_ascii_strtoull(*part, &end, 10);
+            if(end==*part || *end || index >= json_array_get_length(arr)) return NULL;
+            node = json_array_get_element(arr, index);
+        } else {
+            return NULL;
+        }
+    }
+
+    return node;
+}
+
+static JsonNode *json_object_get_path_v(JsonObject *object, gchar **path) {
+    if(!object || !path[0]) return NULL;
+
+    JsonNode *first = json_object_get_member(object, path[0]);
+    return json_node_get_path_v(first, path + 1);
+}
+
+JsonNode *opdesk_json_object_get_path(JsonObject *object, const char *const path) {
+    if(!object) return NULL;
+
+    // the common case is a plain top level member
+    if(!strchr(path, '.')) return json_object_get_member(object, path);
+
+    gchar **parts = g_strsplit(path, ".", -1);
+    JsonNode *node = json_object_get_path_v(object, parts);
+    g_strfreev(parts);
+
+    return node;
+}
+
+char *opdesk_json_node_to_string(JsonNode *node) {
+    if(!node || JSON_NODE_HOLDS_NULL(node)) return g_strdup("");
+
+    if(JSON_NODE_HOLDS_VALUE(node)) {
+        GType vt = json_node_get_value_type(node);
+        if(vt==G_TYPE_STRING) return g_strdup(json_node_get_string(node));
+        if(vt==G_TYPE_INT64) return g_strdup_printf("%" G_GINT64_FORMAT, json_node_get_int(node));
+        if(vt==G_TYPE_DOUBLE) return g_strdup_printf("%g", json_node_get_double(node));
+        if(vt==G_TYPE_BOOLEAN) return g_strdup(json_node_get_boolean(node) ? "true" : "false");
+    }
+
+    // objects and arrays are shown as json
+    return json_to_string(node, FALSE);
+}
+
+static gboolean json_node_get_number(JsonNode *node, gdouble *ret) {
+    if(!JSON_NODE_HOLDS_VALUE(node)) return FALSE;
+
+    GType vt = json_node_get_value_type(node);
+    if(vt==G_TYPE_INT64 || vt==G_TYPE_DOUBLE) {
+        *ret = json_node_get_double(node);
+        return TRUE;
+    } else if(vt==G_TYPE_BOOLEAN) {
+        *ret = json_node_get_boolean(node) ? 1 : 0;
+        return TRUE;
+    } else if(vt==G_TYPE_STRING) {
+        // some payloads carry numbers as strings
+        const gchar *str = json_node_get_string(node);
+        gchar *end = NULL;
+        *ret = g_ascii_strtod(str, &end);
+        return end!=str && *end==0;
+    }
+
+    return FALSE;
+}
+
+static gboolean opdesk_event_rule_condition_eval(OPDeskEventRuleCondition *cond, JsonObject *payload) {
+    JsonNode *node = json_object_get_path_v(payload, cond->path);
+    gboolean present = node!=NULL && !JSON_NODE_HOLDS_NULL(node);
+
+    if(cond->op==CONDITION_EXISTS) return present;
+    if(cond->op==CONDITION_MISSING) return !present;
+
+    // a missing field is only ever 'not equal'
+    if(!present) return cond->op==CONDITION_NE;
+
+    gint cmp = 0;
+    switch(cond->value_type) {
+    case CONDITION_VALUE_NUMBER: {
+        gdouble val;
+        if(!json_node_get_number(node, &val)) return cond->op==CONDITION_NE;
+        cmp = val < cond->num_value ? -1 : (val > cond->num_value ? 1 : 0);
+        break;
+    }
+    case CONDITION_VALUE_BOOLEAN: {
+        gdouble val;
+        if(!json_node_get_number(node, &val)) return cond->op==CONDITION_NE;
+        cmp = (val!=0) - (cond->bool_value!=0);
+        break;
+    }
+    case CONDITION_VALUE_STRING: {
+        if(JSON_NODE_HOLDS_VALUE(node) && json_node_get_value_type(node)==G_TYPE_STRING) {
+            cmp = g_strcmp0(json_node_get_string(node), cond->str_value);
+        } else {
+            char *val = opdesk_json_node_to_string(node);
+            cmp = g_strcmp0(val, cond->str_value);
+            g_free(val);
+        }
+        break;
+    }
+    default:
+        return FALSE;
+    }
+
+    switch(cond->op) {
+    case CONDITION_EQ: return cmp==0;
+    case CONDITION_NE: return cmp!=0;
+    case CONDITION_LT: return cmp<0;
+    case CONDITION_LE: return cmp<=0;
+    case CONDITION_GT: return cmp>0;
+    case CONDITION_GE: return cmp>=0;
+    default: return FALSE;
+    }
+}
+
+gboolean opdesk_event_rule_try_fire(OPDeskEventRule *rule, JsonObject *payload) {
+    for(guint c=0;c<rule->conditions->len;c++) {
+        if(!opdesk_event_rule_condition_eval(g_ptr_array_index(rule->conditions, c), payload)) return FALSE;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    if(rule->cooldown && rule->last_fired && now - rule->last_fired < rule->cooldown) {
+        g_debug("Event notification for %s suppressed, still cooling down", rule->event);
+        return FALSE;
+    }
+    rule->last_fired = now;
+
+    return TRUE;
+}
+
+const char *opdesk_event_rule_get_id(OPDeskEventRule *rule) {
+    return rule->id;
+}
+
+const char *opdesk_event_rule_get_template(OPDeskEventRule *rule) {
+    return rule->template;
+}
+
+GNotificationPriority opdesk_event_rule_get_priority(OPDeskEventRule *rule) {
+    return rule->priority;
+}
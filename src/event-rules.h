@@ -0,0 +1,46 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+/* Event notification rules, compiled from the eventNotification config entries.
+   Rules are indexed by the interned (GQuark) event type so that events nobody
+   subscribed to cost a single lookup. */
+typedef struct _OPDeskEventRule OPDeskEventRule;
+typedef struct _OPDeskEventRules OPDeskEventRules;
+
+OPDeskEventRules *opdesk_event_rules_new();
+void opdesk_event_rules_free(OPDeskEventRules *rules);
+
+gboolean opdesk_event_rules_add_from_json(OPDeskEventRules *rules, JsonObject *rule_conf);
+
+GPtrArray *opdesk_event_rules_lookup(OPDeskEventRules *rules, const char *const event_type);
+
+gboolean opdesk_event_rule_try_fire(OPDeskEventRule *rule, JsonObject *payload);
+
+const char *opdesk_event_rule_get_id(OPDeskEventRule *rule);
+const char *opdesk_event_rule_get_template(OPDeskEventRule *rule);
+GNotificationPriority opdesk_event_rule_get_priority(OPDeskEventRule *rule);
+
+/* typed, nested payload access. paths are dotted, ie. "file.name" or "targets.0" */
+JsonNode *opdesk_json_object_get_path(JsonObject *object, const char *const path);
+char *opdesk_json_node_to_string(JsonNode *node);
+
+G_END_DECLS
@@ -0,0 +1,387 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-file-index"
+#include <glib.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "file-index.h"
+
+// compact once at least this many removed entries make up half the index
+#define COMPACT_MIN_REMOVED 1024
+
+typedef struct {
+    OPDeskFileIndexEntry pub;
+    guint id;
+    char *key;      // lower case path, searched
+    char *name_key; // lower case name, ranked and prefix matched
+    gboolean removed;
+} IndexEntry;
+
+struct _OPDeskFileIndex {
+    GObject parent_instance;
+
+    // IndexEntry by id, removed entries stay until the next compaction
+    GPtrArray *entries;
+    guint removed;
+
+    // "server\norigin\npath" -> IndexEntry
+    GHashTable *by_location;
+    // trigram -> GArray of ids, ascending
+    GHashTable *trigrams;
+
+    // live entries by name_key, rebuilt on the first short query after a change
+    GPtrArray *by_name;
+};
+
+G_DEFINE_TYPE (OPDeskFileIndex, opdesk_file_index, G_TYPE_OBJECT)
+
+static void index_entry_free(IndexEntry *entry) {
+    g_free(entry->pub.origin);
+    g_free(entry->pub.path);
+    g_free(entry->key);
+    g_free(entry->name_key);
+    g_free(entry);
+}
+
+static void opdesk_file_index_finalize(GObject *object) {
+    OPDeskFileIndex *self = OPDESK_FILE_INDEX(object);
+    g_clear_pointer(&self->by_name, g_ptr_array_unref);
+    g_hash_table_destroy(self->trigrams);
+    g_hash_table_destroy(self->by_location);
+    g_ptr_array_unref(self->entries);
+    G_OBJECT_CLASS(opdesk_file_index_parent_class)->finalize(object);
+}
+
+static void opdesk_file_index_class_init(OPDeskFileIndexClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+    object_class->finalize = opdesk_file_index_finalize;
+}
+
+static void opdesk_file_index_init(OPDeskFileIndex *index) {
+    index->entries = g_ptr_array_new_with_free_func((GDestroyNotify)index_entry_free);
+    index->by_location = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    index->trigrams = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_array_unref);
+}
+
+OPDeskFileIndex *opdesk_file_index_new(void) {
+    return g_object_new(OPDESK_TYPE_FILE_INDEX, NULL);
+}
+
+static char *location_key(gpointer server, const char *origin, const char *path) {
+    return g_strdup_printf("%p\n%s\n%s", server, origin, path);
+}
+
+static inline guint32 trigram_at(const char *s) {
+    return ((guint32)(guchar)s[0] << 16) | ((guint32)(guchar)s[1] << 8) | (guint32)(guchar)s[2];
+}
+
+static void index_entry_trigrams(OPDeskFileIndex *index, IndexEntry *entry) {
+    gsize len = strlen(entry->key);
+    for(gsize i=0;i+3<=len;i++) {
+        gpointer tri = GUINT_TO_POINTER(trigram_at(entry->key + i));
+        GArray *ids = g_hash_table_lookup(index->trigrams, tri);
+        if(!ids) {
+            ids = g_array_new(FALSE, FALSE, sizeof(guint));
+            g_hash_table_insert(index->trigrams, tri, ids);
+        }
+        // ids only ever grow, so a repeated trigram in the same path is the last element
+        if(ids->len && g_array_index(ids, guint, ids->len - 1)==entry->id) continue;
+        g_array_append_val(ids, entry->id);
+    }
+}
+
+static void opdesk_file_index_mark_removed(OPDeskFileIndex *index, IndexEntry *entry) {
+    char *loc = location_key(entry->pub.server, entry->pub.origin, entry->pub.path);
+    g_hash_table_remove(index->by_location, loc);
+    g_free(loc);
+
+    // posting lists keep the id, searches skip it
+    entry->removed = TRUE;
+    index->removed++;
+    g_clear_pointer(&index->by_name, g_ptr_array_unref);
+}
+
+static void opdesk_file_index_compact(OPDeskFileIndex *index) {
+    g_debug("Compacting file index, %u of %u entries removed", index->removed, index->entries->len);
+
+    GPtrArray *live = g_ptr_array_new_full(index->entries->len - index->removed, (GDestroyNotify)index_entry_free);
+    g_ptr_array_set_free_func(index->entries, NULL);
+    for(guint e=0;e<index->entries->len;e++) {
+        IndexEntry *entry = g_ptr_array_index(index->entries, e);
+        if(entry->removed) {
+            index_entry_free(entry);
+            continue;
+        }
+        entry->id = live->len;
+        g_ptr_array_add(live, entry);
+    }
+    g_ptr_array_unref(index->entries);
+    index->entries = live;
+    index->removed = 0;
+
+    g_hash_table_remove_all(index->trigrams);
+    for(guint e=0;e<index->entries->len;e++) index_entry_trigrams(index, g_ptr_array_index(index->entries, e));
+}
+
+static void opdesk_file_index_maybe_compact(OPDeskFileIndex *index) {
+    if(index->removed >= COMPACT_MIN_REMOVED && index->removed * 2 >= index->entries->len) opdesk_file_index_compact(index);
+}
+
+void opdesk_file_index_add(OPDeskFileIndex *index, gpointer server, const char *origin, const char *path, gint64 size, gint64 date) {
+    char *loc = location_key(server, origin, path);
+    IndexEntry *old = g_hash_table_lookup(index->by_location, loc);
+    if(old) {
+        // same path, the key doesn't change so neither do the trigrams
+        old->pub.size = size;
+        old->pub.date = date;
+        g_free(loc);
+        return;
+    }
+
+    IndexEntry *entry = g_new0(IndexEntry, 1);
+    entry->id = index->entries->len;
+    entry->pub.server = server;
+    entry->pub.origin = g_strdup(origin);
+    entry->pub.path = g_strdup(path);
+    const char *slash = strrchr(entry->pub.path, '/');
+    entry->pub.name = slash ? slash + 1 : entry->pub.path;
+    entry->pub.size = size;
+    entry->pub.date = date;
+    entry->key = g_utf8_strdown(path, -1);
+    entry->name_key = g_utf8_strdown(entry->pub.name, -1);
+
+    g_ptr_array_add(index->entries, entry);
+    g_hash_table_insert(index->by_location, loc, entry);
+    index_entry_trigrams(index, entry);
+    g_clear_pointer(&index->by_name, g_ptr_array_unref);
+}
+
+void opdesk_file_index_remove(OPDeskFileIndex *index, gpointer server, const char *origin, const char *path) {
+    char *loc = location_key(server, origin, path);
+    IndexEntry *entry = g_hash_table_lookup(index->by_location, loc);
+    g_free(loc);
+    if(!entry) return;
+
+    opdesk_file_index_mark_removed(index, entry);
+    opdesk_file_index_maybe_compact(index);
+}
+
+void opdesk_file_index_remove_folder(OPDeskFileIndex *index, gpointer server, const char *origin, const char *path) {
+    gsize len = strlen(path);
+    for(guint e=0;e<index->entries->len;e++) {
+        IndexEntry *entry = g_ptr_array_index(index->entries, e);
+        if(entry->removed || entry->pub.server!=server || strcmp(entry->pub.origin, origin)) continue;
+        if(strncmp(entry->pub.path, path, len) || entry->pub.path[len]!='/') continue;
+        opdesk_file_index_mark_removed(index, entry);
+    }
+    opdesk_file_index_maybe_compact(index);
+}
+
+void opdesk_file_index_remove_server(OPDeskFileIndex *index, gpointer server, const char *origin) {
+    for(guint e=0;e<index->entries->len;e++) {
+        IndexEntry *entry = g_ptr_array_index(index->entries, e);
+        if(entry->removed || entry->pub.server!=server) continue;
+        if(origin && strcmp(entry->pub.origin, origin)) continue;
+        opdesk_file_index_mark_removed(index, entry);
+    }
+    opdesk_file_index_maybe_compact(index);
+}
+
+void opdesk_file_index_add_listing(OPDeskFileIndex *index, gpointer server, JsonArray *files) {
+    guint len = json_array_get_length(files);
+    for(guint f=0;f<len;f++) {
+        JsonObject *file = json_array_get_object_element(files, f);
+        if(!file) continue;
+
+        const char *type = json_object_get_string_member_with_default(file, "type", "");
+        if(strcmp(type, "folder")==0) {
+            if(json_object_has_member(file, "children")) opdesk_file_index_add_listing(index, server, json_object_get_array_member(file, "children"));
+            continue;
+        }
+        if(strcmp(type, "machinecode")) continue;
+
+        const char *origin = json_object_get_string_member_with_default(file, "origin", "local");
+        const char *path = json_object_get_string_member_with_default(file, "path", NULL);
+        if(!path) path = json_object_get_string_member_with_default(file, "name", NULL);
+        if(!path) continue;
+
+        opdesk_file_index_add(index, server, origin, path,
+            json_object_get_int_member_with_default(file, "size", -1),
+            json_object_get_int_member_with_default(file, "date", 0));
+    }
+}
+
+guint opdesk_file_index_get_count(OPDeskFileIndex *index) {
+    return index->entries->len - index->removed;
+}
+
+static gint compare_name_key(gconstpointer a, gconstpointer b) {
+    const IndexEntry *ea = *(const IndexEntry**)a;
+    const IndexEntry *eb = *(const IndexEntry**)b;
+    gint r = strcmp(ea->name_key, eb->name_key);
+    if(r) return r;
+    return strcmp(ea->key, eb->key);
+}
+
+static GPtrArray *opdesk_file_index_get_by_name(OPDeskFileIndex *index) {
+    if(index->by_name) return index->by_name;
+
+    index->by_name = g_ptr_array_sized_new(index->entries->len - index->removed);
+    for(guint e=0;e<index->entries->len;e++) {
+        IndexEntry *entry = g_ptr_array_index(index->entries, e);
+        if(!entry->removed) g_ptr_array_add(index->by_name, entry);
+    }
+    g_ptr_array_sort(index->by_name, compare_name_key);
+    return index->by_name;
+}
+
+static void opdesk_file_index_search_prefix(OPDeskFileIndex *index, const char *query, guint limit, GPtrArray *results) {
+    GPtrArray *by_name = opdesk_file_index_get_by_name(index);
+    gsize len = strlen(query);
+
+    // first name_key >= query
+    guint lo = 0, hi = by_name->len;
+    while(lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        IndexEntry *entry = g_ptr_array_index(by_name, mid);
+        if(strcmp(entry->name_key, query) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    for(guint e=lo;e<by_name->len && results->len<limit;e++) {
+        IndexEntry *entry = g_ptr_array_index(by_name, e);
+        if(strncmp(entry->name_key, query, len)) break;
+        g_ptr_array_add(results, entry);
+    }
+}
+
+static gint compare_posting_len(gconstpointer a, gconstpointer b) {
+    const GArray *pa = *(const GArray**)a;
+    const GArray *pb = *(const GArray**)b;
+    return (gint)pa->len - (gint)pb->len;
+}
+
+static gint compare_id(const void *a, const void *b) {
+    guint ia = *(const guint*)a;
+    guint ib = *(const guint*)b;
+    return ia < ib ? -1 : ia > ib;
+}
+
+typedef struct {
+    IndexEntry *entry;
+    guint rank;
+} SearchMatch;
+
+static gint compare_match(gconstpointer a, gconstpointer b) {
+    const SearchMatch *ma = a;
+    const SearchMatch *mb = b;
+    if(ma->rank!=mb->rank) return (gint)ma->rank - (gint)mb->rank;
+    return compare_name_key(&ma->entry, &mb->entry);
+}
+
+// moves the k best of n matches to the front, in no particular order
+static void select_best_matches(SearchMatch *m, guint n, guint k) {
+    guint lo = 0, hi = n - 1;
+    while(lo < hi) {
+        SearchMatch pivot = m[lo + (hi - lo) / 2];
+        guint i = lo, j = hi;
+        while(i <= j) {
+            while(compare_match(&m[i], &pivot) < 0) i++;
+            while(compare_match(&m[j], &pivot) > 0) j--;
+            if(i <= j) {
+                SearchMatch t = m[i];
+                m[i] = m[j];
+                m[j] = t;
+                i++;
+                if(j==0) break;
+                j--;
+            }
+        }
+        if(k <= j) hi = j;
+        else if(k > i) lo = i;
+        else break;
+    }
+}
+
+static void opdesk_file_index_search_trigrams(OPDeskFileIndex *index, const char *query, guint limit, GPtrArray *results) {
+    gsize len = strlen(query);
+
+    GPtrArray *postings = g_ptr_array_new();
+    for(gsize i=0;i+3<=len;i++) {
+        GArray *ids = g_hash_table_lookup(index->trigrams, GUINT_TO_POINTER(trigram_at(query + i)));
+        if(!ids) {
+            g_ptr_array_unref(postings);
+            return;
+        }
+        if(!g_ptr_array_find(postings, ids, NULL)) g_ptr_array_add(postings, ids);
+    }
+    // walk the rarest trigram, look the id up in the others
+    g_ptr_array_sort(postings, compare_posting_len);
+
+    GArray *matches = g_array_new(FALSE, FALSE, sizeof(SearchMatch));
+    GArray *first = g_ptr_array_index(postings, 0);
+    for(guint i=0;i<first->len;i++) {
+        guint id = g_array_index(first, guint, i);
+        IndexEntry *entry = g_ptr_array_index(index->entries, id);
+        if(entry->removed) continue;
+
+        gboolean in_all = TRUE;
+        for(guint p=1;p<postings->len && in_all;p++) {
+            GArray *ids = g_ptr_array_index(postings, p);
+            in_all = bsearch(&id, ids->data, ids->len, sizeof(guint), compare_id)!=NULL;
+        }
+        if(!in_all) continue;
+
+        // sharing every trigram doesn't mean they're in order
+        SearchMatch match = { entry, 0 };
+        const char *at = strstr(entry->name_key, query);
+        if(at==entry->name_key) match.rank = 0;
+        else if(at) match.rank = 1;
+        else if(strstr(entry->key, query)) match.rank = 2;
+        else continue;
+
+        g_array_append_val(matches, match);
+    }
+    g_ptr_array_unref(postings);
+
+    // only the best limit need sorting
+    if(matches->len > limit) {
+        select_best_matches((SearchMatch*)matches->data, matches->len, limit);
+        g_array_set_size(matches, limit);
+    }
+    g_array_sort(matches, compare_match);
+    for(guint m=0;m<matches->len;m++) g_ptr_array_add(results, g_array_index(matches, SearchMatch, m).entry);
+    g_array_unref(matches);
+}
+
+GPtrArray *opdesk_file_index_search(OPDeskFileIndex *index, const char *query, guint limit) {
+    GPtrArray *results = g_ptr_array_new();
+
+    char *q = g_utf8_strdown(query, -1);
+    g_strstrip(q);
+    if(*q && limit) {
+        gint64 start = g_get_monotonic_time();
+        if(strlen(q) < 3) opdesk_file_index_search_prefix(index, q, limit, results);
+        else opdesk_file_index_search_trigrams(index, q, limit, results);
+        g_debug("Search for '%s' found %u files in %" G_GINT64_FORMAT " us", q, results->len, g_get_monotonic_time() - start);
+    }
+    g_free(q);
+
+    return results;
+}
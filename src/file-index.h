@@ -0,0 +1,60 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <glib-object.h>
+#include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+/* A file on one of the servers. Read only, owned by the index */
+typedef struct {
+    gpointer server; // OPDeskServer, not referenced
+    char *origin;    // local or sdcard
+    char *path;
+    const char *name; // last component of path
+    gint64 size;      // -1 if unknown, ie. added from an event
+    gint64 date;      // unix time, 0 if unknown
+} OPDeskFileIndexEntry;
+
+/* Every printable file on every server, searchable by name.
+   Servers fill it from a single recursive listing and keep it current from file events.
+   Paths are indexed by lower case trigram so a search only looks at files that share
+   every trigram of the query, queries shorter than that match file name prefixes. */
+#define OPDESK_TYPE_FILE_INDEX opdesk_file_index_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskFileIndex, opdesk_file_index, OPDESK, FILE_INDEX, GObject)
+
+OPDeskFileIndex *opdesk_file_index_new(void);
+
+/* replaces an existing entry for the same server, origin and path */
+void opdesk_file_index_add(OPDeskFileIndex *index, gpointer server, const char *origin, const char *path, gint64 size, gint64 date);
+void opdesk_file_index_remove(OPDeskFileIndex *index, gpointer server, const char *origin, const char *path);
+/* removes everything below path */
+void opdesk_file_index_remove_folder(OPDeskFileIndex *index, gpointer server, const char *origin, const char *path);
+/* origin NULL for all origins */
+void opdesk_file_index_remove_server(OPDeskFileIndex *index, gpointer server, const char *origin);
+
+/* adds the machine code files in an /api/files listing, recursing into folders */
+void opdesk_file_index_add_listing(OPDeskFileIndex *index, gpointer server, JsonArray *files);
+
+guint opdesk_file_index_get_count(OPDeskFileIndex *index);
+
+/* Case insensitive search, file names starting with query first, then names containing it,
+   then files in matching folders. Returns up to limit entries, valid until the index changes.
+   Free with g_ptr_array_unref */
+GPtrArray *opdesk_file_index_search(OPDeskFileIndex *index, const char *query, guint limit);
+
+G_END_DECLS
@@ -0,0 +1,598 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-fleet"
+#include <glib.h>
+
+#include <libsoup/soup.h>
+#include "fleet.h"
+
+#define MAX_IN_FLIGHT_DEFAULT 16
+#define SUMMARY_MAX_NAMES     5
+
+#define MAX_UPLOADS_DEFAULT   8
+#define UPLOAD_START_WINDOW   2
+#define UPLOAD_ATTEMPTS       3
+
+struct OPDeskFleetPreset {
+    char *name;
+    gint bed;
+    gint tool;
+};
+typedef struct OPDeskFleetPreset OPDeskFleetPreset;
+
+struct _OPDeskFleet {
+    GObject parent_instance;
+
+    OPDeskNotificationScheduler *notification_scheduler;
+
+    GPtrArray *servers;
+    GList *groups;
+    GList *preset_names;
+    GHashTable *presets; // name -> OPDeskFleetPreset
+    GList *macro_names;
+
+    guint max_in_flight;
+    guint max_uploads;
+};
+
+G_DEFINE_TYPE (OPDeskFleet, opdesk_fleet, G_TYPE_OBJECT)
+
+/* One run of a command, lives until every server has answered */
+struct OPDeskFleetJob {
+    OPDeskFleet *fleet;
+    OPDeskFleetCommand command;
+    char *scope;
+    gint bed;
+    gint tool;
+    char *macro;
+    gchar **gcode;
+
+    GQueue pending; // OPDeskServer, borrowed from the fleet
+    guint in_flight;
+
+    guint ok;
+    guint failed;
+    guint skipped;
+    GString *failed_names;
+
+    gint64 started;
+};
+typedef struct OPDeskFleetJob OPDeskFleetJob;
+
+/* A single server within a job, one or more requests */
+struct OPDeskFleetTarget {
+    OPDeskFleetJob *job;
+    OPDeskServer *server;
+    guint outstanding;
+    gboolean failed;
+};
+typedef struct OPDeskFleetTarget OPDeskFleetTarget;
+
+static void opdesk_fleet_preset_free(OPDeskFleetPreset *preset) {
+    g_free(preset->name);
+    g_free(preset);
+}
+
+static void opdesk_fleet_finalize(GObject *object) {
+    OPDeskFleet *self = OPDESK_FLEET(object);
+
+    g_object_unref(self->notification_scheduler);
+    g_ptr_array_unref(self->servers);
+    g_list_free_full(self->groups, g_free);
+    g_list_free(self->preset_names);
+    g_hash_table_destroy(self->presets);
+    g_list_free_full(self->macro_names, g_free);
+
+    G_OBJECT_CLASS(opdesk_fleet_parent_class)->finalize(object);
+}
+
+static void opdesk_fleet_class_init(OPDeskFleetClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->finalize = opdesk_fleet_finalize;
+}
+
+static void opdesk_fleet_init(OPDeskFleet *fleet) {
+    fleet->servers = g_ptr_array_new_with_free_func(g_object_unref);
+    fleet->presets = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)opdesk_fleet_preset_free);
+}
+
+static void opdesk_fleet_add_preset(OPDeskFleet *fleet, const char *name, gint bed, gint tool) {
+    if(g_hash_table_contains(fleet->presets, name)) {
+        g_warning("Duplicate preset %s, ignoring", name);
+        return;
+    }
+
+    OPDeskFleetPreset *preset = g_malloc0(sizeof(OPDeskFleetPreset));
+    preset->name = g_strdup(name);
+    preset->bed = bed;
+    preset->tool = tool;
+
+    g_hash_table_insert(fleet->presets, preset->name, preset);
+    fleet->preset_names = g_list_append(fleet->preset_names, preset->name);
+}
+
+OPDeskFleet *opdesk_fleet_new(OPDeskAppConfig *config, OPDeskNotificationScheduler *notification_scheduler) {
+    OPDeskFleet *fleet = g_object_new(OPDESK_TYPE_FLEET, NULL);
+    fleet->notification_scheduler = g_object_ref(notification_scheduler);
+    fleet->max_in_flight = opdesk_app_config_get_int(config, "fleet.maxInFlight", MAX_IN_FLIGHT_DEFAULT);
+    if(!fleet->max_in_flight) fleet->max_in_flight = 1;
+    fleet->max_uploads = opdesk_app_config_get_int(config, "fleet.maxUploads", MAX_UPLOADS_DEFAULT);
+    if(!fleet->max_uploads) fleet->max_uploads = 1;
+
+    JsonArray *presets = opdesk_app_config_get_array(config, "fleet.presets");
+    if(presets) {
+        guint len = json_array_get_length(presets);
+        for(guint p=0;p<len;p++) {
+            JsonObject *preset = json_array_get_object_element(presets, p);
+            if(!preset || !json_object_has_member(preset, "name")) {
+                g_warning("Fleet preset %u has no name, ignoring", p);
+                continue;
+            }
+            opdesk_fleet_add_preset(fleet,
+                json_object_get_string_member(preset, "name"),
+                json_object_get_int_member_with_default(preset, "bed", 0),
+                json_object_get_int_member_with_default(preset, "tool", 0));
+        }
+    } else {
+        // the same defaults as OctoPrint's temperature profiles
+        opdesk_fleet_add_preset(fleet, "ABS", 100, 210);
+        opdesk_fleet_add_preset(fleet, "PLA", 60, 180);
+    }
+
+    return fleet;
+}
+
+void opdesk_fleet_add_server(OPDeskFleet *fleet, OPDeskServer *server) {
+    g_ptr_array_add(fleet->servers, g_object_ref(server));
+
+    const char *group = opdesk_config_get_group(opdesk_server_get_config(server));
+    if(group && !g_list_find_custom(fleet->groups, group, (GCompareFunc)g_strcmp0)) {
+        fleet->groups = g_list_append(fleet->groups, g_strdup(group));
+    }
+
+    for(GList *macro = opdesk_config_get_macro_names(opdesk_server_get_config(server)); macro; macro = macro->next) {
+        if(!g_list_find_custom(fleet->macro_names, macro->data, (GCompareFunc)g_strcmp0)) {
+            fleet->macro_names = g_list_append(fleet->macro_names, g_strdup(macro->data));
+        }
+    }
+}
+
+GList *opdesk_fleet_get_groups(OPDeskFleet *fleet) {
+    return fleet->groups;
+}
+
+GList *opdesk_fleet_get_presets(OPDeskFleet *fleet) {
+    return fleet->preset_names;
+}
+
+GList *opdesk_fleet_get_macros(OPDeskFleet *fleet) {
+    return fleet->macro_names;
+}
+
+static const char *command_description(OPDeskFleetCommand command) {
+    switch(command) {
+    case OPDESK_FLEET_PSU_ON:   return "PSU on";
+    case OPDESK_FLEET_PSU_OFF:  return "PSU off";
+    case OPDESK_FLEET_PREHEAT:  return "Preheat";
+    case OPDESK_FLEET_COOLDOWN: return "Cool down";
+    case OPDESK_FLEET_MACRO:    return "Macro";
+    case OPDESK_FLEET_GCODE:    return "G-code";
+    default: return "Unknown";
+    }
+}
+
+static const char *command_id(OPDeskFleetCommand command) {
+    switch(command) {
+    case OPDESK_FLEET_PSU_ON:   return "fleet-psu-on";
+    case OPDESK_FLEET_PSU_OFF:  return "fleet-psu-off";
+    case OPDESK_FLEET_PREHEAT:  return "fleet-preheat";
+    case OPDESK_FLEET_COOLDOWN: return "fleet-cooldown";
+    case OPDESK_FLEET_MACRO:    return "fleet-macro";
+    case OPDESK_FLEET_GCODE:    return "fleet-gcode";
+    default: return "fleet";
+    }
+}
+
+static void opdesk_fleet_job_free(OPDeskFleetJob *job) {
+    g_string_free(job->failed_names, TRUE);
+    g_free(job->scope);
+    g_free(job->macro);
+    g_strfreev(job->gcode);
+    g_object_unref(job->fleet);
+    g_free(job);
+}
+
+static void opdesk_fleet_job_finish(OPDeskFleetJob *job) {
+    gint64 elapsed = (g_get_monotonic_time() - job->started) / 1000;
+    const char *scope = job->scope ? job->scope : "All printers";
+
+    GString *body = g_string_new(NULL);
+    if(job->macro) g_string_append_printf(body, "%s %s: %u succeeded", command_description(job->command), job->macro, job->ok);
+    else g_string_append_printf(body, "%s: %u succeeded", command_description(job->command), job->ok);
+    if(job->failed) g_string_append_printf(body, ", %u failed", job->failed);
+    if(job->skipped) g_string_append_printf(body, ", %u skipped", job->skipped);
+    if(job->failed) g_string_append_printf(body, "\nFailed: %s", job->failed_names->str);
+
+    g_message("%s (%s) finished in %" G_GINT64_FORMAT " ms", command_description(job->command), scope, elapsed);
+    opdesk_notification_scheduler_submit(job->fleet->notification_scheduler, scope,
+        job->failed ? G_NOTIFICATION_PRIORITY_HIGH : G_NOTIFICATION_PRIORITY_NORMAL,
+        command_id(job->command), body->str);
+
+    g_string_free(body, TRUE);
+    opdesk_fleet_job_free(job);
+}
+
+static void opdesk_fleet_job_pump(OPDeskFleetJob *job);
+
+// failed is the number of failures before this one
+static void summary_add_failed(GString *names, guint failed, OPDeskServer *server) {
+    if(failed < SUMMARY_MAX_NAMES) {
+        if(failed) g_string_append(names, ", ");
+        g_string_append(names, opdesk_config_get_printer_name(opdesk_server_get_config(server)));
+    } else if(failed==SUMMARY_MAX_NAMES) {
+        g_string_append(names, ", ...");
+    }
+}
+
+static void on_target_response(OctoPrintClient *client, guint status, JsonObject *response, OPDeskFleetTarget *target) {
+    if(!SOUP_STATUS_IS_SUCCESSFUL(status)) target->failed = TRUE;
+    if(--target->outstanding) return;
+
+    OPDeskFleetJob *job = target->job;
+    job->in_flight--;
+
+    if(target->failed) {
+        summary_add_failed(job->failed_names, job->failed, target->server);
+        job->failed++;
+    } else {
+        job->ok++;
+    }
+    g_free(target);
+
+    opdesk_fleet_job_pump(job);
+}
+
+// returns FALSE if the server can't take the command
+static gboolean opdesk_fleet_target_start(OPDeskFleetTarget *target) {
+    OPDeskServer *server = target->server;
+    OPDeskFleetJob *job = target->job;
+    OctoPrintClient *client = opdesk_server_get_client(server);
+
+    switch(job->command) {
+    case OPDESK_FLEET_PSU_ON:
+    case OPDESK_FLEET_PSU_OFF:
+        if(!opdesk_server_has_psu_control(server)) return FALSE;
+        target->outstanding = 1;
+        if(job->command==OPDESK_FLEET_PSU_ON) octoprint_client_psucontrol_turn_on_async(client, (OctoPrintClientCallback)on_target_response, target);
+        else octoprint_client_psucontrol_turn_off_async(client, (OctoPrintClientCallback)on_target_response, target);
+        return TRUE;
+    case OPDESK_FLEET_PREHEAT:
+    case OPDESK_FLEET_COOLDOWN:
+        if(!opdesk_server_is_operational(server)) return FALSE;
+        // count both before sending so the first response can't finish the target
+        target->outstanding = 2;
+        octoprint_client_set_bed_target_async(client, job->bed, (OctoPrintClientCallback)on_target_response, target);
+        octoprint_client_set_tool_targets_async(client, opdesk_server_get_tool_count(server), job->tool, (OctoPrintClientCallback)on_target_response, target);
+        return TRUE;
+    case OPDESK_FLEET_MACRO:
+    case OPDESK_FLEET_GCODE:
+        if(!opdesk_server_is_operational(server)) return FALSE;
+        if(job->macro && !opdesk_config_get_macro(opdesk_server_get_config(server), job->macro)) return FALSE;
+        // every line goes in one request per printer
+        target->outstanding = 1;
+        if(job->macro) return opdesk_server_run_macro(server, job->macro, (OctoPrintClientCallback)on_target_response, target);
+        return opdesk_server_send_gcode(server, (const char *const *)job->gcode, (OctoPrintClientCallback)on_target_response, target);
+    default:
+        return FALSE;
+    }
+}
+
+static void opdesk_fleet_job_pump(OPDeskFleetJob *job) {
+    while(job->in_flight < job->fleet->max_in_flight && !g_queue_is_empty(&job->pending)) {
+        OPDeskFleetTarget *target = g_malloc0(sizeof(OPDeskFleetTarget));
+        target->job = job;
+        target->server = g_queue_pop_head(&job->pending);
+
+        job->in_flight++;
+        if(!opdesk_fleet_target_start(target)) {
+            job->in_flight--;
+            job->skipped++;
+            g_free(target);
+        }
+    }
+
+    if(!job->in_flight && g_queue_is_empty(&job->pending)) opdesk_fleet_job_finish(job);
+}
+
+gboolean opdesk_fleet_run(OPDeskFleet *fleet, const char *group, OPDeskFleetCommand command, const char *argument) {
+    if(group && !*group) group = NULL;
+    if(group && !g_list_find_custom(fleet->groups, group, (GCompareFunc)g_strcmp0)) {
+        g_warning("Unknown group %s", group);
+        return FALSE;
+    }
+
+    OPDeskFleetJob *job = g_malloc0(sizeof(OPDeskFleetJob));
+    job->fleet = g_object_ref(fleet);
+    job->command = command;
+    job->scope = g_strdup(group);
+    job->failed_names = g_string_new(NULL);
+    job->started = g_get_monotonic_time();
+    g_queue_init(&job->pending);
+
+    if(command==OPDESK_FLEET_PREHEAT) {
+        OPDeskFleetPreset *p = argument ? g_hash_table_lookup(fleet->presets, argument) : NULL;
+        if(!p) {
+            g_warning("Unknown preset %s", argument);
+            opdesk_fleet_job_free(job);
+            return FALSE;
+        }
+        job->bed = p->bed;
+        job->tool = p->tool;
+    } else if(command==OPDESK_FLEET_MACRO) {
+        if(!argument || !g_list_find_custom(fleet->macro_names, argument, (GCompareFunc)g_strcmp0)) {
+            g_warning("Unknown macro %s", argument);
+            opdesk_fleet_job_free(job);
+            return FALSE;
+        }
+        job->macro = g_strdup(argument);
+    } else if(command==OPDESK_FLEET_GCODE) {
+        job->gcode = g_strsplit(argument ? argument : "", "\n", -1);
+    }
+
+    for(guint s=0;s<fleet->servers->len;s++) {
+        OPDeskServer *server = g_ptr_array_index(fleet->servers, s);
+        if(group && g_strcmp0(group, opdesk_config_get_group(opdesk_server_get_config(server)))) continue;
+        g_queue_push_tail(&job->pending, server);
+    }
+
+    g_message("%s (%s): %u printers", command_description(command), group ? group : "All printers", job->pending.length);
+    opdesk_fleet_job_pump(job);
+
+    return TRUE;
+}
+
+/* Broadcast uploads
+   The file is mapped once and every upload sends straight from the mapping, so the file is read
+   from disk once and held in memory once however many printers it goes to. The number of uploads
+   running at once starts small and grows while the combined throughput keeps improving, backing
+   off when it drops or uploads fail. */
+
+struct OPDeskFleetUploadJob {
+    OPDeskFleet *fleet;
+    char *scope;
+    char *name;
+    GMappedFile *mapped;
+    gboolean print;
+
+    GQueue pending; // OPDeskFleetUploadTarget
+    GPtrArray *active; // OctoPrintUpload in progress
+    guint window;
+    gdouble last_rate; // combined bytes/s when the window last changed
+
+    guint ok;
+    guint failed;
+    guint skipped;
+    guint retries;
+    GString *failed_names;
+
+    gint64 started;
+};
+typedef struct OPDeskFleetUploadJob OPDeskFleetUploadJob;
+
+struct OPDeskFleetUploadTarget {
+    OPDeskFleetUploadJob *job;
+    OPDeskServer *server;
+    guint attempts;
+};
+typedef struct OPDeskFleetUploadTarget OPDeskFleetUploadTarget;
+
+static void opdesk_fleet_upload_job_finish(OPDeskFleetUploadJob *job) {
+    gint64 elapsed = (g_get_monotonic_time() - job->started) / 1000;
+    const char *scope = job->scope ? job->scope : "All printers";
+
+    GString *body = g_string_new(NULL);
+    g_string_append_printf(body, "Uploaded %s to %u printer%s", job->name, job->ok, job->ok==1 ? "" : "s");
+    if(job->failed) g_string_append_printf(body, ", %u failed", job->failed);
+    if(job->skipped) g_string_append_printf(body, ", %u skipped", job->skipped);
+    if(job->failed) g_string_append_printf(body, "\nFailed: %s", job->failed_names->str);
+
+    g_message("Upload of %s (%s) finished in %" G_GINT64_FORMAT " ms, %u retries", job->name, scope, elapsed, job->retries);
+    opdesk_notification_scheduler_submit(job->fleet->notification_scheduler, scope,
+        job->failed ? G_NOTIFICATION_PRIORITY_HIGH : G_NOTIFICATION_PRIORITY_NORMAL,
+        "fleet-upload", body->str);
+
+    g_string_free(body, TRUE);
+    g_string_free(job->failed_names, TRUE);
+    g_ptr_array_unref(job->active);
+    g_mapped_file_unref(job->mapped);
+    g_free(job->name);
+    g_free(job->scope);
+    g_object_unref(job->fleet);
+    g_free(job);
+}
+
+static gdouble opdesk_fleet_upload_job_rate(OPDeskFleetUploadJob *job) {
+    gdouble rate = 0.0;
+    for(guint u=0;u<job->active->len;u++) rate += octoprint_upload_get_rate(g_ptr_array_index(job->active, u));
+    return rate;
+}
+
+// hill climb on the combined throughput of the uploads that were running alongside this one
+static void opdesk_fleet_upload_job_adapt(OPDeskFleetUploadJob *job, gdouble rate) {
+    guint old_window = job->window;
+
+    if(rate > job->last_rate * 1.1 && job->window < job->fleet->max_uploads) job->window++;
+    else if(rate < job->last_rate * 0.9 && job->window > 1) job->window--;
+    job->last_rate = rate;
+
+    if(job->window!=old_window) g_debug("Upload window %u -> %u at %0.0f bytes/s", old_window, job->window, rate);
+}
+
+static void opdesk_fleet_upload_job_pump(OPDeskFleetUploadJob *job);
+
+static void on_upload_target_finished(OctoPrintUpload *upload, OPDeskFleetUploadTarget *target) {
+    OPDeskFleetUploadJob *job = target->job;
+
+    g_signal_handlers_disconnect_by_data(upload, target);
+
+    // measured before it's removed, it was part of the combined rate
+    gdouble rate = opdesk_fleet_upload_job_rate(job);
+    OctoPrintUploadState state = octoprint_upload_get_state(upload);
+    const char *error = octoprint_upload_get_error(upload);
+
+    switch(state) {
+    case OCTOPRINT_UPLOAD_DONE:
+        job->ok++;
+        opdesk_fleet_upload_job_adapt(job, rate);
+        g_free(target);
+        break;
+    case OCTOPRINT_UPLOAD_CANCELLED:
+        summary_add_failed(job->failed_names, job->failed, target->server);
+        job->failed++;
+        g_free(target);
+        break;
+    default:
+        // too many at once is the likeliest reason, back off
+        job->window = MAX(1, job->window / 2);
+        job->last_rate = 0.0;
+        if(target->attempts < UPLOAD_ATTEMPTS) {
+            g_message("Upload to %s failed (%s), retrying", opdesk_config_get_printer_name(opdesk_server_get_config(target->server)), error);
+            job->retries++;
+            g_queue_push_tail(&job->pending, target);
+        } else {
+            summary_add_failed(job->failed_names, job->failed, target->server);
+            job->failed++;
+            g_free(target);
+        }
+        break;
+    }
+
+    g_ptr_array_remove(job->active, upload);
+    opdesk_fleet_upload_job_pump(job);
+}
+
+static void opdesk_fleet_upload_job_pump(OPDeskFleetUploadJob *job) {
+    while(job->active->len < job->window && !g_queue_is_empty(&job->pending)) {
+        OPDeskFleetUploadTarget *target = g_queue_pop_head(&job->pending);
+        target->attempts++;
+
+        OctoPrintUpload *upload = octoprint_upload_new_from_mapped(opdesk_server_get_client(target->server), job->mapped, job->name, job->print);
+        g_signal_connect(upload, "finished", G_CALLBACK(on_upload_target_finished), target);
+        g_ptr_array_add(job->active, upload);
+
+        GError *err = NULL;
+        if(!opdesk_server_start_upload(target->server, upload, FALSE, &err)) {
+            // a mapped file can't fail to open, but just in case
+            g_warning("Unable to start upload: %s", err->message);
+            g_error_free(err);
+            g_signal_handlers_disconnect_by_data(upload, target);
+            g_ptr_array_remove(job->active, upload);
+            summary_add_failed(job->failed_names, job->failed, target->server);
+            job->failed++;
+            g_free(target);
+        }
+    }
+
+    if(!job->active->len && g_queue_is_empty(&job->pending)) opdesk_fleet_upload_job_finish(job);
+}
+
+typedef struct {
+    OPDeskFleet *fleet;
+    char *scope;
+    char *name;
+} OPDeskFleetAnalyzeData;
+
+// analyzed once for the whole group, not per upload
+static void on_fleet_upload_analyzed(GObject *source, GAsyncResult *result, OPDeskFleetAnalyzeData *data) {
+    GError *err = NULL;
+    OPDeskGCodeAnalysis *analysis = opdesk_gcode_analyze_file_finish(result, &err);
+    if(analysis) {
+        for(guint s=0;s<data->fleet->servers->len;s++) {
+            OPDeskServer *server = g_ptr_array_index(data->fleet->servers, s);
+            if(data->scope && g_strcmp0(data->scope, opdesk_config_get_group(opdesk_server_get_config(server)))) continue;
+            opdesk_server_set_file_analysis(server, data->name, analysis);
+        }
+        g_free(analysis);
+    } else {
+        g_debug("Not analyzing %s: %s", data->name, err->message);
+        g_error_free(err);
+    }
+
+    g_object_unref(data->fleet);
+    g_free(data->scope);
+    g_free(data->name);
+    g_free(data);
+}
+
+gboolean opdesk_fleet_upload(OPDeskFleet *fleet, const char *group, GFile *file, gboolean print, GError **error) {
+    if(group && !*group) group = NULL;
+    if(group && !g_list_find_custom(fleet->groups, group, (GCompareFunc)g_strcmp0)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "Unknown group %s", group);
+        return FALSE;
+    }
+
+    char *path = g_file_get_path(file);
+    if(!path) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Only local files can be uploaded to several printers");
+        return FALSE;
+    }
+    GMappedFile *mapped = g_mapped_file_new(path, FALSE, error);
+    g_free(path);
+    if(!mapped) return FALSE;
+
+    OPDeskFleetUploadJob *job = g_malloc0(sizeof(OPDeskFleetUploadJob));
+    job->fleet = g_object_ref(fleet);
+    job->scope = g_strdup(group);
+    job->name = g_file_get_basename(file);
+    job->mapped = mapped;
+    job->print = print;
+    job->active = g_ptr_array_new_with_free_func(g_object_unref);
+    job->window = MIN(UPLOAD_START_WINDOW, fleet->max_uploads);
+    job->failed_names = g_string_new(NULL);
+    job->started = g_get_monotonic_time();
+    g_queue_init(&job->pending);
+
+    for(guint s=0;s<fleet->servers->len;s++) {
+        OPDeskServer *server = g_ptr_array_index(fleet->servers, s);
+        if(group && g_strcmp0(group, opdesk_config_get_group(opdesk_server_get_config(server)))) continue;
+
+        // an upload to print on a busy or disconnected printer would only fail after sending the whole file
+        if(!opdesk_server_is_connected(server) || (print && (!opdesk_server_is_operational(server) || opdesk_server_is_printing(server)))) {
+            job->skipped++;
+            continue;
+        }
+
+        OPDeskFleetUploadTarget *target = g_malloc0(sizeof(OPDeskFleetUploadTarget));
+        target->job = job;
+        target->server = server;
+        g_queue_push_tail(&job->pending, target);
+    }
+
+    OPDeskFleetAnalyzeData *analyze = g_malloc0(sizeof(OPDeskFleetAnalyzeData));
+    analyze->fleet = g_object_ref(fleet);
+    analyze->scope = g_strdup(group);
+    analyze->name = g_strdup(job->name);
+    opdesk_gcode_analyze_file_async(file, NULL, (GAsyncReadyCallback)on_fleet_upload_analyzed, analyze);
+
+    g_message("Uploading %s (%" G_GSIZE_FORMAT " bytes) to %u printers (%s)", job->name, g_mapped_file_get_length(mapped),
+        job->pending.length, group ? group : "All printers");
+    opdesk_fleet_upload_job_pump(job);
+
+    return TRUE;
+}
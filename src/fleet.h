@@ -0,0 +1,61 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <glib-object.h>
+
+#include "config.h"
+#include "server.h"
+#include "notification-scheduler.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+    OPDESK_FLEET_PSU_ON,
+    OPDESK_FLEET_PSU_OFF,
+    OPDESK_FLEET_PREHEAT,
+    OPDESK_FLEET_COOLDOWN,
+    OPDESK_FLEET_MACRO,
+    OPDESK_FLEET_GCODE
+} OPDeskFleetCommand;
+
+/* Commands sent to every server, or every server in a group, at once.
+   Requests are sent concurrently up to fleet.maxInFlight and the results reported in a single notification. */
+#define OPDESK_TYPE_FLEET opdesk_fleet_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskFleet, opdesk_fleet, OPDESK, FLEET, GObject)
+
+OPDeskFleet *opdesk_fleet_new(OPDeskAppConfig *config, OPDeskNotificationScheduler *notification_scheduler);
+
+void opdesk_fleet_add_server(OPDeskFleet *fleet, OPDeskServer *server);
+
+/* group names in config order, owned by the fleet */
+GList *opdesk_fleet_get_groups(OPDeskFleet *fleet);
+/* preset names in config order, owned by the fleet */
+GList *opdesk_fleet_get_presets(OPDeskFleet *fleet);
+/* every macro name configured on at least one server, owned by the fleet */
+GList *opdesk_fleet_get_macros(OPDeskFleet *fleet);
+
+/* group NULL (or "") for all servers. argument is the preset name for OPDESK_FLEET_PREHEAT,
+   the macro name for OPDESK_FLEET_MACRO (servers without it are skipped) and
+   newline separated commands for OPDESK_FLEET_GCODE. FALSE if the group or preset is unknown */
+gboolean opdesk_fleet_run(OPDeskFleet *fleet, const char *group, OPDeskFleetCommand command, const char *argument);
+
+/* Upload the same local file to every connected server, or every server in a group.
+   The file is read once and shared by all uploads, up to fleet.maxUploads run at once and failed uploads are retried.
+   FALSE if the group is unknown or the file can't be read */
+gboolean opdesk_fleet_upload(OPDeskFleet *fleet, const char *group, GFile *file, gboolean print, GError **error);
+
+G_END_DECLS
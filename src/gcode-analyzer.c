@@ -0,0 +1,493 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-gcode"
+#include <string.h>
+#include <math.h>
+
+#include "gcode-analyzer.h"
+#include "gcode-parser.h"
+
+/* mm/min, until the file sets a feed rate */
+#define DEFAULT_FEED 1500.0
+/* smaller chunks aren't worth a thread */
+#define MIN_CHUNK_SIZE (4 * 1024 * 1024)
+/* how far to look for the start G-code's positioning modes */
+#define HEADER_SCAN_SIZE (4 * 1024 * 1024)
+#define Z_EPSILON 0.0001
+
+enum { AXIS_X, AXIS_Y, AXIS_Z, AXIS_E, N_AXES };
+
+static const char axis_letters[N_AXES] = { 'X', 'Y', 'Z', 'E' };
+
+#define PARAM_BIT(l) OPDESK_GCODE_PARAM_BIT(l)
+#define HAS_PARAM(cmd, l) OPDESK_GCODE_HAS_PARAM(cmd, l)
+#define PARAM(cmd, l) OPDESK_GCODE_PARAM(cmd, l)
+
+/* A chunk can't know where the previous one left an axis until it sets it, until then
+   coordinates are kept relative to that unknown start and resolved when chunks are merged. */
+typedef struct {
+    gboolean known;
+    gdouble v;
+} Coord;
+
+typedef struct {
+    gboolean relative;
+    gboolean relative_e;
+} Modes;
+
+/* a move to an absolute coordinate from an unknown one, the only moves a chunk can't measure itself */
+typedef struct {
+    Coord from[N_AXES];
+    Coord to[N_AXES];
+    Coord feed;
+} BoundaryMove;
+
+typedef struct {
+    const char *start;
+    const char *end;
+    GCancellable *cancellable;
+
+    Modes start_modes;
+    Modes modes;
+    Coord pos[N_AXES];
+    Coord feed;
+
+    guint64 lines;
+    gdouble time;
+    gdouble filament;
+    /* distance moved before the chunk sets a feed rate */
+    gdouble unknown_feed_distance;
+    gdouble max_tool_temp;
+    gdouble max_bed_temp;
+
+    /* indexed by Coord.known then axis */
+    gboolean have_bounds[2][3];
+    gdouble min[2][3];
+    gdouble max[2][3];
+
+    /* every boundary move makes at least one axis known */
+    BoundaryMove boundary[N_AXES];
+    guint n_boundary;
+
+    guint layer_comments;
+    /* Z steps between extruding moves within the chunk */
+    guint layers;
+    gboolean extruded;
+    Coord first_extrude_z;
+    Coord last_extrude_z;
+    /* Z becomes known at most once, the step across that can only be compared once merged */
+    gboolean layer_pending;
+    gdouble pending_from;
+    gdouble pending_to;
+} Chunk;
+
+static inline gdouble resolve(Coord c, gdouble start) {
+    return c.known ? c.v : start + c.v;
+}
+
+static inline void bounds_add(gboolean *have, gdouble *min, gdouble *max, gdouble v) {
+    if(!*have) {
+        *have = TRUE;
+        *min = *max = v;
+    } else {
+        if(v < *min) *min = v;
+        if(v > *max) *max = v;
+    }
+}
+
+static gdouble move_distance(const gdouble *d) {
+    gdouble dist = sqrt(d[AXIS_X] * d[AXIS_X] + d[AXIS_Y] * d[AXIS_Y] + d[AXIS_Z] * d[AXIS_Z]);
+    /* retractions take time too */
+    return dist > 0 ? dist : fabs(d[AXIS_E]);
+}
+
+static inline gboolean is_extruding(const gdouble *d) {
+    return d[AXIS_E] > 0 && (d[AXIS_X]!=0 || d[AXIS_Y]!=0);
+}
+
+static void chunk_extrude(Chunk *c, const Coord *to) {
+    for(guint a=0;a<3;a++) {
+        bounds_add(&c->have_bounds[to[a].known][a], &c->min[to[a].known][a], &c->max[to[a].known][a], to[a].v);
+    }
+
+    Coord z = to[AXIS_Z];
+    if(!c->extruded) {
+        c->extruded = TRUE;
+        c->first_extrude_z = z;
+    } else if(z.known==c->last_extrude_z.known) {
+        if(z.v > c->last_extrude_z.v + Z_EPSILON) c->layers++;
+    } else {
+        c->layer_pending = TRUE;
+        c->pending_from = c->last_extrude_z.v;
+        c->pending_to = z.v;
+    }
+    c->last_extrude_z = z;
+}
+
+static void chunk_move(Chunk *c, const OPDeskGCodeCommand *cmd) {
+    if(HAS_PARAM(cmd, 'F') && PARAM(cmd, 'F') > 0) {
+        c->feed.known = TRUE;
+        c->feed.v = PARAM(cmd, 'F');
+    }
+
+    Coord to[N_AXES];
+    gboolean boundary = FALSE;
+    for(guint a=0;a<N_AXES;a++) {
+        to[a] = c->pos[a];
+        if(!HAS_PARAM(cmd, axis_letters[a])) continue;
+
+        gdouble v = PARAM(cmd, axis_letters[a]);
+        if(a==AXIS_E ? c->modes.relative_e : c->modes.relative) {
+            to[a].v += v;
+        } else {
+            if(!to[a].known) boundary = TRUE;
+            to[a].known = TRUE;
+            to[a].v = v;
+        }
+    }
+
+    if(boundary) {
+        BoundaryMove *b = &c->boundary[c->n_boundary++];
+        memcpy(b->from, c->pos, sizeof(b->from));
+        memcpy(b->to, to, sizeof(b->to));
+        b->feed = c->feed;
+    } else {
+        gdouble d[N_AXES];
+        for(guint a=0;a<N_AXES;a++) d[a] = to[a].v - c->pos[a].v;
+
+        gdouble dist = move_distance(d);
+        if(c->feed.known) c->time += dist / c->feed.v * 60.0;
+        else c->unknown_feed_distance += dist;
+        c->filament += d[AXIS_E];
+
+        if(is_extruding(d)) chunk_extrude(c, to);
+    }
+
+    memcpy(c->pos, to, sizeof(c->pos));
+}
+
+static void chunk_line(Chunk *c, const char *p, const char *end) {
+    OPDeskGCodeCommand cmd;
+
+    if(p < end && *p==';') {
+        if(opdesk_gcode_is_layer_comment(p, end)) c->layer_comments++;
+        return;
+    }
+    if(!opdesk_gcode_parse_command(p, end, &cmd)) return;
+
+    if(cmd.letter=='G') {
+        switch(cmd.code) {
+        case 0:
+        case 1:
+        /* arcs are measured as straight lines */
+        case 2:
+        case 3:
+            chunk_move(c, &cmd);
+            break;
+        case 4:
+            if(HAS_PARAM(&cmd, 'P')) c->time += PARAM(&cmd, 'P') / 1000.0;
+            else if(HAS_PARAM(&cmd, 'S')) c->time += PARAM(&cmd, 'S');
+            break;
+        case 28: {
+            gboolean all = !(cmd.seen & (PARAM_BIT('X') | PARAM_BIT('Y') | PARAM_BIT('Z')));
+            for(guint a=0;a<3;a++) {
+                if(all || HAS_PARAM(&cmd, axis_letters[a])) {
+                    c->pos[a].known = TRUE;
+                    c->pos[a].v = 0;
+                }
+            }
+            break;
+        }
+        case 90:
+            c->modes.relative = FALSE;
+            c->modes.relative_e = FALSE;
+            break;
+        case 91:
+            c->modes.relative = TRUE;
+            c->modes.relative_e = TRUE;
+            break;
+        case 92: {
+            gboolean all = !(cmd.seen & (PARAM_BIT('X') | PARAM_BIT('Y') | PARAM_BIT('Z') | PARAM_BIT('E')));
+            for(guint a=0;a<N_AXES;a++) {
+                if(all || HAS_PARAM(&cmd, axis_letters[a])) {
+                    c->pos[a].known = TRUE;
+                    c->pos[a].v = all ? 0 : PARAM(&cmd, axis_letters[a]);
+                }
+            }
+            break;
+        }
+        }
+    } else {
+        switch(cmd.code) {
+        case 82:
+            c->modes.relative_e = FALSE;
+            break;
+        case 83:
+            c->modes.relative_e = TRUE;
+            break;
+        case 104:
+        case 109:
+            if(HAS_PARAM(&cmd, 'S')) c->max_tool_temp = MAX(c->max_tool_temp, PARAM(&cmd, 'S'));
+            if(HAS_PARAM(&cmd, 'R')) c->max_tool_temp = MAX(c->max_tool_temp, PARAM(&cmd, 'R'));
+            break;
+        case 140:
+        case 190:
+            if(HAS_PARAM(&cmd, 'S')) c->max_bed_temp = MAX(c->max_bed_temp, PARAM(&cmd, 'S'));
+            if(HAS_PARAM(&cmd, 'R')) c->max_bed_temp = MAX(c->max_bed_temp, PARAM(&cmd, 'R'));
+            break;
+        }
+    }
+}
+
+static void chunk_reset(Chunk *c, Modes modes) {
+    const char *start = c->start;
+    const char *end = c->end;
+    GCancellable *cancellable = c->cancellable;
+
+    memset(c, 0, sizeof(Chunk));
+    c->start = start;
+    c->end = end;
+    c->cancellable = cancellable;
+    c->start_modes = modes;
+    c->modes = modes;
+}
+
+static gpointer chunk_scan(gpointer data) {
+    Chunk *c = data;
+    const char *p = c->start;
+
+    while(p < c->end) {
+        /* memchr is vectorized by the C library, far faster than looking at every byte here */
+        const char *eol = memchr(p, '\n', c->end - p);
+        if(!eol) eol = c->end;
+
+        c->lines++;
+        chunk_line(c, p, eol);
+        p = eol + 1;
+
+        if((c->lines & 0xffff)==0 && g_cancellable_is_cancelled(c->cancellable)) break;
+    }
+
+    return NULL;
+}
+
+/* The modes the start G-code leaves the printer in, up to the first extruding move.
+   Every chunk but the first starts out assuming these, see opdesk_gcode_analyze_data */
+static Modes scan_header_modes(const char *data, gsize length) {
+    Modes modes = { FALSE, FALSE };
+    const char *end = data + MIN(length, HEADER_SCAN_SIZE);
+    const char *p = data;
+    OPDeskGCodeCommand cmd;
+
+    while(p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if(!eol) eol = end;
+
+        if(opdesk_gcode_parse_command(p, eol, &cmd)) {
+            if(cmd.letter=='G' && cmd.code==90) modes.relative = modes.relative_e = FALSE;
+            else if(cmd.letter=='G' && cmd.code==91) modes.relative = modes.relative_e = TRUE;
+            else if(cmd.letter=='M' && cmd.code==82) modes.relative_e = FALSE;
+            else if(cmd.letter=='M' && cmd.code==83) modes.relative_e = TRUE;
+            else if(cmd.letter=='G' && cmd.code <= 1 && HAS_PARAM(&cmd, 'E') &&
+                    (HAS_PARAM(&cmd, 'X') || HAS_PARAM(&cmd, 'Y'))) break;
+        }
+        p = eol + 1;
+    }
+
+    return modes;
+}
+
+/* Chunks are folded in file order, each resolved against where the one before left off */
+static void merge_chunks(OPDeskGCodeAnalysis *analysis, Chunk *chunks, guint n_chunks) {
+    gdouble pos[N_AXES] = { 0, 0, 0, 0 };
+    gdouble feed = DEFAULT_FEED;
+    gboolean have_bounds[3] = { FALSE, FALSE, FALSE };
+    gboolean extruded = FALSE;
+    gdouble last_z = 0;
+    guint layers = 0;
+    guint layer_comments = 0;
+
+    for(guint i=0;i<n_chunks;i++) {
+        Chunk *c = &chunks[i];
+
+        analysis->lines += c->lines;
+        analysis->print_time += c->time + c->unknown_feed_distance / feed * 60.0;
+        analysis->filament += c->filament;
+        analysis->max_tool_temp = MAX(analysis->max_tool_temp, c->max_tool_temp);
+        analysis->max_bed_temp = MAX(analysis->max_bed_temp, c->max_bed_temp);
+        layer_comments += c->layer_comments;
+
+        for(guint m=0;m<c->n_boundary;m++) {
+            BoundaryMove *b = &c->boundary[m];
+            gdouble d[N_AXES];
+            for(guint a=0;a<N_AXES;a++) d[a] = resolve(b->to[a], pos[a]) - resolve(b->from[a], pos[a]);
+
+            analysis->print_time += move_distance(d) / (b->feed.known ? b->feed.v : feed) * 60.0;
+            analysis->filament += d[AXIS_E];
+            if(is_extruding(d)) {
+                for(guint a=0;a<3;a++) {
+                    bounds_add(&have_bounds[a], &analysis->min[a], &analysis->max[a], resolve(b->to[a], pos[a]));
+                }
+            }
+        }
+
+        for(guint a=0;a<3;a++) {
+            if(c->have_bounds[TRUE][a]) {
+                bounds_add(&have_bounds[a], &analysis->min[a], &analysis->max[a], c->min[TRUE][a]);
+                bounds_add(&have_bounds[a], &analysis->min[a], &analysis->max[a], c->max[TRUE][a]);
+            }
+            if(c->have_bounds[FALSE][a]) {
+                bounds_add(&have_bounds[a], &analysis->min[a], &analysis->max[a], c->min[FALSE][a] + pos[a]);
+                bounds_add(&have_bounds[a], &analysis->min[a], &analysis->max[a], c->max[FALSE][a] + pos[a]);
+            }
+        }
+
+        if(c->extruded) {
+            gdouble first_z = resolve(c->first_extrude_z, pos[AXIS_Z]);
+            if(!extruded) layers = 1;
+            else if(first_z > last_z + Z_EPSILON) layers++;
+            layers += c->layers;
+            if(c->layer_pending && c->pending_to > pos[AXIS_Z] + c->pending_from + Z_EPSILON) layers++;
+
+            last_z = resolve(c->last_extrude_z, pos[AXIS_Z]);
+            extruded = TRUE;
+        }
+
+        for(guint a=0;a<N_AXES;a++) pos[a] = resolve(c->pos[a], pos[a]);
+        if(c->feed.known) feed = c->feed.v;
+    }
+
+    analysis->have_bounds = have_bounds[AXIS_X] && have_bounds[AXIS_Y] && have_bounds[AXIS_Z];
+    /* slicer layer markers are exact, Z steps also count vase mode and non-planar moves */
+    analysis->layers = layer_comments ? layer_comments : layers;
+}
+
+OPDeskGCodeAnalysis *opdesk_gcode_analyze_data(const char *data, gsize length, guint threads, GCancellable *cancellable) {
+    if(threads==0) threads = g_get_num_processors();
+    guint n_chunks = CLAMP(length / MIN_CHUNK_SIZE, 1, threads);
+
+    Chunk *chunks = g_new0(Chunk, n_chunks);
+    const char *end = data + length;
+    const char *p = data;
+    for(guint i=0;i<n_chunks;i++) {
+        chunks[i].start = p;
+        chunks[i].cancellable = cancellable;
+        if(i==n_chunks - 1) {
+            p = end;
+        } else {
+            p = MAX(p, data + length / n_chunks * (i + 1));
+            const char *eol = memchr(p, '\n', end - p);
+            p = eol ? eol + 1 : end;
+        }
+        chunks[i].end = p;
+    }
+
+    /* Positioning modes change how every move is read, but a chunk only learns them from the one
+       before it. Chunks are scanned in parallel assuming the start G-code's modes and any chunk that
+       guessed wrong, ie. after a G91 that wasn't undone, is scanned again once the one before is done. */
+    Modes header_modes = scan_header_modes(data, length);
+    Modes default_modes = { FALSE, FALSE };
+    GThread **workers = g_new0(GThread*, n_chunks);
+    for(guint i=0;i<n_chunks;i++) {
+        chunk_reset(&chunks[i], i==0 ? default_modes : header_modes);
+        if(i > 0) workers[i] = g_thread_new("gcode-analyzer", chunk_scan, &chunks[i]);
+    }
+    chunk_scan(&chunks[0]);
+    for(guint i=1;i<n_chunks;i++) g_thread_join(workers[i]);
+    g_free(workers);
+
+    for(guint i=1;i<n_chunks && !g_cancellable_is_cancelled(cancellable);i++) {
+        Modes entry = chunks[i - 1].modes;
+        if(entry.relative!=chunks[i].start_modes.relative || entry.relative_e!=chunks[i].start_modes.relative_e) {
+            g_debug("Chunk %u started in the wrong positioning mode, scanning it again", i);
+            chunk_reset(&chunks[i], entry);
+            chunk_scan(&chunks[i]);
+        }
+    }
+
+    if(g_cancellable_is_cancelled(cancellable)) {
+        g_free(chunks);
+        return NULL;
+    }
+
+    OPDeskGCodeAnalysis *analysis = g_new0(OPDeskGCodeAnalysis, 1);
+    merge_chunks(analysis, chunks, n_chunks);
+    g_free(chunks);
+
+    return analysis;
+}
+
+OPDeskGCodeAnalysis *opdesk_gcode_analyze_file(const char *filename, GCancellable *cancellable, GError **error) {
+    GMappedFile *mapped = g_mapped_file_new(filename, FALSE, error);
+    if(!mapped) return NULL;
+
+    gint64 start = g_get_monotonic_time();
+    OPDeskGCodeAnalysis *analysis = opdesk_gcode_analyze_data(g_mapped_file_get_contents(mapped),
+        g_mapped_file_get_length(mapped), 0, cancellable);
+    if(analysis) {
+        g_debug("Analyzed %s, %" G_GUINT64_FORMAT " lines in %0.3fs", filename, analysis->lines,
+            (g_get_monotonic_time() - start) / (gdouble)G_USEC_PER_SEC);
+    } else {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Analysis cancelled");
+    }
+
+    g_mapped_file_unref(mapped);
+    return analysis;
+}
+
+static void analyze_file_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    GError *err = NULL;
+    OPDeskGCodeAnalysis *analysis = opdesk_gcode_analyze_file(task_data, cancellable, &err);
+    if(analysis) g_task_return_pointer(task, analysis, g_free);
+    else g_task_return_error(task, err);
+}
+
+void opdesk_gcode_analyze_file_async(GFile *file, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data) {
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    char *path = g_file_get_path(file);
+    if(!path) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Only local files can be analyzed");
+        g_object_unref(task);
+        return;
+    }
+
+    g_task_set_task_data(task, path, g_free);
+    g_task_run_in_thread(task, analyze_file_thread);
+    g_object_unref(task);
+}
+
+OPDeskGCodeAnalysis *opdesk_gcode_analyze_file_finish(GAsyncResult *result, GError **error) {
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+char *opdesk_gcode_analysis_to_string(const OPDeskGCodeAnalysis *analysis) {
+    GString *str = g_string_new(NULL);
+    guint64 minutes = (guint64)(analysis->print_time / 60.0 + 0.5);
+
+    if(minutes >= 60) g_string_append_printf(str, "Print time: %" G_GUINT64_FORMAT "h %02" G_GUINT64_FORMAT "m (estimate)\n", minutes / 60, minutes % 60);
+    else g_string_append_printf(str, "Print time: %" G_GUINT64_FORMAT "m (estimate)\n", minutes);
+    g_string_append_printf(str, "Filament: %0.2fm\n", analysis->filament / 1000.0);
+    g_string_append_printf(str, "Layers: %u\n", analysis->layers);
+    if(analysis->have_bounds) {
+        g_string_append_printf(str, "Size: %0.1f x %0.1f x %0.1fmm\n",
+            analysis->max[0] - analysis->min[0], analysis->max[1] - analysis->min[1], analysis->max[2] - analysis->min[2]);
+    }
+    g_string_append_printf(str, "Max temperatures: %0.0f°C tool, %0.0f°C bed", analysis->max_tool_temp, analysis->max_bed_temp);
+
+    return g_string_free(str, FALSE);
+}
@@ -0,0 +1,52 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Summary of a local G-code file, see opdesk_gcode_analyze_file.
+   The print time is the sum of move distance / feed rate plus dwells, acceleration and
+   heat up time aren't accounted for. Bounds cover extruding moves only. */
+typedef struct {
+    guint64 lines;
+    /* seconds */
+    gdouble print_time;
+    /* mm of filament, net of retractions, all extruders */
+    gdouble filament;
+    guint layers;
+    gboolean have_bounds;
+    gdouble min[3];
+    gdouble max[3];
+    gdouble max_tool_temp;
+    gdouble max_bed_temp;
+} OPDeskGCodeAnalysis;
+
+/* Scans data on up to threads worker threads (0 for one per processor).
+   Returns a new analysis, free with g_free. NULL only if cancelled */
+OPDeskGCodeAnalysis *opdesk_gcode_analyze_data(const char *data, gsize length, guint threads, GCancellable *cancellable);
+/* Maps the file and analyzes it, blocks until done */
+OPDeskGCodeAnalysis *opdesk_gcode_analyze_file(const char *filename, GCancellable *cancellable, GError **error);
+
+/* The same, on a worker thread. file must be local */
+void opdesk_gcode_analyze_file_async(GFile *file, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+OPDeskGCodeAnalysis *opdesk_gcode_analyze_file_finish(GAsyncResult *result, GError **error);
+
+/* human readable, one value per line */
+char *opdesk_gcode_analysis_to_string(const OPDeskGCodeAnalysis *analysis);
+
+G_END_DECLS
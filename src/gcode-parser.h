@@ -0,0 +1,131 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <glib.h>
+#include <string.h>
+
+G_BEGIN_DECLS
+
+/* The G-code line parser shared by the analyzer and toolpath loader. Inline, it runs once per line
+   of files with tens of millions of lines. */
+
+typedef struct {
+    char letter;
+    gint code;
+    /* one bit per parameter letter, value[] is only set for those */
+    guint32 seen;
+    gdouble value[26];
+} OPDeskGCodeCommand;
+
+#define OPDESK_GCODE_PARAM_BIT(l) (1u << ((l) - 'A'))
+#define OPDESK_GCODE_HAS_PARAM(cmd, l) ((cmd)->seen & OPDESK_GCODE_PARAM_BIT(l))
+#define OPDESK_GCODE_PARAM(cmd, l) ((cmd)->value[(l) - 'A'])
+
+static const gdouble opdesk_gcode_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+};
+
+/* Plain decimals only, which is all a slicer writes. Much cheaper than g_ascii_strtod
+   and doesn't need a terminated string */
+static inline const char *opdesk_gcode_parse_number(const char *p, const char *end, gdouble *out) {
+    gboolean negative = FALSE;
+    if(p < end && (*p=='-' || *p=='+')) {
+        negative = *p=='-';
+        p++;
+    }
+
+    guint64 mantissa = 0;
+    guint digits = 0;
+    gint scale = 0;
+    while(p < end && *p >= '0' && *p <= '9') {
+        if(digits < 18) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits++;
+        } else {
+            scale--;
+        }
+        p++;
+    }
+    if(p < end && *p=='.') {
+        p++;
+        while(p < end && *p >= '0' && *p <= '9') {
+            if(digits < 18) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits++;
+                scale++;
+            }
+            p++;
+        }
+    }
+
+    gdouble v = (gdouble)mantissa;
+    if(scale > 0) v /= opdesk_gcode_powers_of_ten[scale];
+    else if(scale < 0) v *= opdesk_gcode_powers_of_ten[MIN(-scale, 18)];
+    *out = negative ? -v : v;
+    return p;
+}
+
+/* FALSE for anything but a G or M command. Line numbers and checksums are skipped */
+static inline gboolean opdesk_gcode_parse_command(const char *p, const char *end, OPDeskGCodeCommand *cmd) {
+    while(p < end && (*p==' ' || *p=='\t')) p++;
+    if(p < end && (*p=='N' || *p=='n')) {
+        p++;
+        while(p < end && *p!=' ' && *p!='\t') p++;
+        while(p < end && (*p==' ' || *p=='\t')) p++;
+    }
+    if(p >= end) return FALSE;
+
+    cmd->letter = *p & ~0x20;
+    if(cmd->letter!='G' && cmd->letter!='M') return FALSE;
+    p++;
+
+    cmd->code = 0;
+    if(p >= end || *p < '0' || *p > '9') return FALSE;
+    while(p < end && *p >= '0' && *p <= '9') {
+        cmd->code = cmd->code * 10 + (*p - '0');
+        p++;
+    }
+    /* subcodes, G29.1 */
+    if(p < end && *p=='.') {
+        p++;
+        while(p < end && *p >= '0' && *p <= '9') p++;
+    }
+
+    cmd->seen = 0;
+    while(p < end) {
+        char c = *p & ~0x20;
+        if(*p==';' || *p=='*') break;
+        if(c >= 'A' && c <= 'Z') {
+            p = opdesk_gcode_parse_number(p + 1, end, &cmd->value[c - 'A']);
+            cmd->seen |= OPDESK_GCODE_PARAM_BIT(c);
+        } else {
+            p++;
+        }
+    }
+
+    return TRUE;
+}
+
+static inline gboolean opdesk_gcode_is_layer_comment(const char *p, const char *end) {
+    gsize len = end - p;
+    /* Cura writes ;LAYER:n, PrusaSlicer and its forks ;LAYER_CHANGE */
+    return (len >= 7 && memcmp(p, ";LAYER:", 7)==0) ||
+           (len >= 13 && memcmp(p, ";LAYER_CHANGE", 13)==0);
+}
+
+G_END_DECLS
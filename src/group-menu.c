@@ -0,0 +1,139 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-group-menu"
+#include <glib.h>
+
+#include "group-menu.h"
+#include "server-menu.h"
+
+struct _OPDeskGroupMenu {
+    GtkMenuItem parent_inst;
+
+    char *name;
+    GPtrArray *servers;
+
+    guint idle_timeout;
+    guint idle_source;
+
+    GtkWidget *submenu;
+};
+
+G_DEFINE_TYPE(OPDeskGroupMenu, opdesk_group_menu, GTK_TYPE_MENU_ITEM);
+
+static void opdesk_group_menu_dispose(GObject *object) {
+    OPDeskGroupMenu *self = OPDESK_GROUP_MENU(object);
+
+    if(self->idle_source) {
+        g_source_remove(self->idle_source);
+        self->idle_source = 0;
+    }
+
+    G_OBJECT_CLASS(opdesk_group_menu_parent_class)->dispose(object);
+}
+
+static void opdesk_group_menu_finalize(GObject *object) {
+    OPDeskGroupMenu *self = OPDESK_GROUP_MENU(object);
+
+    g_free(self->name);
+    g_ptr_array_unref(self->servers);
+    G_OBJECT_CLASS(opdesk_group_menu_parent_class)->finalize(object);
+}
+
+static void opdesk_group_menu_class_init(OPDeskGroupMenuClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_group_menu_dispose;
+    object_class->finalize = opdesk_group_menu_finalize;
+}
+
+static void clear_submenu_destroy_item(GtkWidget *widget, gpointer data) {
+    gtk_widget_destroy(widget);
+}
+
+static gboolean on_submenu_idle_timeout(OPDeskGroupMenu *menu) {
+    g_debug("Destroying unused menus for group %s", menu->name);
+    menu->idle_source = 0;
+    gtk_container_foreach(GTK_CONTAINER(menu->submenu), clear_submenu_destroy_item, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_submenu_show(GtkWidget *submenu, OPDeskGroupMenu *menu) {
+    if(menu->idle_source) {
+        g_source_remove(menu->idle_source);
+        menu->idle_source = 0;
+    }
+
+    GList *children = gtk_container_get_children(GTK_CONTAINER(submenu));
+    if(!children) {
+        g_debug("Building menus for group %s", menu->name);
+        for(guint s=0;s<menu->servers->len;s++) {
+            OPDeskServerMenu *smi = opdesk_server_menu_new(g_ptr_array_index(menu->servers, s), menu->idle_timeout);
+            gtk_menu_shell_append(GTK_MENU_SHELL(submenu), GTK_WIDGET(smi));
+        }
+        gtk_widget_show_all(submenu);
+    }
+    g_list_free(children);
+}
+
+static void on_submenu_hide(GtkWidget *submenu, OPDeskGroupMenu *menu) {
+    if(!menu->idle_timeout || menu->idle_source) return;
+    menu->idle_source = g_timeout_add_seconds(menu->idle_timeout, G_SOURCE_FUNC(on_submenu_idle_timeout), menu);
+}
+
+static void opdesk_group_menu_init(OPDeskGroupMenu *menu) {
+    menu->servers = g_ptr_array_new_with_free_func(g_object_unref);
+
+    menu->submenu = gtk_menu_new();
+    gtk_menu_item_set_submenu(GTK_MENU_ITEM(menu), menu->submenu);
+    g_signal_connect(menu->submenu, "show", G_CALLBACK(on_submenu_show), menu);
+    g_signal_connect(menu->submenu, "hide", G_CALLBACK(on_submenu_hide), menu);
+}
+
+OPDeskGroupMenu *opdesk_group_menu_new(const char *name, guint idle_timeout) {
+    OPDeskGroupMenu *menu = g_object_new(OPDESK_TYPE_GROUP_MENU, NULL);
+    menu->name = g_strdup(name);
+    menu->idle_timeout = idle_timeout;
+    gtk_menu_item_set_label(GTK_MENU_ITEM(menu), name);
+
+    return menu;
+}
+
+const char *opdesk_group_menu_get_name(OPDeskGroupMenu *menu) {
+    return menu->name;
+}
+
+void opdesk_group_menu_add_server(OPDeskGroupMenu *menu, OPDeskServer *server) {
+    g_ptr_array_add(menu->servers, g_object_ref(server));
+}
+
+void opdesk_group_menu_refresh_label(OPDeskGroupMenu *menu) {
+    guint printing = 0;
+    guint offline = 0;
+
+    for(guint s=0;s<menu->servers->len;s++) {
+        OPDeskServer *server = g_ptr_array_index(menu->servers, s);
+        if(opdesk_server_is_printing(server)) printing++;
+        else if(!opdesk_server_is_operational(server)) offline++;
+    }
+
+    char *lbl;
+    if(offline) lbl = g_strdup_printf("%s (%u/%u printing, %u offline)", menu->name, printing, menu->servers->len, offline);
+    else lbl = g_strdup_printf("%s (%u/%u printing)", menu->name, printing, menu->servers->len);
+    gtk_menu_item_set_label(GTK_MENU_ITEM(menu), lbl);
+    g_free(lbl);
+}
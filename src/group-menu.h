@@ -0,0 +1,37 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gtk/gtk.h>
+
+#include "server.h"
+
+G_BEGIN_DECLS
+
+/* A menu item for servers sharing a config 'group', server menus are only created while the group is open */
+#define OPDESK_TYPE_GROUP_MENU (opdesk_group_menu_get_type())
+G_DECLARE_FINAL_TYPE(OPDeskGroupMenu, opdesk_group_menu, OPDESK, GROUP_MENU, GtkMenuItem)
+
+OPDeskGroupMenu *opdesk_group_menu_new(const char *name, guint idle_timeout);
+
+const char *opdesk_group_menu_get_name(OPDeskGroupMenu *menu);
+
+void opdesk_group_menu_add_server(OPDeskGroupMenu *menu, OPDeskServer *server);
+
+/* update the summary shown in the label, ie. 'Farm A (2/10 printing)' */
+void opdesk_group_menu_refresh_label(OPDeskGroupMenu *menu);
+
+G_END_DECLS
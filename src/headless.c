@@ -0,0 +1,123 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-headless"
+#include <glib.h>
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#endif
+
+#include "headless.h"
+#include "core.h"
+
+struct _OPDeskHeadless {
+    GApplication parent_instance;
+
+    OPDeskOptions options;
+    OPDeskCore *core;
+
+    guint sigint_source;
+    guint sigterm_source;
+};
+
+G_DEFINE_TYPE(OPDeskHeadless, opdesk_headless, G_TYPE_APPLICATION)
+
+OPDeskHeadless *opdesk_headless_new() {
+    return g_object_new(OPDESK_TYPE_HEADLESS,
+                        "application-id", "io.github.the-eg.octoprint-desktop",
+                        "flags", G_APPLICATION_NON_UNIQUE,
+                        NULL);
+}
+
+static void opdesk_headless_finalize(GObject *object) {
+    OPDeskHeadless *headless = OPDESK_HEADLESS(object);
+
+    opdesk_options_clear(&headless->options);
+
+    G_OBJECT_CLASS(opdesk_headless_parent_class)->finalize(object);
+}
+
+static void opdesk_headless_class_init(OPDeskHeadlessClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->finalize = opdesk_headless_finalize;
+}
+
+#ifdef G_OS_UNIX
+static gboolean on_quit_signal(OPDeskHeadless *headless) {
+    g_message("Signal received, shutting down");
+
+    // returning G_SOURCE_REMOVE only removes the source that fired, so the release below happens once
+    guint fired = g_source_get_id(g_main_current_source());
+    if(headless->sigint_source && headless->sigint_source!=fired) g_source_remove(headless->sigint_source);
+    if(headless->sigterm_source && headless->sigterm_source!=fired) g_source_remove(headless->sigterm_source);
+    headless->sigint_source = 0;
+    headless->sigterm_source = 0;
+    g_application_release(G_APPLICATION(headless));
+    return G_SOURCE_REMOVE;
+}
+#endif
+
+static gint opdesk_headless_handle_local_options(OPDeskHeadless *headless, GVariantDict *options, gpointer user_data) {
+    return opdesk_options_handle_local(&headless->options, G_APPLICATION(headless));
+}
+
+static void opdesk_headless_activate(OPDeskHeadless *headless, gpointer user_data) {
+    // nothing to show, running is all there is
+}
+
+static void opdesk_headless_startup(OPDeskHeadless *headless, gpointer user_data) {
+    g_message("----------------------------------------------------");
+    g_message("   OctoPrint Desktop Application Startup (headless) ");
+    g_message("----------------------------------------------------");
+
+    // there's no window or tray icon keeping the application alive
+    g_application_hold(G_APPLICATION(headless));
+
+    headless->core = opdesk_core_new(G_APPLICATION(headless), headless->options.config_path);
+    opdesk_core_add_actions(headless->core, G_ACTION_MAP(headless));
+    if(!g_application_get_dbus_connection(G_APPLICATION(headless))) {
+        opdesk_notification_scheduler_set_log_only(opdesk_core_get_notification_scheduler(headless->core), TRUE);
+    }
+
+#ifdef G_OS_UNIX
+    headless->sigint_source = g_unix_signal_add(SIGINT, G_SOURCE_FUNC(on_quit_signal), headless);
+    headless->sigterm_source = g_unix_signal_add(SIGTERM, G_SOURCE_FUNC(on_quit_signal), headless);
+#endif
+}
+
+static void opdesk_headless_shutdown(OPDeskHeadless *headless, gpointer user_data) {
+    if(headless->sigint_source) g_source_remove(headless->sigint_source);
+    if(headless->sigterm_source) g_source_remove(headless->sigterm_source);
+    headless->sigint_source = 0;
+    headless->sigterm_source = 0;
+
+    g_clear_object(&headless->core);
+
+    g_message("----------------------------------------------------");
+    g_message("       OctoPrint Desktop Application Shutdown       ");
+    g_message("----------------------------------------------------");
+}
+
+static void opdesk_headless_init(OPDeskHeadless *headless) {
+    g_signal_connect(headless, "activate", G_CALLBACK(opdesk_headless_activate), NULL);
+    g_signal_connect(headless, "startup", G_CALLBACK(opdesk_headless_startup), NULL);
+    g_signal_connect(headless, "shutdown", G_CALLBACK(opdesk_headless_shutdown), NULL);
+    g_signal_connect(headless, "handle-local-options", G_CALLBACK(opdesk_headless_handle_local_options), NULL);
+
+    opdesk_options_add_entries(&headless->options, G_APPLICATION(headless));
+}
@@ -0,0 +1,29 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* --headless: the core on a plain GApplication, no display, tray or GTK. Notifications are logged
+   when there is no session bus to send them to. SIGINT/SIGTERM quit */
+#define OPDESK_TYPE_HEADLESS (opdesk_headless_get_type())
+G_DECLARE_FINAL_TYPE(OPDeskHeadless, opdesk_headless, OPDESK, HEADLESS, GApplication)
+
+OPDeskHeadless *opdesk_headless_new();
+
+G_END_DECLS
@@ -1,11 +1,27 @@
+#include <string.h>
+
+#include "headless.h"
+#ifdef OPD_GUI
 #include "app.h"
+#endif
 
 int main(int argc, char *argv[]) {
+    // decided before any GTK is initialized, the option itself is parsed with the others
+    gboolean headless = FALSE;
+    for(int a=1;a<argc;a++) {
+        if(strcmp(argv[a], "--headless")==0) headless = TRUE;
+    }
+
+    GApplication *app;
+#ifdef OPD_GUI
+    if(!headless) app = G_APPLICATION(opdesk_app_new());
+    else
+#endif
+    app = G_APPLICATION(opdesk_headless_new());
 
-    OPDeskApp *app = opdesk_app_new();
-    int res = g_application_run(G_APPLICATION(app), argc, argv);
+    int res = g_application_run(app, argc, argv);
 
     g_object_unref(app);
 
     return res;
-}
\ No newline at end of file
+}
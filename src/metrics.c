@@ -0,0 +1,399 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-metrics"
+#include <glib.h>
+#include <string.h>
+#include <libsoup/soup.h>
+
+#include "metrics.h"
+
+#define ADDRESS_DEFAULT "127.0.0.1"
+#define MAX_HEATERS 8
+#define HEATER_NAME_LEN 16
+
+// everything read by the listener thread is a gint or gsize read with atomics
+typedef struct {
+    OPDeskServerStats stats;
+
+    gint connected;
+    gint operational;
+    gint printing;
+    gint paused;
+    gint error;
+    // 1/10000ths, -1 without a job
+    gint progress;
+    gint time_left;
+
+    // names are written before n_heaters is raised to include them, and never change
+    gint n_heaters;
+    struct {
+        char name[HEATER_NAME_LEN];
+        // 1/100ths of a degree
+        gint actual;
+        gint target;
+    } heaters[MAX_HEATERS];
+
+    // set before n_printers includes this slot, main thread only past that
+    char *name;
+    OPDeskServer *server;
+} OPDeskMetricsPrinter;
+
+struct _OPDeskMetrics {
+    GObject parent_instance;
+
+    OPDeskMetricsPrinter *printers;
+    guint max_printers;
+    gint n_printers;
+
+    OctoPrintHistogram ui;
+
+    SoupServer *soup_server;
+    GMainContext *context;
+    GMainLoop *loop;
+    GThread *thread;
+};
+
+G_DEFINE_TYPE (OPDeskMetrics, opdesk_metrics, G_TYPE_OBJECT)
+
+static void opdesk_metrics_dispose(GObject *object) {
+    OPDeskMetrics *self = OPDESK_METRICS(object);
+
+    // nothing reads the slots once the thread is gone
+    if(self->thread) {
+        g_main_loop_quit(self->loop);
+        g_thread_join(self->thread);
+        self->thread = NULL;
+    }
+    if(self->soup_server) {
+        soup_server_disconnect(self->soup_server);
+        g_clear_object(&self->soup_server);
+    }
+
+    for(gint p=0;p<self->n_printers;p++) {
+        OPDeskMetricsPrinter *printer = &self->printers[p];
+        if(!printer->server) continue;
+        g_signal_handlers_disconnect_by_data(printer->server, printer);
+        opdesk_server_set_stats(printer->server, NULL);
+        printer->server = NULL;
+    }
+
+    G_OBJECT_CLASS(opdesk_metrics_parent_class)->dispose(object);
+}
+
+static void opdesk_metrics_finalize(GObject *object) {
+    OPDeskMetrics *self = OPDESK_METRICS(object);
+
+    for(gint p=0;p<self->n_printers;p++) g_free(self->printers[p].name);
+    g_free(self->printers);
+    if(self->loop) g_main_loop_unref(self->loop);
+    if(self->context) g_main_context_unref(self->context);
+
+    G_OBJECT_CLASS(opdesk_metrics_parent_class)->finalize(object);
+}
+
+static void opdesk_metrics_class_init(OPDeskMetricsClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_metrics_dispose;
+    object_class->finalize = opdesk_metrics_finalize;
+}
+
+static void opdesk_metrics_init(OPDeskMetrics *metrics) {
+}
+
+/* Scrapes, on the listener thread */
+
+static void append_double(GString *out, gdouble value) {
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+    g_string_append(out, g_ascii_formatd(buf, sizeof(buf), "%.6g", value));
+}
+
+static void append_label_value(GString *out, const char *value) {
+    for(const char *c=value;*c;c++) {
+        if(*c=='\\' || *c=='"') g_string_append_c(out, '\\');
+        if(*c=='\n') g_string_append(out, "\\n");
+        else g_string_append_c(out, *c);
+    }
+}
+
+static void append_family(GString *out, const char *name, const char *type, const char *help) {
+    g_string_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// labels are complete label pairs without braces, ie. printer="Ender 3"
+static void append_sample(GString *out, const char *name, const char *labels, gdouble value) {
+    g_string_append(out, name);
+    if(labels && *labels) g_string_append_printf(out, "{%s}", labels);
+    g_string_append_c(out, ' ');
+    append_double(out, value);
+    g_string_append_c(out, '\n');
+}
+
+static void append_histogram(GString *out, const char *name, const char *labels, OctoPrintHistogram *histogram) {
+    const char *sep = labels && *labels ? "," : "";
+    gsize cumulative = 0;
+
+    for(guint b=0;b<OCTOPRINT_HISTOGRAM_N_BUCKETS;b++) {
+        cumulative += g_atomic_pointer_get(&histogram->buckets[b]);
+        g_string_append_printf(out, "%s_bucket{%s%sle=\"", name, labels ? labels : "", sep);
+        append_double(out, octoprint_histogram_bounds[b] / (gdouble)G_USEC_PER_SEC);
+        g_string_append_printf(out, "\"} %" G_GSIZE_FORMAT "\n", cumulative);
+    }
+
+    // buckets and the count aren't read all at once, don't let +Inf come out below the others
+    gsize count = MAX(g_atomic_pointer_get(&histogram->count), cumulative);
+    g_string_append_printf(out, "%s_bucket{%s%sle=\"+Inf\"} %" G_GSIZE_FORMAT "\n", name, labels ? labels : "", sep, count);
+
+    GString *sample = g_string_new(name);
+    g_string_append(sample, "_sum");
+    append_sample(out, sample->str, labels, g_atomic_pointer_get(&histogram->sum_usec) / (gdouble)G_USEC_PER_SEC);
+    g_string_truncate(sample, strlen(name));
+    g_string_append(sample, "_count");
+    append_sample(out, sample->str, labels, count);
+    g_string_free(sample, TRUE);
+}
+
+static char *printer_labels(OPDeskMetricsPrinter *printer) {
+    GString *labels = g_string_new("printer=\"");
+    append_label_value(labels, printer->name);
+    g_string_append_c(labels, '"');
+    return g_string_free(labels, FALSE);
+}
+
+typedef enum {
+    GAUGE_CONNECTED,
+    GAUGE_OPERATIONAL,
+    GAUGE_PRINTING,
+    GAUGE_PAUSED,
+    GAUGE_ERROR,
+    N_STATE_GAUGES
+} OPDeskMetricsStateGauge;
+
+static const char *const state_gauges[N_STATE_GAUGES][2] = {
+    { "opdesk_printer_connected", "1 if connected to OctoPrint" },
+    { "opdesk_printer_operational", "1 if OctoPrint is connected to the printer" },
+    { "opdesk_printer_printing", "1 while a job is printing" },
+    { "opdesk_printer_paused", "1 while a job is paused or pausing" },
+    { "opdesk_printer_error", "1 if OctoPrint reports the printer in an error state" },
+};
+
+static gint state_gauge_value(OPDeskMetricsPrinter *printer, OPDeskMetricsStateGauge gauge) {
+    switch(gauge) {
+    case GAUGE_CONNECTED:   return g_atomic_int_get(&printer->connected);
+    case GAUGE_OPERATIONAL: return g_atomic_int_get(&printer->operational);
+    case GAUGE_PRINTING:    return g_atomic_int_get(&printer->printing);
+    case GAUGE_PAUSED:      return g_atomic_int_get(&printer->paused);
+    case GAUGE_ERROR:       return g_atomic_int_get(&printer->error);
+    default:                return 0;
+    }
+}
+
+static GString *opdesk_metrics_format(OPDeskMetrics *metrics) {
+    GString *out = g_string_sized_new(4096);
+    gint n_printers = g_atomic_int_get(&metrics->n_printers);
+    char **labels = g_new0(char*, n_printers + 1);
+    for(gint p=0;p<n_printers;p++) labels[p] = printer_labels(&metrics->printers[p]);
+
+    for(guint g=0;g<N_STATE_GAUGES;g++) {
+        append_family(out, state_gauges[g][0], "gauge", state_gauges[g][1]);
+        for(gint p=0;p<n_printers;p++) append_sample(out, state_gauges[g][0], labels[p], state_gauge_value(&metrics->printers[p], g));
+    }
+
+    append_family(out, "opdesk_printer_progress_ratio", "gauge", "Progress of the current job, -1 without one");
+    for(gint p=0;p<n_printers;p++) {
+        gint progress = g_atomic_int_get(&metrics->printers[p].progress);
+        append_sample(out, "opdesk_printer_progress_ratio", labels[p], progress < 0 ? -1 : progress / 10000.0);
+    }
+
+    append_family(out, "opdesk_printer_time_left_seconds", "gauge", "Time OctoPrint estimates is left in the current job, -1 without one");
+    for(gint p=0;p<n_printers;p++) append_sample(out, "opdesk_printer_time_left_seconds", labels[p], g_atomic_int_get(&metrics->printers[p].time_left));
+
+    append_family(out, "opdesk_printer_temperature_celsius", "gauge", "Heater temperatures");
+    append_family(out, "opdesk_printer_target_temperature_celsius", "gauge", "Heater target temperatures");
+    for(guint target=0;target<2;target++) {
+        const char *name = target ? "opdesk_printer_target_temperature_celsius" : "opdesk_printer_temperature_celsius";
+        for(gint p=0;p<n_printers;p++) {
+            OPDeskMetricsPrinter *printer = &metrics->printers[p];
+            gint n_heaters = g_atomic_int_get(&printer->n_heaters);
+            for(gint h=0;h<n_heaters;h++) {
+                GString *heater_labels = g_string_new(labels[p]);
+                g_string_append(heater_labels, ",heater=\"");
+                append_label_value(heater_labels, printer->heaters[h].name);
+                g_string_append_c(heater_labels, '"');
+                gint value = target ? g_atomic_int_get(&printer->heaters[h].target) : g_atomic_int_get(&printer->heaters[h].actual);
+                append_sample(out, name, heater_labels->str, value / 100.0);
+                g_string_free(heater_labels, TRUE);
+            }
+        }
+    }
+
+    append_family(out, "opdesk_socket_frames_total", "counter", "Websocket frames received");
+    for(gint p=0;p<n_printers;p++) append_sample(out, "opdesk_socket_frames_total", labels[p], g_atomic_pointer_get(&metrics->printers[p].stats.octoprint.frames));
+
+    append_family(out, "opdesk_socket_received_bytes_total", "counter", "Websocket bytes received");
+    for(gint p=0;p<n_printers;p++) append_sample(out, "opdesk_socket_received_bytes_total", labels[p], g_atomic_pointer_get(&metrics->printers[p].stats.octoprint.bytes));
+
+    append_family(out, "opdesk_socket_parse_seconds", "histogram", "Time spent parsing websocket frames");
+    for(gint p=0;p<n_printers;p++) append_histogram(out, "opdesk_socket_parse_seconds", labels[p], &metrics->printers[p].stats.octoprint.parse);
+
+    append_family(out, "opdesk_rest_request_seconds", "histogram", "REST request latency by endpoint, including retries");
+    for(gint p=0;p<n_printers;p++) {
+        OctoPrintStats *stats = &metrics->printers[p].stats.octoprint;
+        gint n_endpoints = g_atomic_int_get(&stats->n_endpoints);
+        for(gint e=0;e<n_endpoints;e++) {
+            GString *endpoint_labels = g_string_new(labels[p]);
+            g_string_append(endpoint_labels, ",endpoint=\"");
+            append_label_value(endpoint_labels, stats->endpoints[e].endpoint);
+            g_string_append_c(endpoint_labels, '"');
+            append_histogram(out, "opdesk_rest_request_seconds", endpoint_labels->str, &stats->endpoints[e].latency);
+            g_string_free(endpoint_labels, TRUE);
+        }
+    }
+
+    append_family(out, "opdesk_reconnects_total", "counter", "Websocket reconnect attempts");
+    for(gint p=0;p<n_printers;p++) append_sample(out, "opdesk_reconnects_total", labels[p], g_atomic_pointer_get(&metrics->printers[p].stats.reconnects));
+
+    append_family(out, "opdesk_template_renders_total", "counter", "Status, notification and G-code templates expanded");
+    for(gint p=0;p<n_printers;p++) append_sample(out, "opdesk_template_renders_total", labels[p], g_atomic_pointer_get(&metrics->printers[p].stats.template_renders));
+
+    append_family(out, "opdesk_ui_update_seconds", "histogram", "Time spent updating the tray from printer state");
+    append_histogram(out, "opdesk_ui_update_seconds", NULL, &metrics->ui);
+
+    g_strfreev(labels);
+    return out;
+}
+
+static void handle_metrics(SoupServer *server, SoupMessage *msg, const char *path, GHashTable *query, SoupClientContext *client, OPDeskMetrics *metrics) {
+    if(msg->method!=SOUP_METHOD_GET && msg->method!=SOUP_METHOD_HEAD) {
+        soup_message_set_status(msg, SOUP_STATUS_METHOD_NOT_ALLOWED);
+        return;
+    }
+
+    GString *out = opdesk_metrics_format(metrics);
+    gsize len = out->len;
+    soup_message_set_status(msg, SOUP_STATUS_OK);
+    soup_message_set_response(msg, "text/plain; version=0.0.4; charset=utf-8", SOUP_MEMORY_TAKE, g_string_free(out, FALSE), len);
+}
+
+static gpointer opdesk_metrics_thread(OPDeskMetrics *metrics) {
+    g_main_context_push_thread_default(metrics->context);
+    g_main_loop_run(metrics->loop);
+    g_main_context_pop_thread_default(metrics->context);
+    return NULL;
+}
+
+/* Slots, on the main thread */
+
+static void opdesk_metrics_update_printer(OPDeskServer *server, OPDeskMetricsPrinter *printer) {
+    g_atomic_int_set(&printer->connected, opdesk_server_is_connected(server));
+    g_atomic_int_set(&printer->operational, opdesk_server_is_operational(server));
+    g_atomic_int_set(&printer->printing, opdesk_server_is_printing(server));
+    g_atomic_int_set(&printer->paused, opdesk_server_is_paused(server));
+    g_atomic_int_set(&printer->error, opdesk_server_has_error(server));
+
+    gdouble progress = opdesk_server_get_print_progress(server);
+    g_atomic_int_set(&printer->progress, progress < 0 ? -1 : (gint)(progress * 10000));
+    g_atomic_int_set(&printer->time_left, (gint)opdesk_server_get_time_left(server));
+}
+
+static void opdesk_metrics_update_temps(OPDeskServer *server, OPDeskMetricsPrinter *printer) {
+    GList *names = opdesk_server_get_temp_names(server);
+    for(GList *name = names; name; name = name->next) {
+        gint n_heaters = printer->n_heaters;
+        gint h;
+        for(h=0;h<n_heaters;h++) {
+            if(g_strcmp0(printer->heaters[h].name, name->data)==0) break;
+        }
+        if(h==n_heaters) {
+            if(n_heaters==MAX_HEATERS) continue;
+            g_strlcpy(printer->heaters[h].name, name->data, HEATER_NAME_LEN);
+        }
+
+        float actual, target;
+        opdesk_server_get_temp(server, name->data, &actual, &target);
+        g_atomic_int_set(&printer->heaters[h].actual, (gint)(actual * 100));
+        g_atomic_int_set(&printer->heaters[h].target, (gint)(target * 100));
+        if(h==n_heaters) g_atomic_int_set(&printer->n_heaters, n_heaters + 1);
+    }
+    g_list_free(names);
+}
+
+void opdesk_metrics_add_server(OPDeskMetrics *metrics, OPDeskServer *server) {
+    if((guint)metrics->n_printers==metrics->max_printers) {
+        g_warning("No metrics slot left for %s", opdesk_config_get_printer_name(opdesk_server_get_config(server)));
+        return;
+    }
+
+    OPDeskMetricsPrinter *printer = &metrics->printers[metrics->n_printers];
+    printer->name = g_strdup(opdesk_config_get_printer_name(opdesk_server_get_config(server)));
+    printer->server = server;
+    opdesk_metrics_update_printer(server, printer);
+    opdesk_metrics_update_temps(server, printer);
+    g_atomic_int_set(&metrics->n_printers, metrics->n_printers + 1);
+
+    g_signal_connect(server, "state-updated", G_CALLBACK(opdesk_metrics_update_printer), printer);
+    g_signal_connect(server, "temps-updated", G_CALLBACK(opdesk_metrics_update_temps), printer);
+
+    opdesk_server_set_stats(server, &printer->stats);
+}
+
+OctoPrintHistogram *opdesk_metrics_get_ui_histogram(OPDeskMetrics *metrics) {
+    return &metrics->ui;
+}
+
+OPDeskMetrics *opdesk_metrics_new(OPDeskAppConfig *config, guint n_servers) {
+    guint port = opdesk_app_config_get_int(config, "metrics.port", 0);
+    if(!port) return NULL;
+    const char *address = opdesk_app_config_get_string(config, "metrics.address", ADDRESS_DEFAULT);
+
+    GInetAddress *inet_address = g_inet_address_new_from_string(address);
+    if(!inet_address) {
+        g_warning("Not serving metrics, metrics.address %s isn't an IP address", address);
+        return NULL;
+    }
+
+    OPDeskMetrics *metrics = g_object_new(OPDESK_TYPE_METRICS, NULL);
+    metrics->max_printers = n_servers;
+    metrics->printers = g_new0(OPDeskMetricsPrinter, MAX(n_servers, 1));
+    metrics->context = g_main_context_new();
+    metrics->loop = g_main_loop_new(metrics->context, FALSE);
+
+    // the listening socket and every connection belong to the thread's context
+    g_main_context_push_thread_default(metrics->context);
+    metrics->soup_server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "octoprint-desktop ", NULL);
+    soup_server_add_handler(metrics->soup_server, "/metrics", (SoupServerCallback)handle_metrics, metrics, NULL);
+
+    GSocketAddress *socket_address = g_inet_socket_address_new(inet_address, port);
+    GError *err = NULL;
+    gboolean listening = soup_server_listen(metrics->soup_server, socket_address, 0, &err);
+    g_object_unref(socket_address);
+    g_object_unref(inet_address);
+    g_main_context_pop_thread_default(metrics->context);
+
+    if(!listening) {
+        g_warning("Unable to serve metrics on %s:%u: %s", address, port, err->message);
+        g_error_free(err);
+        g_object_unref(metrics);
+        return NULL;
+    }
+
+    metrics->thread = g_thread_new("opdesk-metrics", (GThreadFunc)opdesk_metrics_thread, metrics);
+    g_message("Serving metrics on http://%s:%u/metrics", address, port);
+
+    return metrics;
+}
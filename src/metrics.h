@@ -0,0 +1,42 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <glib-object.h>
+
+#include "config.h"
+#include "server.h"
+#include "octoprint/stats.h"
+
+G_BEGIN_DECLS
+
+/* An optional HTTP listener serving /metrics in the Prometheus text format: printer state, temperatures
+   and progress plus internal counters. Every value lives in a slot allocated up front and updated with
+   atomics on the main thread, the listener has its own thread and main context so scrapes never wait
+   on, or allocate from, the main thread. */
+#define OPDESK_TYPE_METRICS opdesk_metrics_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskMetrics, opdesk_metrics, OPDESK, METRICS, GObject)
+
+/* NULL if metrics.port isn't set or the port can't be opened. Slots for up to n_servers are allocated here */
+OPDeskMetrics *opdesk_metrics_new(OPDeskAppConfig *config, guint n_servers);
+
+/* the server's gauges follow its signals and its counters are attached, until the metrics are disposed */
+void opdesk_metrics_add_server(OPDeskMetrics *metrics, OPDeskServer *server);
+
+/* time spent updating the tray from server state */
+OctoPrintHistogram *opdesk_metrics_get_ui_histogram(OPDeskMetrics *metrics);
+
+G_END_DECLS
@@ -0,0 +1,519 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-mjpeg"
+#include <glib.h>
+#include <string.h>
+
+#include <libsoup/soup.h>
+#include "mjpeg-stream.h"
+#include "webcam.h"
+
+#define MJPEG_READ_SIZE     (64 * 1024)
+#define MJPEG_MAX_BUFFER    (16 * 1024 * 1024) // without a complete frame
+#define MJPEG_RETRY         3 // seconds
+#define MJPEG_TIMEOUT       10 // seconds without data
+#define MJPEG_MAX_PER_HOST  8
+// X-Timestamp farther than this from our clock isn't wall clock time, or the clocks are off
+#define MJPEG_MAX_CLOCK_SKEW (60 * G_USEC_PER_SEC)
+
+typedef struct {
+    GBytes *data;
+    gint max_width;
+    gint max_height;
+    gint64 received; // monotonic
+    gint64 captured; // real time, 0 if unknown
+    gint64 decode_time;
+} OPDeskMJPEGFrame;
+
+typedef struct _OPDeskMJPEGConnection OPDeskMJPEGConnection;
+
+struct _OPDeskMJPEGStream {
+    GObject parent_instance;
+
+    char *url;
+    gboolean running;
+    OPDeskMJPEGConnection *connection;
+    guint retry_source;
+
+    gint max_width;
+    gint max_height;
+
+    // only one frame is decoded at a time, pending is the newest frame received since
+    gboolean decoding;
+    OPDeskMJPEGFrame *pending;
+    cairo_surface_t *frame;
+
+    OPDeskMJPEGStats stats;
+    gint64 fps_start;
+    guint fps_frames;
+};
+
+// one request, replaced when the stream is stopped or retried. Callbacks for a connection that
+// isn't the stream's anymore free it
+struct _OPDeskMJPEGConnection {
+    OPDeskMJPEGStream *stream;
+    SoupMessage *msg;
+    GCancellable *cancellable;
+    GInputStream *input;
+
+    GByteArray *buffer;
+    gsize read_offset;
+    char *boundary;
+    gsize boundary_len;
+
+    // the part being received, offsets into buffer
+    gboolean in_part;
+    gsize part_start;
+    gsize scan_from;
+    gssize part_length; // -1 without a Content-Length
+    gint64 part_received;
+    gint64 part_captured;
+};
+
+G_DEFINE_TYPE (OPDeskMJPEGStream, opdesk_mjpeg_stream, G_TYPE_OBJECT)
+
+typedef enum {
+    FRAME,
+    ERROR,
+    N_SIGNALS
+} OPDeskMJPEGStreamSignals;
+
+static guint obj_signals[N_SIGNALS] = { 0, };
+
+static SoupSession *mjpeg_session = NULL;
+
+static void opdesk_mjpeg_frame_free(OPDeskMJPEGFrame *frame) {
+    g_bytes_unref(frame->data);
+    g_free(frame);
+}
+
+static void opdesk_mjpeg_connection_free(OPDeskMJPEGConnection *conn) {
+    g_object_unref(conn->cancellable);
+    g_object_unref(conn->msg);
+    if(conn->input) g_object_unref(conn->input);
+    g_byte_array_unref(conn->buffer);
+    g_free(conn->boundary);
+    g_object_unref(conn->stream);
+    g_free(conn);
+}
+
+// the connection is freed by its pending callback
+static void opdesk_mjpeg_stream_detach_connection(OPDeskMJPEGStream *stream) {
+    if(!stream->connection) return;
+    g_cancellable_cancel(stream->connection->cancellable);
+    stream->connection = NULL;
+}
+
+static void opdesk_mjpeg_stream_dispose(GObject *object) {
+    OPDeskMJPEGStream *self = OPDESK_MJPEG_STREAM(object);
+
+    opdesk_mjpeg_stream_stop(self);
+
+    G_OBJECT_CLASS(opdesk_mjpeg_stream_parent_class)->dispose(object);
+}
+
+static void opdesk_mjpeg_stream_finalize(GObject *object) {
+    OPDeskMJPEGStream *self = OPDESK_MJPEG_STREAM(object);
+
+    g_free(self->url);
+    if(self->frame) cairo_surface_destroy(self->frame);
+
+    G_OBJECT_CLASS(opdesk_mjpeg_stream_parent_class)->finalize(object);
+}
+
+static void opdesk_mjpeg_stream_class_init(OPDeskMJPEGStreamClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_mjpeg_stream_dispose;
+    object_class->finalize = opdesk_mjpeg_stream_finalize;
+
+    obj_signals[FRAME] = g_signal_new("frame", G_TYPE_FROM_CLASS(klass),
+        G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL, NULL, NULL, G_TYPE_NONE, 0);
+    obj_signals[ERROR] = g_signal_new("error", G_TYPE_FROM_CLASS(klass),
+        G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_STRING);
+}
+
+static void opdesk_mjpeg_stream_init(OPDeskMJPEGStream *stream) {
+}
+
+OPDeskMJPEGStream *opdesk_mjpeg_stream_new(const char *url) {
+    OPDeskMJPEGStream *stream = g_object_new(OPDESK_TYPE_MJPEG_STREAM, NULL);
+    stream->url = g_strdup(url);
+    return stream;
+}
+
+static void decode_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    OPDeskMJPEGFrame *frame = task_data;
+
+    GError *err = NULL;
+    gint64 start = g_get_monotonic_time();
+    cairo_surface_t *surface = opdesk_webcam_decode(frame->data, frame->max_width, frame->max_height, &err);
+    frame->decode_time = g_get_monotonic_time() - start;
+
+    if(surface) g_task_return_pointer(task, surface, (GDestroyNotify)cairo_surface_destroy);
+    else g_task_return_error(task, err);
+}
+
+static void opdesk_mjpeg_stream_decode(OPDeskMJPEGStream *stream, OPDeskMJPEGFrame *frame);
+
+static void opdesk_mjpeg_stream_update_stats(OPDeskMJPEGStream *stream, OPDeskMJPEGFrame *frame) {
+    OPDeskMJPEGStats *stats = &stream->stats;
+    gint64 now = g_get_monotonic_time();
+
+    gboolean from_camera = frame->captured!=0;
+    gdouble latency = from_camera ? (g_get_real_time() - frame->captured) / 1000.0 : (now - frame->received) / 1000.0;
+    gdouble decode = frame->decode_time / 1000.0;
+
+    // smoothed, but not across a change in what's measured
+    if(!stats->frames || from_camera!=stats->latency_from_camera) {
+        stats->latency_ms = latency;
+        stats->decode_ms = decode;
+    } else {
+        stats->latency_ms = stats->latency_ms * 0.8 + latency * 0.2;
+        stats->decode_ms = stats->decode_ms * 0.8 + decode * 0.2;
+    }
+    stats->latency_from_camera = from_camera;
+    stats->frames++;
+
+    stream->fps_frames++;
+    if(!stream->fps_start) stream->fps_start = now;
+    else if(now - stream->fps_start >= G_USEC_PER_SEC) {
+        stats->fps = stream->fps_frames * (gdouble)G_USEC_PER_SEC / (now - stream->fps_start);
+        stream->fps_start = now;
+        stream->fps_frames = 0;
+    }
+}
+
+static void on_frame_decoded(OPDeskMJPEGStream *stream, GAsyncResult *result, gpointer user_data) {
+    OPDeskMJPEGFrame *frame = g_task_get_task_data(G_TASK(result));
+    stream->decoding = FALSE;
+
+    GError *err = NULL;
+    cairo_surface_t *surface = g_task_propagate_pointer(G_TASK(result), &err);
+    if(!surface) {
+        // a corrupt frame now and then is normal on a busy network
+        g_debug("Dropping frame from %s: %s", stream->url, err->message);
+        g_error_free(err);
+    } else if(stream->running) {
+        if(stream->frame) cairo_surface_destroy(stream->frame);
+        stream->frame = surface;
+        opdesk_mjpeg_stream_update_stats(stream, frame);
+        g_signal_emit(stream, obj_signals[FRAME], 0);
+    } else {
+        cairo_surface_destroy(surface);
+    }
+
+    if(stream->pending) {
+        OPDeskMJPEGFrame *next = stream->pending;
+        stream->pending = NULL;
+        opdesk_mjpeg_stream_decode(stream, next);
+    }
+}
+
+static void opdesk_mjpeg_stream_decode(OPDeskMJPEGStream *stream, OPDeskMJPEGFrame *frame) {
+    stream->decoding = TRUE;
+    frame->max_width = stream->max_width;
+    frame->max_height = stream->max_height;
+
+    GTask *task = g_task_new(stream, NULL, (GAsyncReadyCallback)on_frame_decoded, NULL);
+    g_task_set_task_data(task, frame, (GDestroyNotify)opdesk_mjpeg_frame_free);
+    g_task_run_in_thread(task, decode_thread);
+    g_object_unref(task);
+}
+
+static void opdesk_mjpeg_stream_frame_received(OPDeskMJPEGStream *stream, GBytes *data, gint64 received, gint64 captured) {
+    OPDeskMJPEGFrame *frame = g_malloc0(sizeof(OPDeskMJPEGFrame));
+    frame->data = data;
+    frame->received = received;
+    frame->captured = captured;
+
+    if(!stream->decoding) {
+        opdesk_mjpeg_stream_decode(stream, frame);
+        return;
+    }
+
+    // showing an old frame late is worse than not showing it
+    if(stream->pending) {
+        stream->stats.dropped++;
+        opdesk_mjpeg_frame_free(stream->pending);
+    }
+    stream->pending = frame;
+}
+
+static gssize find(const guint8 *data, gsize len, gsize from, const char *needle, gsize needle_len) {
+    if(len < needle_len || from > len - needle_len) return -1;
+
+    const guint8 *p = data + from;
+    const guint8 *end = data + len - needle_len + 1;
+    while(p < end) {
+        p = memchr(p, needle[0], end - p);
+        if(!p) return -1;
+        if(memcmp(p, needle, needle_len)==0) return p - data;
+        p++;
+    }
+    return -1;
+}
+
+static void opdesk_mjpeg_connection_parse_headers(OPDeskMJPEGConnection *conn, const guint8 *headers, gsize len) {
+    conn->part_length = -1;
+    conn->part_captured = 0;
+
+    char *text = g_strndup((const char*)headers, len);
+    char **lines = g_strsplit(text, "\r\n", -1);
+    for(char **line = lines; *line; line++) {
+        if(g_ascii_strncasecmp(*line, "Content-Length:", 15)==0) {
+            conn->part_length = g_ascii_strtoll(*line + 15, NULL, 10);
+            if(conn->part_length < 0 || conn->part_length > MJPEG_MAX_BUFFER) conn->part_length = -1;
+        } else if(g_ascii_strncasecmp(*line, "X-Timestamp:", 12)==0) {
+            // seconds.microseconds. ustreamer sends wall clock time, mjpg-streamer the capture time since boot
+            gint64 captured = (gint64)(g_ascii_strtod(*line + 12, NULL) * G_USEC_PER_SEC);
+            gint64 now = g_get_real_time();
+            if(captured > now - MJPEG_MAX_CLOCK_SKEW && captured < now + MJPEG_MAX_CLOCK_SKEW) conn->part_captured = MIN(captured, now);
+        }
+    }
+    g_strfreev(lines);
+    g_free(text);
+}
+
+// Hands every complete part in the buffer to the decoder and removes it. FALSE if the buffer has grown too large
+static gboolean opdesk_mjpeg_connection_parse(OPDeskMJPEGConnection *conn) {
+    GByteArray *buf = conn->buffer;
+    gsize consumed = 0;
+
+    while(TRUE) {
+        if(!conn->in_part) {
+            gssize boundary = find(buf->data, buf->len, consumed, conn->boundary, conn->boundary_len);
+            if(boundary < 0) {
+                // keep what could be the start of a boundary
+                if(buf->len - consumed >= conn->boundary_len) consumed = buf->len - conn->boundary_len + 1;
+                break;
+            }
+
+            gsize headers_start = boundary + conn->boundary_len;
+            gssize headers_end = find(buf->data, buf->len, headers_start, "\r\n\r\n", 4);
+            if(headers_end < 0) {
+                consumed = boundary;
+                break;
+            }
+
+            opdesk_mjpeg_connection_parse_headers(conn, buf->data + headers_start, headers_end - headers_start);
+            conn->in_part = TRUE;
+            conn->part_start = headers_end + 4;
+            conn->scan_from = conn->part_start;
+            conn->part_received = g_get_monotonic_time();
+        }
+
+        gsize end;
+        gsize next;
+        if(conn->part_length >= 0) {
+            if(buf->len - conn->part_start < (gsize)conn->part_length) break;
+            end = conn->part_start + conn->part_length;
+            next = end;
+        } else {
+            // no length, the part ends at the next boundary
+            gssize boundary = find(buf->data, buf->len, conn->scan_from, conn->boundary, conn->boundary_len);
+            if(boundary < 0) {
+                if(buf->len >= conn->part_start + conn->boundary_len) conn->scan_from = buf->len - conn->boundary_len + 1;
+                break;
+            }
+            end = boundary;
+            next = boundary;
+            // the boundary is found without its leading "--", and is preceded by a line break
+            for(gint c=0;c<2 && end > conn->part_start && buf->data[end - 1]=='-';c++) end--;
+            if(end > conn->part_start && buf->data[end - 1]=='\n') end--;
+            if(end > conn->part_start && buf->data[end - 1]=='\r') end--;
+        }
+
+        GBytes *part = g_bytes_new(buf->data + conn->part_start, end - conn->part_start);
+        conn->in_part = FALSE;
+        consumed = next;
+        opdesk_mjpeg_stream_frame_received(conn->stream, part, conn->part_received, conn->part_captured);
+    }
+
+    if(consumed) {
+        g_byte_array_remove_range(buf, 0, consumed);
+        if(conn->in_part) {
+            conn->part_start -= consumed;
+            conn->scan_from -= consumed;
+        }
+    }
+
+    return buf->len <= MJPEG_MAX_BUFFER;
+}
+
+static void opdesk_mjpeg_stream_connect(OPDeskMJPEGStream *stream);
+
+static gboolean on_retry(OPDeskMJPEGStream *stream) {
+    stream->retry_source = 0;
+    opdesk_mjpeg_stream_connect(stream);
+    return G_SOURCE_REMOVE;
+}
+
+static void opdesk_mjpeg_connection_failed(OPDeskMJPEGConnection *conn, const char *message) {
+    OPDeskMJPEGStream *stream = conn->stream;
+    g_message("Webcam stream %s failed: %s, retrying in %d seconds", stream->url, message, MJPEG_RETRY);
+
+    stream->connection = NULL;
+    stream->retry_source = g_timeout_add_seconds(MJPEG_RETRY, G_SOURCE_FUNC(on_retry), stream);
+    g_signal_emit(stream, obj_signals[ERROR], 0, message);
+
+    opdesk_mjpeg_connection_free(conn);
+}
+
+static void opdesk_mjpeg_connection_read(OPDeskMJPEGConnection *conn);
+
+static void on_read(GInputStream *input, GAsyncResult *result, OPDeskMJPEGConnection *conn) {
+    GError *err = NULL;
+    gssize len = g_input_stream_read_finish(input, result, &err);
+
+    if(conn!=conn->stream->connection) {
+        if(err) g_error_free(err);
+        opdesk_mjpeg_connection_free(conn);
+        return;
+    }
+
+    if(len <= 0) {
+        opdesk_mjpeg_connection_failed(conn, err ? err->message : "The stream ended");
+        if(err) g_error_free(err);
+        return;
+    }
+
+    g_byte_array_set_size(conn->buffer, conn->read_offset + len);
+    if(!opdesk_mjpeg_connection_parse(conn)) {
+        opdesk_mjpeg_connection_failed(conn, "No frames found in the stream");
+        return;
+    }
+
+    opdesk_mjpeg_connection_read(conn);
+}
+
+static void opdesk_mjpeg_connection_read(OPDeskMJPEGConnection *conn) {
+    conn->read_offset = conn->buffer->len;
+    g_byte_array_set_size(conn->buffer, conn->read_offset + MJPEG_READ_SIZE);
+    g_input_stream_read_async(conn->input, conn->buffer->data + conn->read_offset, MJPEG_READ_SIZE, G_PRIORITY_DEFAULT,
+        conn->cancellable, (GAsyncReadyCallback)on_read, conn);
+}
+
+static void on_sent(SoupSession *session, GAsyncResult *result, OPDeskMJPEGConnection *conn) {
+    GError *err = NULL;
+    conn->input = soup_session_send_finish(session, result, &err);
+
+    if(conn!=conn->stream->connection) {
+        if(err) g_error_free(err);
+        opdesk_mjpeg_connection_free(conn);
+        return;
+    }
+
+    if(!conn->input) {
+        opdesk_mjpeg_connection_failed(conn, err->message);
+        g_error_free(err);
+        return;
+    }
+
+    if(!SOUP_STATUS_IS_SUCCESSFUL(conn->msg->status_code)) {
+        char *message = g_strdup_printf("%u %s", conn->msg->status_code, conn->msg->reason_phrase);
+        opdesk_mjpeg_connection_failed(conn, message);
+        g_free(message);
+        return;
+    }
+
+    GHashTable *params = NULL;
+    const char *type = soup_message_headers_get_content_type(conn->msg->response_headers, &params);
+    const char *boundary = params ? g_hash_table_lookup(params, "boundary") : NULL;
+    if(!type || !g_str_has_prefix(type, "multipart/") || !boundary || !*boundary) {
+        if(params) g_hash_table_destroy(params);
+        opdesk_mjpeg_connection_failed(conn, "Not an MJPEG stream");
+        return;
+    }
+
+    // some streamers include the "--" in the parameter, others don't. Searching without it finds either
+    while(*boundary=='-') boundary++;
+    conn->boundary = g_strdup(*boundary ? boundary : "--");
+    conn->boundary_len = strlen(conn->boundary);
+    g_hash_table_destroy(params);
+
+    g_debug("Receiving %s", conn->stream->url);
+    opdesk_mjpeg_connection_read(conn);
+}
+
+static void opdesk_mjpeg_stream_connect(OPDeskMJPEGStream *stream) {
+    if(!mjpeg_session) {
+        mjpeg_session = soup_session_new_with_options(
+            "max-conns-per-host", MJPEG_MAX_PER_HOST,
+            "timeout", MJPEG_TIMEOUT,
+            NULL);
+    }
+
+    SoupMessage *msg = soup_message_new("GET", stream->url);
+    if(!msg) {
+        g_warning("Invalid webcam stream URL %s", stream->url);
+        g_signal_emit(stream, obj_signals[ERROR], 0, "Invalid stream URL");
+        return;
+    }
+
+    OPDeskMJPEGConnection *conn = g_malloc0(sizeof(OPDeskMJPEGConnection));
+    conn->stream = g_object_ref(stream);
+    conn->msg = msg;
+    conn->cancellable = g_cancellable_new();
+    conn->buffer = g_byte_array_sized_new(2 * MJPEG_READ_SIZE);
+    stream->connection = conn;
+
+    soup_session_send_async(mjpeg_session, msg, conn->cancellable, (GAsyncReadyCallback)on_sent, conn);
+}
+
+void opdesk_mjpeg_stream_start(OPDeskMJPEGStream *stream) {
+    if(stream->running) return;
+    stream->running = TRUE;
+
+    stream->fps_start = 0;
+    stream->fps_frames = 0;
+    stream->stats.fps = 0.0;
+
+    g_debug("Starting %s", stream->url);
+    opdesk_mjpeg_stream_connect(stream);
+}
+
+void opdesk_mjpeg_stream_stop(OPDeskMJPEGStream *stream) {
+    if(!stream->running) return;
+    stream->running = FALSE;
+
+    g_debug("Stopping %s", stream->url);
+    if(stream->retry_source) {
+        g_source_remove(stream->retry_source);
+        stream->retry_source = 0;
+    }
+    opdesk_mjpeg_stream_detach_connection(stream);
+    g_clear_pointer(&stream->pending, opdesk_mjpeg_frame_free);
+}
+
+gboolean opdesk_mjpeg_stream_is_running(OPDeskMJPEGStream *stream) {
+    return stream->running;
+}
+
+void opdesk_mjpeg_stream_set_max_size(OPDeskMJPEGStream *stream, gint width, gint height) {
+    stream->max_width = width;
+    stream->max_height = height;
+}
+
+cairo_surface_t *opdesk_mjpeg_stream_get_frame(OPDeskMJPEGStream *stream) {
+    return stream->frame;
+}
+
+void opdesk_mjpeg_stream_get_stats(OPDeskMJPEGStream *stream, OPDeskMJPEGStats *stats) {
+    *stats = stream->stats;
+}
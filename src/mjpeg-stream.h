@@ -0,0 +1,56 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <glib-object.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+    gdouble fps;
+    /* capture to decoded and ready to draw, from the frame's X-Timestamp when the streamer sends
+       wall clock time. Otherwise latency_from_camera is FALSE and it's only the time since the frame arrived */
+    gdouble latency_ms;
+    gboolean latency_from_camera;
+    gdouble decode_ms;
+    guint64 frames;
+    /* frames that arrived while an older one was still decoding and were replaced by a newer one */
+    guint64 dropped;
+} OPDeskMJPEGStats;
+
+/* A multipart/x-mixed-replace JPEG stream, as served by mjpg-streamer or ustreamer.
+   Frames are decoded on a worker thread, one at a time, and only the newest frame waiting is
+   decoded next, the rest are dropped. "frame" is emitted when a new frame is ready to draw.
+   If the stream fails it's retried after a few seconds, "error" (message) is emitted each time. */
+#define OPDESK_TYPE_MJPEG_STREAM opdesk_mjpeg_stream_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskMJPEGStream, opdesk_mjpeg_stream, OPDESK, MJPEG_STREAM, GObject)
+
+OPDeskMJPEGStream *opdesk_mjpeg_stream_new(const char *url);
+
+/* stop closes the connection, nothing is received or decoded until it's started again */
+void opdesk_mjpeg_stream_start(OPDeskMJPEGStream *stream);
+void opdesk_mjpeg_stream_stop(OPDeskMJPEGStream *stream);
+gboolean opdesk_mjpeg_stream_is_running(OPDeskMJPEGStream *stream);
+
+/* frames are scaled down while decoding to fit, 0 for full size */
+void opdesk_mjpeg_stream_set_max_size(OPDeskMJPEGStream *stream, gint width, gint height);
+
+/* the newest decoded frame or NULL, owned by the stream */
+cairo_surface_t *opdesk_mjpeg_stream_get_frame(OPDeskMJPEGStream *stream);
+void opdesk_mjpeg_stream_get_stats(OPDeskMJPEGStream *stream, OPDeskMJPEGStats *stats);
+
+G_END_DECLS
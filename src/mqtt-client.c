@@ -0,0 +1,456 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-mqtt"
+#include <glib.h>
+#include <string.h>
+
+#include "mqtt-client.h"
+
+#define RETRY_INTERVAL 10
+#define KEEP_ALIVE_DEFAULT 60
+#define READ_SIZE 16384
+// far more than any OctoPrint-MQTT message, anything bigger is a broken stream
+#define MAX_PACKET_SIZE (4 * 1024 * 1024)
+
+enum {
+    MQTT_CONNECT = 1,
+    MQTT_CONNACK = 2,
+    MQTT_PUBLISH = 3,
+    MQTT_PUBACK = 4,
+    MQTT_SUBSCRIBE = 8,
+    MQTT_SUBACK = 9,
+    MQTT_PINGREQ = 12,
+    MQTT_PINGRESP = 13,
+    MQTT_DISCONNECT = 14
+};
+
+struct _OPDeskMQTTClient {
+    GObject parent_instance;
+
+    char *host;
+    guint16 port;
+    gboolean tls;
+    char *client_id;
+    char *username;
+    char *password;
+    guint keep_alive;
+
+    GPtrArray *filters;
+    guint16 next_packet_id;
+
+    GSocketClient *socket_client;
+    GSocketConnection *connection;
+    GCancellable *cancellable;
+    gboolean connected;
+
+    GByteArray *received; // not yet parsed
+    gint64 last_received;
+    GQueue writes; // GBytes, the head is being written
+    guint ping_source;
+    guint retry_source;
+};
+
+G_DEFINE_TYPE (OPDeskMQTTClient, opdesk_mqtt_client, G_TYPE_OBJECT)
+
+enum {
+    CONNECTED,
+    DISCONNECTED,
+    MESSAGE,
+    N_SIGNALS
+};
+
+static guint obj_signals[N_SIGNALS] = { 0, };
+
+static void opdesk_mqtt_client_teardown(OPDeskMQTTClient *client);
+
+static void opdesk_mqtt_client_dispose(GObject *object) {
+    OPDeskMQTTClient *self = OPDESK_MQTT_CLIENT(object);
+
+    if(self->retry_source) g_source_remove(self->retry_source);
+    self->retry_source = 0;
+
+    // say goodbye if nothing else is being written, the broker drops the session either way
+    if(self->connected && g_queue_is_empty(&self->writes)) {
+        const guint8 disconnect[] = { MQTT_DISCONNECT << 4, 0 };
+        g_output_stream_write_all(g_io_stream_get_output_stream(G_IO_STREAM(self->connection)), disconnect, sizeof(disconnect), NULL, NULL, NULL);
+    }
+    opdesk_mqtt_client_teardown(self);
+    g_clear_object(&self->socket_client);
+
+    G_OBJECT_CLASS(opdesk_mqtt_client_parent_class)->dispose(object);
+}
+
+static void opdesk_mqtt_client_finalize(GObject *object) {
+    OPDeskMQTTClient *self = OPDESK_MQTT_CLIENT(object);
+
+    g_free(self->host);
+    g_free(self->client_id);
+    g_free(self->username);
+    g_free(self->password);
+    g_ptr_array_unref(self->filters);
+    g_byte_array_unref(self->received);
+
+    G_OBJECT_CLASS(opdesk_mqtt_client_parent_class)->finalize(object);
+}
+
+static void opdesk_mqtt_client_class_init(OPDeskMQTTClientClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_mqtt_client_dispose;
+    object_class->finalize = opdesk_mqtt_client_finalize;
+
+    obj_signals[CONNECTED] = g_signal_new("connected", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL, NULL, NULL, G_TYPE_NONE, 0);
+    obj_signals[DISCONNECTED] = g_signal_new("disconnected", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL, NULL, NULL, G_TYPE_NONE, 0);
+    obj_signals[MESSAGE] = g_signal_new("message", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST | G_SIGNAL_NO_HOOKS, 0, NULL, NULL, NULL, G_TYPE_NONE, 3, G_TYPE_STRING, G_TYPE_BYTES, G_TYPE_BOOLEAN);
+}
+
+static void opdesk_mqtt_client_init(OPDeskMQTTClient *client) {
+    client->filters = g_ptr_array_new_with_free_func(g_free);
+    client->received = g_byte_array_new();
+    client->keep_alive = KEEP_ALIVE_DEFAULT;
+    client->next_packet_id = 1;
+    client->socket_client = g_socket_client_new();
+    g_queue_init(&client->writes);
+}
+
+/* Packets */
+
+static void append_u16(GByteArray *packet, guint16 value) {
+    const guint8 bytes[] = { value >> 8, value & 0xff };
+    g_byte_array_append(packet, bytes, 2);
+}
+
+static void append_string(GByteArray *packet, const char *str) {
+    gsize len = MIN(strlen(str), G_MAXUINT16);
+    append_u16(packet, len);
+    g_byte_array_append(packet, (const guint8*)str, len);
+}
+
+// fixed header in front of body
+static GBytes *packet_finish(guint8 header, GByteArray *body) {
+    guint8 fixed[5];
+    guint n = 0;
+    fixed[n++] = header;
+
+    gsize remaining = body->len;
+    do {
+        guint8 digit = remaining % 128;
+        remaining /= 128;
+        if(remaining) digit |= 0x80;
+        fixed[n++] = digit;
+    } while(remaining && n < sizeof(fixed));
+
+    g_byte_array_prepend(body, fixed, n);
+    return g_byte_array_free_to_bytes(body);
+}
+
+static guint16 opdesk_mqtt_client_packet_id(OPDeskMQTTClient *client) {
+    guint16 id = client->next_packet_id++;
+    if(!client->next_packet_id) client->next_packet_id = 1;
+    return id;
+}
+
+/* Writing */
+
+static void opdesk_mqtt_client_write_next(OPDeskMQTTClient *client);
+
+static gboolean on_retry(OPDeskMQTTClient *client) {
+    client->retry_source = 0;
+    opdesk_mqtt_client_connect(client);
+    return G_SOURCE_REMOVE;
+}
+
+static void opdesk_mqtt_client_lost(OPDeskMQTTClient *client, const char *reason) {
+    g_warning("Lost connection to MQTT broker %s:%u: %s", client->host, client->port, reason);
+
+    gboolean was_connected = client->connected;
+    opdesk_mqtt_client_teardown(client);
+    if(was_connected) g_signal_emit(client, obj_signals[DISCONNECTED], 0);
+
+    if(!client->retry_source) client->retry_source = g_timeout_add_seconds(RETRY_INTERVAL, G_SOURCE_FUNC(on_retry), client);
+}
+
+static void on_written(GOutputStream *stream, GAsyncResult *result, OPDeskMQTTClient *client) {
+    GError *err = NULL;
+    if(!g_output_stream_write_all_finish(stream, result, NULL, &err)) {
+        // cancelled means the client may already be gone
+        if(!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) opdesk_mqtt_client_lost(client, err->message);
+        g_error_free(err);
+        return;
+    }
+
+    g_bytes_unref(g_queue_pop_head(&client->writes));
+    opdesk_mqtt_client_write_next(client);
+}
+
+static void opdesk_mqtt_client_write_next(OPDeskMQTTClient *client) {
+    GBytes *packet = g_queue_peek_head(&client->writes);
+    if(!packet) return;
+
+    gsize size;
+    gconstpointer data = g_bytes_get_data(packet, &size);
+    g_output_stream_write_all_async(g_io_stream_get_output_stream(G_IO_STREAM(client->connection)), data, size, G_PRIORITY_DEFAULT, client->cancellable, (GAsyncReadyCallback)on_written, client);
+}
+
+// takes packet
+static void opdesk_mqtt_client_send(OPDeskMQTTClient *client, GBytes *packet) {
+    if(!client->connection) {
+        g_bytes_unref(packet);
+        return;
+    }
+
+    g_queue_push_tail(&client->writes, packet);
+    if(g_queue_get_length(&client->writes)==1) opdesk_mqtt_client_write_next(client);
+}
+
+static void opdesk_mqtt_client_send_subscribe(OPDeskMQTTClient *client, guint first, guint count) {
+    if(!count) return;
+
+    GByteArray *body = g_byte_array_new();
+    append_u16(body, opdesk_mqtt_client_packet_id(client));
+    for(guint f=first;f<first+count;f++) {
+        const guint8 qos = 0;
+        append_string(body, g_ptr_array_index(client->filters, f));
+        g_byte_array_append(body, &qos, 1);
+    }
+    opdesk_mqtt_client_send(client, packet_finish(MQTT_SUBSCRIBE << 4 | 0x02, body));
+}
+
+static gboolean on_ping(OPDeskMQTTClient *client) {
+    if(g_get_monotonic_time() - client->last_received > client->keep_alive * G_USEC_PER_SEC * 3 / 2) {
+        client->ping_source = 0;
+        opdesk_mqtt_client_lost(client, "timed out");
+        return G_SOURCE_REMOVE;
+    }
+
+    opdesk_mqtt_client_send(client, packet_finish(MQTT_PINGREQ << 4, g_byte_array_new()));
+    return G_SOURCE_CONTINUE;
+}
+
+/* Reading */
+
+static const char *connack_reason(guint8 code) {
+    switch(code) {
+    case 1: return "unacceptable protocol version";
+    case 2: return "client identifier rejected";
+    case 3: return "server unavailable";
+    case 4: return "bad user name or password";
+    case 5: return "not authorized";
+    default: return "refused";
+    }
+}
+
+static void opdesk_mqtt_client_handle_publish(OPDeskMQTTClient *client, guint8 flags, const guint8 *data, gsize len) {
+    guint qos = (flags >> 1) & 0x03;
+    if(len < 2) return;
+    gsize topic_len = data[0] << 8 | data[1];
+    gsize offset = 2 + topic_len + (qos ? 2 : 0);
+    if(offset > len) return;
+
+    if(qos==1) {
+        GByteArray *body = g_byte_array_new();
+        g_byte_array_append(body, data + 2 + topic_len, 2);
+        opdesk_mqtt_client_send(client, packet_finish(MQTT_PUBACK << 4, body));
+    }
+
+    char *topic = g_strndup((const char*)data + 2, topic_len);
+    if(g_utf8_validate(topic, -1, NULL)) {
+        GBytes *payload = g_bytes_new(data + offset, len - offset);
+        g_signal_emit(client, obj_signals[MESSAGE], 0, topic, payload, (gboolean)(flags & 0x01));
+        g_bytes_unref(payload);
+    }
+    g_free(topic);
+}
+
+static void opdesk_mqtt_client_handle_packet(OPDeskMQTTClient *client, guint8 header, const guint8 *data, gsize len) {
+    switch(header >> 4) {
+    case MQTT_CONNACK:
+        if(len < 2 || data[1]) {
+            opdesk_mqtt_client_lost(client, len < 2 ? "malformed CONNACK" : connack_reason(data[1]));
+            return;
+        }
+        g_message("Connected to MQTT broker %s:%u", client->host, client->port);
+        client->connected = TRUE;
+        opdesk_mqtt_client_send_subscribe(client, 0, client->filters->len);
+        client->ping_source = g_timeout_add_seconds(MAX(client->keep_alive / 2, 1), G_SOURCE_FUNC(on_ping), client);
+        g_signal_emit(client, obj_signals[CONNECTED], 0);
+        break;
+    case MQTT_PUBLISH:
+        opdesk_mqtt_client_handle_publish(client, header & 0x0f, data, len);
+        break;
+    case MQTT_SUBACK:
+        for(gsize c=2;c<len;c++) {
+            if(data[c]==0x80) g_warning("MQTT broker %s:%u refused a subscription", client->host, client->port);
+        }
+        break;
+    case MQTT_PINGRESP:
+        break;
+    default:
+        g_debug("Ignoring MQTT packet type %u", header >> 4);
+        break;
+    }
+}
+
+// FALSE if the connection was dropped
+static gboolean opdesk_mqtt_client_parse(OPDeskMQTTClient *client) {
+    while(client->connection && client->received->len >= 2) {
+        const guint8 *data = client->received->data;
+        gsize remaining = 0;
+        guint n = 1;
+        guint shift = 0;
+        gboolean complete = FALSE;
+        while(n < client->received->len && n <= 4) {
+            remaining |= (gsize)(data[n] & 0x7f) << shift;
+            shift += 7;
+            if(!(data[n++] & 0x80)) {
+                complete = TRUE;
+                break;
+            }
+        }
+        if(!complete) {
+            if(n > 4) {
+                opdesk_mqtt_client_lost(client, "malformed packet length");
+                return FALSE;
+            }
+            break;
+        }
+        if(remaining > MAX_PACKET_SIZE) {
+            opdesk_mqtt_client_lost(client, "packet too large");
+            return FALSE;
+        }
+        if(client->received->len < n + remaining) break;
+
+        opdesk_mqtt_client_handle_packet(client, data[0], data + n, remaining);
+        // handling can drop the connection, which empties the buffer
+        if(client->received->len >= n + remaining) g_byte_array_remove_range(client->received, 0, n + remaining);
+    }
+    return client->connection!=NULL;
+}
+
+static void on_read(GInputStream *stream, GAsyncResult *result, OPDeskMQTTClient *client) {
+    GError *err = NULL;
+    GBytes *bytes = g_input_stream_read_bytes_finish(stream, result, &err);
+    if(!bytes) {
+        if(!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) opdesk_mqtt_client_lost(client, err->message);
+        g_error_free(err);
+        return;
+    }
+
+    gsize size;
+    gconstpointer data = g_bytes_get_data(bytes, &size);
+    if(!size) {
+        g_bytes_unref(bytes);
+        opdesk_mqtt_client_lost(client, "closed by the broker");
+        return;
+    }
+
+    client->last_received = g_get_monotonic_time();
+    g_byte_array_append(client->received, data, size);
+    g_bytes_unref(bytes);
+
+    if(!opdesk_mqtt_client_parse(client)) return;
+    g_input_stream_read_bytes_async(stream, READ_SIZE, G_PRIORITY_DEFAULT, client->cancellable, (GAsyncReadyCallback)on_read, client);
+}
+
+/* Connection */
+
+static void opdesk_mqtt_client_teardown(OPDeskMQTTClient *client) {
+    if(client->ping_source) g_source_remove(client->ping_source);
+    client->ping_source = 0;
+
+    // pending reads and writes finish cancelled without touching the client
+    if(client->cancellable) g_cancellable_cancel(client->cancellable);
+    g_clear_object(&client->cancellable);
+    g_clear_object(&client->connection);
+    g_queue_clear_full(&client->writes, (GDestroyNotify)g_bytes_unref);
+    g_byte_array_set_size(client->received, 0);
+    client->connected = FALSE;
+}
+
+static void on_socket_connected(GSocketClient *socket_client, GAsyncResult *result, OPDeskMQTTClient *client) {
+    GError *err = NULL;
+    GSocketConnection *connection = g_socket_client_connect_to_host_finish(socket_client, result, &err);
+    if(!connection) {
+        if(!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) opdesk_mqtt_client_lost(client, err->message);
+        g_error_free(err);
+        return;
+    }
+
+    client->connection = connection;
+    client->last_received = g_get_monotonic_time();
+
+    GByteArray *body = g_byte_array_new();
+    append_string(body, "MQTT");
+    const guint8 level = 4;
+    g_byte_array_append(body, &level, 1);
+    // clean session, there's nothing worth keeping while away
+    guint8 flags = 0x02;
+    if(client->username) flags |= 0x80;
+    if(client->username && client->password) flags |= 0x40;
+    g_byte_array_append(body, &flags, 1);
+    append_u16(body, client->keep_alive);
+    append_string(body, client->client_id);
+    if(client->username) append_string(body, client->username);
+    if(client->username && client->password) append_string(body, client->password);
+    opdesk_mqtt_client_send(client, packet_finish(MQTT_CONNECT << 4, body));
+
+    g_input_stream_read_bytes_async(g_io_stream_get_input_stream(G_IO_STREAM(connection)), READ_SIZE, G_PRIORITY_DEFAULT, client->cancellable, (GAsyncReadyCallback)on_read, client);
+}
+
+void opdesk_mqtt_client_connect(OPDeskMQTTClient *client) {
+    if(client->retry_source) g_source_remove(client->retry_source);
+    client->retry_source = 0;
+    if(client->connection || client->cancellable) return;
+
+    g_debug("Connecting to MQTT broker %s:%u", client->host, client->port);
+    client->cancellable = g_cancellable_new();
+    g_socket_client_set_tls(client->socket_client, client->tls);
+    g_socket_client_connect_to_host_async(client->socket_client, client->host, client->port, client->cancellable, (GAsyncReadyCallback)on_socket_connected, client);
+}
+
+OPDeskMQTTClient *opdesk_mqtt_client_new(const char *host, guint16 port, const char *client_id) {
+    OPDeskMQTTClient *client = g_object_new(OPDESK_TYPE_MQTT_CLIENT, NULL);
+    client->host = g_strdup(host);
+    client->port = port;
+    client->client_id = client_id ? g_strdup(client_id) : g_strdup_printf("octoprint-desktop-%08x", g_random_int());
+    return client;
+}
+
+void opdesk_mqtt_client_set_credentials(OPDeskMQTTClient *client, const char *username, const char *password) {
+    g_free(client->username);
+    g_free(client->password);
+    client->username = g_strdup(username);
+    client->password = g_strdup(password);
+}
+
+void opdesk_mqtt_client_set_tls(OPDeskMQTTClient *client, gboolean tls) {
+    client->tls = tls;
+}
+
+void opdesk_mqtt_client_set_keep_alive(OPDeskMQTTClient *client, guint keep_alive) {
+    client->keep_alive = CLAMP(keep_alive, 1, G_MAXUINT16);
+}
+
+void opdesk_mqtt_client_subscribe(OPDeskMQTTClient *client, const char *filter) {
+    g_ptr_array_add(client->filters, g_strdup(filter));
+    if(client->connected) opdesk_mqtt_client_send_subscribe(client, client->filters->len - 1, 1);
+}
+
+gboolean opdesk_mqtt_client_is_connected(OPDeskMQTTClient *client) {
+    return client->connected;
+}
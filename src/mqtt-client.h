@@ -0,0 +1,47 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* A minimal MQTT 3.1.1 subscriber: one connection, QoS 0 subscriptions, nothing published.
+   Reconnects on its own and subscribes again each time.
+
+   Signals:
+    - connected, once the broker has accepted the connection
+    - disconnected
+    - message, topic (string), payload (GBytes), retained (gboolean) */
+#define OPDESK_TYPE_MQTT_CLIENT opdesk_mqtt_client_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskMQTTClient, opdesk_mqtt_client, OPDESK, MQTT_CLIENT, GObject)
+
+/* client_id NULL for a random one */
+OPDeskMQTTClient *opdesk_mqtt_client_new(const char *host, guint16 port, const char *client_id);
+
+/* before connecting. username NULL for none */
+void opdesk_mqtt_client_set_credentials(OPDeskMQTTClient *client, const char *username, const char *password);
+void opdesk_mqtt_client_set_tls(OPDeskMQTTClient *client, gboolean tls);
+/* seconds, default 60 */
+void opdesk_mqtt_client_set_keep_alive(OPDeskMQTTClient *client, guint keep_alive);
+
+/* topic filter, + and # wildcards allowed. Sent now if connected and on every reconnect */
+void opdesk_mqtt_client_subscribe(OPDeskMQTTClient *client, const char *filter);
+
+void opdesk_mqtt_client_connect(OPDeskMQTTClient *client);
+gboolean opdesk_mqtt_client_is_connected(OPDeskMQTTClient *client);
+
+G_END_DECLS
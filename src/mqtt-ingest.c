@@ -0,0 +1,397 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-mqtt"
+#include <glib.h>
+#include <string.h>
+#include <json-glib/json-glib.h>
+
+#include "mqtt-ingest.h"
+#include "mqtt-client.h"
+
+#define PORT_DEFAULT 1883
+#define PORT_TLS_DEFAULT 8883
+// temperatures arrive a heater at a time, every couple of seconds per printer
+#define FLUSH_INTERVAL 250
+
+typedef struct {
+    OPDeskServer *server;
+    char *base_topic;
+
+    GHashTable *temps; // heater -> gdouble[2], actual and target
+    gboolean temps_dirty;
+    GVariantDict *pending; // NULL if there's nothing to feed
+} IngestPrinter;
+
+struct _OPDeskMQTTIngest {
+    GObject parent_instance;
+
+    OPDeskMQTTClient *client;
+    GHashTable *printers; // base topic -> IngestPrinter
+    GPtrArray *dirty;
+    guint flush_source;
+};
+
+G_DEFINE_TYPE (OPDeskMQTTIngest, opdesk_mqtt_ingest, G_TYPE_OBJECT)
+
+static void ingest_printer_free(IngestPrinter *printer) {
+    g_hash_table_destroy(printer->temps);
+    if(printer->pending) g_variant_dict_unref(printer->pending);
+    g_free(printer->base_topic);
+    g_free(printer);
+}
+
+static void opdesk_mqtt_ingest_dispose(GObject *object) {
+    OPDeskMQTTIngest *self = OPDESK_MQTT_INGEST(object);
+
+    if(self->flush_source) g_source_remove(self->flush_source);
+    self->flush_source = 0;
+    if(self->client) g_signal_handlers_disconnect_by_data(self->client, self);
+    g_clear_object(&self->client);
+
+    G_OBJECT_CLASS(opdesk_mqtt_ingest_parent_class)->dispose(object);
+}
+
+static void opdesk_mqtt_ingest_finalize(GObject *object) {
+    OPDeskMQTTIngest *self = OPDESK_MQTT_INGEST(object);
+
+    g_ptr_array_unref(self->dirty);
+    g_hash_table_destroy(self->printers);
+
+    G_OBJECT_CLASS(opdesk_mqtt_ingest_parent_class)->finalize(object);
+}
+
+static void opdesk_mqtt_ingest_class_init(OPDeskMQTTIngestClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_mqtt_ingest_dispose;
+    object_class->finalize = opdesk_mqtt_ingest_finalize;
+}
+
+static void opdesk_mqtt_ingest_init(OPDeskMQTTIngest *ingest) {
+    ingest->printers = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)ingest_printer_free);
+    ingest->dirty = g_ptr_array_new();
+}
+
+/* Feeding */
+
+static void ingest_printer_feed(IngestPrinter *printer) {
+    if(printer->temps_dirty) {
+        GVariantBuilder temps;
+        g_variant_builder_init(&temps, G_VARIANT_TYPE("a{s(ddd)}"));
+        GHashTableIter iter;
+        const char *name;
+        gdouble *temp;
+        g_hash_table_iter_init(&iter, printer->temps);
+        while(g_hash_table_iter_next(&iter, (gpointer*)&name, (gpointer*)&temp)) {
+            g_variant_builder_add(&temps, "{s(ddd)}", name, temp[0], temp[1], 0.0);
+        }
+        if(!printer->pending) printer->pending = g_variant_dict_new(NULL);
+        g_variant_dict_insert_value(printer->pending, "temps", g_variant_builder_end(&temps));
+        printer->temps_dirty = FALSE;
+    }
+    if(!printer->pending) return;
+
+    GVariant *changes = g_variant_ref_sink(g_variant_dict_end(printer->pending));
+    g_variant_dict_unref(printer->pending);
+    printer->pending = NULL;
+    opdesk_server_feed_state(printer->server, changes);
+    g_variant_unref(changes);
+}
+
+static gboolean on_flush(OPDeskMQTTIngest *ingest) {
+    ingest->flush_source = 0;
+
+    for(guint p=0;p<ingest->dirty->len;p++) ingest_printer_feed(g_ptr_array_index(ingest->dirty, p));
+    g_ptr_array_set_size(ingest->dirty, 0);
+    return G_SOURCE_REMOVE;
+}
+
+static GVariantDict *opdesk_mqtt_ingest_pending(OPDeskMQTTIngest *ingest, IngestPrinter *printer) {
+    if(!printer->pending && !printer->temps_dirty) g_ptr_array_add(ingest->dirty, printer);
+    if(!printer->pending) printer->pending = g_variant_dict_new(NULL);
+    if(!ingest->flush_source) ingest->flush_source = g_timeout_add(FLUSH_INTERVAL, G_SOURCE_FUNC(on_flush), ingest);
+    return printer->pending;
+}
+
+// feed what's pending for printer now, ahead of an event
+static void opdesk_mqtt_ingest_flush_printer(OPDeskMQTTIngest *ingest, IngestPrinter *printer) {
+    if(!printer->pending && !printer->temps_dirty) return;
+    g_ptr_array_remove_fast(ingest->dirty, printer);
+    ingest_printer_feed(printer);
+}
+
+/* Topics */
+
+// OctoPrint's printer state ids, anything not here is offline
+static const struct {
+    const char *id;
+    gboolean printing, paused, pausing, cancelling, error, ready;
+} printer_states[] = {
+    { "OPERATIONAL", .ready = TRUE },
+    { "STARTING", .printing = TRUE },
+    { "PRINTING", .printing = TRUE },
+    { "RESUMING", .printing = TRUE },
+    { "FINISHING", .printing = TRUE },
+    { "PAUSING", .printing = TRUE, .pausing = TRUE },
+    { "PAUSED", .paused = TRUE },
+    { "CANCELLING", .printing = TRUE, .cancelling = TRUE },
+    { "TRANSFERING_FILE" },
+    { "ERROR", .error = TRUE },
+    { "CLOSED_WITH_ERROR", .error = TRUE },
+};
+
+static void opdesk_mqtt_ingest_state_id(GVariantDict *pending, const char *state_id) {
+    guint s = 0;
+    while(s < G_N_ELEMENTS(printer_states) && g_strcmp0(state_id, printer_states[s].id)) s++;
+    gboolean known = s < G_N_ELEMENTS(printer_states);
+
+    g_variant_dict_insert(pending, "operational", "b", known && !printer_states[s].error);
+    g_variant_dict_insert(pending, "printing", "b", known && printer_states[s].printing);
+    g_variant_dict_insert(pending, "paused", "b", known && printer_states[s].paused);
+    g_variant_dict_insert(pending, "pausing", "b", known && printer_states[s].pausing);
+    g_variant_dict_insert(pending, "cancelling", "b", known && printer_states[s].cancelling);
+    g_variant_dict_insert(pending, "error", "b", known && printer_states[s].error);
+    g_variant_dict_insert(pending, "ready", "b", known && printer_states[s].ready);
+}
+
+static void opdesk_mqtt_ingest_job_file(GVariantDict *pending, const char *display, const char *path, const char *origin) {
+    if(!path) return;
+
+    char *basename = g_path_get_basename(path);
+    g_variant_dict_insert(pending, "file", "s", display ? display : basename);
+    g_variant_dict_insert(pending, "path", "s", path);
+    g_variant_dict_insert(pending, "origin", "s", origin ? origin : "local");
+    g_free(basename);
+}
+
+// the same current data the websocket sends, when the plugin is set to publish it with progress
+static void opdesk_mqtt_ingest_printer_data(GVariantDict *pending, JsonObject *data) {
+    JsonObject *state = json_object_has_member(data, "state") ? json_object_get_object_member(data, "state") : NULL;
+    JsonObject *flags = state && json_object_has_member(state, "flags") ? json_object_get_object_member(state, "flags") : NULL;
+    if(flags) {
+        const char *const names[] = { "operational", "paused", "printing", "pausing", "cancelling", "sdReady", "error", "ready" };
+        for(guint n=0;n<G_N_ELEMENTS(names);n++) {
+            g_variant_dict_insert(pending, names[n], "b", json_object_get_boolean_member_with_default(flags, names[n], FALSE));
+        }
+    }
+
+    JsonObject *job = json_object_has_member(data, "job") ? json_object_get_object_member(data, "job") : NULL;
+    JsonObject *file = job && json_object_has_member(job, "file") ? json_object_get_object_member(job, "file") : NULL;
+    if(file) {
+        opdesk_mqtt_ingest_job_file(pending,
+            json_object_get_string_member_with_default(file, "display", NULL),
+            json_object_get_string_member_with_default(file, "path", NULL),
+            json_object_get_string_member_with_default(file, "origin", NULL));
+    }
+
+    JsonObject *progress = json_object_has_member(data, "progress") ? json_object_get_object_member(data, "progress") : NULL;
+    if(progress) {
+        g_variant_dict_insert(pending, "timeLeft", "x", json_object_get_int_member_with_default(progress, "printTimeLeft", -1));
+    }
+}
+
+static void opdesk_mqtt_ingest_temperature(OPDeskMQTTIngest *ingest, IngestPrinter *printer, const char *heater, JsonObject *payload) {
+    gdouble *temp = g_hash_table_lookup(printer->temps, heater);
+    if(!temp) {
+        temp = g_new0(gdouble, 2);
+        g_hash_table_insert(printer->temps, g_strdup(heater), temp);
+    }
+    temp[0] = json_object_get_double_member_with_default(payload, "actual", 0.0);
+    temp[1] = json_object_get_double_member_with_default(payload, "target", 0.0);
+
+    if(!printer->pending && !printer->temps_dirty) {
+        g_ptr_array_add(ingest->dirty, printer);
+        if(!ingest->flush_source) ingest->flush_source = g_timeout_add(FLUSH_INTERVAL, G_SOURCE_FUNC(on_flush), ingest);
+    }
+    printer->temps_dirty = TRUE;
+}
+
+static void opdesk_mqtt_ingest_progress(OPDeskMQTTIngest *ingest, IngestPrinter *printer, const char *kind, JsonObject *payload) {
+    // slicing progress is of no interest
+    if(strcmp(kind, "printing")) return;
+
+    GVariantDict *pending = opdesk_mqtt_ingest_pending(ingest, printer);
+    g_variant_dict_insert(pending, "progress", "d", json_object_get_double_member_with_default(payload, "progress", 0.0) / 100.0);
+    opdesk_mqtt_ingest_job_file(pending, NULL,
+        json_object_get_string_member_with_default(payload, "path", NULL),
+        json_object_get_string_member_with_default(payload, "location", NULL));
+
+    if(json_object_has_member(payload, "printer_data")) {
+        JsonNode *data = json_object_get_member(payload, "printer_data");
+        if(JSON_NODE_HOLDS_OBJECT(data)) opdesk_mqtt_ingest_printer_data(pending, json_node_get_object(data));
+    }
+}
+
+static void opdesk_mqtt_ingest_event(OPDeskMQTTIngest *ingest, IngestPrinter *printer, const char *type, JsonObject *payload) {
+    // what the event implies goes in before anything handles it
+    if(strcmp(type, "PrinterStateChanged")==0) {
+        opdesk_mqtt_ingest_state_id(opdesk_mqtt_ingest_pending(ingest, printer), json_object_get_string_member_with_default(payload, "state_id", NULL));
+    } else if(strcmp(type, "PrintStarted")==0) {
+        GVariantDict *pending = opdesk_mqtt_ingest_pending(ingest, printer);
+        opdesk_mqtt_ingest_job_file(pending,
+            json_object_get_string_member_with_default(payload, "name", NULL),
+            json_object_get_string_member_with_default(payload, "path", NULL),
+            json_object_get_string_member_with_default(payload, "origin", NULL));
+        g_variant_dict_insert(pending, "progress", "d", 0.0);
+    } else if(strcmp(type, "PrintDone")==0) {
+        g_variant_dict_insert(opdesk_mqtt_ingest_pending(ingest, printer), "progress", "d", 1.0);
+    }
+    opdesk_mqtt_ingest_flush_printer(ingest, printer);
+
+    // as the websocket sends it
+    JsonObject *event_payload = json_object_new();
+    GList *members = json_object_get_members(payload);
+    for(GList *m = members; m; m = m->next) {
+        if(!g_str_has_prefix(m->data, "_")) json_object_set_member(event_payload, m->data, json_object_dup_member(payload, m->data));
+    }
+    g_list_free(members);
+
+    JsonObject *event = json_object_new();
+    json_object_set_string_member(event, "type", type);
+    json_object_set_object_member(event, "payload", event_payload);
+    opdesk_server_feed_event(printer->server, event);
+    json_object_unref(event);
+}
+
+static void opdesk_mqtt_ingest_set_connected(OPDeskMQTTIngest *ingest, IngestPrinter *printer, gboolean connected) {
+    if(opdesk_server_is_connected(printer->server)==connected) return;
+    g_variant_dict_insert(opdesk_mqtt_ingest_pending(ingest, printer), "connected", "b", connected);
+    opdesk_mqtt_ingest_flush_printer(ingest, printer);
+}
+
+// base/category/name, or base/mqtt for the last will
+static IngestPrinter *opdesk_mqtt_ingest_lookup(OPDeskMQTTIngest *ingest, const char *topic, char **category, char **name) {
+    *category = *name = NULL;
+
+    const char *last = strrchr(topic, '/');
+    if(!last) return NULL;
+
+    if(strcmp(last + 1, "mqtt")==0) {
+        char *base = g_strndup(topic, last + 1 - topic);
+        IngestPrinter *printer = g_hash_table_lookup(ingest->printers, base);
+        g_free(base);
+        if(printer) *category = g_strdup("mqtt");
+        return printer;
+    }
+
+    const char *cat = last;
+    while(cat > topic && *(cat - 1)!='/') cat--;
+    if(cat==topic) return NULL;
+
+    char *base = g_strndup(topic, cat - topic);
+    IngestPrinter *printer = g_hash_table_lookup(ingest->printers, base);
+    g_free(base);
+    if(!printer) return NULL;
+
+    *category = g_strndup(cat, last - cat);
+    *name = g_strdup(last + 1);
+    return printer;
+}
+
+static void on_message(OPDeskMQTTClient *client, const char *topic, GBytes *payload, gboolean retained, OPDeskMQTTIngest *ingest) {
+    char *category, *name;
+    IngestPrinter *printer = opdesk_mqtt_ingest_lookup(ingest, topic, &category, &name);
+    if(!printer) return;
+
+    gsize size;
+    const char *data = g_bytes_get_data(payload, &size);
+
+    if(strcmp(category, "mqtt")==0) {
+        opdesk_mqtt_ingest_set_connected(ingest, printer, size==9 && memcmp(data, "connected", 9)==0);
+        g_free(category);
+        return;
+    }
+
+    JsonParser *parser = json_parser_new();
+    GError *err = NULL;
+    if(!json_parser_load_from_data(parser, data, size, &err) || !JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser))) {
+        g_debug("Ignoring %s: %s", topic, err ? err->message : "not an object");
+        if(err) g_error_free(err);
+        g_object_unref(parser);
+        g_free(category);
+        g_free(name);
+        return;
+    }
+    JsonObject *obj = json_node_get_object(json_parser_get_root(parser));
+
+    // plugins without a last will are only known to be there by what they send
+    if(!retained) opdesk_mqtt_ingest_set_connected(ingest, printer, TRUE);
+
+    if(strcmp(category, "temperature")==0) opdesk_mqtt_ingest_temperature(ingest, printer, name, obj);
+    else if(strcmp(category, "progress")==0) opdesk_mqtt_ingest_progress(ingest, printer, name, obj);
+    // a retained event is history, not news
+    else if(strcmp(category, "event")==0 && !retained) opdesk_mqtt_ingest_event(ingest, printer, name, obj);
+
+    g_object_unref(parser);
+    g_free(category);
+    g_free(name);
+}
+
+static void on_disconnected(OPDeskMQTTClient *client, OPDeskMQTTIngest *ingest) {
+    // nothing is known about any of them until the broker is back
+    GHashTableIter iter;
+    IngestPrinter *printer;
+    g_hash_table_iter_init(&iter, ingest->printers);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer*)&printer)) opdesk_mqtt_ingest_set_connected(ingest, printer, FALSE);
+}
+
+OPDeskMQTTIngest *opdesk_mqtt_ingest_new(OPDeskAppConfig *config, GList *servers) {
+    const char *host = opdesk_app_config_get_string(config, "mqtt.host", NULL);
+    if(!host) return NULL;
+
+    OPDeskMQTTIngest *ingest = g_object_new(OPDESK_TYPE_MQTT_INGEST, NULL);
+    gboolean tls = opdesk_app_config_get_boolean(config, "mqtt.tls", FALSE);
+    guint16 port = opdesk_app_config_get_int(config, "mqtt.port", tls ? PORT_TLS_DEFAULT : PORT_DEFAULT);
+    ingest->client = opdesk_mqtt_client_new(host, port, opdesk_app_config_get_string(config, "mqtt.clientId", NULL));
+    opdesk_mqtt_client_set_tls(ingest->client, tls);
+    opdesk_mqtt_client_set_keep_alive(ingest->client, opdesk_app_config_get_int(config, "mqtt.keepAlive", 60));
+    opdesk_mqtt_client_set_credentials(ingest->client,
+        opdesk_app_config_get_string(config, "mqtt.username", NULL),
+        opdesk_app_config_get_string(config, "mqtt.password", NULL));
+
+    for(GList *s = servers; s; s = s->next) {
+        OPDeskConfig *server_config = opdesk_server_get_config(s->data);
+        const char *configured = opdesk_config_get_mqtt_base_topic(server_config);
+        char *base_topic = g_str_has_suffix(configured, "/") ? g_strdup(configured) : g_strconcat(configured, "/", NULL);
+        if(g_hash_table_contains(ingest->printers, base_topic)) {
+            g_warning("%s has the same MQTT base topic as another printer (%s), set a unique mqttBaseTopic for each", opdesk_config_get_printer_name(server_config), base_topic);
+            g_free(base_topic);
+            continue;
+        }
+
+        IngestPrinter *printer = g_new0(IngestPrinter, 1);
+        printer->server = s->data;
+        printer->base_topic = base_topic;
+        printer->temps = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+        g_hash_table_insert(ingest->printers, printer->base_topic, printer);
+
+        const char *const categories[] = { "temperature/+", "progress/+", "event/+", "mqtt" };
+        for(guint c=0;c<G_N_ELEMENTS(categories);c++) {
+            char *filter = g_strconcat(printer->base_topic, categories[c], NULL);
+            opdesk_mqtt_client_subscribe(ingest->client, filter);
+            g_free(filter);
+        }
+    }
+
+    g_signal_connect(ingest->client, "message", G_CALLBACK(on_message), ingest);
+    g_signal_connect(ingest->client, "disconnected", G_CALLBACK(on_disconnected), ingest);
+    opdesk_mqtt_client_connect(ingest->client);
+
+    g_message("Ingesting %u printers from MQTT broker %s:%u", g_hash_table_size(ingest->printers), host, port);
+    return ingest;
+}
@@ -0,0 +1,35 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <glib-object.h>
+
+#include "config.h"
+#include "server.h"
+
+G_BEGIN_DECLS
+
+/* Printer state from the OctoPrint-MQTT plugin over one broker connection, instead of a websocket per
+   printer. Each server's mqttBaseTopic is subscribed to and its temperature/, progress/ and event/
+   messages are fed into servers created with opdesk_server_new_fed. The plugin's last will (mqtt under
+   the base topic) says whether OctoPrint is connected. */
+#define OPDESK_TYPE_MQTT_INGEST opdesk_mqtt_ingest_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskMQTTIngest, opdesk_mqtt_ingest, OPDESK, MQTT_INGEST, GObject)
+
+/* NULL unless mqtt.host is set. The servers must outlive the ingest */
+OPDeskMQTTIngest *opdesk_mqtt_ingest_new(OPDeskAppConfig *config, GList *servers);
+
+G_END_DECLS
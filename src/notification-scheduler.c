@@ -0,0 +1,336 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-notify"
+#include <glib.h>
+
+#include "notification-scheduler.h"
+
+#define WINDOW_DEFAULT           2.0
+#define DIGEST_THRESHOLD_DEFAULT 3
+#define RATE_LOW_DEFAULT         4
+#define RATE_NORMAL_DEFAULT      10
+#define RATE_HIGH_DEFAULT        20
+
+// shortest time between flushes
+#define FLUSH_INTERVAL_MS 250
+#define DIGEST_MAX_NAMES  8
+
+// GNotificationPriority values are 0..3
+#define N_PRIORITIES (G_NOTIFICATION_PRIORITY_URGENT + 1)
+
+struct OPDeskPendingNotification {
+    char *full_id;
+    char *id;
+    char *printer_name;
+    char *body;
+    GNotificationPriority priority;
+    gint64 due;
+};
+typedef struct OPDeskPendingNotification OPDeskPendingNotification;
+
+// token bucket, refilled continuously at rate per minute. A rate <= 0 is unlimited
+struct OPDeskNotificationBucket {
+    gdouble tokens;
+    gdouble rate;
+    gint64 last_refill;
+};
+typedef struct OPDeskNotificationBucket OPDeskNotificationBucket;
+
+struct _OPDeskNotificationScheduler {
+    GObject parent_instance;
+
+    GApplication *app;
+    GIcon *notification_icon;
+    // nowhere to show them, see opdesk_notification_scheduler_set_log_only
+    gboolean log_only;
+
+    gint64 window;
+    guint digest_threshold;
+
+    OPDeskNotificationBucket buckets[N_PRIORITIES];
+
+    // pending notifications in submission order, indexed by full id for coalescing
+    GQueue pending;
+    GHashTable *pending_by_id;
+
+    guint flush_source;
+    gint64 flush_at;
+};
+
+G_DEFINE_TYPE (OPDeskNotificationScheduler, opdesk_notification_scheduler, G_TYPE_OBJECT)
+
+static gint priority_rank(GNotificationPriority priority) {
+    switch(priority) {
+    case G_NOTIFICATION_PRIORITY_LOW:    return 0;
+    case G_NOTIFICATION_PRIORITY_NORMAL: return 1;
+    case G_NOTIFICATION_PRIORITY_HIGH:   return 2;
+    case G_NOTIFICATION_PRIORITY_URGENT: return 3;
+    default:                             return 1;
+    }
+}
+
+static void opdesk_pending_notification_free(OPDeskPendingNotification *note) {
+    g_free(note->full_id);
+    g_free(note->id);
+    g_free(note->printer_name);
+    g_free(note->body);
+    g_free(note);
+}
+
+static void opdesk_notification_scheduler_finalize(GObject *object) {
+    OPDeskNotificationScheduler *self = OPDESK_NOTIFICATION_SCHEDULER(object);
+
+    if(self->flush_source) g_source_remove(self->flush_source);
+    g_hash_table_destroy(self->pending_by_id);
+    g_queue_clear_full(&self->pending, (GDestroyNotify)opdesk_pending_notification_free);
+    g_object_unref(self->notification_icon);
+
+    G_OBJECT_CLASS(opdesk_notification_scheduler_parent_class)->finalize(object);
+}
+
+static void opdesk_notification_scheduler_class_init(OPDeskNotificationSchedulerClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->finalize = opdesk_notification_scheduler_finalize;
+}
+
+static void opdesk_notification_scheduler_init(OPDeskNotificationScheduler *scheduler) {
+    scheduler->notification_icon = g_themed_icon_new("octoprint-tentacle");
+    g_queue_init(&scheduler->pending);
+    scheduler->pending_by_id = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+static void bucket_init(OPDeskNotificationBucket *bucket, gdouble rate) {
+    bucket->rate = rate;
+    bucket->tokens = MAX(rate, 1);
+    bucket->last_refill = g_get_monotonic_time();
+}
+
+static gboolean bucket_take(OPDeskNotificationBucket *bucket, gint64 now) {
+    if(bucket->rate <= 0) return TRUE;
+
+    gdouble elapsed_min = (gdouble)(now - bucket->last_refill) / (60.0 * G_USEC_PER_SEC);
+    bucket->tokens = MIN(MAX(bucket->rate, 1), bucket->tokens + elapsed_min * bucket->rate);
+    bucket->last_refill = now;
+
+    if(bucket->tokens < 1) return FALSE;
+    bucket->tokens -= 1;
+    return TRUE;
+}
+
+// when the bucket will have a token again, as of its last bucket_take
+static gint64 bucket_next(OPDeskNotificationBucket *bucket, gint64 now) {
+    if(bucket->rate <= 0 || bucket->tokens >= 1) return now;
+    return bucket->last_refill + (gint64)((1 - bucket->tokens) / bucket->rate * 60.0 * G_USEC_PER_SEC);
+}
+
+OPDeskNotificationScheduler *opdesk_notification_scheduler_new(GApplication *app, OPDeskAppConfig *config) {
+    OPDeskNotificationScheduler *scheduler = g_object_new(OPDESK_TYPE_NOTIFICATION_SCHEDULER, NULL);
+
+    scheduler->app = app;
+    scheduler->window = opdesk_app_config_get_double(config, "notifications.window", WINDOW_DEFAULT) * G_USEC_PER_SEC;
+    scheduler->digest_threshold = opdesk_app_config_get_int(config, "notifications.digestThreshold", DIGEST_THRESHOLD_DEFAULT);
+
+    bucket_init(&scheduler->buckets[G_NOTIFICATION_PRIORITY_LOW], opdesk_app_config_get_double(config, "notifications.rateLimit.low", RATE_LOW_DEFAULT));
+    bucket_init(&scheduler->buckets[G_NOTIFICATION_PRIORITY_NORMAL], opdesk_app_config_get_double(config, "notifications.rateLimit.normal", RATE_NORMAL_DEFAULT));
+    bucket_init(&scheduler->buckets[G_NOTIFICATION_PRIORITY_HIGH], opdesk_app_config_get_double(config, "notifications.rateLimit.high", RATE_HIGH_DEFAULT));
+
+    return scheduler;
+}
+
+void opdesk_notification_scheduler_set_log_only(OPDeskNotificationScheduler *scheduler, gboolean log_only) {
+    scheduler->log_only = log_only;
+}
+
+static void opdesk_notification_scheduler_send(OPDeskNotificationScheduler *scheduler, const char *const full_id, const char *const title, const char *const body, GNotificationPriority priority) {
+    if(scheduler->log_only) {
+        g_message("%s: %s", title, body);
+        return;
+    }
+
+    GNotification *notification = g_notification_new(title);
+    g_notification_set_priority(notification, priority);
+    g_notification_set_body(notification, body);
+    g_notification_set_icon(notification, scheduler->notification_icon);
+    g_application_send_notification(scheduler->app, full_id, notification);
+    g_object_unref(notification);
+}
+
+static void opdesk_notification_scheduler_send_pending(OPDeskNotificationScheduler *scheduler, OPDeskPendingNotification *note) {
+    gchar *title = g_strdup_printf("OctoPrint [%s]", note->printer_name);
+    opdesk_notification_scheduler_send(scheduler, note->full_id, title, note->body, note->priority);
+    g_free(title);
+}
+
+static void opdesk_notification_scheduler_remove_pending(OPDeskNotificationScheduler *scheduler, OPDeskPendingNotification *note) {
+    g_hash_table_remove(scheduler->pending_by_id, note->full_id);
+    g_queue_remove(&scheduler->pending, note);
+    opdesk_pending_notification_free(note);
+}
+
+// fold a group of notifications with the same id from different printers into one
+static void opdesk_notification_scheduler_send_digest(OPDeskNotificationScheduler *scheduler, GPtrArray *group) {
+    OPDeskPendingNotification *first = g_ptr_array_index(group, 0);
+    GNotificationPriority priority = first->priority;
+    gboolean same_body = TRUE;
+
+    GString *names = g_string_new(NULL);
+    for(guint n=0;n<group->len;n++) {
+        OPDeskPendingNotification *note = g_ptr_array_index(group, n);
+        if(priority_rank(note->priority) > priority_rank(priority)) priority = note->priority;
+        if(g_strcmp0(note->body, first->body)) same_body = FALSE;
+
+        if(n < DIGEST_MAX_NAMES) {
+            if(n) g_string_append(names, ", ");
+            g_string_append(names, note->printer_name);
+        }
+    }
+    if(group->len > DIGEST_MAX_NAMES) g_string_append_printf(names, " and %u more", group->len - DIGEST_MAX_NAMES);
+
+    gchar *title = g_strdup_printf("OctoPrint [%u printers]", group->len);
+    gchar *body = g_strdup_printf("%s\n%s", same_body ? first->body : "Multiple notifications", names->str);
+    gchar *full_id = g_strdup_printf("octoprint-digest-%s", first->id);
+
+    g_message("Digest of %u notifications: %s", group->len, first->id);
+    opdesk_notification_scheduler_send(scheduler, full_id, title, body, priority);
+
+    g_free(full_id);
+    g_free(body);
+    g_free(title);
+    g_string_free(names, TRUE);
+}
+
+static gboolean opdesk_notification_scheduler_flush(OPDeskNotificationScheduler *scheduler);
+
+static void opdesk_notification_scheduler_schedule(OPDeskNotificationScheduler *scheduler, gint64 at) {
+    if(scheduler->flush_source) {
+        if(scheduler->flush_at <= at) return;
+        g_source_remove(scheduler->flush_source);
+    }
+
+    gint64 now = g_get_monotonic_time();
+    guint interval = MAX(at - now, FLUSH_INTERVAL_MS * 1000) / 1000;
+    scheduler->flush_at = now + (gint64)interval * 1000;
+    scheduler->flush_source = g_timeout_add(interval, G_SOURCE_FUNC(opdesk_notification_scheduler_flush), scheduler);
+}
+
+static gboolean opdesk_notification_scheduler_flush(OPDeskNotificationScheduler *scheduler) {
+    gint64 now = g_get_monotonic_time();
+
+    // once anything with an id is due, everything pending with that id goes in its group
+    GHashTable *due_ids = g_hash_table_new(g_str_hash, g_str_equal);
+    for(GList *l = scheduler->pending.head; l; l = l->next) {
+        OPDeskPendingNotification *note = l->data;
+        if(note->due <= now) g_hash_table_add(due_ids, note->id);
+    }
+
+    GHashTable *groups = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)g_ptr_array_unref);
+    GPtrArray *order = g_ptr_array_new();
+    for(GList *l = scheduler->pending.head; l; l = l->next) {
+        OPDeskPendingNotification *note = l->data;
+        if(!g_hash_table_contains(due_ids, note->id)) continue;
+
+        GPtrArray *group = g_hash_table_lookup(groups, note->id);
+        if(!group) {
+            group = g_ptr_array_new();
+            g_hash_table_insert(groups, note->id, group);
+            g_ptr_array_add(order, group);
+        }
+        g_ptr_array_add(group, note);
+    }
+    g_hash_table_destroy(due_ids);
+
+    for(guint g=0;g<order->len;g++) {
+        GPtrArray *group = g_ptr_array_index(order, g);
+        OPDeskPendingNotification *first = g_ptr_array_index(group, 0);
+
+        if(scheduler->digest_threshold && group->len >= scheduler->digest_threshold) {
+            // a digest counts as a single notification
+            if(!bucket_take(&scheduler->buckets[first->priority], now)) continue;
+
+            opdesk_notification_scheduler_send_digest(scheduler, group);
+            for(guint n=0;n<group->len;n++) opdesk_notification_scheduler_remove_pending(scheduler, g_ptr_array_index(group, n));
+            continue;
+        }
+
+        for(guint n=0;n<group->len;n++) {
+            OPDeskPendingNotification *note = g_ptr_array_index(group, n);
+            // rate limited notifications stay pending and are retried once the bucket refills
+            if(!bucket_take(&scheduler->buckets[note->priority], now)) continue;
+
+            opdesk_notification_scheduler_send_pending(scheduler, note);
+            opdesk_notification_scheduler_remove_pending(scheduler, note);
+        }
+    }
+
+    g_ptr_array_unref(order);
+    g_hash_table_destroy(groups);
+
+    // sleep until the next note is due or its bucket refills instead of polling
+    scheduler->flush_source = 0;
+    if(g_queue_is_empty(&scheduler->pending)) return G_SOURCE_REMOVE;
+
+    gint64 next = G_MAXINT64;
+    for(GList *l = scheduler->pending.head; l; l = l->next) {
+        OPDeskPendingNotification *note = l->data;
+        gint64 at = note->due > now ? note->due : bucket_next(&scheduler->buckets[note->priority], now);
+        next = MIN(next, at);
+    }
+    opdesk_notification_scheduler_schedule(scheduler, next);
+
+    return G_SOURCE_REMOVE;
+}
+
+void opdesk_notification_scheduler_submit(OPDeskNotificationScheduler *scheduler, const char *const printer_name, GNotificationPriority priority, const char *const id, const char *const body) {
+    gchar *full_id = g_strdup_printf("octoprint-%s-%s", printer_name, id);
+    OPDeskPendingNotification *pending = g_hash_table_lookup(scheduler->pending_by_id, full_id);
+
+    if(priority==G_NOTIFICATION_PRIORITY_URGENT) {
+        // urgent notifications skip the queue, and replace anything pending with the same id
+        if(pending) opdesk_notification_scheduler_remove_pending(scheduler, pending);
+
+        gchar *title = g_strdup_printf("OctoPrint [%s]", printer_name);
+        opdesk_notification_scheduler_send(scheduler, full_id, title, body, priority);
+        g_free(title);
+        g_free(full_id);
+        return;
+    }
+
+    if(pending) {
+        // coalesce, the newest notification wins but keeps its place in the queue
+        g_debug("Coalescing notification %s", full_id);
+        g_free(pending->body);
+        pending->body = g_strdup(body);
+        pending->priority = priority;
+        g_free(full_id);
+        return;
+    }
+
+    pending = g_malloc0(sizeof(OPDeskPendingNotification));
+    pending->full_id = full_id;
+    pending->id = g_strdup(id);
+    pending->printer_name = g_strdup(printer_name);
+    pending->body = g_strdup(body);
+    pending->priority = priority;
+    pending->due = g_get_monotonic_time() + scheduler->window;
+
+    g_queue_push_tail(&scheduler->pending, pending);
+    g_hash_table_insert(scheduler->pending_by_id, pending->full_id, pending);
+
+    opdesk_notification_scheduler_schedule(scheduler, pending->due);
+}
@@ -0,0 +1,38 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gio/gio.h>
+
+#include "config.h"
+
+G_BEGIN_DECLS
+
+/* Sits between the server menus and GApplication. Notifications are held for a short window
+   so repeats can be coalesced and bursts from many printers folded into a single digest,
+   then sent subject to a per priority rate limit. Urgent notifications are sent immediately. */
+#define OPDESK_TYPE_NOTIFICATION_SCHEDULER opdesk_notification_scheduler_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskNotificationScheduler, opdesk_notification_scheduler, OPDESK, NOTIFICATION_SCHEDULER, GObject)
+
+OPDeskNotificationScheduler *opdesk_notification_scheduler_new(GApplication *app, OPDeskAppConfig *config);
+
+/* Log notifications instead of sending them, for --headless without a session bus.
+   Coalescing, digests and rate limits still apply */
+void opdesk_notification_scheduler_set_log_only(OPDeskNotificationScheduler *scheduler, gboolean log_only);
+
+void opdesk_notification_scheduler_submit(OPDeskNotificationScheduler *scheduler, const char *const printer_name, GNotificationPriority priority, const char *const id, const char *const body);
+
+G_END_DECLS
@@ -17,20 +17,55 @@
 #define G_LOG_USE_STRUCTURED
 #define G_LOG_DOMAIN "octoclient"
 #include <glib.h>
+#include <string.h>
 
 #include <libsoup/soup.h>
 #include "client.h"
 
+#define OCTOPRINT_CLIENT_MAX_PER_HOST 4
+#define OCTOPRINT_CLIENT_MAX_ATTEMPTS 3
+#define OCTOPRINT_CLIENT_RETRY_DELAY 500 // ms, doubled for each attempt
+#define OCTOPRINT_CLIENT_RETRY_MAX_DELAY 30000 // ms, longer Retry-After values are cut to this
+#define OCTOPRINT_CLIENT_INTERACTIVE_TIMEOUT 10000 // ms
+
+/* A parsed GET response kept for conditional requests */
+struct OctoPrintClientCacheEntry {
+    char *path;
+    JsonObject *body;
+    char *etag;
+    char *last_modified;
+    gint64 fetched; // monotonic time
+    gsize size;
+
+    GList *lru_link;
+};
+typedef struct OctoPrintClientCacheEntry OctoPrintClientCacheEntry;
+
 struct _OctoPrintClient {
     GObject parent_instance;
 
     SoupSession *session;
     char *url;
     char *api_key;
+
+    struct {
+        GHashTable *entries; // path -> OctoPrintClientCacheEntry
+        GQueue lru; // most recently used at the head
+        gsize size;
+        gsize max_size;
+        GHashTable *ttls; // path prefix -> seconds
+    } cache;
+
+    OctoPrintStats *stats;
+
+    // shared with other clients for the same host, see octoprint_client_get_host_queue
+    struct OctoPrintHostQueue *host_queue;
 };
 
 G_DEFINE_TYPE (OctoPrintClient, octoprint_client, G_TYPE_OBJECT)
 
+static void octoprint_client_release_host_queue(OctoPrintClient *client);
+
 typedef enum {
     PROP_URL = 1,
     PROP_API_KEY,
@@ -44,6 +79,7 @@ static void octoprint_client_set_property(GObject *object, guint property_id, co
 
     switch ((OctoPrintClientProperty)property_id) {
     case PROP_URL:
+        octoprint_client_release_host_queue(self);
         g_free(self->url);
         self->url = g_value_dup_string(value);
         break;
@@ -81,15 +117,113 @@ static void octoprint_client_dispose(GObject *object) {
 static void octoprint_client_finalize(GObject *object) {
     OctoPrintClient *self = OCTOPRINT_CLIENT(object);
 
+    octoprint_client_release_host_queue(self);
     g_free(self->url);
     g_free(self->api_key);
     g_object_unref(self->session);
 
+    g_hash_table_destroy(self->cache.entries);
+    g_queue_clear(&self->cache.lru);
+    g_hash_table_destroy(self->cache.ttls);
+
     G_OBJECT_CLASS(octoprint_client_parent_class)->finalize(object);
 }
 
+static void octoprint_client_cache_entry_free(OctoPrintClientCacheEntry *entry) {
+    g_free(entry->path);
+    json_object_unref(entry->body);
+    g_free(entry->etag);
+    g_free(entry->last_modified);
+    g_free(entry);
+}
+
 static void octoprint_client_init(OctoPrintClient *client) {
-    client->session = soup_session_new();
+    // requests are limited per host in octoprint_host_queue_dispatch, don't let libsoup queue them again
+    client->session = soup_session_new_with_options("max-conns-per-host", OCTOPRINT_CLIENT_MAX_PER_HOST, NULL);
+
+    client->cache.entries = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)octoprint_client_cache_entry_free);
+    g_queue_init(&client->cache.lru);
+    client->cache.ttls = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static void octoprint_client_cache_remove(OctoPrintClient *client, OctoPrintClientCacheEntry *entry) {
+    g_queue_delete_link(&client->cache.lru, entry->lru_link);
+    client->cache.size -= entry->size;
+    g_hash_table_remove(client->cache.entries, entry->path);
+}
+
+static void octoprint_client_cache_evict(OctoPrintClient *client) {
+    while(client->cache.size > client->cache.max_size && client->cache.lru.tail) {
+        OctoPrintClientCacheEntry *entry = client->cache.lru.tail->data;
+        g_debug("Evicting %s from cache", entry->path);
+        octoprint_client_cache_remove(client, entry);
+    }
+}
+
+static void octoprint_client_cache_touch(OctoPrintClient *client, OctoPrintClientCacheEntry *entry) {
+    g_queue_unlink(&client->cache.lru, entry->lru_link);
+    g_queue_push_head_link(&client->cache.lru, entry->lru_link);
+}
+
+static void octoprint_client_cache_store(OctoPrintClient *client, const char *const path, JsonObject *body, const char *etag, const char *last_modified, gsize size) {
+    OctoPrintClientCacheEntry *old = g_hash_table_lookup(client->cache.entries, path);
+    if(old) octoprint_client_cache_remove(client, old);
+
+    // don't let a single response flush everything else out
+    if(size > client->cache.max_size / 2) return;
+
+    OctoPrintClientCacheEntry *entry = g_malloc0(sizeof(OctoPrintClientCacheEntry));
+    entry->path = g_strdup(path);
+    entry->body = json_object_ref(body);
+    entry->etag = g_strdup(etag);
+    entry->last_modified = g_strdup(last_modified);
+    entry->fetched = g_get_monotonic_time();
+    entry->size = size;
+
+    g_queue_push_head(&client->cache.lru, entry);
+    entry->lru_link = client->cache.lru.head;
+    g_hash_table_insert(client->cache.entries, entry->path, entry);
+    client->cache.size += size;
+
+    octoprint_client_cache_evict(client);
+}
+
+// the TTL of the longest matching path prefix
+static guint octoprint_client_cache_get_ttl(OctoPrintClient *client, const char *const path) {
+    GHashTableIter iter;
+    gpointer prefix, ttl;
+    gsize best_len = 0;
+    guint best_ttl = 0;
+
+    g_hash_table_iter_init(&iter, client->cache.ttls);
+    while(g_hash_table_iter_next(&iter, &prefix, &ttl)) {
+        gsize len = strlen(prefix);
+        if(len > best_len && g_str_has_prefix(path, prefix)) {
+            best_len = len;
+            best_ttl = GPOINTER_TO_UINT(ttl);
+        }
+    }
+
+    return best_ttl;
+}
+
+void octoprint_client_set_stats(OctoPrintClient *client, OctoPrintStats *stats) {
+    client->stats = stats;
+}
+
+void octoprint_client_set_cache_size(OctoPrintClient *client, gsize max_size) {
+    client->cache.max_size = max_size;
+    octoprint_client_cache_evict(client);
+}
+
+void octoprint_client_set_cache_ttl(OctoPrintClient *client, const char *const path_prefix, guint ttl) {
+    g_hash_table_insert(client->cache.ttls, g_strdup(path_prefix), GUINT_TO_POINTER(ttl));
+}
+
+void octoprint_client_clear_cache(OctoPrintClient *client) {
+    g_queue_clear(&client->cache.lru);
+    g_hash_table_remove_all(client->cache.entries);
+    client->cache.size = 0;
 }
 
 OctoPrintClient *octoprint_client_new(const char *const url, const char *const api_key) {
@@ -99,11 +233,15 @@ OctoPrintClient *octoprint_client_new(const char *const url, const char *const a
         NULL);
 }
 
-static JsonObject *octoprint_client_perform(OctoPrintClient *client, const char *const method, const char *const path, JsonNode *data) {
+static SoupMessage *octoprint_client_build_message(OctoPrintClient *client, const char *const method, const char *const path, JsonNode *data, OctoPrintClientCacheEntry *cached) {
     gchar *full_url = g_strdup_printf("%s%s", client->url, path);
     SoupMessage *msg = soup_message_new(method, full_url);
+    g_free(full_url);
 
     soup_message_headers_append(msg->request_headers, "X-Api-Key", client->api_key);
+    if(cached && cached->etag) soup_message_headers_append(msg->request_headers, "If-None-Match", cached->etag);
+    if(cached && cached->last_modified) soup_message_headers_append(msg->request_headers, "If-Modified-Since", cached->last_modified);
+
     if(data) {
         JsonGenerator *gen = json_generator_new();
         json_generator_set_root(gen, data);
@@ -114,10 +252,43 @@ static JsonObject *octoprint_client_perform(OctoPrintClient *client, const char
         soup_message_set_request(msg, "application/json", SOUP_MEMORY_TAKE, body, blen);
     }
 
-    guint ret_code = soup_session_send_message(client->session, msg);
-    g_free(full_url);
+    return msg;
+}
+
+/* Looks up the cache entry for a request, dropping entries the request will make stale.
+   Sets *hit if the entry can be used without a request. */
+static OctoPrintClientCacheEntry *octoprint_client_cache_lookup(OctoPrintClient *client, const char *const method, const char *const path, JsonNode *data, gboolean *cacheable, gboolean *hit) {
+    *cacheable = client->cache.max_size && !data && g_strcmp0(method, "GET")==0;
+    *hit = FALSE;
 
-    if (ret_code >= 200 && ret_code < 300) {
+    OctoPrintClientCacheEntry *cached = g_hash_table_lookup(client->cache.entries, path);
+    if(!cached) return NULL;
+
+    if(!*cacheable) {
+        // anything else to a cached path probably changes it
+        octoprint_client_cache_remove(client, cached);
+        return NULL;
+    }
+
+    guint ttl = octoprint_client_cache_get_ttl(client, path);
+    if(ttl && g_get_monotonic_time() - cached->fetched < (gint64)ttl * G_USEC_PER_SEC) {
+        octoprint_client_cache_touch(client, cached);
+        *hit = TRUE;
+    }
+
+    return cached;
+}
+
+static JsonObject *octoprint_client_handle_response(OctoPrintClient *client, SoupMessage *msg, const char *const method, const char *const path, gboolean cacheable, OctoPrintClientCacheEntry *cached) {
+    guint ret_code = msg->status_code;
+
+    if (cached && ret_code==SOUP_STATUS_NOT_MODIFIED) {
+        cached->fetched = g_get_monotonic_time();
+        octoprint_client_cache_touch(client, cached);
+
+        g_message("%s %s -> %d", method, path, ret_code);
+        return json_object_ref(cached->body);
+    } else if (ret_code >= 200 && ret_code < 300) {
         JsonObject *obj = NULL;
         if(msg->response_body->length) {
             JsonParser *parser = json_parser_new();
@@ -127,39 +298,415 @@ static JsonObject *octoprint_client_perform(OctoPrintClient *client, const char
             obj = json_node_dup_object(root);
             g_object_unref(parser);
         }
-        g_object_unref(msg);
+
+        if(cacheable && obj) {
+            const char *etag = soup_message_headers_get_one(msg->response_headers, "ETag");
+            const char *last_modified = soup_message_headers_get_one(msg->response_headers, "Last-Modified");
+
+            // without a validator or TTL there's no way to use it again
+            if(etag || last_modified || octoprint_client_cache_get_ttl(client, path)) {
+                octoprint_client_cache_store(client, path, obj, etag, last_modified, msg->response_body->length);
+            }
+        }
 
         g_message("%s %s -> %d", method, path, ret_code);
         return obj;
     } else {
-        g_object_unref(msg);
         g_warning("%s %s -> %d", method, path, ret_code);
         return NULL;
     }
 }
 
-JsonObject *octoprint_client_login(OctoPrintClient *client) {
+static JsonObject *octoprint_client_perform(OctoPrintClient *client, const char *const method, const char *const path, JsonNode *data) {
+    gboolean cacheable, hit;
+    OctoPrintClientCacheEntry *cached = octoprint_client_cache_lookup(client, method, path, data, &cacheable, &hit);
+
+    if(hit) {
+        g_debug("%s %s -> cached", method, path);
+        return json_object_ref(cached->body);
+    }
+
+    SoupMessage *msg = octoprint_client_build_message(client, method, path, data, cached);
+    gint64 started = g_get_monotonic_time();
+    soup_session_send_message(client->session, msg);
+    if(client->stats) octoprint_stats_add_request(client->stats, path, g_get_monotonic_time() - started);
+
+    JsonObject *obj = octoprint_client_handle_response(client, msg, method, path, cacheable, cached);
+    g_object_unref(msg);
+
+    return obj;
+}
+
+/* Request scheduling
+   Asynchronous requests are queued per host (not per client, several OctoPrint instances
+   often share a host) by priority. One connection to each host is kept free for
+   interactive requests so they never wait behind background or bulk transfers. */
+
+
+struct OctoPrintHostQueue {
+    char *host;
+    GQueue queued[OCTOPRINT_REQUEST_N_PRIORITIES];
+    guint in_flight;
+    guint ref_count; // held by each client for the host and each of their requests
+};
+typedef struct OctoPrintHostQueue OctoPrintHostQueue;
+
+struct OctoPrintRequest {
+    gint ref_count;
+
+    OctoPrintClient *client;
+    OctoPrintHostQueue *host;
+    OctoPrintRequestPriority priority;
+
+    char *method;
+    char *path;
+    JsonNode *data;
+    SoupMessage *prepared; // sent as is instead of building a message from data
+
+    SoupMessage *msg; // only while in flight
+    gint64 started;
+    guint attempts;
+    gboolean unconditional; // sent without validators, see on_request_finished
+    gboolean done;
+    gboolean aborted;
+
+    gint64 deadline; // monotonic time, 0 for none
+    guint deadline_source;
+    guint retry_source; // waiting to be queued again after a transient error
+    GCancellable *cancellable;
+    gulong cancelled_id;
+
+    OctoPrintClientCallback callback;
+    gpointer user_data;
+};
+typedef struct OctoPrintRequest OctoPrintRequest;
+
+static GHashTable *host_queues = NULL; // "host:port" -> OctoPrintHostQueue
+
+static void octoprint_host_queue_unref(OctoPrintHostQueue *queue);
+
+static OctoPrintRequest *octoprint_request_ref(OctoPrintRequest *req) {
+    req->ref_count++;
+    return req;
+}
+
+static void octoprint_request_unref(OctoPrintRequest *req) {
+    if(--req->ref_count) return;
+
+    octoprint_host_queue_unref(req->host);
+    g_object_unref(req->client);
+    g_free(req->method);
+    g_free(req->path);
+    if(req->data) json_node_unref(req->data);
+    if(req->prepared) g_object_unref(req->prepared);
+    if(req->cancellable) g_object_unref(req->cancellable);
+    g_free(req);
+}
+
+static OctoPrintHostQueue *octoprint_client_get_host_queue(OctoPrintClient *client) {
+    if(client->host_queue) return client->host_queue;
+    if(!host_queues) host_queues = g_hash_table_new(g_str_hash, g_str_equal);
+
+    SoupURI *uri = soup_uri_new(client->url);
+    char *host = uri ? g_strdup_printf("%s:%u", uri->host, uri->port) : g_strdup(client->url);
+    if(uri) soup_uri_free(uri);
+
+    OctoPrintHostQueue *queue = g_hash_table_lookup(host_queues, host);
+    if(queue) {
+        g_free(host);
+    } else {
+        queue = g_malloc0(sizeof(OctoPrintHostQueue));
+        queue->host = host;
+        for(guint p=0;p<OCTOPRINT_REQUEST_N_PRIORITIES;p++) g_queue_init(&queue->queued[p]);
+        g_hash_table_insert(host_queues, queue->host, queue);
+    }
+
+    queue->ref_count++;
+    client->host_queue = queue;
+    return queue;
+}
+
+static void octoprint_host_queue_unref(OctoPrintHostQueue *queue) {
+    if(--queue->ref_count) return;
+
+    g_hash_table_remove(host_queues, queue->host);
+    g_free(queue->host);
+    g_free(queue);
 
-    // build the body : {passive: true}
+    if(!g_hash_table_size(host_queues)) g_clear_pointer(&host_queues, g_hash_table_destroy);
+}
+
+static void octoprint_client_release_host_queue(OctoPrintClient *client) {
+    if(client->host_queue) octoprint_host_queue_unref(client->host_queue);
+    client->host_queue = NULL;
+}
+
+static void octoprint_request_complete(OctoPrintRequest *req, guint status, JsonObject *response) {
+    if(req->done) return;
+    req->done = TRUE;
+
+    if(req->deadline_source) {
+        g_source_remove(req->deadline_source);
+        req->deadline_source = 0;
+    }
+    if(req->cancelled_id) {
+        g_cancellable_disconnect(req->cancellable, req->cancelled_id);
+        req->cancelled_id = 0;
+    }
+
+    if(req->callback) req->callback(req->client, status, response, req->user_data);
+}
+
+static void octoprint_host_queue_dispatch(OctoPrintHostQueue *host);
+
+static gboolean on_request_retry(OctoPrintRequest *req) {
+    req->retry_source = 0;
+
+    // the queue keeps its reference
+    g_queue_push_head(&req->host->queued[req->priority], req);
+    octoprint_host_queue_dispatch(req->host);
+    return G_SOURCE_REMOVE;
+}
+
+// ms before a request that failed with a transient error is sent again, Retry-After if the server sent one
+static guint octoprint_request_retry_delay(OctoPrintRequest *req, SoupMessage *msg) {
+    const char *retry_after = soup_message_headers_get_one(msg->response_headers, "Retry-After");
+    if(retry_after) {
+        // either seconds or an HTTP date
+        gchar *end = NULL;
+        guint64 seconds = g_ascii_strtoull(retry_after, &end, 10);
+        if(end!=retry_after && !*end) return MIN(seconds * 1000, OCTOPRINT_CLIENT_RETRY_MAX_DELAY);
+
+        SoupDate *date = soup_date_new_from_string(retry_after);
+        if(date) {
+            gint64 wait = (gint64)soup_date_to_time_t(date) - g_get_real_time() / G_USEC_PER_SEC;
+            soup_date_free(date);
+            return CLAMP(wait * 1000, 0, OCTOPRINT_CLIENT_RETRY_MAX_DELAY);
+        }
+    }
+
+    return OCTOPRINT_CLIENT_RETRY_DELAY << (req->attempts - 1);
+}
+
+static void on_request_finished(SoupSession *session, SoupMessage *msg, OctoPrintRequest *req) {
+    OctoPrintHostQueue *host = req->host;
+    host->in_flight--;
+    req->msg = NULL;
+    if(req->client->stats) octoprint_stats_add_request(req->client->stats, req->path, g_get_monotonic_time() - req->started);
+
+    guint status = msg->status_code;
+    gboolean idempotent = !req->prepared && g_strcmp0(req->method, "GET")==0;
+    gboolean transient = SOUP_STATUS_IS_TRANSPORT_ERROR(status) || status==SOUP_STATUS_BAD_GATEWAY || status==SOUP_STATUS_SERVICE_UNAVAILABLE || status==SOUP_STATUS_GATEWAY_TIMEOUT;
+
+    if(!req->aborted && idempotent && transient && req->attempts < OCTOPRINT_CLIENT_MAX_ATTEMPTS) {
+        guint delay = octoprint_request_retry_delay(req, msg);
+        // not worth waiting for if the deadline would cancel it first
+        if(!req->deadline || g_get_monotonic_time() + (gint64)delay * 1000 < req->deadline) {
+            g_message("%s %s -> %d, retrying in %u ms", req->method, req->path, status, delay);
+            req->retry_source = g_timeout_add(delay, G_SOURCE_FUNC(on_request_retry), req);
+            // the connection is free for others meanwhile
+            octoprint_host_queue_dispatch(host);
+            return;
+        }
+    }
+
+    if(req->aborted) {
+        g_warning("%s %s -> cancelled", req->method, req->path);
+        octoprint_request_complete(req, SOUP_STATUS_CANCELLED, NULL);
+    } else {
+        gboolean cacheable, hit;
+        OctoPrintClientCacheEntry *cached = octoprint_client_cache_lookup(req->client, req->method, req->path, req->data, &cacheable, &hit);
+        if(req->prepared) {
+            // the cache doesn't know what was actually requested
+            cacheable = FALSE;
+            cached = NULL;
+        } else if(status==SOUP_STATUS_NOT_MODIFIED && !cached && !req->unconditional) {
+            // the entry the validators came from was dropped while this was in flight, ask for the whole thing
+            g_message("%s %s -> %d, no longer cached, requesting it again", req->method, req->path, status);
+            req->unconditional = TRUE;
+            g_queue_push_head(&host->queued[req->priority], req);
+            octoprint_host_queue_dispatch(host);
+            return;
+        }
+        JsonObject *obj = octoprint_client_handle_response(req->client, msg, req->method, req->path, cacheable, cached);
+        octoprint_request_complete(req, status, obj);
+        if(obj) json_object_unref(obj);
+    }
+
+    // the request can hold the last reference to the host
+    octoprint_host_queue_dispatch(host);
+    octoprint_request_unref(req);
+}
+
+static void octoprint_request_start(OctoPrintRequest *req) {
+    gboolean cacheable, hit;
+    OctoPrintClientCacheEntry *cached = octoprint_client_cache_lookup(req->client, req->method, req->path, req->data, &cacheable, &hit);
+
+    if(hit && !req->prepared) {
+        g_debug("%s %s -> cached", req->method, req->path);
+        octoprint_request_complete(req, SOUP_STATUS_OK, cached->body);
+        octoprint_request_unref(req);
+        return;
+    }
+
+    req->attempts++;
+    req->host->in_flight++;
+    req->started = g_get_monotonic_time();
+    if(req->prepared) req->msg = g_object_ref(req->prepared);
+    else req->msg = octoprint_client_build_message(req->client, req->method, req->path, req->data, req->unconditional ? NULL : cached);
+
+    // the session takes the message reference
+    soup_session_queue_message(req->client->session, req->msg, (SoupSessionCallback)on_request_finished, req);
+}
+
+static void octoprint_host_queue_dispatch(OctoPrintHostQueue *host) {
+    // a request answered from the cache can drop the last reference to its client and the host with it
+    host->ref_count++;
+
+    while(host->in_flight < OCTOPRINT_CLIENT_MAX_PER_HOST) {
+        OctoPrintRequest *req = NULL;
+        for(guint p=0;p<OCTOPRINT_REQUEST_N_PRIORITIES && !req;p++) {
+            // keep a connection free for interactive requests
+            if(p!=OCTOPRINT_REQUEST_INTERACTIVE && host->in_flight >= OCTOPRINT_CLIENT_MAX_PER_HOST - 1) break;
+            req = g_queue_pop_head(&host->queued[p]);
+        }
+        if(!req) break;
+
+        octoprint_request_start(req);
+    }
+
+    octoprint_host_queue_unref(host);
+}
+
+// deadline passed or cancelled, always called from the main loop
+static void octoprint_request_abort(OctoPrintRequest *req) {
+    if(req->done || req->aborted) return;
+    req->aborted = TRUE;
+
+    if(req->msg) {
+        // on_request_finished completes the request
+        soup_session_cancel_message(req->client->session, req->msg, SOUP_STATUS_CANCELLED);
+    } else if(req->retry_source) {
+        g_source_remove(req->retry_source);
+        req->retry_source = 0;
+        g_warning("%s %s -> cancelled before it was retried", req->method, req->path);
+        octoprint_request_complete(req, SOUP_STATUS_CANCELLED, NULL);
+        octoprint_request_unref(req);
+    } else if(g_queue_remove(&req->host->queued[req->priority], req)) {
+        g_warning("%s %s -> cancelled before it was sent", req->method, req->path);
+        octoprint_request_complete(req, SOUP_STATUS_CANCELLED, NULL);
+        octoprint_request_unref(req);
+    }
+}
+
+static gboolean on_request_deadline(OctoPrintRequest *req) {
+    req->deadline_source = 0;
+    g_message("%s %s missed its deadline", req->method, req->path);
+    octoprint_request_abort(req);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean on_request_cancelled_idle(OctoPrintRequest *req) {
+    octoprint_request_abort(req);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_request_cancelled(GCancellable *cancellable, OctoPrintRequest *req) {
+    // g_cancellable_disconnect can't be called from here, finish up from the main loop
+    g_idle_add_full(G_PRIORITY_DEFAULT, G_SOURCE_FUNC(on_request_cancelled_idle), octoprint_request_ref(req), (GDestroyNotify)octoprint_request_unref);
+}
+
+static OctoPrintRequest *octoprint_request_new(OctoPrintClient *client, OctoPrintRequestPriority priority, const char *const method, const char *const path, OctoPrintClientCallback callback, gpointer user_data) {
+    OctoPrintRequest *req = g_malloc0(sizeof(OctoPrintRequest));
+    req->ref_count = 1; // held by the queue until finished
+    req->client = g_object_ref(client);
+    req->host = octoprint_client_get_host_queue(client);
+    req->host->ref_count++;
+    req->priority = priority;
+    req->method = g_strdup(method);
+    req->path = g_strdup(path);
+    req->callback = callback;
+    req->user_data = user_data;
+
+    return req;
+}
+
+static void octoprint_request_queue(OctoPrintRequest *req, guint timeout_ms, GCancellable *cancellable) {
+    if(timeout_ms) {
+        req->deadline = g_get_monotonic_time() + (gint64)timeout_ms * 1000;
+        req->deadline_source = g_timeout_add(timeout_ms, G_SOURCE_FUNC(on_request_deadline), req);
+    }
+    if(cancellable) {
+        req->cancellable = g_object_ref(cancellable);
+        req->cancelled_id = g_cancellable_connect(cancellable, G_CALLBACK(on_request_cancelled), req, NULL);
+    }
+
+    g_queue_push_tail(&req->host->queued[req->priority], req);
+    octoprint_host_queue_dispatch(req->host);
+}
+
+void octoprint_client_request_async(OctoPrintClient *client, OctoPrintRequestPriority priority, const char *const method, const char *const path, JsonNode *data, guint timeout_ms, GCancellable *cancellable, OctoPrintClientCallback callback, gpointer user_data) {
+    OctoPrintRequest *req = octoprint_request_new(client, priority, method, path, callback, user_data);
+    if(data) req->data = json_node_ref(data);
+
+    octoprint_request_queue(req, timeout_ms, cancellable);
+}
+
+SoupMessage *octoprint_client_new_message(OctoPrintClient *client, const char *const method, const char *const path) {
+    return octoprint_client_build_message(client, method, path, NULL, NULL);
+}
+
+void octoprint_client_queue_message(OctoPrintClient *client, OctoPrintRequestPriority priority, SoupMessage *msg, const char *const path, guint timeout_ms, GCancellable *cancellable, OctoPrintClientCallback callback, gpointer user_data) {
+    OctoPrintRequest *req = octoprint_request_new(client, priority, msg->method, path, callback, user_data);
+    req->prepared = g_object_ref(msg);
+
+    octoprint_request_queue(req, timeout_ms, cancellable);
+}
+
+void octoprint_client_pause_message(OctoPrintClient *client, SoupMessage *msg) {
+    soup_session_pause_message(client->session, msg);
+}
+
+void octoprint_client_unpause_message(OctoPrintClient *client, SoupMessage *msg) {
+    soup_session_unpause_message(client->session, msg);
+}
+
+// {passive: true}
+static JsonNode *octoprint_client_login_body(void) {
     JsonBuilder *builder = json_builder_new();
     json_builder_begin_object(builder);
     json_builder_set_member_name(builder, "passive");
     json_builder_add_boolean_value(builder, TRUE);
     json_builder_end_object(builder);
 
-    JsonNode *data = json_builder_get_root(builder);    
+    JsonNode *data = json_builder_get_root(builder);
+    g_object_unref(builder);
+
+    return data;
+}
 
+JsonObject *octoprint_client_login(OctoPrintClient *client) {
+    JsonNode *data = octoprint_client_login_body();
     JsonObject *ret = octoprint_client_perform(client, "POST", "/api/login", data);
-    g_object_unref(builder);
     json_node_unref(data);
 
     return ret;
 }
 
+void octoprint_client_login_async(OctoPrintClient *client, OctoPrintClientCallback callback, gpointer user_data) {
+    JsonNode *data = octoprint_client_login_body();
+    octoprint_client_request_async(client, OCTOPRINT_REQUEST_BACKGROUND, "POST", "/api/login", data, 30000, NULL, callback, user_data);
+    json_node_unref(data);
+}
+
 JsonObject *octoprint_client_pluginmanager_plugins(OctoPrintClient *client) {
     return octoprint_client_perform(client, "GET", "/plugin/pluginmanager/plugins", NULL);
 }
 
+void octoprint_client_pluginmanager_plugins_async(OctoPrintClient *client, OctoPrintClientCallback callback, gpointer user_data) {
+    octoprint_client_request_async(client, OCTOPRINT_REQUEST_BACKGROUND, "GET", "/plugin/pluginmanager/plugins", NULL, 30000, NULL, callback, user_data);
+}
+
 gboolean octoprint_client_plugin_enabled(OctoPrintClient *client, const char *const plugin_id) {
     JsonObject *resp = octoprint_client_pluginmanager_plugins(client);
 
@@ -168,6 +715,13 @@ gboolean octoprint_client_plugin_enabled(OctoPrintClient *client, const char *co
         return FALSE;
     }
 
+    gboolean enabled = octoprint_client_plugin_enabled_in(resp, plugin_id);
+    json_object_unref(resp);
+
+    return enabled;
+}
+
+gboolean octoprint_client_plugin_enabled_in(JsonObject *resp, const char *const plugin_id) {
     JsonArray *plugins = json_object_get_array_member(resp, "plugins");
     GList *plugin_member_first = json_array_get_elements(plugins);
     GList *plugin_member = plugin_member_first;
@@ -178,7 +732,6 @@ gboolean octoprint_client_plugin_enabled(OctoPrintClient *client, const char *co
 
         if(g_strcmp0(pkey, plugin_id)==0) {
             g_list_free(plugin_member_first);
-            json_object_unref(resp);
             g_debug("Checking if plugin is enabled: %s = %s", plugin_id, penabled ? "Yes" : "No");
             return penabled;
         }
@@ -187,8 +740,6 @@ gboolean octoprint_client_plugin_enabled(OctoPrintClient *client, const char *co
     }
     g_list_free(plugin_member_first);
 
-    json_object_unref(resp);
-
     g_debug("Checking if plugin is enabled: %s not installed (No)", plugin_id);
     return FALSE;
 }
@@ -205,15 +756,20 @@ gchar *octoprint_client_get_setting_string(OctoPrintClient *client, const char *
     JsonNode *root = json_node_new(JSON_NODE_OBJECT);
     json_node_set_object(root, settings);
 
-    GError *err;
+    GError *err = NULL;
     JsonNode *setting_value = json_path_query(setting_path, root, &err);
     
     if (!setting_value) {
         g_warning("Couldn't lookup octoprint setting %s: %s", setting_path, err->message);
+        g_error_free(err);
+        json_node_unref(root);
+        json_object_unref(settings);
+        return NULL;
     }
 
     JsonArray *matches = json_node_get_array(setting_value);
-    const char *val = json_array_get_string_element(matches, 0);
+    const char *val = NULL;
+    if(json_array_get_length(matches)) val = json_array_get_string_element(matches, 0);
 
     char *ret = NULL;
 
@@ -229,13 +785,21 @@ gchar *octoprint_client_get_setting_string(OctoPrintClient *client, const char *
 }
 
 void octoprint_client_plugin_simple_api_command(OctoPrintClient *client, const char *const plugin_id, JsonNode *payload) {
+    octoprint_client_plugin_simple_api_command_async(client, plugin_id, payload, NULL, NULL);
+}
+
+void octoprint_client_plugin_simple_api_command_async(OctoPrintClient *client, const char *const plugin_id, JsonNode *payload, OctoPrintClientCallback callback, gpointer user_data) {
     char *path = g_strdup_printf("/api/plugin/%s", plugin_id);
 
-    octoprint_client_perform(client, "POST", path, payload);
+    octoprint_client_request_async(client, OCTOPRINT_REQUEST_INTERACTIVE, "POST", path, payload, OCTOPRINT_CLIENT_INTERACTIVE_TIMEOUT, NULL, callback, user_data);
     g_free(path);
 }
 
 void octoprint_client_psucontrol_turn_on(OctoPrintClient *client) {
+    octoprint_client_psucontrol_turn_on_async(client, NULL, NULL);
+}
+
+void octoprint_client_psucontrol_turn_on_async(OctoPrintClient *client, OctoPrintClientCallback callback, gpointer user_data) {
     JsonBuilder *builder = json_builder_new();
     json_builder_begin_object(builder);
     json_builder_set_member_name(builder, "command");
@@ -244,11 +808,16 @@ void octoprint_client_psucontrol_turn_on(OctoPrintClient *client) {
 
     JsonNode *data = json_builder_get_root(builder);  
 
-    octoprint_client_plugin_simple_api_command(client, "psucontrol", data);
+    octoprint_client_plugin_simple_api_command_async(client, "psucontrol", data, callback, user_data);
+    json_node_unref(data);
     g_object_unref(builder);
 }
 
 void octoprint_client_psucontrol_turn_off(OctoPrintClient *client) {
+    octoprint_client_psucontrol_turn_off_async(client, NULL, NULL);
+}
+
+void octoprint_client_psucontrol_turn_off_async(OctoPrintClient *client, OctoPrintClientCallback callback, gpointer user_data) {
     JsonBuilder *builder = json_builder_new();
     json_builder_begin_object(builder);
     json_builder_set_member_name(builder, "command");
@@ -257,7 +826,8 @@ void octoprint_client_psucontrol_turn_off(OctoPrintClient *client) {
 
     JsonNode *data = json_builder_get_root(builder);  
 
-    octoprint_client_plugin_simple_api_command(client, "psucontrol", data);
+    octoprint_client_plugin_simple_api_command_async(client, "psucontrol", data, callback, user_data);
+    json_node_unref(data);
     g_object_unref(builder);
 }
 
@@ -301,7 +871,31 @@ JsonObject *octoprint_client_get_printer_profile(OctoPrintClient *client, const
     return resp;
 }
 
+void octoprint_client_send_commands(OctoPrintClient *client, const char *const *commands) {
+    octoprint_client_send_commands_async(client, commands, NULL, NULL);
+}
+
+void octoprint_client_send_commands_async(OctoPrintClient *client, const char *const *commands, OctoPrintClientCallback callback, gpointer user_data) {
+    JsonBuilder *builder = json_builder_new();
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "commands");
+    json_builder_begin_array(builder);
+    for(const char *const *c=commands;*c;c++) json_builder_add_string_value(builder, *c);
+    json_builder_end_array(builder);
+    json_builder_end_object(builder);
+
+    JsonNode *root = json_builder_get_root(builder);
+
+    octoprint_client_request_async(client, OCTOPRINT_REQUEST_INTERACTIVE, "POST", "/api/printer/command", root, OCTOPRINT_CLIENT_INTERACTIVE_TIMEOUT, NULL, callback, user_data);
+    json_node_unref(root);
+    g_object_unref(builder);
+}
+
 void octoprint_client_set_bed_target(OctoPrintClient *client, gint target) {
+    octoprint_client_set_bed_target_async(client, target, NULL, NULL);
+}
+
+void octoprint_client_set_bed_target_async(OctoPrintClient *client, gint target, OctoPrintClientCallback callback, gpointer user_data) {
     JsonBuilder *builder = json_builder_new();
     json_builder_begin_object(builder);
     json_builder_set_member_name(builder, "command");
@@ -312,7 +906,8 @@ void octoprint_client_set_bed_target(OctoPrintClient *client, gint target) {
 
     JsonNode *root = json_builder_get_root(builder);
 
-    octoprint_client_perform(client, "POST", "/api/printer/bed", root);
+    octoprint_client_request_async(client, OCTOPRINT_REQUEST_INTERACTIVE, "POST", "/api/printer/bed", root, OCTOPRINT_CLIENT_INTERACTIVE_TIMEOUT, NULL, callback, user_data);
+    json_node_unref(root);
     g_object_unref(builder);
 }
 void octoprint_client_set_chamber_target(OctoPrintClient *client, gint target) {
@@ -326,7 +921,8 @@ void octoprint_client_set_chamber_target(OctoPrintClient *client, gint target) {
 
     JsonNode *root = json_builder_get_root(builder);
 
-    octoprint_client_perform(client, "POST", "/api/printer/chamber", root);
+    octoprint_client_request_async(client, OCTOPRINT_REQUEST_INTERACTIVE, "POST", "/api/printer/chamber", root, OCTOPRINT_CLIENT_INTERACTIVE_TIMEOUT, NULL, NULL, NULL);
+    json_node_unref(root);
     g_object_unref(builder);
 }
 
@@ -346,8 +942,51 @@ void octoprint_client_set_tool_target(OctoPrintClient *client, gint tool, gint t
 
     JsonNode *root = json_builder_get_root(builder);
 
-    octoprint_client_perform(client, "POST", "/api/printer/tool", root);
+    octoprint_client_request_async(client, OCTOPRINT_REQUEST_INTERACTIVE, "POST", "/api/printer/tool", root, OCTOPRINT_CLIENT_INTERACTIVE_TIMEOUT, NULL, NULL, NULL);
+    json_node_unref(root);
     g_free(tooln);
     g_object_unref(builder);
 }
- 
\ No newline at end of file
+ 
+void octoprint_client_set_tool_targets_async(OctoPrintClient *client, gint tools, gint target, OctoPrintClientCallback callback, gpointer user_data) {
+    JsonBuilder *builder = json_builder_new();
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "command");
+    json_builder_add_string_value(builder, "target");
+    json_builder_set_member_name(builder, "targets");
+    json_builder_begin_object(builder);
+    for(gint t=0;t<tools;t++) {
+        char *tooln = g_strdup_printf("tool%d", t);
+        json_builder_set_member_name(builder, tooln);
+        json_builder_add_int_value(builder, target);
+        g_free(tooln);
+    }
+    json_builder_end_object(builder);
+    json_builder_end_object(builder);
+
+    JsonNode *root = json_builder_get_root(builder);
+
+    octoprint_client_request_async(client, OCTOPRINT_REQUEST_INTERACTIVE, "POST", "/api/printer/tool", root, OCTOPRINT_CLIENT_INTERACTIVE_TIMEOUT, NULL, callback, user_data);
+    json_node_unref(root);
+    g_object_unref(builder);
+}
+
+void octoprint_client_select_file_async(OctoPrintClient *client, const char *const origin, const char *const path, gboolean print, OctoPrintClientCallback callback, gpointer user_data) {
+    JsonBuilder *builder = json_builder_new();
+    json_builder_begin_object(builder);
+    json_builder_set_member_name(builder, "command");
+    json_builder_add_string_value(builder, "select");
+    json_builder_set_member_name(builder, "print");
+    json_builder_add_boolean_value(builder, print);
+    json_builder_end_object(builder);
+
+    JsonNode *root = json_builder_get_root(builder);
+
+    char *escaped = g_uri_escape_string(path, "/", FALSE);
+    char *api_path = g_strdup_printf("/api/files/%s/%s", origin, escaped);
+    octoprint_client_request_async(client, OCTOPRINT_REQUEST_INTERACTIVE, "POST", api_path, root, OCTOPRINT_CLIENT_INTERACTIVE_TIMEOUT, NULL, callback, user_data);
+    g_free(api_path);
+    g_free(escaped);
+    json_node_unref(root);
+    g_object_unref(builder);
+}
@@ -17,7 +17,11 @@
 #pragma once
 
 #include <glib.h>
+#include <gio/gio.h>
 #include <json-glib/json-glib.h>
+#include <libsoup/soup.h>
+
+#include "stats.h"
 
 G_BEGIN_DECLS
 
@@ -26,28 +30,88 @@ G_DECLARE_FINAL_TYPE(OctoPrintClient, octoprint_client, OCTOPRINT, CLIENT, GObje
 
 OctoPrintClient *octoprint_client_new(const char *const url, const char *const api_key);
 
+/* GET responses are cached and revalidated with If-None-Match/If-Modified-Since.
+   The cache is size bounded (bytes of response body, 0 disables it) with least recently used entries evicted first.
+   Paths starting with path_prefix are returned from the cache without a request for ttl seconds.
+   Returned objects may be shared with the cache and must not be modified. */
+void octoprint_client_set_cache_size(OctoPrintClient *client, gsize max_size);
+void octoprint_client_set_cache_ttl(OctoPrintClient *client, const char *const path_prefix, guint ttl);
+void octoprint_client_clear_cache(OctoPrintClient *client);
+
+/* REST latency by endpoint is added to stats, which must outlive the client. NULL to stop.
+   Cached responses aren't counted */
+void octoprint_client_set_stats(OctoPrintClient *client, OctoPrintStats *stats);
+
+typedef enum {
+    OCTOPRINT_REQUEST_INTERACTIVE, // user actions, always have a connection available
+    OCTOPRINT_REQUEST_BACKGROUND,
+    OCTOPRINT_REQUEST_BULK,        // large transfers
+    OCTOPRINT_REQUEST_N_PRIORITIES
+} OctoPrintRequestPriority;
+
+/* status is the HTTP status, or SOUP_STATUS_CANCELLED if the request was cancelled or missed its deadline.
+   response is NULL on failure or an empty body and is only valid during the callback */
+typedef void (*OctoPrintClientCallback)(OctoPrintClient *client, guint status, JsonObject *response, gpointer user_data);
+
+/* Queue a request behind others of the same or higher priority to the same host.
+   timeout_ms of 0 means no deadline, GETs are retried after a backoff on transient errors. callback can be NULL,
+   and is called before this returns if a cached response can be used */
+void octoprint_client_request_async(OctoPrintClient *client, OctoPrintRequestPriority priority, const char *const method, const char *const path, JsonNode *data, guint timeout_ms, GCancellable *cancellable, OctoPrintClientCallback callback, gpointer user_data);
+
+/* For requests that need more control over the body than a JSON object, ie. streamed uploads.
+   The message has the API key set. */
+SoupMessage *octoprint_client_new_message(OctoPrintClient *client, const char *const method, const char *const path);
+/* Queue a message from octoprint_client_new_message like octoprint_client_request_async.
+   It is sent exactly once, even if it is a GET. The queue holds a reference to msg until it finishes */
+void octoprint_client_queue_message(OctoPrintClient *client, OctoPrintRequestPriority priority, SoupMessage *msg, const char *const path, guint timeout_ms, GCancellable *cancellable, OctoPrintClientCallback callback, gpointer user_data);
+/* Stop and resume reading a queued message's response, ie. to limit its rate.
+   Only valid once the message has been sent, ie. from its got-chunk handler */
+void octoprint_client_pause_message(OctoPrintClient *client, SoupMessage *msg);
+void octoprint_client_unpause_message(OctoPrintClient *client, SoupMessage *msg);
+
+/* The functions returning a response block the calling thread and skip the request queue,
+   only use them off the main thread. The _async versions are queued as background requests */
 JsonObject *octoprint_client_login(OctoPrintClient *client);
+void octoprint_client_login_async(OctoPrintClient *client, OctoPrintClientCallback callback, gpointer user_data);
 
 JsonObject *octoprint_client_pluginmanager_plugins(OctoPrintClient *client);
+void octoprint_client_pluginmanager_plugins_async(OctoPrintClient *client, OctoPrintClientCallback callback, gpointer user_data);
 gboolean octoprint_client_plugin_enabled(OctoPrintClient *client, const char *const plugin_id);
+/* plugin_enabled for a response from pluginmanager_plugins */
+gboolean octoprint_client_plugin_enabled_in(JsonObject *plugins, const char *const plugin_id);
 
 JsonObject *octoprint_client_get_settings(OctoPrintClient *client);
 
+/* Fetches all settings for a single JSONPath lookup, prefer an OctoPrintSettings snapshot */
 gchar *octoprint_client_get_setting_string(OctoPrintClient *client, const char *const setting_path);
 
+/* Commands are sent as interactive requests and return immediately */
 void octoprint_client_plugin_simple_api_command(OctoPrintClient *client, const char *const plugin_id, JsonNode *payload);
+void octoprint_client_plugin_simple_api_command_async(OctoPrintClient *client, const char *const plugin_id, JsonNode *payload, OctoPrintClientCallback callback, gpointer user_data);
 
 JsonObject *octoprint_client_get_connection(OctoPrintClient *client);
 gchar *octoprint_client_get_current_profile(OctoPrintClient *client);
 JsonObject *octoprint_client_get_printer_profile(OctoPrintClient *client, const gchar *profile_id);
 
+/* all commands are sent in a single request, OctoPrint queues them in order */
+void octoprint_client_send_commands(OctoPrintClient *client, const char *const *commands);
+void octoprint_client_send_commands_async(OctoPrintClient *client, const char *const *commands, OctoPrintClientCallback callback, gpointer user_data);
+
 void octoprint_client_set_bed_target(OctoPrintClient *client, gint target);
+void octoprint_client_set_bed_target_async(OctoPrintClient *client, gint target, OctoPrintClientCallback callback, gpointer user_data);
 void octoprint_client_set_chamber_target(OctoPrintClient *client, gint target);
 void octoprint_client_set_tool_target(OctoPrintClient *client, gint tool, gint target);
+/* sets tool0 through tool<tools-1> to the same target in one request */
+void octoprint_client_set_tool_targets_async(OctoPrintClient *client, gint tools, gint target, OctoPrintClientCallback callback, gpointer user_data);
+
+/* selects a file already on the server (origin local or sdcard), optionally starting the print */
+void octoprint_client_select_file_async(OctoPrintClient *client, const char *const origin, const char *const path, gboolean print, OctoPrintClientCallback callback, gpointer user_data);
 
 /* Plugin specific.
    NOTE: these assume the plugin is present and do nothing to verify that is true */
 void octoprint_client_psucontrol_turn_on(OctoPrintClient *client);
 void octoprint_client_psucontrol_turn_off(OctoPrintClient *client);
+void octoprint_client_psucontrol_turn_on_async(OctoPrintClient *client, OctoPrintClientCallback callback, gpointer user_data);
+void octoprint_client_psucontrol_turn_off_async(OctoPrintClient *client, OctoPrintClientCallback callback, gpointer user_data);
 
 G_END_DECLS
\ No newline at end of file
@@ -0,0 +1,359 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "octodownload"
+#include <glib.h>
+
+#include <libsoup/soup.h>
+#include "download.h"
+
+#define OCTOPRINT_DOWNLOAD_PROGRESS_INTERVAL (250 * 1000) // us
+#define OCTOPRINT_DOWNLOAD_MIN_PAUSE        (20 * 1000)  // us, smaller debts are carried to the next chunk
+
+struct _OctoPrintDownload {
+    GObject parent_instance;
+
+    OctoPrintClient *client;
+    char *path;
+    GFile *file;
+
+    // only while receiving
+    GFileIOStream *io;
+    SoupMessage *msg;
+
+    GCancellable *cancellable;
+
+    OctoPrintDownloadState state;
+    char *error;
+
+    // keep a partial file and continue it with a Range request
+    gboolean resumable;
+    // bytes already in the file when this attempt started
+    goffset offset;
+    // the server says offset is the whole file
+    gboolean complete;
+    // the partial file can't be continued, remove it even if resumable
+    gboolean discard;
+
+    goffset received;
+    goffset total;
+
+    gint64 last_progress;
+
+    // bytes/s, 0 for no limit. The response is paused while it's ahead of the limit
+    guint rate_limit;
+    gint64 rate_start;
+    goffset rate_received;
+    guint unpause_source;
+};
+
+G_DEFINE_TYPE(OctoPrintDownload, octoprint_download, G_TYPE_OBJECT)
+
+typedef enum {
+    PROGRESS,
+    FINISHED,
+    N_SIGNALS
+} OctoPrintDownloadSignals;
+
+static guint obj_signals[N_SIGNALS] = { 0, };
+
+static void octoprint_download_finalize(GObject *object) {
+    OctoPrintDownload *self = OCTOPRINT_DOWNLOAD(object);
+
+    g_object_unref(self->client);
+    g_free(self->path);
+    g_object_unref(self->file);
+    if(self->io) g_object_unref(self->io);
+    if(self->msg) g_object_unref(self->msg);
+    g_object_unref(self->cancellable);
+    g_free(self->error);
+
+    G_OBJECT_CLASS(octoprint_download_parent_class)->finalize(object);
+}
+
+#define octoprint_download_signal(a, b, c, ...) \
+        g_signal_new( \
+            a, \
+            G_TYPE_FROM_CLASS(b), \
+            G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, \
+            0, \
+            NULL, \
+            NULL, \
+            NULL, \
+            G_TYPE_NONE, \
+            c, \
+            __VA_ARGS__)
+
+static void octoprint_download_class_init(OctoPrintDownloadClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->finalize = octoprint_download_finalize;
+
+    obj_signals[PROGRESS] = octoprint_download_signal("progress", object_class, 0, NULL);
+    obj_signals[FINISHED] = octoprint_download_signal("finished", object_class, 0, NULL);
+}
+
+static void octoprint_download_init(OctoPrintDownload *download) {
+    download->cancellable = g_cancellable_new();
+    download->state = OCTOPRINT_DOWNLOAD_QUEUED;
+}
+
+OctoPrintDownload *octoprint_download_new(OctoPrintClient *client, const char *const path, GFile *dest) {
+    OctoPrintDownload *download = g_object_new(OCTOPRINT_TYPE_DOWNLOAD, NULL);
+    download->client = g_object_ref(client);
+    download->path = g_strdup(path);
+    download->file = g_object_ref(dest);
+
+    return download;
+}
+
+char *octoprint_download_file_path(const char *const origin, const char *const path) {
+    char *escaped = g_uri_escape_string(path, "/", FALSE);
+    char *ret = g_strdup_printf("/downloads/files/%s/%s", origin, escaped);
+    g_free(escaped);
+
+    return ret;
+}
+
+static void octoprint_download_fail(OctoPrintDownload *download, const char *const error) {
+    if(download->error) return;
+    download->error = g_strdup(error);
+    // on_download_finished picks up the error
+    g_cancellable_cancel(download->cancellable);
+}
+
+// drops everything after size and continues writing from there
+static gboolean octoprint_download_truncate(OctoPrintDownload *download, goffset size) {
+    if(!g_seekable_truncate(G_SEEKABLE(download->io), size, NULL, NULL) ||
+       !g_seekable_seek(G_SEEKABLE(download->io), size, G_SEEK_SET, NULL, NULL)) {
+        octoprint_download_fail(download, "Unable to restart download");
+        return FALSE;
+    }
+    download->received = size;
+    return TRUE;
+}
+
+static void on_msg_got_headers(SoupMessage *msg, OctoPrintDownload *download) {
+    if(msg->status_code==SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE && download->offset) {
+        // nothing after the end, the partial file may be the whole file already: Content-Range: bytes */<length>
+        const char *range = soup_message_headers_get_one(msg->response_headers, "Content-Range");
+        if(range && g_str_has_prefix(range, "bytes */") && g_ascii_strtoll(range + 8, NULL, 10)==download->offset) {
+            download->complete = TRUE;
+            download->total = download->offset;
+        } else {
+            download->discard = TRUE;
+        }
+        return;
+    }
+    if(!SOUP_STATUS_IS_SUCCESSFUL(msg->status_code)) return;
+
+    goffset length = soup_message_headers_get_content_length(msg->response_headers);
+    if(msg->status_code==SOUP_STATUS_PARTIAL_CONTENT) {
+        goffset start, end, total;
+        if(!soup_message_headers_get_content_range(msg->response_headers, &start, &end, &total) || start!=download->offset) {
+            g_warning("Download of %s resumed at the wrong offset", download->path);
+            download->discard = TRUE;
+            octoprint_download_fail(download, "Server resumed at the wrong offset");
+            return;
+        }
+        download->total = total > 0 ? total : download->offset + length;
+        g_message("Resuming download of %s at %" G_GOFFSET_FORMAT " bytes", download->path, download->offset);
+    } else {
+        if(download->offset) {
+            // the range was ignored, the whole file is coming
+            g_message("Download of %s can't be resumed, starting over", download->path);
+            if(!octoprint_download_truncate(download, 0)) return;
+            download->offset = 0;
+        }
+        download->total = length;
+    }
+
+    download->state = OCTOPRINT_DOWNLOAD_RECEIVING;
+    download->rate_start = g_get_monotonic_time();
+    download->rate_received = 0;
+    g_signal_emit(download, obj_signals[PROGRESS], 0);
+}
+
+static gboolean on_unpause(OctoPrintDownload *download) {
+    download->unpause_source = 0;
+    if(download->msg) octoprint_client_unpause_message(download->client, download->msg);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_msg_got_chunk(SoupMessage *msg, SoupBuffer *chunk, OctoPrintDownload *download) {
+    // error pages aren't part of the file
+    if(!SOUP_STATUS_IS_SUCCESSFUL(msg->status_code) || download->error) return;
+
+    GError *err = NULL;
+    if(!g_output_stream_write_all(g_io_stream_get_output_stream(G_IO_STREAM(download->io)), chunk->data, chunk->length, NULL, NULL, &err)) {
+        g_warning("Error writing %s: %s", download->path, err->message);
+        octoprint_download_fail(download, err->message);
+        g_error_free(err);
+        return;
+    }
+    download->received += chunk->length;
+
+    gint64 now = g_get_monotonic_time();
+    if(download->rate_limit) {
+        // when the bytes so far would be due at the limit, stop reading until then
+        download->rate_received += chunk->length;
+        gint64 due = download->rate_start + download->rate_received * G_USEC_PER_SEC / download->rate_limit;
+        if(due - now > OCTOPRINT_DOWNLOAD_MIN_PAUSE && !download->unpause_source) {
+            octoprint_client_pause_message(download->client, msg);
+            download->unpause_source = g_timeout_add((due - now) / 1000, G_SOURCE_FUNC(on_unpause), download);
+        }
+    }
+
+    if(now - download->last_progress < OCTOPRINT_DOWNLOAD_PROGRESS_INTERVAL) return;
+    download->last_progress = now;
+    g_signal_emit(download, obj_signals[PROGRESS], 0);
+}
+
+// redirects and authentication send the request again, drop what this attempt wrote
+static void on_msg_restarted(SoupMessage *msg, OctoPrintDownload *download) {
+    if(download->received==download->offset) return;
+
+    g_message("Restarting download of %s", download->path);
+    octoprint_download_truncate(download, download->offset);
+}
+
+static void on_download_finished(OctoPrintClient *client, guint status, JsonObject *response, OctoPrintDownload *download) {
+    if(download->error) {
+        download->state = OCTOPRINT_DOWNLOAD_FAILED;
+    } else if(status==SOUP_STATUS_CANCELLED) {
+        download->state = OCTOPRINT_DOWNLOAD_CANCELLED;
+    } else if(SOUP_STATUS_IS_SUCCESSFUL(status) || (status==SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE && download->complete)) {
+        download->state = OCTOPRINT_DOWNLOAD_DONE;
+    } else {
+        download->state = OCTOPRINT_DOWNLOAD_FAILED;
+        download->error = g_strdup_printf("%u %s", status, soup_status_get_phrase(status));
+    }
+
+    if(download->unpause_source) {
+        g_source_remove(download->unpause_source);
+        download->unpause_source = 0;
+    }
+    g_signal_handlers_disconnect_by_data(download->msg, download);
+    g_clear_object(&download->msg);
+
+    GError *err = NULL;
+    if(!g_io_stream_close(G_IO_STREAM(download->io), NULL, &err) && download->state==OCTOPRINT_DOWNLOAD_DONE) {
+        download->state = OCTOPRINT_DOWNLOAD_FAILED;
+        download->error = g_strdup(err->message);
+    }
+    if(err) g_error_free(err);
+    g_clear_object(&download->io);
+
+    if(download->state!=OCTOPRINT_DOWNLOAD_DONE && (!download->resumable || download->discard)) g_file_delete(download->file, NULL, NULL);
+
+    g_message("Download of %s %s, %" G_GOFFSET_FORMAT " bytes", download->path,
+        download->state==OCTOPRINT_DOWNLOAD_DONE ? "finished" : download->state==OCTOPRINT_DOWNLOAD_CANCELLED ? "cancelled" : "failed",
+        download->received);
+
+    g_signal_emit(download, obj_signals[FINISHED], 0);
+    g_object_unref(download); // taken in octoprint_download_start
+}
+
+gboolean octoprint_download_start(OctoPrintDownload *download, GError **error) {
+    g_return_val_if_fail(download->state==OCTOPRINT_DOWNLOAD_QUEUED && !download->msg, FALSE);
+
+    goffset existing = 0;
+    if(download->resumable) {
+        GFileInfo *info = g_file_query_info(download->file, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+        if(info) {
+            existing = g_file_info_get_size(info);
+            g_object_unref(info);
+        }
+    }
+
+    if(existing) {
+        download->io = g_file_open_readwrite(download->file, NULL, error);
+        if(download->io && !g_seekable_seek(G_SEEKABLE(download->io), 0, G_SEEK_END, NULL, error)) g_clear_object(&download->io);
+    } else {
+        download->io = g_file_replace_readwrite(download->file, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, NULL, error);
+    }
+    if(!download->io) return FALSE;
+    download->offset = existing;
+    download->received = existing;
+
+    download->msg = octoprint_client_new_message(download->client, "GET", download->path);
+    if(download->offset) soup_message_headers_set_range(download->msg->request_headers, download->offset, -1);
+    // chunks go straight to the file instead of piling up in the message
+    soup_message_body_set_accumulate(download->msg->response_body, FALSE);
+
+    g_signal_connect(download->msg, "got-headers", G_CALLBACK(on_msg_got_headers), download);
+    g_signal_connect(download->msg, "got-chunk", G_CALLBACK(on_msg_got_chunk), download);
+    g_signal_connect(download->msg, "restarted", G_CALLBACK(on_msg_restarted), download);
+
+    g_message("Downloading %s", download->path);
+
+    octoprint_client_queue_message(download->client, OCTOPRINT_REQUEST_BULK, download->msg, download->path, 0, download->cancellable,
+        (OctoPrintClientCallback)on_download_finished, g_object_ref(download));
+
+    return TRUE;
+}
+
+void octoprint_download_cancel(OctoPrintDownload *download) {
+    g_cancellable_cancel(download->cancellable);
+}
+
+void octoprint_download_set_resumable(OctoPrintDownload *download, gboolean resumable) {
+    g_return_if_fail(download->state==OCTOPRINT_DOWNLOAD_QUEUED && !download->msg);
+    download->resumable = resumable;
+}
+
+void octoprint_download_set_rate_limit(OctoPrintDownload *download, guint bytes_per_second) {
+    if(download->rate_limit==bytes_per_second) return;
+    download->rate_limit = bytes_per_second;
+
+    // measure against the new limit from now on
+    download->rate_start = g_get_monotonic_time();
+    download->rate_received = 0;
+    if(download->unpause_source) {
+        g_source_remove(download->unpause_source);
+        on_unpause(download);
+    }
+}
+
+const char *octoprint_download_get_path(OctoPrintDownload *download) {
+    return download->path;
+}
+
+GFile *octoprint_download_get_file(OctoPrintDownload *download) {
+    return download->file;
+}
+
+OctoPrintDownloadState octoprint_download_get_state(OctoPrintDownload *download) {
+    return download->state;
+}
+
+const char *octoprint_download_get_error(OctoPrintDownload *download) {
+    return download->error;
+}
+
+goffset octoprint_download_get_received(OctoPrintDownload *download) {
+    return download->received;
+}
+
+goffset octoprint_download_get_total(OctoPrintDownload *download) {
+    return download->total;
+}
+
+gdouble octoprint_download_get_progress(OctoPrintDownload *download) {
+    if(!download->total) return 0.0;
+    return MIN((gdouble)download->received / download->total, 1.0);
+}
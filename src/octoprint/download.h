@@ -0,0 +1,71 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "client.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+    OCTOPRINT_DOWNLOAD_QUEUED,
+    OCTOPRINT_DOWNLOAD_RECEIVING,
+    OCTOPRINT_DOWNLOAD_DONE,
+    OCTOPRINT_DOWNLOAD_FAILED,
+    OCTOPRINT_DOWNLOAD_CANCELLED
+} OctoPrintDownloadState;
+
+/* A file fetched from OctoPrint and written to a local file as it arrives, memory use doesn't
+   depend on the file size. Downloads are bulk requests and don't hold up anything else.
+   "progress" is emitted a few times a second while receiving, "finished" once it's done, failed or cancelled.
+   The local file is removed unless the download completes, or it's resumable. */
+#define OCTOPRINT_TYPE_DOWNLOAD octoprint_download_get_type()
+G_DECLARE_FINAL_TYPE(OctoPrintDownload, octoprint_download, OCTOPRINT, DOWNLOAD, GObject)
+
+/* path is the server path, ie. from octoprint_download_file_path */
+OctoPrintDownload *octoprint_download_new(OctoPrintClient *client, const char *const path, GFile *dest);
+
+/* /downloads/files/<origin>/<path> for a file in OctoPrint's storage, escaped */
+char *octoprint_download_file_path(const char *const origin, const char *const path);
+
+/* FALSE if the local file can't be created */
+gboolean octoprint_download_start(OctoPrintDownload *download, GError **error);
+void octoprint_download_cancel(OctoPrintDownload *download);
+
+/* Before starting. A resumable download keeps what it received when it fails or is cancelled,
+   and a new download to the same file asks for the rest with a Range request.
+   It starts over if the server ignores the range */
+void octoprint_download_set_resumable(OctoPrintDownload *download, gboolean resumable);
+/* bytes per second, 0 for no limit. Can be changed while receiving */
+void octoprint_download_set_rate_limit(OctoPrintDownload *download, guint bytes_per_second);
+
+const char *octoprint_download_get_path(OctoPrintDownload *download);
+GFile *octoprint_download_get_file(OctoPrintDownload *download);
+OctoPrintDownloadState octoprint_download_get_state(OctoPrintDownload *download);
+/* NULL unless the download failed */
+const char *octoprint_download_get_error(OctoPrintDownload *download);
+
+/* including what a resumed download already had */
+goffset octoprint_download_get_received(OctoPrintDownload *download);
+/* 0 if the server didn't send a length */
+goffset octoprint_download_get_total(OctoPrintDownload *download);
+/* 0.0 - 1.0 */
+gdouble octoprint_download_get_progress(OctoPrintDownload *download);
+
+G_END_DECLS
@@ -0,0 +1,171 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "octoiothread"
+#include <glib.h>
+
+#include "io-thread.h"
+
+// how long wakes are collected before draining, about a frame
+#define DRAIN_INTERVAL 16
+
+typedef struct {
+    OctoPrintIODrainFunc func;
+    gpointer user_data;
+} OctoPrintIODrain;
+
+struct _OctoPrintIOThread {
+    GObject parent_instance;
+
+    char *name;
+    GThread *thread;
+    GMainContext *context;
+    GMainLoop *loop;
+
+    // the creating thread's
+    GMainContext *drain_context;
+    GSource *drain_source;
+    gint drain_scheduled;
+    GList *drains; // OctoPrintIODrain
+};
+
+G_DEFINE_TYPE (OctoPrintIOThread, octoprint_io_thread, G_TYPE_OBJECT)
+
+static gboolean on_quit(GMainLoop *loop) {
+    g_main_loop_quit(loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void octoprint_io_thread_dispose(GObject *object) {
+    OctoPrintIOThread *self = OCTOPRINT_IO_THREAD(object);
+
+    if(self->thread) {
+        // at a lower priority than anything already invoked, so that runs first
+        g_main_context_invoke_full(self->context, G_PRIORITY_LOW, (GSourceFunc)on_quit, self->loop, NULL);
+        g_thread_join(self->thread);
+        self->thread = NULL;
+        g_debug("Stopped I/O thread %s", self->name);
+    }
+
+    // nothing can wake it now
+    if(self->drain_source) {
+        g_source_destroy(self->drain_source);
+        g_source_unref(self->drain_source);
+        self->drain_source = NULL;
+    }
+    g_list_free_full(self->drains, g_free);
+    self->drains = NULL;
+
+    G_OBJECT_CLASS(octoprint_io_thread_parent_class)->dispose(object);
+}
+
+static void octoprint_io_thread_finalize(GObject *object) {
+    OctoPrintIOThread *self = OCTOPRINT_IO_THREAD(object);
+
+    g_main_loop_unref(self->loop);
+    g_main_context_unref(self->context);
+    g_main_context_unref(self->drain_context);
+    g_free(self->name);
+
+    G_OBJECT_CLASS(octoprint_io_thread_parent_class)->finalize(object);
+}
+
+static void octoprint_io_thread_class_init(OctoPrintIOThreadClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = octoprint_io_thread_dispose;
+    object_class->finalize = octoprint_io_thread_finalize;
+}
+
+static void octoprint_io_thread_init(OctoPrintIOThread *thread) {
+    thread->context = g_main_context_new();
+    thread->loop = g_main_loop_new(thread->context, FALSE);
+}
+
+static gpointer octoprint_io_thread_run(OctoPrintIOThread *thread) {
+    // sessions and websockets created here run on this context
+    g_main_context_push_thread_default(thread->context);
+    g_main_loop_run(thread->loop);
+    g_main_context_pop_thread_default(thread->context);
+    return NULL;
+}
+
+// only ever dispatched by its ready time
+static gboolean drain_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+    g_source_set_ready_time(source, -1);
+    return callback(user_data);
+}
+
+static GSourceFuncs drain_source_funcs = {
+    .dispatch = drain_source_dispatch,
+};
+
+static gboolean on_drain(OctoPrintIOThread *thread) {
+    // before draining, anything pushed from here on needs another tick
+    g_atomic_int_set(&thread->drain_scheduled, 0);
+
+    // a drain can remove itself
+    GList *drains = g_list_copy(thread->drains);
+    for(GList *d = drains; d; d = d->next) {
+        OctoPrintIODrain *drain = d->data;
+        if(g_list_find(thread->drains, drain)) drain->func(drain->user_data);
+    }
+    g_list_free(drains);
+
+    return G_SOURCE_CONTINUE;
+}
+
+OctoPrintIOThread *octoprint_io_thread_new(const char *const name) {
+    OctoPrintIOThread *thread = g_object_new(OCTOPRINT_TYPE_IO_THREAD, NULL);
+    thread->name = g_strdup(name);
+
+    thread->drain_context = g_main_context_ref_thread_default();
+    thread->drain_source = g_source_new(&drain_source_funcs, sizeof(GSource));
+    g_source_set_name(thread->drain_source, name);
+    g_source_set_callback(thread->drain_source, (GSourceFunc)on_drain, thread, NULL);
+    g_source_attach(thread->drain_source, thread->drain_context);
+
+    thread->thread = g_thread_new(name, (GThreadFunc)octoprint_io_thread_run, thread);
+    g_debug("Started I/O thread %s", name);
+    return thread;
+}
+
+GMainContext *octoprint_io_thread_get_context(OctoPrintIOThread *thread) {
+    return thread->context;
+}
+
+void octoprint_io_thread_add_drain(OctoPrintIOThread *thread, OctoPrintIODrainFunc func, gpointer user_data) {
+    OctoPrintIODrain *drain = g_new0(OctoPrintIODrain, 1);
+    drain->func = func;
+    drain->user_data = user_data;
+    thread->drains = g_list_append(thread->drains, drain);
+}
+
+void octoprint_io_thread_remove_drain(OctoPrintIOThread *thread, OctoPrintIODrainFunc func, gpointer user_data) {
+    for(GList *d = thread->drains; d; d = d->next) {
+        OctoPrintIODrain *drain = d->data;
+        if(drain->func!=func || drain->user_data!=user_data) continue;
+        thread->drains = g_list_delete_link(thread->drains, d);
+        g_free(drain);
+        return;
+    }
+}
+
+void octoprint_io_thread_wake(OctoPrintIOThread *thread) {
+    if(!g_atomic_int_compare_and_exchange(&thread->drain_scheduled, 0, 1)) return;
+    g_source_set_ready_time(thread->drain_source, g_get_monotonic_time() + DRAIN_INTERVAL * 1000);
+}
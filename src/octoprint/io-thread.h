@@ -0,0 +1,43 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/* A thread running its own GMainContext for socket I/O and parsing. Work done there is handed back
+   to the thread that created it through queues the I/O side pushes to and then wakes: the drain
+   functions are called on the creating thread's context on its next tick, once per tick however
+   many wakes there were. */
+#define OCTOPRINT_TYPE_IO_THREAD octoprint_io_thread_get_type()
+G_DECLARE_FINAL_TYPE (OctoPrintIOThread, octoprint_io_thread, OCTOPRINT, IO_THREAD, GObject)
+
+typedef void (*OctoPrintIODrainFunc)(gpointer user_data);
+
+/* starts the thread. Disposing it stops and joins it, after anything already invoked on it has run */
+OctoPrintIOThread *octoprint_io_thread_new(const char *const name);
+
+GMainContext *octoprint_io_thread_get_context(OctoPrintIOThread *thread);
+
+/* creating thread only */
+void octoprint_io_thread_add_drain(OctoPrintIOThread *thread, OctoPrintIODrainFunc func, gpointer user_data);
+void octoprint_io_thread_remove_drain(OctoPrintIOThread *thread, OctoPrintIODrainFunc func, gpointer user_data);
+
+/* any thread, after pushing something for the drains */
+void octoprint_io_thread_wake(OctoPrintIOThread *thread);
+
+G_END_DECLS
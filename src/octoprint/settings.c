@@ -0,0 +1,123 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "octosettings"
+#include <glib.h>
+
+#include "settings.h"
+
+struct _OctoPrintSettings {
+    GObject parent_instance;
+
+    JsonObject *root;
+
+    // dotted path -> JsonNode, the nodes are owned by root
+    GHashTable *index;
+};
+
+G_DEFINE_TYPE(OctoPrintSettings, octoprint_settings, G_TYPE_OBJECT)
+
+static void octoprint_settings_finalize(GObject *object) {
+    OctoPrintSettings *self = OCTOPRINT_SETTINGS(object);
+
+    g_hash_table_destroy(self->index);
+    if(self->root) json_object_unref(self->root);
+
+    G_OBJECT_CLASS(octoprint_settings_parent_class)->finalize(object);
+}
+
+static void octoprint_settings_class_init(OctoPrintSettingsClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->finalize = octoprint_settings_finalize;
+}
+
+static void octoprint_settings_init(OctoPrintSettings *settings) {
+    settings->index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static void octoprint_settings_index_node(OctoPrintSettings *settings, const char *path, JsonNode *node);
+
+static void octoprint_settings_index_object(OctoPrintSettings *settings, const char *path, JsonObject *obj) {
+    GList *members_first = json_object_get_members(obj);
+    GList *member = members_first;
+    while(member) {
+        char *member_path = path ? g_strdup_printf("%s.%s", path, (char*)member->data) : g_strdup(member->data);
+        octoprint_settings_index_node(settings, member_path, json_object_get_member(obj, member->data));
+        g_free(member_path);
+        member = member->next;
+    }
+    g_list_free(members_first);
+}
+
+static void octoprint_settings_index_node(OctoPrintSettings *settings, const char *path, JsonNode *node) {
+    g_hash_table_insert(settings->index, g_strdup(path), node);
+
+    if(JSON_NODE_HOLDS_OBJECT(node)) {
+        octoprint_settings_index_object(settings, path, json_node_get_object(node));
+    } else if(JSON_NODE_HOLDS_ARRAY(node)) {
+        JsonArray *arr = json_node_get_array(node);
+        guint len = json_array_get_length(arr);
+        for(guint i=0;i<len;i++) {
+            char *element_path = g_strdup_printf("%s.%u", path, i);
+            octoprint_settings_index_node(settings, element_path, json_array_get_element(arr, i));
+            g_free(element_path);
+        }
+    }
+}
+
+OctoPrintSettings *octoprint_settings_new(JsonObject *settings) {
+    OctoPrintSettings *snapshot = g_object_new(OCTOPRINT_TYPE_SETTINGS, NULL);
+    snapshot->root = json_object_ref(settings);
+    octoprint_settings_index_object(snapshot, NULL, snapshot->root);
+
+    g_debug("Indexed %u settings", g_hash_table_size(snapshot->index));
+
+    return snapshot;
+}
+
+gboolean octoprint_settings_has(OctoPrintSettings *settings, const char *const path) {
+    return g_hash_table_contains(settings->index, path);
+}
+
+JsonNode *octoprint_settings_get_node(OctoPrintSettings *settings, const char *const path) {
+    return g_hash_table_lookup(settings->index, path);
+}
+
+const char *octoprint_settings_get_string(OctoPrintSettings *settings, const char *const path, const char *default_value) {
+    JsonNode *node = octoprint_settings_get_node(settings, path);
+    if(!node || !JSON_NODE_HOLDS_VALUE(node) || json_node_get_value_type(node)!=G_TYPE_STRING) return default_value;
+    return json_node_get_string(node);
+}
+
+gint64 octoprint_settings_get_int(OctoPrintSettings *settings, const char *const path, gint64 default_value) {
+    JsonNode *node = octoprint_settings_get_node(settings, path);
+    if(!node || !JSON_NODE_HOLDS_VALUE(node)) return default_value;
+    return json_node_get_int(node);
+}
+
+gdouble octoprint_settings_get_double(OctoPrintSettings *settings, const char *const path, gdouble default_value) {
+    JsonNode *node = octoprint_settings_get_node(settings, path);
+    if(!node || !JSON_NODE_HOLDS_VALUE(node)) return default_value;
+    return json_node_get_double(node);
+}
+
+gboolean octoprint_settings_get_boolean(OctoPrintSettings *settings, const char *const path, gboolean default_value) {
+    JsonNode *node = octoprint_settings_get_node(settings, path);
+    if(!node || !JSON_NODE_HOLDS_VALUE(node)) return default_value;
+    return json_node_get_boolean(node);
+}
@@ -0,0 +1,42 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+#include <glib-object.h>
+#include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+/* A read only copy of /api/settings, indexed by dotted path when it's created.
+   Array elements are indexed by position, ie. "temperature.profiles.0.bed" */
+#define OCTOPRINT_TYPE_SETTINGS octoprint_settings_get_type()
+G_DECLARE_FINAL_TYPE(OctoPrintSettings, octoprint_settings, OCTOPRINT, SETTINGS, GObject)
+
+/* takes a reference to settings */
+OctoPrintSettings *octoprint_settings_new(JsonObject *settings);
+
+gboolean octoprint_settings_has(OctoPrintSettings *settings, const char *const path);
+
+/* NULL if path doesn't exist. The node is owned by the snapshot */
+JsonNode *octoprint_settings_get_node(OctoPrintSettings *settings, const char *const path);
+
+const char *octoprint_settings_get_string(OctoPrintSettings *settings, const char *const path, const char *default_value);
+gint64 octoprint_settings_get_int(OctoPrintSettings *settings, const char *const path, gint64 default_value);
+gdouble octoprint_settings_get_double(OctoPrintSettings *settings, const char *const path, gdouble default_value);
+gboolean octoprint_settings_get_boolean(OctoPrintSettings *settings, const char *const path, gboolean default_value);
+
+G_END_DECLS
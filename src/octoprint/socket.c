@@ -21,18 +21,7 @@
 #include <json-glib/json-glib.h>
 #include <libsoup/soup.h>
 #include "socket.h"
-
-struct _OctoPrintSocket {
-    GObject parent_instance;
-
-    char *url;
-    SoupSession *session;
-    SoupWebsocketConnection *websocket;
-
-    gboolean connected;
-};
-
-G_DEFINE_TYPE (OctoPrintSocket, octoprint_socket, G_TYPE_OBJECT)
+#include "spsc-queue.h"
 
 typedef enum {
     CONNECTED,
@@ -49,8 +38,81 @@ typedef enum {
 
 static guint obj_signals[N_SIGNALS] = { 0, };
 
+// the message keys OctoPrint sends that are passed on, by signal
+static const char *const message_signals[N_SIGNALS] = {
+    [CONNECTED] = "connected",
+    [HISTORY] = "history",
+    [CURRENT] = "current",
+    [EVENT] = "event",
+    [PLUGIN] = "plugin",
+    [TIMELAPSE] = "timelapse",
+    [RENDERPROGRESS] = "renderProgress",
+};
+
+/* A decoded message on its way to a signal. Once queued the I/O side doesn't touch it again */
+typedef struct {
+    OctoPrintSocketSignal signal;
+    JsonObject *data;
+    char *error;
+} OctoPrintSocketMessage;
+
+static void octoprint_socket_message_free(OctoPrintSocketMessage *message) {
+    if(message->data) json_object_unref(message->data);
+    g_free(message->error);
+    g_free(message);
+}
+
+/* Everything done on the I/O context, the socket's own thread's unless it was created with an
+   OctoPrintIOThread. Shared by the socket and anything invoked on the I/O context, whichever is last frees it */
+typedef struct {
+    char *url;
+    OctoPrintIOThread *io_thread;
+    GMainContext *context; // NULL for the default
+    // without an I/O thread messages are emitted right away on this, NULL once disposed
+    OctoPrintSocket *socket;
+    // with one, they go through here to the drain
+    OctoPrintSPSCQueue *queue;
+
+    // I/O context only
+    SoupSession *session;
+    SoupWebsocketConnection *websocket;
+    gboolean shut_down;
+
+    // either
+    gint connected;
+    OctoPrintStats *stats;
+} OctoPrintSocketIO;
+
+static void octoprint_socket_io_clear(OctoPrintSocketIO *io) {
+    if(io->queue) octoprint_spsc_queue_free(io->queue);
+    g_free(io->url);
+}
+
+static OctoPrintSocketIO *octoprint_socket_io_ref(OctoPrintSocketIO *io) {
+    return g_atomic_rc_box_acquire(io);
+}
+
+static void octoprint_socket_io_unref(OctoPrintSocketIO *io) {
+    g_atomic_rc_box_release_full(io, (GDestroyNotify)octoprint_socket_io_clear);
+}
+
+static void octoprint_socket_io_closure_unref(OctoPrintSocketIO *io, GClosure *closure) {
+    octoprint_socket_io_unref(io);
+}
+
+struct _OctoPrintSocket {
+    GObject parent_instance;
+
+    char *url;
+    OctoPrintIOThread *io_thread;
+    OctoPrintSocketIO *io;
+};
+
+G_DEFINE_TYPE (OctoPrintSocket, octoprint_socket, G_TYPE_OBJECT)
+
 typedef enum {
     PROP_URL = 1,
+    PROP_IO_THREAD,
     N_PROPERTIES
 } OctoPrintSocketProperty;
 
@@ -64,6 +126,10 @@ static void octoprint_socket_set_property(GObject *object, guint property_id, co
         g_free(self->url);
         self->url = g_value_dup_string(value);
         break;
+    case PROP_IO_THREAD:
+        g_clear_object(&self->io_thread);
+        self->io_thread = g_value_dup_object(value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
         break;
@@ -76,13 +142,64 @@ static void octoprint_socket_get_property(GObject *object, guint property_id, GV
     case PROP_URL:
         g_value_set_string(value, self->url);
         break;
+    case PROP_IO_THREAD:
+        g_value_set_object(value, self->io_thread);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
         break;
     }
 }
 
+/* Calls onto the I/O context */
+
+typedef struct {
+    OctoPrintSocketIO *io;
+    char *text;
+} OctoPrintSocketCall;
+
+static void octoprint_socket_call_free(OctoPrintSocketCall *call) {
+    octoprint_socket_io_unref(call->io);
+    g_free(call->text);
+    g_free(call);
+}
+
+// runs func right away if the I/O context is the caller's
+static void octoprint_socket_invoke(OctoPrintSocket *socket, GSourceFunc func, const char *text) {
+    OctoPrintSocketCall *call = g_new0(OctoPrintSocketCall, 1);
+    call->io = octoprint_socket_io_ref(socket->io);
+    call->text = g_strdup(text);
+    g_main_context_invoke_full(socket->io->context, G_PRIORITY_DEFAULT, func, call, (GDestroyNotify)octoprint_socket_call_free);
+}
+
+static gboolean octoprint_socket_io_shutdown(OctoPrintSocketCall *call) {
+    OctoPrintSocketIO *io = call->io;
+    io->shut_down = TRUE;
+
+    if(io->websocket) {
+        g_signal_handlers_disconnect_by_data(io->websocket, io);
+        if(soup_websocket_connection_get_state(io->websocket)==SOUP_WEBSOCKET_STATE_OPEN) {
+            soup_websocket_connection_close(io->websocket, SOUP_WEBSOCKET_CLOSE_GOING_AWAY, NULL);
+        }
+        g_clear_object(&io->websocket);
+    }
+    if(io->session) soup_session_abort(io->session);
+    g_clear_object(&io->session);
+    return G_SOURCE_REMOVE;
+}
+
+static void octoprint_socket_drain(OctoPrintSocket *socket);
+
 static void octoprint_socket_dispose(GObject *object) {
+    OctoPrintSocket *self = OCTOPRINT_SOCKET(object);
+
+    if(self->io) {
+        if(self->io_thread) octoprint_io_thread_remove_drain(self->io_thread, (OctoPrintIODrainFunc)octoprint_socket_drain, self);
+        self->io->socket = NULL;
+        octoprint_socket_invoke(self, (GSourceFunc)octoprint_socket_io_shutdown, NULL);
+        g_clear_pointer(&self->io, octoprint_socket_io_unref);
+    }
+    g_clear_object(&self->io_thread);
 
     G_OBJECT_CLASS(octoprint_socket_parent_class)->dispose(object);
 }
@@ -91,11 +208,29 @@ static void octoprint_socket_finalize(GObject *object) {
     OctoPrintSocket *self = OCTOPRINT_SOCKET(object);
 
     g_free(self->url);
-    g_object_unref(self->session);
-    if(self->websocket) g_object_unref(self->websocket);
     G_OBJECT_CLASS(octoprint_socket_parent_class)->finalize(object);
 }
 
+static void octoprint_socket_constructed(GObject *object) {
+    OctoPrintSocket *self = OCTOPRINT_SOCKET(object);
+
+    OctoPrintSocketIO *io = g_atomic_rc_box_new0(OctoPrintSocketIO);
+    io->url = g_strdup(self->url);
+    if(self->io_thread) {
+        // not a reference, the last one can't be let go of on the thread itself. It's only stopped
+        // once everything invoked on it has run, and nothing else runs there to wake it after that
+        io->io_thread = self->io_thread;
+        io->context = octoprint_io_thread_get_context(self->io_thread);
+        io->queue = octoprint_spsc_queue_new((GDestroyNotify)octoprint_socket_message_free);
+        octoprint_io_thread_add_drain(self->io_thread, (OctoPrintIODrainFunc)octoprint_socket_drain, self);
+    } else {
+        io->socket = self;
+    }
+    self->io = io;
+
+    G_OBJECT_CLASS(octoprint_socket_parent_class)->constructed(object);
+}
+
 #define octoprint_socket_signal(a, b, c, ...) \
         g_signal_new( \
             a, \
@@ -114,10 +249,12 @@ static void octoprint_socket_class_init(OctoPrintSocketClass *klass) {
 
     object_class->get_property = octoprint_socket_get_property;
     object_class->set_property = octoprint_socket_set_property;
+    object_class->constructed = octoprint_socket_constructed;
     object_class->dispose = octoprint_socket_dispose;
     object_class->finalize = octoprint_socket_finalize;
 
     obj_properties[PROP_URL] = g_param_spec_string("url", "URL", "The OctoPrint base URL.", NULL, G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
+    obj_properties[PROP_IO_THREAD] = g_param_spec_object("io-thread", "I/O thread", "Thread the websocket runs on, NULL for the creating thread's context.", OCTOPRINT_TYPE_IO_THREAD, G_PARAM_CONSTRUCT_ONLY | G_PARAM_READWRITE);
 
     g_object_class_install_properties (object_class, N_PROPERTIES, obj_properties);
 
@@ -133,16 +270,67 @@ static void octoprint_socket_class_init(OctoPrintSocketClass *klass) {
 }
 
 static void octoprint_socket_init(OctoPrintSocket *socket) {
-    socket->session = soup_session_new();
 }
 
-OctoPrintSocket *octoprint_socket_new(const char *const url) {
+OctoPrintSocket *octoprint_socket_new(const char *const url, OctoPrintIOThread *io_thread) {
     return g_object_new(OCTOPRINT_TYPE_SOCKET, 
         "url", url,
+        "io-thread", io_thread,
         NULL);
 }
 
-static void octoprint_socket_on_ws_closed(SoupWebsocketConnection *ws, OctoPrintSocket *socket) {
+/* Delivery */
+
+static void octoprint_socket_emit(OctoPrintSocket *socket, OctoPrintSocketMessage *message) {
+    switch(message->signal) {
+    case DISCONNECTED:
+        g_signal_emit(socket, obj_signals[DISCONNECTED], 0);
+        break;
+    case ERROR:
+        g_signal_emit(socket, obj_signals[ERROR], 0, message->error);
+        break;
+    default:
+        g_signal_emit(socket, obj_signals[message->signal], 0, message->data);
+        break;
+    }
+}
+
+// I/O context, takes message
+static void octoprint_socket_io_deliver(OctoPrintSocketIO *io, OctoPrintSocketMessage *message) {
+    if(io->queue) {
+        octoprint_spsc_queue_push(io->queue, message);
+        octoprint_io_thread_wake(io->io_thread);
+        return;
+    }
+
+    if(io->socket) octoprint_socket_emit(io->socket, message);
+    octoprint_socket_message_free(message);
+}
+
+static void octoprint_socket_io_deliver_signal(OctoPrintSocketIO *io, OctoPrintSocketSignal signal, const char *error) {
+    OctoPrintSocketMessage *message = g_new0(OctoPrintSocketMessage, 1);
+    message->signal = signal;
+    message->error = g_strdup(error);
+    octoprint_socket_io_deliver(io, message);
+}
+
+// once per tick on the creating thread
+static void octoprint_socket_drain(OctoPrintSocket *socket) {
+    // a handler could drop the last reference
+    g_object_ref(socket);
+
+    OctoPrintSocketMessage *message;
+    while(socket->io && (message = octoprint_spsc_queue_pop(socket->io->queue))) {
+        octoprint_socket_emit(socket, message);
+        octoprint_socket_message_free(message);
+    }
+
+    g_object_unref(socket);
+}
+
+/* I/O context */
+
+static void octoprint_socket_on_ws_closed(SoupWebsocketConnection *ws, OctoPrintSocketIO *io) {
     gushort code = soup_websocket_connection_get_close_code(ws);
     gchar *error_msg;
 
@@ -188,12 +376,19 @@ static void octoprint_socket_on_ws_closed(SoupWebsocketConnection *ws, OctoPrint
         break;
 
     }
-    socket->connected = FALSE;
     g_warning("Disconnected from socket: %s, %s", error_msg, soup_websocket_connection_get_close_data(ws));
-    g_signal_emit(socket, obj_signals[DISCONNECTED], 0);
+
+    // a reconnect may already have replaced it
+    if(ws==io->websocket) {
+        g_atomic_int_set(&io->connected, FALSE);
+        io->websocket = NULL;
+    }
+    g_signal_handlers_disconnect_by_data(ws, io);
+    g_object_unref(ws);
+    octoprint_socket_io_deliver_signal(io, DISCONNECTED, NULL);
 }
 
-static void octoprint_socket_on_ws_message(SoupWebsocketConnection *ws, gint type, GBytes *message, OctoPrintSocket *socket) {
+static void octoprint_socket_on_ws_message(SoupWebsocketConnection *ws, gint type, GBytes *message, OctoPrintSocketIO *io) {
     if(type!=SOUP_WEBSOCKET_DATA_TEXT) return;
 
     gsize sz;
@@ -203,22 +398,38 @@ static void octoprint_socket_on_ws_message(SoupWebsocketConnection *ws, gint typ
 
     if(sz==0) return;
 
+    OctoPrintStats *stats = g_atomic_pointer_get(&io->stats);
     if(ptr[0]=='a') {
+        gint64 parse_start = g_get_monotonic_time();
         JsonParser *parser = json_parser_new();
-        json_parser_load_from_data(parser, ptr+1, -1, NULL);
+        json_parser_load_from_data(parser, ptr+1, sz-1, NULL);
+        if(stats) octoprint_stats_add_frame(stats, sz, g_get_monotonic_time() - parse_start);
+
+        // collected first so the parser is gone before anything is delivered, json-glib's
+        // references aren't atomic and a queued object must belong only to the other side
+        GPtrArray *messages = g_ptr_array_new();
 
         JsonNode *root = json_parser_get_root(parser);
-        if(JSON_NODE_HOLDS_ARRAY(root)) {
+        if(root && JSON_NODE_HOLDS_ARRAY(root)) {
             JsonArray *arr = json_node_get_array(root);
             GList *arr_list_first = json_array_get_elements(arr);
             GList *arr_list = arr_list_first;
             while(arr_list) {
-                JsonObject *msg = json_node_get_object(arr_list->data);
-                GList *msg_keys_first = json_object_get_members(msg);
+                JsonObject *msg = JSON_NODE_HOLDS_OBJECT(arr_list->data) ? json_node_get_object(arr_list->data) : NULL;
+                GList *msg_keys_first = msg ? json_object_get_members(msg) : NULL;
                 GList *msg_keys = msg_keys_first;
-                while(msg_keys) {                    
-                    JsonObject *data = json_object_get_object_member(msg, msg_keys->data);
-                    g_signal_emit_by_name(socket, msg_keys->data, data);
+                while(msg_keys) {
+                    JsonNode *data = json_object_get_member(msg, msg_keys->data);
+                    for(guint s=0;s<N_SIGNALS;s++) {
+                        if(!message_signals[s] || g_strcmp0(message_signals[s], msg_keys->data)) continue;
+                        if(!JSON_NODE_HOLDS_OBJECT(data)) break;
+
+                        OctoPrintSocketMessage *m = g_new0(OctoPrintSocketMessage, 1);
+                        m->signal = s;
+                        m->data = json_node_dup_object(data);
+                        g_ptr_array_add(messages, m);
+                        break;
+                    }
                     msg_keys = msg_keys->next;
                 }
                 arr_list = arr_list->next;
@@ -228,30 +439,82 @@ static void octoprint_socket_on_ws_message(SoupWebsocketConnection *ws, gint typ
         }
 
         g_object_unref(parser);
-    } else if (ptr[0]=='h') { g_message("Socket Heartbeat \U0001F49A"); }
+
+        for(guint m=0;m<messages->len;m++) octoprint_socket_io_deliver(io, g_ptr_array_index(messages, m));
+        g_ptr_array_free(messages, TRUE);
+    } else if (ptr[0]=='h') {
+        g_message("Socket Heartbeat \U0001F49A");
+        if(stats) octoprint_stats_add_frame(stats, sz, 0);
+    }
 }
 
-static void octoprint_socket_on_connect(SoupSession *session, GAsyncResult *res, OctoPrintSocket *socket) {
+static void octoprint_socket_on_connect(SoupSession *session, GAsyncResult *res, OctoPrintSocketIO *io) {
     GError *err = NULL;
-    if (socket->websocket = soup_session_websocket_connect_finish(session, res, &err)) {
+    SoupWebsocketConnection *websocket = soup_session_websocket_connect_finish(session, res, &err);
+
+    if(io->shut_down) {
+        if(websocket) {
+            soup_websocket_connection_close(websocket, SOUP_WEBSOCKET_CLOSE_GOING_AWAY, NULL);
+            g_object_unref(websocket);
+        }
+        if(err) g_error_free(err);
+    } else if (websocket) {
+        // the one it replaces, if it's still closing, is released by its closed handler
+        io->websocket = websocket;
 
         // don't limit incoming payload size
         // 0 = unlimited
         GValue max = G_VALUE_INIT;
         g_value_init(&max, G_TYPE_UINT64);
         g_value_set_uint64(&max, 0);
-        g_object_set_property(G_OBJECT(socket->websocket), "max-incoming-payload-size", &max);
+        g_object_set_property(G_OBJECT(io->websocket), "max-incoming-payload-size", &max);
 
-        socket->connected = TRUE;
-        g_signal_connect(socket->websocket, "message", G_CALLBACK(octoprint_socket_on_ws_message), socket);
-        g_signal_connect(socket->websocket, "closed", G_CALLBACK(octoprint_socket_on_ws_closed), socket);
-        g_debug("Socket connected to %s", socket->url);
+        g_atomic_int_set(&io->connected, TRUE);
+        // each holds the I/O state, a websocket still closing when it's shut down can outlive it
+        g_signal_connect_data(io->websocket, "message", G_CALLBACK(octoprint_socket_on_ws_message), octoprint_socket_io_ref(io), (GClosureNotify)octoprint_socket_io_closure_unref, 0);
+        g_signal_connect_data(io->websocket, "closed", G_CALLBACK(octoprint_socket_on_ws_closed), octoprint_socket_io_ref(io), (GClosureNotify)octoprint_socket_io_closure_unref, 0);
+        g_debug("Socket connected to %s", io->url);
     } else {
-        g_warning("Couldn't connect socket to %s: %s", socket->url, err->message);
-        g_signal_emit(socket, obj_signals[ERROR], 0, err->message);
+        g_warning("Couldn't connect socket to %s: %s", io->url, err->message);
+        octoprint_socket_io_deliver_signal(io, ERROR, err->message);
+        g_error_free(err);
     }
+
+    octoprint_socket_io_unref(io);
 }
 
+static gboolean octoprint_socket_io_connect(OctoPrintSocketCall *call) {
+    OctoPrintSocketIO *io = call->io;
+    if(io->shut_down) return G_SOURCE_REMOVE;
+
+    // created here so it uses this context
+    if(!io->session) io->session = soup_session_new();
+
+    SoupMessage *msg = soup_message_new("GET", call->text);
+    soup_session_websocket_connect_async(io->session, msg, NULL, NULL, NULL, (GAsyncReadyCallback)octoprint_socket_on_connect, octoprint_socket_io_ref(io));
+    g_object_unref(msg);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean octoprint_socket_io_disconnect(OctoPrintSocketCall *call) {
+    OctoPrintSocketIO *io = call->io;
+    if(io->websocket && soup_websocket_connection_get_state(io->websocket)==SOUP_WEBSOCKET_STATE_OPEN) {
+        soup_websocket_connection_close(io->websocket, SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean octoprint_socket_io_send(OctoPrintSocketCall *call) {
+    OctoPrintSocketIO *io = call->io;
+    if(!io->websocket || soup_websocket_connection_get_state(io->websocket)!=SOUP_WEBSOCKET_STATE_OPEN) return G_SOURCE_REMOVE;
+
+    g_debug("Sending message: %s", call->text);
+    soup_websocket_connection_send_text(io->websocket, call->text);
+    return G_SOURCE_REMOVE;
+}
+
+/* Creating thread */
+
 void octoprint_socket_connect(OctoPrintSocket *socket) {
     // create a session id, 16 random lower case letters
     char session[17];
@@ -271,17 +534,15 @@ void octoprint_socket_connect(OctoPrintSocket *socket) {
     full_url = g_strdup_printf("%s/sockjs/%s/%s/websocket", socket->url, server, session);
     g_debug("Connecting, full URL: %s", full_url);
 
-    SoupMessage *msg = soup_message_new("GET", full_url);
-    soup_session_websocket_connect_async(socket->session, msg, NULL, NULL, NULL, (GAsyncReadyCallback)octoprint_socket_on_connect, socket);
+    octoprint_socket_invoke(socket, (GSourceFunc)octoprint_socket_io_connect, full_url);
     g_rand_free(r);
     g_free(server);
     g_free(full_url);
 }
 
 void octoprint_socket_disconnect(OctoPrintSocket *socket) {
-    if(!socket->connected) return;
-    socket->connected = FALSE;
-    soup_websocket_connection_close(socket->websocket, SOUP_WEBSOCKET_CLOSE_NORMAL, NULL);
+    if(!g_atomic_int_compare_and_exchange(&socket->io->connected, TRUE, FALSE)) return;
+    octoprint_socket_invoke(socket, (GSourceFunc)octoprint_socket_io_disconnect, NULL);
 }
 
 static void octoprint_socket_send_message(OctoPrintSocket *socket, const char* message) {
@@ -303,15 +564,17 @@ static void octoprint_socket_send_message(OctoPrintSocket *socket, const char* m
     g_object_unref(builder);
     json_node_unref(root);
 
-    g_debug("Sending message: %s", msg);
-
-    soup_websocket_connection_send_text(socket->websocket, msg);
+    octoprint_socket_invoke(socket, (GSourceFunc)octoprint_socket_io_send, msg);
 
     g_free(msg);
 }
 
+void octoprint_socket_set_stats(OctoPrintSocket *socket, OctoPrintStats *stats) {
+    g_atomic_pointer_set(&socket->io->stats, stats);
+}
+
 gboolean octoprint_socket_is_connected(OctoPrintSocket *socket) {
-    return socket->connected;
+    return g_atomic_int_get(&socket->io->connected);
 }
 
 void octoprint_socket_auth(OctoPrintSocket *socket, const char *const user, const char *const session) {
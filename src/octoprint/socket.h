@@ -18,18 +18,26 @@
 
 #include <glib-object.h>
 
+#include "stats.h"
+#include "io-thread.h"
+
 G_BEGIN_DECLS
 
 #define OCTOPRINT_TYPE_SOCKET octoprint_socket_get_type()
 G_DECLARE_FINAL_TYPE (OctoPrintSocket, octoprint_socket, OCTOPRINT, SOCKET, GObject)
 
-OctoPrintSocket *octoprint_socket_new(const char *const url);
+/* With an io_thread the websocket and parsing run on it and signals are emitted on the creating
+   thread's next drain. NULL to do everything on the creating thread's context */
+OctoPrintSocket *octoprint_socket_new(const char *const url, OctoPrintIOThread *io_thread);
 
 void octoprint_socket_connect(OctoPrintSocket *socket);
 void octoprint_socket_disconnect(OctoPrintSocket *socket);
 
 gboolean octoprint_socket_is_connected(OctoPrintSocket *socket);
 
+/* frames received and the time spent parsing them are added to stats, which must outlive the socket. NULL to stop */
+void octoprint_socket_set_stats(OctoPrintSocket *socket, OctoPrintStats *stats);
+
 void octoprint_socket_auth(OctoPrintSocket *socket, const char *const user, const char *const session);
 
 G_END_DECLS
\ No newline at end of file
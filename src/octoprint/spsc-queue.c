@@ -0,0 +1,71 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "octospscqueue"
+#include <glib.h>
+
+#include "spsc-queue.h"
+
+/* A linked list with a dummy node at the head. The producer only writes the tail node's next and the
+   consumer only frees nodes it has moved past, so the one atomic next pointer is all they share. */
+typedef struct _OctoPrintSPSCNode OctoPrintSPSCNode;
+struct _OctoPrintSPSCNode {
+    OctoPrintSPSCNode *next;
+    gpointer item;
+};
+
+struct _OctoPrintSPSCQueue {
+    OctoPrintSPSCNode *head; // consumer, already popped
+    OctoPrintSPSCNode *tail; // producer
+    GDestroyNotify free_func;
+};
+
+OctoPrintSPSCQueue *octoprint_spsc_queue_new(GDestroyNotify free_func) {
+    OctoPrintSPSCQueue *queue = g_new0(OctoPrintSPSCQueue, 1);
+    queue->head = queue->tail = g_new0(OctoPrintSPSCNode, 1);
+    queue->free_func = free_func;
+    return queue;
+}
+
+void octoprint_spsc_queue_free(OctoPrintSPSCQueue *queue) {
+    gpointer item;
+    while((item = octoprint_spsc_queue_pop(queue))) {
+        if(queue->free_func) queue->free_func(item);
+    }
+    g_free(queue->head);
+    g_free(queue);
+}
+
+void octoprint_spsc_queue_push(OctoPrintSPSCQueue *queue, gpointer item) {
+    OctoPrintSPSCNode *node = g_new0(OctoPrintSPSCNode, 1);
+    node->item = item;
+    // publishes item along with the node
+    g_atomic_pointer_set(&queue->tail->next, node);
+    queue->tail = node;
+}
+
+gpointer octoprint_spsc_queue_pop(OctoPrintSPSCQueue *queue) {
+    OctoPrintSPSCNode *next = g_atomic_pointer_get(&queue->head->next);
+    if(!next) return NULL;
+
+    // next becomes the dummy
+    gpointer item = next->item;
+    next->item = NULL;
+    g_free(queue->head);
+    queue->head = next;
+    return item;
+}
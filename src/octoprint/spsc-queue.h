@@ -0,0 +1,36 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Unbounded single producer, single consumer queue. Pushing and popping don't lock or wait:
+   exactly one thread may push and exactly one (possibly other) thread may pop. */
+typedef struct _OctoPrintSPSCQueue OctoPrintSPSCQueue;
+
+/* free_func is called on anything still queued when the queue is freed */
+OctoPrintSPSCQueue *octoprint_spsc_queue_new(GDestroyNotify free_func);
+/* once neither side will use it again */
+void octoprint_spsc_queue_free(OctoPrintSPSCQueue *queue);
+
+/* producer only, item must not be NULL */
+void octoprint_spsc_queue_push(OctoPrintSPSCQueue *queue, gpointer item);
+/* consumer only, NULL when empty */
+gpointer octoprint_spsc_queue_pop(OctoPrintSPSCQueue *queue);
+
+G_END_DECLS
@@ -0,0 +1,83 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "octoprint-stats"
+#include <glib.h>
+#include <string.h>
+
+#include "stats.h"
+
+const gint64 octoprint_histogram_bounds[OCTOPRINT_HISTOGRAM_N_BUCKETS] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000, 500000, 2500000
+};
+
+void octoprint_histogram_observe(OctoPrintHistogram *histogram, gint64 usec) {
+    if(usec < 0) usec = 0;
+
+    guint b = 0;
+    while(b < OCTOPRINT_HISTOGRAM_N_BUCKETS && usec > octoprint_histogram_bounds[b]) b++;
+    // past the last bound only shows up in the count, as +Inf
+    if(b < OCTOPRINT_HISTOGRAM_N_BUCKETS) g_atomic_pointer_add(&histogram->buckets[b], 1);
+
+    g_atomic_pointer_add(&histogram->sum_usec, usec);
+    g_atomic_pointer_add(&histogram->count, 1);
+}
+
+void octoprint_stats_add_frame(OctoPrintStats *stats, gsize bytes, gint64 parse_usec) {
+    g_atomic_pointer_add(&stats->frames, 1);
+    g_atomic_pointer_add(&stats->bytes, bytes);
+    octoprint_histogram_observe(&stats->parse, parse_usec);
+}
+
+// /api/files/local/some/part.gcode?recursive=true -> /api/files, plugins keep their id
+static void endpoint_from_path(const char *const path, char *endpoint) {
+    const char *end = path;
+    guint segments = g_str_has_prefix(path, "/api/plugin/") ? 3 : 2;
+
+    for(guint s=0;s<segments && *end;s++) {
+        end++;
+        while(*end && *end!='/' && *end!='?') end++;
+        if(*end=='?') break;
+    }
+
+    gsize len = MIN((gsize)(end - path), OCTOPRINT_STATS_ENDPOINT_LEN - 1);
+    memcpy(endpoint, path, len);
+    endpoint[len] = '\0';
+}
+
+// only called from the thread that owns the stats, so only reads need to be careful
+void octoprint_stats_add_request(OctoPrintStats *stats, const char *const path, gint64 usec) {
+    char endpoint[OCTOPRINT_STATS_ENDPOINT_LEN];
+    endpoint_from_path(path, endpoint);
+
+    gint n = stats->n_endpoints;
+    gint e;
+    for(e=0;e<n;e++) {
+        if(strcmp(stats->endpoints[e].endpoint, endpoint)==0) break;
+    }
+
+    if(e==n) {
+        if(n==OCTOPRINT_STATS_MAX_ENDPOINTS) {
+            e = n - 1;
+        } else {
+            g_strlcpy(stats->endpoints[e].endpoint, endpoint, OCTOPRINT_STATS_ENDPOINT_LEN);
+            g_atomic_int_set(&stats->n_endpoints, n + 1);
+        }
+    }
+
+    octoprint_histogram_observe(&stats->endpoints[e].latency, usec);
+}
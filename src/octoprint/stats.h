@@ -0,0 +1,64 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Counters kept for the metrics endpoint. They're preallocated by whoever wants them and handed to
+   clients and sockets, which only ever add to them with atomics. Another thread can read them at
+   any time without locking; names are written before the count that publishes them. */
+
+#define OCTOPRINT_HISTOGRAM_N_BUCKETS 12
+/* upper bounds of each bucket in microseconds, +Inf is implied */
+extern const gint64 octoprint_histogram_bounds[OCTOPRINT_HISTOGRAM_N_BUCKETS];
+
+typedef struct {
+    // not cumulative, the bucket an observation fell in
+    gsize buckets[OCTOPRINT_HISTOGRAM_N_BUCKETS];
+    gsize count;
+    gsize sum_usec;
+} OctoPrintHistogram;
+
+void octoprint_histogram_observe(OctoPrintHistogram *histogram, gint64 usec);
+
+#define OCTOPRINT_STATS_MAX_ENDPOINTS 32
+#define OCTOPRINT_STATS_ENDPOINT_LEN 48
+
+typedef struct {
+    char endpoint[OCTOPRINT_STATS_ENDPOINT_LEN];
+    OctoPrintHistogram latency;
+} OctoPrintEndpointStats;
+
+typedef struct {
+    // websocket frames
+    gsize frames;
+    gsize bytes;
+    OctoPrintHistogram parse;
+
+    // REST requests by endpoint, ie. /api/job or /api/plugin/psucontrol. Read with g_atomic_int_get
+    gint n_endpoints;
+    OctoPrintEndpointStats endpoints[OCTOPRINT_STATS_MAX_ENDPOINTS];
+} OctoPrintStats;
+
+void octoprint_stats_add_frame(OctoPrintStats *stats, gsize bytes, gint64 parse_usec);
+/* path is the request path, query and file names are dropped. Once every slot is used
+   new endpoints are counted in the last one */
+void octoprint_stats_add_request(OctoPrintStats *stats, const char *const path, gint64 usec);
+
+G_END_DECLS
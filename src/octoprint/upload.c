@@ -0,0 +1,374 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "octoupload"
+#include <glib.h>
+#include <string.h>
+
+#include <libsoup/soup.h>
+#include "upload.h"
+
+#define OCTOPRINT_UPLOAD_CHUNK_SIZE (64 * 1024)
+#define OCTOPRINT_UPLOAD_PROGRESS_INTERVAL (250 * 1000) // us
+
+struct _OctoPrintUpload {
+    GObject parent_instance;
+
+    OctoPrintClient *client;
+    // one of these is the source
+    GFile *file;
+    GMappedFile *mapped; // shared by every upload of the same file
+    char *name;
+    gboolean print;
+
+    // only while sending
+    GInputStream *stream;
+    SoupMessage *msg;
+    char *preamble; // multipart headers before the file
+    char *epilogue; // after the file, the select/print fields and closing boundary
+
+    GCancellable *cancellable;
+
+    OctoPrintUploadState state;
+    char *error;
+
+    goffset file_size;
+    goffset file_read;
+    goffset sent;
+    goffset total;
+
+    gint64 started;
+    gint64 finished;
+    gint64 last_progress;
+};
+
+G_DEFINE_TYPE(OctoPrintUpload, octoprint_upload, G_TYPE_OBJECT)
+
+typedef enum {
+    PROGRESS,
+    FINISHED,
+    N_SIGNALS
+} OctoPrintUploadSignals;
+
+static guint obj_signals[N_SIGNALS] = { 0, };
+
+static void octoprint_upload_finalize(GObject *object) {
+    OctoPrintUpload *self = OCTOPRINT_UPLOAD(object);
+
+    g_object_unref(self->client);
+    if(self->file) g_object_unref(self->file);
+    if(self->mapped) g_mapped_file_unref(self->mapped);
+    g_free(self->name);
+    if(self->stream) g_object_unref(self->stream);
+    if(self->msg) g_object_unref(self->msg);
+    g_free(self->preamble);
+    g_free(self->epilogue);
+    g_object_unref(self->cancellable);
+    g_free(self->error);
+
+    G_OBJECT_CLASS(octoprint_upload_parent_class)->finalize(object);
+}
+
+#define octoprint_upload_signal(a, b, c, ...) \
+        g_signal_new( \
+            a, \
+            G_TYPE_FROM_CLASS(b), \
+            G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, \
+            0, \
+            NULL, \
+            NULL, \
+            NULL, \
+            G_TYPE_NONE, \
+            c, \
+            __VA_ARGS__)
+
+static void octoprint_upload_class_init(OctoPrintUploadClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->finalize = octoprint_upload_finalize;
+
+    obj_signals[PROGRESS] = octoprint_upload_signal("progress", object_class, 0, NULL);
+    obj_signals[FINISHED] = octoprint_upload_signal("finished", object_class, 0, NULL);
+}
+
+static void octoprint_upload_init(OctoPrintUpload *upload) {
+    upload->cancellable = g_cancellable_new();
+    upload->state = OCTOPRINT_UPLOAD_QUEUED;
+}
+
+OctoPrintUpload *octoprint_upload_new(OctoPrintClient *client, GFile *file, gboolean print) {
+    OctoPrintUpload *upload = g_object_new(OCTOPRINT_TYPE_UPLOAD, NULL);
+    upload->client = g_object_ref(client);
+    upload->file = g_object_ref(file);
+    upload->name = g_file_get_basename(file);
+    upload->print = print;
+
+    return upload;
+}
+
+OctoPrintUpload *octoprint_upload_new_from_mapped(OctoPrintClient *client, GMappedFile *mapped, const char *const name, gboolean print) {
+    OctoPrintUpload *upload = g_object_new(OCTOPRINT_TYPE_UPLOAD, NULL);
+    upload->client = g_object_ref(client);
+    upload->mapped = g_mapped_file_ref(mapped);
+    upload->name = g_strdup(name);
+    upload->print = print;
+
+    return upload;
+}
+
+static void octoprint_upload_fail(OctoPrintUpload *upload, const char *const error) {
+    if(upload->error) return;
+    upload->error = g_strdup(error);
+    // on_upload_finished picks up the error
+    g_cancellable_cancel(upload->cancellable);
+}
+
+// queue the next piece of the body, called each time the previous one has been written
+static void octoprint_upload_append_next(OctoPrintUpload *upload) {
+    if(!upload->stream) return; // the epilogue is queued, nothing left
+
+    char *buf = g_malloc(OCTOPRINT_UPLOAD_CHUNK_SIZE);
+    GError *err = NULL;
+    gssize len = g_input_stream_read(upload->stream, buf, OCTOPRINT_UPLOAD_CHUNK_SIZE, NULL, &err);
+
+    if(len < 0) {
+        g_free(buf);
+        g_warning("Error reading %s: %s", upload->name, err->message);
+        octoprint_upload_fail(upload, err->message);
+        g_error_free(err);
+        return;
+    }
+
+    if(len > 0) {
+        upload->file_read += len;
+        if(upload->file_read > upload->file_size) {
+            g_free(buf);
+            octoprint_upload_fail(upload, "File changed while uploading");
+            return;
+        }
+        soup_message_body_append(upload->msg->request_body, SOUP_MEMORY_TAKE, buf, len);
+        return;
+    }
+
+    g_free(buf);
+    if(upload->file_read!=upload->file_size) {
+        octoprint_upload_fail(upload, "File changed while uploading");
+        return;
+    }
+
+    g_input_stream_close(upload->stream, NULL, NULL);
+    g_clear_object(&upload->stream);
+    soup_message_body_append(upload->msg->request_body, SOUP_MEMORY_STATIC, upload->epilogue, strlen(upload->epilogue));
+    soup_message_body_complete(upload->msg->request_body);
+}
+
+static void on_msg_wrote_chunk(SoupMessage *msg, OctoPrintUpload *upload) {
+    octoprint_upload_append_next(upload);
+}
+
+static void on_msg_wrote_body_data(SoupMessage *msg, SoupBuffer *chunk, OctoPrintUpload *upload) {
+    upload->sent += chunk->length;
+
+    gint64 now = g_get_monotonic_time();
+    if(now - upload->last_progress < OCTOPRINT_UPLOAD_PROGRESS_INTERVAL) return;
+    upload->last_progress = now;
+    g_signal_emit(upload, obj_signals[PROGRESS], 0);
+}
+
+static void on_msg_wrote_headers(SoupMessage *msg, OctoPrintUpload *upload) {
+    // the time spent waiting for a connection isn't part of the rate
+    upload->state = OCTOPRINT_UPLOAD_SENDING;
+    upload->started = g_get_monotonic_time();
+    g_signal_emit(upload, obj_signals[PROGRESS], 0);
+}
+
+// the preamble, and for a mapped file everything else. Streamed files are appended in on_msg_wrote_chunk
+static void octoprint_upload_append_body_start(OctoPrintUpload *upload) {
+    SoupMessageBody *body = upload->msg->request_body;
+    soup_message_body_append(body, SOUP_MEMORY_STATIC, upload->preamble, strlen(upload->preamble));
+
+    if(upload->mapped) {
+        // the buffer points straight at the mapped pages, there's no copy per upload
+        SoupBuffer *contents = soup_buffer_new_with_owner(g_mapped_file_get_contents(upload->mapped), upload->file_size,
+            g_mapped_file_ref(upload->mapped), (GDestroyNotify)g_mapped_file_unref);
+        soup_message_body_append_buffer(body, contents);
+        soup_buffer_free(contents);
+
+        soup_message_body_append(body, SOUP_MEMORY_STATIC, upload->epilogue, strlen(upload->epilogue));
+        soup_message_body_complete(body);
+    }
+}
+
+// sent chunks are discarded (SOUP_MESSAGE_CAN_REBUILD), start the body over if libsoup needs to send it again
+static void on_msg_restarted(SoupMessage *msg, OctoPrintUpload *upload) {
+    g_message("Restarting upload of %s", upload->name);
+
+    if(upload->mapped) {
+        // nothing to reopen
+    } else if(!upload->stream) {
+        GError *err = NULL;
+        upload->stream = G_INPUT_STREAM(g_file_read(upload->file, NULL, &err));
+        if(!upload->stream) {
+            octoprint_upload_fail(upload, err->message);
+            g_error_free(err);
+            return;
+        }
+    } else if(!g_seekable_seek(G_SEEKABLE(upload->stream), 0, G_SEEK_SET, NULL, NULL)) {
+        octoprint_upload_fail(upload, "Unable to restart upload");
+        return;
+    }
+
+    upload->file_read = 0;
+    upload->sent = 0;
+    soup_message_body_truncate(msg->request_body);
+    octoprint_upload_append_body_start(upload);
+}
+
+static void on_upload_finished(OctoPrintClient *client, guint status, JsonObject *response, OctoPrintUpload *upload) {
+    upload->finished = g_get_monotonic_time();
+    if(!upload->started) upload->started = upload->finished;
+
+    if(upload->error) {
+        upload->state = OCTOPRINT_UPLOAD_FAILED;
+    } else if(status==SOUP_STATUS_CANCELLED) {
+        upload->state = OCTOPRINT_UPLOAD_CANCELLED;
+    } else if(SOUP_STATUS_IS_SUCCESSFUL(status)) {
+        upload->state = OCTOPRINT_UPLOAD_DONE;
+    } else {
+        upload->state = OCTOPRINT_UPLOAD_FAILED;
+        upload->error = g_strdup_printf("%u %s", status, soup_status_get_phrase(status));
+    }
+
+    g_message("Upload of %s %s after %0.1f s", upload->name,
+        upload->state==OCTOPRINT_UPLOAD_DONE ? "finished" : upload->state==OCTOPRINT_UPLOAD_CANCELLED ? "cancelled" : "failed",
+        octoprint_upload_get_elapsed(upload));
+
+    g_signal_handlers_disconnect_by_data(upload->msg, upload);
+    g_clear_object(&upload->msg);
+    if(upload->stream) {
+        g_input_stream_close(upload->stream, NULL, NULL);
+        g_clear_object(&upload->stream);
+    }
+
+    g_signal_emit(upload, obj_signals[FINISHED], 0);
+    g_object_unref(upload); // taken in octoprint_upload_start
+}
+
+gboolean octoprint_upload_start(OctoPrintUpload *upload, GError **error) {
+    g_return_val_if_fail(upload->state==OCTOPRINT_UPLOAD_QUEUED && !upload->msg, FALSE);
+
+    if(upload->mapped) {
+        upload->file_size = g_mapped_file_get_length(upload->mapped);
+    } else {
+        GFileInfo *info = g_file_query_info(upload->file, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE, NULL, error);
+        if(!info) return FALSE;
+        upload->file_size = g_file_info_get_size(info);
+        g_object_unref(info);
+
+        upload->stream = G_INPUT_STREAM(g_file_read(upload->file, NULL, error));
+        if(!upload->stream) return FALSE;
+    }
+
+    char *boundary = g_strdup_printf("------opdesk%08x%08x", g_random_int(), g_random_int());
+    char *filename = g_strdup(upload->name);
+    g_strdelimit(filename, "\"\r\n", '_');
+
+    upload->preamble = g_strdup_printf(
+        "--%s\r\n"
+        "Content-Disposition: form-data; name=\"file\"; filename=\"%s\"\r\n"
+        "Content-Type: application/octet-stream\r\n"
+        "\r\n", boundary, filename);
+    g_free(filename);
+
+    GString *epilogue = g_string_new("\r\n");
+    if(upload->print) {
+        g_string_append_printf(epilogue, "--%s\r\nContent-Disposition: form-data; name=\"select\"\r\n\r\ntrue\r\n", boundary);
+        g_string_append_printf(epilogue, "--%s\r\nContent-Disposition: form-data; name=\"print\"\r\n\r\ntrue\r\n", boundary);
+    }
+    g_string_append_printf(epilogue, "--%s--\r\n", boundary);
+    upload->epilogue = g_string_free(epilogue, FALSE);
+
+    upload->total = strlen(upload->preamble) + upload->file_size + strlen(upload->epilogue);
+
+    upload->msg = octoprint_client_new_message(upload->client, "POST", "/api/files/local");
+
+    char *content_type = g_strdup_printf("multipart/form-data; boundary=%s", boundary);
+    soup_message_headers_replace(upload->msg->request_headers, "Content-Type", content_type);
+    g_free(content_type);
+    g_free(boundary);
+
+    soup_message_headers_set_encoding(upload->msg->request_headers, SOUP_ENCODING_CONTENT_LENGTH);
+    soup_message_headers_set_content_length(upload->msg->request_headers, upload->total);
+
+    // a streamed file only holds one chunk at a time: the next is read when the previous has been written
+    soup_message_set_flags(upload->msg, SOUP_MESSAGE_CAN_REBUILD);
+    soup_message_body_set_accumulate(upload->msg->request_body, FALSE);
+    octoprint_upload_append_body_start(upload);
+
+    g_signal_connect(upload->msg, "wrote-headers", G_CALLBACK(on_msg_wrote_headers), upload);
+    g_signal_connect(upload->msg, "wrote-chunk", G_CALLBACK(on_msg_wrote_chunk), upload);
+    g_signal_connect(upload->msg, "wrote-body-data", G_CALLBACK(on_msg_wrote_body_data), upload);
+    g_signal_connect(upload->msg, "restarted", G_CALLBACK(on_msg_restarted), upload);
+
+    g_message("Uploading %s (%" G_GOFFSET_FORMAT " bytes)%s", upload->name, upload->file_size, upload->print ? " to print" : "");
+
+    octoprint_client_queue_message(upload->client, OCTOPRINT_REQUEST_BULK, upload->msg, "/api/files/local", 0, upload->cancellable,
+        (OctoPrintClientCallback)on_upload_finished, g_object_ref(upload));
+
+    return TRUE;
+}
+
+void octoprint_upload_cancel(OctoPrintUpload *upload) {
+    g_cancellable_cancel(upload->cancellable);
+}
+
+const char *octoprint_upload_get_name(OctoPrintUpload *upload) {
+    return upload->name;
+}
+
+OctoPrintUploadState octoprint_upload_get_state(OctoPrintUpload *upload) {
+    return upload->state;
+}
+
+const char *octoprint_upload_get_error(OctoPrintUpload *upload) {
+    return upload->error;
+}
+
+goffset octoprint_upload_get_sent(OctoPrintUpload *upload) {
+    return upload->sent;
+}
+
+goffset octoprint_upload_get_total(OctoPrintUpload *upload) {
+    return upload->total;
+}
+
+gdouble octoprint_upload_get_progress(OctoPrintUpload *upload) {
+    if(!upload->total) return 0.0;
+    return (gdouble)upload->sent / upload->total;
+}
+
+gdouble octoprint_upload_get_elapsed(OctoPrintUpload *upload) {
+    if(!upload->started) return 0.0;
+    gint64 end = upload->finished ? upload->finished : g_get_monotonic_time();
+    return (gdouble)(end - upload->started) / G_USEC_PER_SEC;
+}
+
+gdouble octoprint_upload_get_rate(OctoPrintUpload *upload) {
+    gdouble elapsed = octoprint_upload_get_elapsed(upload);
+    if(elapsed <= 0.0) return 0.0;
+    return upload->sent / elapsed;
+}
@@ -0,0 +1,66 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "client.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+    OCTOPRINT_UPLOAD_QUEUED,
+    OCTOPRINT_UPLOAD_SENDING,
+    OCTOPRINT_UPLOAD_DONE,
+    OCTOPRINT_UPLOAD_FAILED,
+    OCTOPRINT_UPLOAD_CANCELLED
+} OctoPrintUploadState;
+
+/* A file uploaded to OctoPrint's local storage, POST /api/files/local.
+   The file is read in fixed size chunks as the connection takes them, memory use doesn't
+   depend on the file size. Uploads are bulk requests and don't hold up anything else.
+   "progress" is emitted a few times a second while sending, "finished" once it's done, failed or cancelled. */
+#define OCTOPRINT_TYPE_UPLOAD octoprint_upload_get_type()
+G_DECLARE_FINAL_TYPE(OctoPrintUpload, octoprint_upload, OCTOPRINT, UPLOAD, GObject)
+
+/* print selects and starts printing the file once it's uploaded */
+OctoPrintUpload *octoprint_upload_new(OctoPrintClient *client, GFile *file, gboolean print);
+/* Sends an already mapped file, any number of uploads can share the mapping.
+   name is the file name given to OctoPrint */
+OctoPrintUpload *octoprint_upload_new_from_mapped(OctoPrintClient *client, GMappedFile *mapped, const char *const name, gboolean print);
+
+/* FALSE if the file can't be read */
+gboolean octoprint_upload_start(OctoPrintUpload *upload, GError **error);
+void octoprint_upload_cancel(OctoPrintUpload *upload);
+
+const char *octoprint_upload_get_name(OctoPrintUpload *upload);
+OctoPrintUploadState octoprint_upload_get_state(OctoPrintUpload *upload);
+/* NULL unless the upload failed */
+const char *octoprint_upload_get_error(OctoPrintUpload *upload);
+
+/* request body bytes, including the multipart framing */
+goffset octoprint_upload_get_sent(OctoPrintUpload *upload);
+goffset octoprint_upload_get_total(OctoPrintUpload *upload);
+/* 0.0 - 1.0 */
+gdouble octoprint_upload_get_progress(OctoPrintUpload *upload);
+/* average bytes per second since sending started */
+gdouble octoprint_upload_get_rate(OctoPrintUpload *upload);
+/* seconds spent sending */
+gdouble octoprint_upload_get_elapsed(OctoPrintUpload *upload);
+
+G_END_DECLS
@@ -0,0 +1,418 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-preview"
+#include <glib.h>
+
+#include "preview-window.h"
+#include "toolpath.h"
+#include "octoprint/download.h"
+
+#define PREVIEW_MARGIN 12.0
+#define PREVIEW_ZOOM_STEP 1.25
+#define PREVIEW_LINE_WIDTH 0.4 // mm, about an extrusion width
+
+struct _OPDeskPreviewWindow {
+    GtkWindow parent_inst;
+
+    OPDeskServer *server;
+
+    GtkWidget *area;
+    GtkWidget *scale;
+    GtkWidget *status;
+
+    GCancellable *cancellable;
+    OctoPrintDownload *download;
+    GFile *temp_file;
+    OPDeskToolpath *toolpath;
+
+    guint layer;
+    gint printing_layer;
+    // the slider moves with the printing layer until it's moved somewhere else
+    gboolean follow;
+
+    gdouble zoom;
+    gdouble pan_x;
+    gdouble pan_y;
+    gdouble drag_x;
+    gdouble drag_y;
+};
+
+G_DEFINE_TYPE(OPDeskPreviewWindow, opdesk_preview_window, GTK_TYPE_WINDOW);
+
+typedef enum {
+    WINDOW_PROP_SERVER = 1,
+    N_PROPERTIES
+} OPDeskPreviewWindowProperties;
+
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
+
+static void on_server_status_updated(OPDeskServer *server, OPDeskPreviewWindow *win);
+
+static void opdesk_preview_window_set_property(GObject *object, guint property_id, const GValue *value, GParamSpec *pspec) {
+    OPDeskPreviewWindow *self = OPDESK_PREVIEW_WINDOW(object);
+
+    switch ((OPDeskPreviewWindowProperties)property_id) {
+    case WINDOW_PROP_SERVER:
+        if(self->server) {
+            g_signal_handlers_disconnect_by_data(self->server, self);
+            g_object_unref(self->server);
+        }
+        self->server = g_value_get_object(value);
+        if(self->server) {
+            g_object_ref(self->server);
+            g_signal_connect_object(self->server, "status-updated", G_CALLBACK(on_server_status_updated), self, 0);
+        }
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+        break;
+    }
+}
+
+static void opdesk_preview_window_get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec) {
+    OPDeskPreviewWindow *self = OPDESK_PREVIEW_WINDOW(object);
+    switch ((OPDeskPreviewWindowProperties)property_id) {
+    case WINDOW_PROP_SERVER:
+        g_value_set_object(value, self->server);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+        break;
+    }
+}
+
+static void opdesk_preview_window_dispose(GObject *object) {
+    OPDeskPreviewWindow *self = OPDESK_PREVIEW_WINDOW(object);
+
+    // loading or downloading can outlive the window, stop it
+    g_cancellable_cancel(self->cancellable);
+    if(self->download) {
+        g_signal_handlers_disconnect_by_data(self->download, self);
+        octoprint_download_cancel(self->download);
+        g_clear_object(&self->download);
+    }
+
+    G_OBJECT_CLASS(opdesk_preview_window_parent_class)->dispose(object);
+}
+
+static void opdesk_preview_window_finalize(GObject *object) {
+    OPDeskPreviewWindow *self = OPDESK_PREVIEW_WINDOW(object);
+
+    if(self->server) g_object_unref(self->server);
+    if(self->temp_file) {
+        g_file_delete(self->temp_file, NULL, NULL);
+        g_object_unref(self->temp_file);
+    }
+    if(self->toolpath) opdesk_toolpath_free(self->toolpath);
+    g_object_unref(self->cancellable);
+
+    G_OBJECT_CLASS(opdesk_preview_window_parent_class)->finalize(object);
+}
+
+static void opdesk_preview_window_class_init(OPDeskPreviewWindowClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->get_property = opdesk_preview_window_get_property;
+    object_class->set_property = opdesk_preview_window_set_property;
+    object_class->dispose = opdesk_preview_window_dispose;
+    object_class->finalize = opdesk_preview_window_finalize;
+
+    obj_properties[WINDOW_PROP_SERVER] = g_param_spec_object("server", "server", "OctoPrint Server", OPDESK_TYPE_SERVER, G_PARAM_READWRITE);
+
+    g_object_class_install_properties (object_class, N_PROPERTIES, obj_properties);
+}
+
+static void opdesk_preview_window_update_status(OPDeskPreviewWindow *win) {
+    guint layers = opdesk_toolpath_get_layer_count(win->toolpath);
+    if(!layers) {
+        gtk_label_set_text(GTK_LABEL(win->status), "No extrusions found");
+        return;
+    }
+
+    char *text = g_strdup_printf("Layer %u of %u, Z %0.2f mm%s", win->layer + 1, layers,
+        opdesk_toolpath_get_layer_z(win->toolpath, win->layer), (gint)win->layer==win->printing_layer ? " (printing)" : "");
+    gtk_label_set_text(GTK_LABEL(win->status), text);
+    g_free(text);
+}
+
+static gboolean on_area_draw(GtkWidget *area, cairo_t *cr, OPDeskPreviewWindow *win) {
+    gdouble width = gtk_widget_get_allocated_width(area);
+    gdouble height = gtk_widget_get_allocated_height(area);
+
+    cairo_set_source_rgb(cr, 0.12, 0.12, 0.12);
+    cairo_paint(cr);
+
+    gdouble min_x, min_y, max_x, max_y;
+    if(!win->toolpath || !opdesk_toolpath_get_bounds(win->toolpath, &min_x, &min_y, &max_x, &max_y)) return FALSE;
+
+    gdouble fit = MIN((width - 2 * PREVIEW_MARGIN) / MAX(max_x - min_x, 1.0), (height - 2 * PREVIEW_MARGIN) / MAX(max_y - min_y, 1.0));
+    gdouble scale = MAX(fit, 0.01) * win->zoom;
+
+    // G-code Y points away from the viewer, up on screen
+    cairo_translate(cr, width / 2 + win->pan_x, height / 2 + win->pan_y);
+    cairo_scale(cr, scale, -scale);
+    cairo_translate(cr, -(min_x + max_x) / 2, -(min_y + max_y) / 2);
+
+    gdouble x1, y1, x2, y2;
+    cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+    gdouble pixel = 1.0 / scale;
+
+    cairo_set_line_width(cr, MAX(PREVIEW_LINE_WIDTH, pixel));
+    cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+    cairo_set_line_join(cr, CAIRO_LINE_JOIN_ROUND);
+
+    // the layer below for context
+    if(win->layer > 0) {
+        opdesk_toolpath_append_layer(win->toolpath, cr, win->layer - 1, x1, y1, x2, y2, pixel);
+        cairo_set_source_rgba(cr, 0.6, 0.6, 0.6, 0.3);
+        cairo_stroke(cr);
+    }
+
+    opdesk_toolpath_append_layer(win->toolpath, cr, win->layer, x1, y1, x2, y2, pixel);
+    if((gint)win->layer==win->printing_layer) cairo_set_source_rgb(cr, 1.0, 0.55, 0.1);
+    else cairo_set_source_rgb(cr, 0.25, 0.7, 1.0);
+    cairo_stroke(cr);
+
+    return FALSE;
+}
+
+static gboolean on_area_scroll(GtkWidget *area, GdkEventScroll *event, OPDeskPreviewWindow *win) {
+    gdouble factor;
+    if(event->direction==GDK_SCROLL_UP) factor = PREVIEW_ZOOM_STEP;
+    else if(event->direction==GDK_SCROLL_DOWN) factor = 1.0 / PREVIEW_ZOOM_STEP;
+    else if(event->direction==GDK_SCROLL_SMOOTH && event->delta_y!=0) factor = event->delta_y < 0 ? PREVIEW_ZOOM_STEP : 1.0 / PREVIEW_ZOOM_STEP;
+    else return GDK_EVENT_PROPAGATE;
+
+    factor = CLAMP(win->zoom * factor, 1.0, 1000.0) / win->zoom;
+
+    // keep the point under the cursor where it is
+    gdouble cx = event->x - gtk_widget_get_allocated_width(area) / 2.0;
+    gdouble cy = event->y - gtk_widget_get_allocated_height(area) / 2.0;
+    win->pan_x = cx * (1.0 - factor) + win->pan_x * factor;
+    win->pan_y = cy * (1.0 - factor) + win->pan_y * factor;
+    win->zoom *= factor;
+    if(win->zoom==1.0) win->pan_x = win->pan_y = 0.0;
+
+    gtk_widget_queue_draw(area);
+    return GDK_EVENT_STOP;
+}
+
+static gboolean on_area_button_press(GtkWidget *area, GdkEventButton *event, OPDeskPreviewWindow *win) {
+    win->drag_x = event->x;
+    win->drag_y = event->y;
+    return GDK_EVENT_STOP;
+}
+
+static gboolean on_area_motion(GtkWidget *area, GdkEventMotion *event, OPDeskPreviewWindow *win) {
+    if(!(event->state & GDK_BUTTON1_MASK)) return GDK_EVENT_PROPAGATE;
+
+    win->pan_x += event->x - win->drag_x;
+    win->pan_y += event->y - win->drag_y;
+    win->drag_x = event->x;
+    win->drag_y = event->y;
+    gtk_widget_queue_draw(area);
+    return GDK_EVENT_STOP;
+}
+
+static void on_scale_value_changed(GtkRange *range, OPDeskPreviewWindow *win) {
+    win->layer = (guint)gtk_range_get_value(range) - 1;
+    win->follow = (gint)win->layer==win->printing_layer;
+    opdesk_preview_window_update_status(win);
+    gtk_widget_queue_draw(win->area);
+}
+
+static void opdesk_preview_window_update_printing_layer(OPDeskPreviewWindow *win) {
+    if(!win->server || !win->toolpath) return;
+
+    // DisplayLayerProgress counts from 1
+    gint layer = opdesk_server_get_current_layer(win->server) - 1;
+    layer = MIN(layer, (gint)opdesk_toolpath_get_layer_count(win->toolpath) - 1);
+    if(layer==win->printing_layer) return;
+
+    gboolean follow = win->follow || win->printing_layer < 0;
+    win->printing_layer = layer;
+
+    gtk_scale_clear_marks(GTK_SCALE(win->scale));
+    if(layer >= 0) {
+        gtk_scale_add_mark(GTK_SCALE(win->scale), layer + 1, GTK_POS_BOTTOM, "Printing");
+        if(follow) gtk_range_set_value(GTK_RANGE(win->scale), layer + 1);
+    }
+
+    opdesk_preview_window_update_status(win);
+    gtk_widget_queue_draw(win->area);
+}
+
+static void on_server_status_updated(OPDeskServer *server, OPDeskPreviewWindow *win) {
+    opdesk_preview_window_update_printing_layer(win);
+}
+
+static void on_toolpath_loaded(GObject *source, GAsyncResult *result, OPDeskPreviewWindow *win) {
+    GError *err = NULL;
+    OPDeskToolpath *toolpath = opdesk_toolpath_load_file_finish(result, &err);
+
+    if(!toolpath) {
+        if(!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) gtk_label_set_text(GTK_LABEL(win->status), err->message);
+        g_error_free(err);
+        g_object_unref(win);
+        return;
+    }
+
+    // the downloaded copy isn't needed once it's loaded
+    if(win->temp_file) {
+        g_file_delete(win->temp_file, NULL, NULL);
+        g_clear_object(&win->temp_file);
+    }
+
+    win->toolpath = toolpath;
+    guint layers = opdesk_toolpath_get_layer_count(toolpath);
+    g_message("Loaded preview, %" G_GSIZE_FORMAT " segments in %u layers", opdesk_toolpath_get_segment_count(toolpath), layers);
+
+    if(layers) {
+        gtk_range_set_range(GTK_RANGE(win->scale), 1, MAX(layers, 2));
+        gtk_range_set_value(GTK_RANGE(win->scale), 1);
+        gtk_widget_set_sensitive(win->scale, layers > 1);
+    }
+    opdesk_preview_window_update_printing_layer(win);
+    opdesk_preview_window_update_status(win);
+    gtk_widget_queue_draw(win->area);
+
+    g_object_unref(win);
+}
+
+static void opdesk_preview_window_load(OPDeskPreviewWindow *win, GFile *file) {
+    gtk_label_set_text(GTK_LABEL(win->status), "Loading...");
+    opdesk_toolpath_load_file_async(file, win->cancellable, (GAsyncReadyCallback)on_toolpath_loaded, g_object_ref(win));
+}
+
+static void on_download_progress(OctoPrintDownload *download, OPDeskPreviewWindow *win) {
+    char *received = g_format_size(octoprint_download_get_received(download));
+    char *text;
+    if(octoprint_download_get_total(download)) {
+        text = g_strdup_printf("Downloading... %0.0f%% (%s)", octoprint_download_get_progress(download) * 100, received);
+    } else {
+        text = g_strdup_printf("Downloading... %s", received);
+    }
+    gtk_label_set_text(GTK_LABEL(win->status), text);
+    g_free(text);
+    g_free(received);
+}
+
+static void on_download_finished(OctoPrintDownload *download, OPDeskPreviewWindow *win) {
+    if(octoprint_download_get_state(download)==OCTOPRINT_DOWNLOAD_DONE) {
+        opdesk_preview_window_load(win, win->temp_file);
+    } else if(octoprint_download_get_error(download)) {
+        char *text = g_strdup_printf("Download failed: %s", octoprint_download_get_error(download));
+        gtk_label_set_text(GTK_LABEL(win->status), text);
+        g_free(text);
+    }
+
+    g_clear_object(&win->download);
+}
+
+static void opdesk_preview_window_download_job(OPDeskPreviewWindow *win) {
+    const char *origin;
+    const char *path = opdesk_server_get_print_path(win->server, &origin);
+    if(!path) {
+        gtk_label_set_text(GTK_LABEL(win->status), "No file selected");
+        return;
+    }
+    if(g_strcmp0(origin, "local")) {
+        gtk_label_set_text(GTK_LABEL(win->status), "Files on the printer's SD card can't be previewed");
+        return;
+    }
+
+    char *title = g_strdup_printf("Preview: %s - %s", path, opdesk_config_get_printer_name(opdesk_server_get_config(win->server)));
+    gtk_window_set_title(GTK_WINDOW(win), title);
+    g_free(title);
+
+    GError *err = NULL;
+    GFileIOStream *stream;
+    win->temp_file = g_file_new_tmp("opdesk-preview-XXXXXX.gcode", &stream, &err);
+    if(!win->temp_file) {
+        gtk_label_set_text(GTK_LABEL(win->status), err->message);
+        g_error_free(err);
+        return;
+    }
+    g_io_stream_close(G_IO_STREAM(stream), NULL, NULL);
+    g_object_unref(stream);
+
+    char *download_path = octoprint_download_file_path(origin, path);
+    win->download = octoprint_download_new(opdesk_server_get_client(win->server), download_path, win->temp_file);
+    g_free(download_path);
+
+    g_signal_connect_object(win->download, "progress", G_CALLBACK(on_download_progress), win, 0);
+    g_signal_connect_object(win->download, "finished", G_CALLBACK(on_download_finished), win, 0);
+    if(!octoprint_download_start(win->download, &err)) {
+        gtk_label_set_text(GTK_LABEL(win->status), err->message);
+        g_error_free(err);
+        g_clear_object(&win->download);
+        return;
+    }
+    gtk_label_set_text(GTK_LABEL(win->status), "Downloading...");
+}
+
+static void opdesk_preview_window_init(OPDeskPreviewWindow *win) {
+    win->cancellable = g_cancellable_new();
+    win->printing_layer = -1;
+    win->zoom = 1.0;
+
+    gtk_window_set_default_size(GTK_WINDOW(win), 640, 640);
+    gtk_window_set_title(GTK_WINDOW(win), "Preview");
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+    gtk_container_add(GTK_CONTAINER(win), box);
+
+    win->area = gtk_drawing_area_new();
+    gtk_widget_add_events(win->area, GDK_BUTTON_PRESS_MASK | GDK_BUTTON1_MOTION_MASK | GDK_SCROLL_MASK | GDK_SMOOTH_SCROLL_MASK);
+    g_signal_connect(win->area, "draw", G_CALLBACK(on_area_draw), win);
+    g_signal_connect(win->area, "scroll-event", G_CALLBACK(on_area_scroll), win);
+    g_signal_connect(win->area, "button-press-event", G_CALLBACK(on_area_button_press), win);
+    g_signal_connect(win->area, "motion-notify-event", G_CALLBACK(on_area_motion), win);
+    gtk_box_pack_start(GTK_BOX(box), win->area, TRUE, TRUE, 0);
+
+    win->scale = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 1, 2, 1);
+    gtk_scale_set_digits(GTK_SCALE(win->scale), 0);
+    gtk_widget_set_sensitive(win->scale, FALSE);
+    g_signal_connect(win->scale, "value-changed", G_CALLBACK(on_scale_value_changed), win);
+    gtk_box_pack_start(GTK_BOX(box), win->scale, FALSE, FALSE, 0);
+
+    win->status = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(win->status), 0.0);
+    gtk_widget_set_margin_start(win->status, 6);
+    gtk_widget_set_margin_bottom(win->status, 6);
+    gtk_box_pack_start(GTK_BOX(box), win->status, FALSE, FALSE, 0);
+}
+
+OPDeskPreviewWindow *opdesk_preview_window_new_for_file(GFile *file) {
+    OPDeskPreviewWindow *win = g_object_new(OPDESK_TYPE_PREVIEW_WINDOW, NULL);
+
+    char *name = g_file_get_basename(file);
+    char *title = g_strdup_printf("Preview: %s", name);
+    gtk_window_set_title(GTK_WINDOW(win), title);
+    g_free(title);
+    g_free(name);
+
+    opdesk_preview_window_load(win, file);
+    return win;
+}
+
+OPDeskPreviewWindow *opdesk_preview_window_new_for_server(OPDeskServer *server) {
+    OPDeskPreviewWindow *win = g_object_new(OPDESK_TYPE_PREVIEW_WINDOW, "server", server, NULL);
+    opdesk_preview_window_download_job(win);
+    return win;
+}
@@ -0,0 +1,34 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gtk/gtk.h>
+
+#include "server.h"
+
+G_BEGIN_DECLS
+
+/* Layer by layer view of a G-code file's extrusions. Scroll to zoom, drag to pan.
+   For a server the selected job is downloaded, and the layer being printed is highlighted
+   and followed when DisplayLayerProgress is installed. */
+#define OPDESK_TYPE_PREVIEW_WINDOW (opdesk_preview_window_get_type())
+G_DECLARE_FINAL_TYPE(OPDeskPreviewWindow, opdesk_preview_window, OPDESK, PREVIEW_WINDOW, GtkWindow)
+
+/* file must be local */
+OPDeskPreviewWindow *opdesk_preview_window_new_for_file(GFile *file);
+OPDeskPreviewWindow *opdesk_preview_window_new_for_server(OPDeskServer *server);
+
+G_END_DECLS
@@ -23,32 +23,19 @@
 struct _OPDeskPSUMenu {
     GtkMenuItem parent_inst;
 
-    gulong on_connected_instance;
-    gulong on_disconnected_instance;
-    gulong on_plugin_instance;
-
-    // plugins supported
-    gboolean have_psu_control;
-
-    gboolean psu_is_on;
-
-    OctoPrintClient *client;
-    OctoPrintSocket *socket;
+    OPDeskServer *server;
 };
 
 G_DEFINE_TYPE(OPDeskPSUMenu, opdesk_psu_menu, GTK_TYPE_MENU_ITEM);
 
 typedef enum {
-    MENU_PROP_CLIENT = 1,
-    MENU_PROP_SOCKET,
+    MENU_PROP_SERVER = 1,
     N_PROPERTIES
 } OPDeskPSUMenuProperties;
 
 static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
 
-static void opdesk_psu_menu_socket_connected(OctoPrintSocket *socket, JsonObject *data, OPDeskPSUMenu *menu);
-static void opdesk_psu_menu_socket_disconnected(OctoPrintSocket *socket, OPDeskPSUMenu *menu);
-static void opdesk_psu_menu_socket_plugin(OctoPrintSocket *socket, JsonObject *plugin, OPDeskPSUMenu *menu);
+static void opdesk_psu_menu_psu_updated(OPDeskServer *server, OPDeskPSUMenu *menu);
 
 static void opdesk_psu_menu_activate(OPDeskPSUMenu *menu, gpointer data);
 
@@ -56,22 +43,16 @@ static void opdesk_psu_menu_set_property(GObject *object, guint property_id, con
     OPDeskPSUMenu *self = OPDESK_PSU_MENU(object);
 
     switch ((OPDeskPSUMenuProperties)property_id) {
-    case MENU_PROP_CLIENT:
-        if(self->client) g_object_unref(self->client);
-        self->client = g_value_get_object(value);
-        if(self->client) g_object_ref(self->client);
-        break;
-    case MENU_PROP_SOCKET:
-        if(self->on_connected_instance) g_signal_handler_disconnect(self->socket, self->on_connected_instance);
-        if(self->on_disconnected_instance) g_signal_handler_disconnect(self->socket, self->on_disconnected_instance);
-        if(self->on_plugin_instance) g_signal_handler_disconnect(self->socket, self->on_plugin_instance);
-        if(self->socket) g_object_unref(self->socket);
-        self->socket = g_value_get_object(value);
-        if(self->socket) {
-            g_object_ref(self->socket);
-            self->on_connected_instance = g_signal_connect(self->socket, "connected", G_CALLBACK(opdesk_psu_menu_socket_connected), self);
-            self->on_disconnected_instance = g_signal_connect(self->socket, "disconnected", G_CALLBACK(opdesk_psu_menu_socket_disconnected), self);
-            self->on_plugin_instance = g_signal_connect(self->socket, "plugin", G_CALLBACK(opdesk_psu_menu_socket_plugin), self);
+    case MENU_PROP_SERVER:
+        if(self->server) {
+            g_signal_handlers_disconnect_by_data(self->server, self);
+            g_object_unref(self->server);
+        }
+        self->server = g_value_get_object(value);
+        if(self->server) {
+            g_object_ref(self->server);
+            g_signal_connect_object(self->server, "psu-updated", G_CALLBACK(opdesk_psu_menu_psu_updated), self, 0);
+            opdesk_psu_menu_psu_updated(self->server, self);
         }
         break;
     default:
@@ -83,11 +64,8 @@ static void opdesk_psu_menu_set_property(GObject *object, guint property_id, con
 static void opdesk_psu_menu_get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec) {
     OPDeskPSUMenu *self = OPDESK_PSU_MENU(object);
     switch ((OPDeskPSUMenuProperties)property_id) {
-    case MENU_PROP_CLIENT:
-        g_value_set_object(value, self->client);
-        break;
-    case MENU_PROP_SOCKET:
-        g_value_set_object(value, self->socket);
+    case MENU_PROP_SERVER:
+        g_value_set_object(value, self->server);
         break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
@@ -103,8 +81,7 @@ static void opdesk_psu_menu_dispose(GObject *object) {
 static void opdesk_psu_menu_finalize(GObject *object) {
     OPDeskPSUMenu *self = OPDESK_PSU_MENU(object);
 
-    if(self->client) g_object_unref(self->client);
-    if(self->socket) g_object_unref(self->socket);
+    if(self->server) g_object_unref(self->server);
     G_OBJECT_CLASS(opdesk_psu_menu_parent_class)->finalize(object);
 }
 
@@ -116,8 +93,7 @@ static void opdesk_psu_menu_class_init(OPDeskPSUMenuClass *klass) {
     object_class->dispose = opdesk_psu_menu_dispose;
     object_class->finalize = opdesk_psu_menu_finalize;
 
-    obj_properties[MENU_PROP_CLIENT] = g_param_spec_object("client", "client", "OctoPrint Client instance", OCTOPRINT_TYPE_CLIENT, G_PARAM_READWRITE);
-    obj_properties[MENU_PROP_SOCKET] = g_param_spec_object("socket", "socket", "OctoPrint Socket instance", OCTOPRINT_TYPE_SOCKET, G_PARAM_READWRITE);
+    obj_properties[MENU_PROP_SERVER] = g_param_spec_object("server", "server", "OctoPrint server", OPDESK_TYPE_SERVER, G_PARAM_READWRITE);
 
     g_object_class_install_properties (object_class, N_PROPERTIES, obj_properties);
 }
@@ -125,51 +101,24 @@ static void opdesk_psu_menu_class_init(OPDeskPSUMenuClass *klass) {
 static void opdesk_psu_menu_init(OPDeskPSUMenu *menu) {
     gtk_menu_item_set_label(GTK_MENU_ITEM(menu), "PSU Toggle");
     gtk_widget_set_sensitive(GTK_WIDGET(menu), FALSE);
+    gtk_widget_set_no_show_all(GTK_WIDGET(menu), TRUE);
     g_signal_connect(menu, "activate", G_CALLBACK(opdesk_psu_menu_activate), NULL);
 }
 
-OPDeskPSUMenu *opdesk_psu_menu_new() {
-    return g_object_new(OPDESK_TYPE_PSU_MENU, NULL);
+OPDeskPSUMenu *opdesk_psu_menu_new(OPDeskServer *server) {
+    return g_object_new(OPDESK_TYPE_PSU_MENU, "server", server, NULL);
 }
 
-static void opdesk_psu_menu_socket_connected(OctoPrintSocket *socket, JsonObject *data, OPDeskPSUMenu *menu) {
-    g_debug("got socket connected");
-    menu->have_psu_control = octoprint_client_plugin_enabled(menu->client, "psucontrol");
-
-    // eventually check for other plugins, but for now PSU control
-    if(menu->have_psu_control) {
-        g_message("PSU Control plugin detected, PSU menu item enabled");
-        gtk_widget_show(GTK_WIDGET(menu));
-        // the menu item will be 'disabled' until we know if the PSU is on or off
+static void opdesk_psu_menu_psu_updated(OPDeskServer *server, OPDeskPSUMenu *menu) {
+    if(!opdesk_server_has_psu_control(server)) {
+        gtk_widget_hide(GTK_WIDGET(menu));
         gtk_widget_set_sensitive(GTK_WIDGET(menu), FALSE);
-    } else {
-        g_message("No compatible PSU plugins found, PSU menu item disabled");
-    }
-}
-
-static void opdesk_psu_menu_socket_disconnected(OctoPrintSocket *socket, OPDeskPSUMenu *menu) {
-    // forget what we know about plugins
-    menu->have_psu_control = FALSE;
-    menu->psu_is_on = FALSE;
-
-    gtk_widget_hide(GTK_WIDGET(menu));
-    gtk_widget_set_sensitive(GTK_WIDGET(menu), FALSE);
-}
-
-static void opdesk_psu_menu_socket_plugin(OctoPrintSocket *socket, JsonObject *plugin, OPDeskPSUMenu *menu) {
-    const gchar *plugin_id = json_object_get_string_member(plugin, "plugin");
-
-    if(g_strcmp0(plugin_id, "psucontrol")==0) {
-        JsonObject *data = json_object_get_object_member(plugin, "data");
-        menu->psu_is_on = json_object_get_boolean_member(data, "isPSUOn");
-    } else {
         return;
     }
 
-    g_debug("PSU status = %s", menu->psu_is_on ? "ON" : "OFF");
-
+    gtk_widget_show(GTK_WIDGET(menu));
     gtk_widget_set_sensitive(GTK_WIDGET(menu), TRUE);
-    char *lbl = g_strdup_printf("Turn PSU %s", menu->psu_is_on ? "OFF" : "ON");
+    char *lbl = g_strdup_printf("Turn PSU %s", opdesk_server_psu_is_on(server) ? "OFF" : "ON");
     gtk_menu_item_set_label(GTK_MENU_ITEM(menu), lbl);
     g_free(lbl);
 }
@@ -177,9 +126,11 @@ static void opdesk_psu_menu_socket_plugin(OctoPrintSocket *socket, JsonObject *p
 static void opdesk_psu_menu_activate(OPDeskPSUMenu *menu, gpointer data) {
 
     // we shouldn't be able to get here without having support...but just in case
-    if(!menu->have_psu_control) return;
+    if(!opdesk_server_has_psu_control(menu->server)) return;
+
+    OctoPrintClient *client = opdesk_server_get_client(menu->server);
 
-    if(menu->psu_is_on) {
+    if(opdesk_server_psu_is_on(menu->server)) {
         char *yes = "Yes";
         char *no = "No";
         char *msg = "Are you sure you want to turn the printer off? If you have a print in progress, it will be ruined and it won't be recoverable.";
@@ -195,12 +146,12 @@ static void opdesk_psu_menu_activate(OPDeskPSUMenu *menu, gpointer data) {
         gint response = gtk_dialog_run(GTK_DIALOG(dialog));
         if(response==GTK_RESPONSE_YES) {
             g_message("Turning PSU OFF");
-            octoprint_client_psucontrol_turn_off(menu->client);
+            octoprint_client_psucontrol_turn_off(client);
         }
 
         gtk_widget_destroy(dialog);
     } else {
         g_message("Turning PSU ON");
-        octoprint_client_psucontrol_turn_on(menu->client);
+        octoprint_client_psucontrol_turn_on(client);
     }
 }
\ No newline at end of file
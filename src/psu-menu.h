@@ -16,14 +16,13 @@
 // along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
 #pragma once
 #include <gtk/gtk.h>
-#include "octoprint/client.h"
-#include "octoprint/socket.h"
+#include "server.h"
 
 G_BEGIN_DECLS
 
 #define OPDESK_TYPE_PSU_MENU (opdesk_psu_menu_get_type())
 G_DECLARE_FINAL_TYPE(OPDeskPSUMenu, opdesk_psu_menu, OPDESK, PSU_MENU, GtkMenuItem)
 
-OPDeskPSUMenu *opdesk_psu_menu_new();
+OPDeskPSUMenu *opdesk_psu_menu_new(OPDeskServer *server);
 
 G_END_DECLS
@@ -0,0 +1,533 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-relay"
+#include <glib.h>
+#include <string.h>
+#include <libsoup/soup.h>
+
+#include "relay.h"
+
+#define MAX_RATE_DEFAULT 10
+#define RETRY_INTERVAL 10
+
+#define FRAME_SNAPSHOT 'S'
+#define FRAME_DELTA    'D'
+#define FRAME_EVENT    'E'
+
+static const char *const relay_protocols[] = { OPDESK_RELAY_PROTOCOL, NULL };
+
+static const char *server_name(OPDeskServer *server) {
+    return opdesk_config_get_printer_name(opdesk_server_get_config(server));
+}
+
+// the wire format is little endian, whatever either end runs on
+static GBytes *frame_new(guchar kind, GVariant *payload) {
+    GVariant *frame = g_variant_ref_sink(g_variant_new("(yv)", kind, payload));
+    if(G_BYTE_ORDER==G_BIG_ENDIAN) {
+        GVariant *swapped = g_variant_byteswap(frame);
+        g_variant_unref(frame);
+        frame = swapped;
+    }
+    GBytes *bytes = g_variant_get_data_as_bytes(frame);
+    g_variant_unref(frame);
+    return bytes;
+}
+
+// NULL if bytes isn't a frame. Untrusted, so only normal form values are used
+static GVariant *frame_parse(GBytes *bytes) {
+    GVariant *frame = g_variant_ref_sink(g_variant_new_from_bytes(G_VARIANT_TYPE("(yv)"), bytes, FALSE));
+    if(G_BYTE_ORDER==G_BIG_ENDIAN) {
+        GVariant *swapped = g_variant_byteswap(frame);
+        g_variant_unref(frame);
+        frame = swapped;
+    }
+    GVariant *normal = g_variant_get_normal_form(frame);
+    g_variant_unref(frame);
+    return normal;
+}
+
+/* Upstream */
+
+struct _OPDeskRelayServer {
+    GObject parent_instance;
+
+    SoupServer *soup_server;
+    SoupAuthDomain *auth_domain;
+    char *token;
+
+    GList *servers;
+    GList *clients; // SoupWebsocketConnection
+
+    // OPDeskServer -> a{sv} last sent in a delta
+    GHashTable *published;
+    GHashTable *dirty;
+
+    gint64 min_interval;
+    gint64 last_flush;
+    guint flush_source;
+};
+
+G_DEFINE_TYPE (OPDeskRelayServer, opdesk_relay_server, G_TYPE_OBJECT)
+
+static void opdesk_relay_server_dispose(GObject *object) {
+    OPDeskRelayServer *self = OPDESK_RELAY_SERVER(object);
+
+    if(self->flush_source) g_source_remove(self->flush_source);
+    self->flush_source = 0;
+
+    for(GList *server = self->servers; server; server = server->next) {
+        g_signal_handlers_disconnect_by_data(server->data, self);
+    }
+    g_list_free(self->servers);
+    self->servers = NULL;
+
+    for(GList *client = self->clients; client; client = client->next) {
+        g_signal_handlers_disconnect_by_data(client->data, self);
+        if(soup_websocket_connection_get_state(client->data)==SOUP_WEBSOCKET_STATE_OPEN) {
+            soup_websocket_connection_close(client->data, SOUP_WEBSOCKET_CLOSE_GOING_AWAY, NULL);
+        }
+    }
+    g_list_free_full(self->clients, g_object_unref);
+    self->clients = NULL;
+
+    if(self->soup_server) soup_server_disconnect(self->soup_server);
+    g_clear_object(&self->soup_server);
+    g_clear_object(&self->auth_domain);
+
+    G_OBJECT_CLASS(opdesk_relay_server_parent_class)->dispose(object);
+}
+
+static void opdesk_relay_server_finalize(GObject *object) {
+    OPDeskRelayServer *self = OPDESK_RELAY_SERVER(object);
+
+    g_hash_table_destroy(self->published);
+    g_hash_table_destroy(self->dirty);
+    g_free(self->token);
+
+    G_OBJECT_CLASS(opdesk_relay_server_parent_class)->finalize(object);
+}
+
+static void opdesk_relay_server_class_init(OPDeskRelayServerClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_relay_server_dispose;
+    object_class->finalize = opdesk_relay_server_finalize;
+}
+
+static void opdesk_relay_server_init(OPDeskRelayServer *relay) {
+    relay->published = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_variant_unref);
+    relay->dirty = g_hash_table_new(g_direct_hash, g_direct_equal);
+}
+
+// one encoding for every client
+static void opdesk_relay_server_broadcast(OPDeskRelayServer *relay, GBytes *frame) {
+    gsize size;
+    gconstpointer data = g_bytes_get_data(frame, &size);
+    for(GList *client = relay->clients; client; client = client->next) {
+        if(soup_websocket_connection_get_state(client->data)!=SOUP_WEBSOCKET_STATE_OPEN) continue;
+        soup_websocket_connection_send_binary(client->data, data, size);
+    }
+}
+
+static void opdesk_relay_server_flush(OPDeskRelayServer *relay) {
+    if(relay->flush_source) g_source_remove(relay->flush_source);
+    relay->flush_source = 0;
+    if(!g_hash_table_size(relay->dirty)) return;
+
+    GVariantBuilder changes;
+    g_variant_builder_init(&changes, G_VARIANT_TYPE("a{sa{sv}}"));
+    gboolean any = FALSE;
+
+    for(GList *l = relay->servers; l; l = l->next) {
+        OPDeskServer *server = l->data;
+        if(!g_hash_table_contains(relay->dirty, server)) continue;
+
+        GVariant *state = g_variant_ref_sink(opdesk_server_get_state(server));
+        GVariant *fields = opdesk_server_state_diff(state, g_hash_table_lookup(relay->published, server));
+        if(fields) {
+            g_variant_builder_add(&changes, "{s@a{sv}}", server_name(server), fields);
+            g_hash_table_replace(relay->published, server, g_variant_ref(state));
+            any = TRUE;
+        }
+        g_variant_unref(state);
+    }
+    g_hash_table_remove_all(relay->dirty);
+    relay->last_flush = g_get_monotonic_time();
+
+    if(!any) {
+        g_variant_builder_clear(&changes);
+        return;
+    }
+
+    GBytes *frame = frame_new(FRAME_DELTA, g_variant_builder_end(&changes));
+    opdesk_relay_server_broadcast(relay, frame);
+    g_bytes_unref(frame);
+}
+
+static gboolean on_flush_timeout(OPDeskRelayServer *relay) {
+    relay->flush_source = 0;
+    opdesk_relay_server_flush(relay);
+    return G_SOURCE_REMOVE;
+}
+
+static void opdesk_relay_server_server_changed(OPDeskServer *server, OPDeskRelayServer *relay) {
+    g_hash_table_add(relay->dirty, server);
+    if(relay->flush_source) return;
+
+    gint64 wait = relay->last_flush + relay->min_interval - g_get_monotonic_time();
+    relay->flush_source = g_timeout_add(MAX(wait, 0) / 1000, G_SOURCE_FUNC(on_flush_timeout), relay);
+}
+
+static void opdesk_relay_server_server_event(OPDeskServer *server, JsonObject *event, OPDeskRelayServer *relay) {
+    if(!relay->clients) return;
+
+    // whatever led up to the event goes first
+    opdesk_relay_server_flush(relay);
+
+    JsonNode *node = json_node_new(JSON_NODE_OBJECT);
+    json_node_set_object(node, event);
+    char *json = json_to_string(node, FALSE);
+    json_node_unref(node);
+
+    GBytes *frame = frame_new(FRAME_EVENT, g_variant_new("(ss)", server_name(server), json));
+    opdesk_relay_server_broadcast(relay, frame);
+    g_bytes_unref(frame);
+    g_free(json);
+}
+
+static void on_client_closed(SoupWebsocketConnection *connection, OPDeskRelayServer *relay) {
+    g_message("Relay client %s disconnected, %u left", soup_uri_get_host(soup_websocket_connection_get_uri(connection)), g_list_length(relay->clients) - 1);
+    relay->clients = g_list_remove(relay->clients, connection);
+    g_signal_handlers_disconnect_by_data(connection, relay);
+    g_object_unref(connection);
+}
+
+static void on_client_connected(SoupServer *server, SoupWebsocketConnection *connection, const char *path, SoupClientContext *client, OPDeskRelayServer *relay) {
+    g_message("Relay client %s connected", soup_client_context_get_host(client));
+
+    // a delta sent after the snapshot has to build on what the snapshot had
+    opdesk_relay_server_flush(relay);
+
+    GVariantBuilder printers;
+    g_variant_builder_init(&printers, G_VARIANT_TYPE("a{sa{sv}}"));
+    for(GList *s = relay->servers; s; s = s->next) {
+        g_variant_builder_add(&printers, "{s@a{sv}}", server_name(s->data), g_hash_table_lookup(relay->published, s->data));
+    }
+    GBytes *frame = frame_new(FRAME_SNAPSHOT, g_variant_builder_end(&printers));
+    gsize size;
+    gconstpointer data = g_bytes_get_data(frame, &size);
+    soup_websocket_connection_send_binary(connection, data, size);
+    g_bytes_unref(frame);
+
+    relay->clients = g_list_prepend(relay->clients, g_object_ref(connection));
+    g_signal_connect(connection, "closed", G_CALLBACK(on_client_closed), relay);
+}
+
+// takes as long whatever the password and however much of it matches, so the token can't be guessed a byte at a time
+static gboolean token_equal(const char *password, const char *token) {
+    if(!password) return FALSE;
+
+    gsize password_len = strlen(password);
+    gsize token_len = strlen(token);
+    guchar diff = password_len!=token_len;
+    for(gsize i=0;i<token_len;i++) diff |= (guchar)token[i] ^ (guchar)password[i < password_len ? i : 0];
+
+    return diff==0;
+}
+
+static gboolean on_basic_auth(SoupAuthDomain *domain, SoupMessage *msg, const char *username, const char *password, OPDeskRelayServer *relay) {
+    return token_equal(password, relay->token);
+}
+
+OPDeskRelayServer *opdesk_relay_server_new(OPDeskAppConfig *config, GList *servers) {
+    guint port = opdesk_app_config_get_int(config, "relay.port", 0);
+    if(!port) return NULL;
+
+    const char *token = opdesk_app_config_get_string(config, "relay.token", NULL);
+    if(!token || !*token) {
+        g_warning("Not relaying, relay.token must be set along with relay.port");
+        return NULL;
+    }
+
+    OPDeskRelayServer *relay = g_object_new(OPDESK_TYPE_RELAY_SERVER, NULL);
+    relay->token = g_strdup(token);
+    gdouble max_rate = opdesk_app_config_get_double(config, "relay.maxRate", MAX_RATE_DEFAULT);
+    relay->min_interval = G_USEC_PER_SEC / (max_rate > 0 ? max_rate : MAX_RATE_DEFAULT);
+
+    relay->soup_server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "octoprint-desktop ", NULL);
+    relay->auth_domain = soup_auth_domain_basic_new(
+        SOUP_AUTH_DOMAIN_REALM, "OctoPrint-Desktop relay",
+        SOUP_AUTH_DOMAIN_BASIC_AUTH_CALLBACK, on_basic_auth,
+        SOUP_AUTH_DOMAIN_BASIC_AUTH_DATA, relay,
+        SOUP_AUTH_DOMAIN_ADD_PATH, OPDESK_RELAY_PATH,
+        NULL);
+    soup_server_add_auth_domain(relay->soup_server, relay->auth_domain);
+    soup_server_add_websocket_handler(relay->soup_server, OPDESK_RELAY_PATH, NULL, (char**)relay_protocols, (SoupServerWebsocketCallback)on_client_connected, relay, NULL);
+
+    GError *err = NULL;
+    if(!soup_server_listen_all(relay->soup_server, port, 0, &err)) {
+        g_warning("Unable to relay on port %u: %s", port, err->message);
+        g_error_free(err);
+        g_object_unref(relay);
+        return NULL;
+    }
+
+    relay->servers = g_list_copy(servers);
+    for(GList *server = relay->servers; server; server = server->next) {
+        g_hash_table_insert(relay->published, server->data, g_variant_ref_sink(opdesk_server_get_state(server->data)));
+        g_signal_connect(server->data, "state-updated", G_CALLBACK(opdesk_relay_server_server_changed), relay);
+        g_signal_connect(server->data, "psu-updated", G_CALLBACK(opdesk_relay_server_server_changed), relay);
+        g_signal_connect(server->data, "temps-updated", G_CALLBACK(opdesk_relay_server_server_changed), relay);
+        g_signal_connect(server->data, "render-progress", G_CALLBACK(opdesk_relay_server_server_changed), relay);
+        g_signal_connect(server->data, "event", G_CALLBACK(opdesk_relay_server_server_event), relay);
+    }
+
+    g_message("Relaying %u printers on port %u", g_list_length(relay->servers), port);
+    return relay;
+}
+
+/* Downstream */
+
+struct _OPDeskRelayClient {
+    GObject parent_instance;
+
+    char *url;
+    char *token;
+
+    SoupSession *session;
+    SoupWebsocketConnection *websocket;
+    GCancellable *cancellable;
+    guint retry_source;
+
+    GHashTable *servers; // name -> OPDeskServer
+};
+
+G_DEFINE_TYPE (OPDeskRelayClient, opdesk_relay_client, G_TYPE_OBJECT)
+
+static void opdesk_relay_client_dispose(GObject *object) {
+    OPDeskRelayClient *self = OPDESK_RELAY_CLIENT(object);
+
+    if(self->retry_source) g_source_remove(self->retry_source);
+    self->retry_source = 0;
+    if(self->cancellable) g_cancellable_cancel(self->cancellable);
+    g_clear_object(&self->cancellable);
+    if(self->websocket) {
+        g_signal_handlers_disconnect_by_data(self->websocket, self);
+        if(soup_websocket_connection_get_state(self->websocket)==SOUP_WEBSOCKET_STATE_OPEN) {
+            soup_websocket_connection_close(self->websocket, SOUP_WEBSOCKET_CLOSE_GOING_AWAY, NULL);
+        }
+    }
+    g_clear_object(&self->websocket);
+    g_clear_object(&self->session);
+
+    G_OBJECT_CLASS(opdesk_relay_client_parent_class)->dispose(object);
+}
+
+static void opdesk_relay_client_finalize(GObject *object) {
+    OPDeskRelayClient *self = OPDESK_RELAY_CLIENT(object);
+
+    g_hash_table_destroy(self->servers);
+    g_free(self->url);
+    g_free(self->token);
+
+    G_OBJECT_CLASS(opdesk_relay_client_parent_class)->finalize(object);
+}
+
+static void opdesk_relay_client_class_init(OPDeskRelayClientClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_relay_client_dispose;
+    object_class->finalize = opdesk_relay_client_finalize;
+}
+
+static void opdesk_relay_client_init(OPDeskRelayClient *client) {
+    client->servers = g_hash_table_new(g_str_hash, g_str_equal);
+    client->session = soup_session_new();
+}
+
+static void opdesk_relay_client_connect(OPDeskRelayClient *client);
+
+static void opdesk_relay_client_set_disconnected(OPDeskRelayClient *client, OPDeskServer *server) {
+    if(!opdesk_server_is_connected(server)) return;
+
+    GVariantDict changes;
+    g_variant_dict_init(&changes, NULL);
+    g_variant_dict_insert(&changes, "connected", "b", FALSE);
+    opdesk_server_feed_state(server, g_variant_dict_end(&changes));
+}
+
+static gboolean on_retry(OPDeskRelayClient *client) {
+    client->retry_source = 0;
+    opdesk_relay_client_connect(client);
+    return G_SOURCE_REMOVE;
+}
+
+static void opdesk_relay_client_lost(OPDeskRelayClient *client) {
+    GHashTableIter iter;
+    gpointer server;
+    g_hash_table_iter_init(&iter, client->servers);
+    while(g_hash_table_iter_next(&iter, NULL, &server)) opdesk_relay_client_set_disconnected(client, server);
+
+    if(!client->retry_source) client->retry_source = g_timeout_add_seconds(RETRY_INTERVAL, G_SOURCE_FUNC(on_retry), client);
+}
+
+static void opdesk_relay_client_apply_printers(OPDeskRelayClient *client, GVariant *printers, gboolean snapshot) {
+    if(!g_variant_is_of_type(printers, G_VARIANT_TYPE("a{sa{sv}}"))) {
+        g_warning("Ignoring malformed %s from relay", snapshot ? "snapshot" : "delta");
+        return;
+    }
+
+    GHashTable *seen = snapshot ? g_hash_table_new(g_direct_hash, g_direct_equal) : NULL;
+
+    GVariantIter iter;
+    const char *name;
+    GVariant *state;
+    g_variant_iter_init(&iter, printers);
+    while(g_variant_iter_next(&iter, "{&s@a{sv}}", &name, &state)) {
+        OPDeskServer *server = g_hash_table_lookup(client->servers, name);
+        if(server) {
+            opdesk_server_feed_state(server, state);
+            if(seen) g_hash_table_add(seen, server);
+        }
+        g_variant_unref(state);
+    }
+
+    if(seen) {
+        GHashTableIter servers;
+        gpointer server;
+        g_hash_table_iter_init(&servers, client->servers);
+        while(g_hash_table_iter_next(&servers, NULL, &server)) {
+            if(!g_hash_table_contains(seen, server)) opdesk_relay_client_set_disconnected(client, server);
+        }
+        g_hash_table_destroy(seen);
+    }
+}
+
+static void opdesk_relay_client_apply_event(OPDeskRelayClient *client, GVariant *payload) {
+    if(!g_variant_is_of_type(payload, G_VARIANT_TYPE("(ss)"))) {
+        g_warning("Ignoring malformed event from relay");
+        return;
+    }
+
+    const char *name, *json;
+    g_variant_get(payload, "(&s&s)", &name, &json);
+    OPDeskServer *server = g_hash_table_lookup(client->servers, name);
+    if(!server) return;
+
+    JsonNode *node = json_from_string(json, NULL);
+    if(node && JSON_NODE_HOLDS_OBJECT(node)) opdesk_server_feed_event(server, json_node_get_object(node));
+    if(node) json_node_unref(node);
+}
+
+static void on_relay_message(SoupWebsocketConnection *websocket, gint type, GBytes *message, OPDeskRelayClient *client) {
+    if(type!=SOUP_WEBSOCKET_DATA_BINARY) return;
+
+    GVariant *frame = frame_parse(message);
+    guchar kind;
+    GVariant *payload;
+    g_variant_get(frame, "(yv)", &kind, &payload);
+
+    switch(kind) {
+    case FRAME_SNAPSHOT:
+        g_message("Got snapshot of %" G_GSIZE_FORMAT " printers from relay", g_variant_n_children(payload));
+        opdesk_relay_client_apply_printers(client, payload, TRUE);
+        break;
+    case FRAME_DELTA:
+        opdesk_relay_client_apply_printers(client, payload, FALSE);
+        break;
+    case FRAME_EVENT:
+        opdesk_relay_client_apply_event(client, payload);
+        break;
+    default:
+        g_debug("Ignoring relay frame of kind %u", kind);
+        break;
+    }
+
+    g_variant_unref(payload);
+    g_variant_unref(frame);
+}
+
+static void on_relay_closed(SoupWebsocketConnection *websocket, OPDeskRelayClient *client) {
+    g_warning("Disconnected from relay %s: %u %s", client->url, soup_websocket_connection_get_close_code(websocket), soup_websocket_connection_get_close_data(websocket));
+    g_signal_handlers_disconnect_by_data(websocket, client);
+    g_clear_object(&client->websocket);
+    opdesk_relay_client_lost(client);
+}
+
+static void on_relay_connected(SoupSession *session, GAsyncResult *result, OPDeskRelayClient *client) {
+    GError *err = NULL;
+    SoupWebsocketConnection *websocket = soup_session_websocket_connect_finish(session, result, &err);
+    if(!websocket) {
+        if(!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_warning("Unable to connect to relay %s: %s", client->url, err->message);
+            opdesk_relay_client_lost(client);
+        }
+        g_error_free(err);
+        g_object_unref(client);
+        return;
+    }
+
+    g_message("Connected to relay %s", client->url);
+    g_clear_object(&client->cancellable);
+    client->websocket = websocket;
+    // snapshots of big fleets are bigger than the default limit
+    g_object_set(websocket, "max-incoming-payload-size", (guint64)0, NULL);
+    g_signal_connect(websocket, "message", G_CALLBACK(on_relay_message), client);
+    g_signal_connect(websocket, "closed", G_CALLBACK(on_relay_closed), client);
+    g_object_unref(client);
+}
+
+static void opdesk_relay_client_connect(OPDeskRelayClient *client) {
+    char *url = g_strdup_printf("%s%s", client->url, OPDESK_RELAY_PATH);
+    SoupMessage *msg = soup_message_new("GET", url);
+    g_free(url);
+    if(!msg) {
+        g_warning("Not connecting to relay, %s isn't a valid URL", client->url);
+        return;
+    }
+
+    char *credentials = g_strdup_printf("relay:%s", client->token);
+    char *encoded = g_base64_encode((const guchar*)credentials, strlen(credentials));
+    char *authorization = g_strdup_printf("Basic %s", encoded);
+    soup_message_headers_replace(msg->request_headers, "Authorization", authorization);
+    g_free(authorization);
+    g_free(encoded);
+    g_free(credentials);
+
+    if(client->cancellable) g_object_unref(client->cancellable);
+    client->cancellable = g_cancellable_new();
+    soup_session_websocket_connect_async(client->session, msg, NULL, (char**)relay_protocols, client->cancellable, (GAsyncReadyCallback)on_relay_connected, g_object_ref(client));
+    g_object_unref(msg);
+}
+
+OPDeskRelayClient *opdesk_relay_client_new(OPDeskAppConfig *config, GList *servers) {
+    OPDeskRelayClient *client = g_object_new(OPDESK_TYPE_RELAY_CLIENT, NULL);
+    client->url = g_strdup(opdesk_app_config_get_string(config, "relay.url", NULL));
+    client->token = g_strdup(opdesk_app_config_get_string(config, "relay.token", ""));
+
+    // no trailing slash, the path is added to it
+    gsize len = strlen(client->url);
+    while(len && client->url[len-1]=='/') client->url[--len] = '\0';
+
+    for(GList *server = servers; server; server = server->next) {
+        g_hash_table_insert(client->servers, (gpointer)server_name(server->data), server->data);
+    }
+
+    opdesk_relay_client_connect(client);
+    return client;
+}
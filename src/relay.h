@@ -0,0 +1,52 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <glib-object.h>
+
+#include "config.h"
+#include "server.h"
+
+G_BEGIN_DECLS
+
+/* Relay mode: one instance keeps the connection to each OctoPrint server and passes the decoded state on
+   to any number of other instances, so the load on each OctoPrint stays the same however many desktops
+   are watching.
+
+   The protocol is a websocket at /relay with the subprotocol below, authenticated with HTTP basic auth
+   (any user, relay.token as the password). Every frame is binary, a little endian GVariant of type (yv):
+    - 'S' a{sa{sv}}, printer name to the whole of opdesk_server_get_state, sent once on connect
+    - 'D' a{sa{sv}}, the fields that changed since the last snapshot or delta, at most relay.maxRate a second
+    - 'E' (ss), printer name and an OctoPrint event message as JSON, in order with the deltas */
+#define OPDESK_RELAY_PROTOCOL "opdesk-relay-1"
+#define OPDESK_RELAY_PATH "/relay"
+
+/* The upstream end, serving every server in servers */
+#define OPDESK_TYPE_RELAY_SERVER opdesk_relay_server_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskRelayServer, opdesk_relay_server, OPDESK, RELAY_SERVER, GObject)
+
+/* NULL unless relay.port is set, or if it can't be opened. The servers must outlive the relay */
+OPDeskRelayServer *opdesk_relay_server_new(OPDeskAppConfig *config, GList *servers);
+
+/* The downstream end, feeding servers created with opdesk_server_new_fed from relay.url.
+   Printers are matched by name, ones the relay doesn't know about are shown disconnected */
+#define OPDESK_TYPE_RELAY_CLIENT opdesk_relay_client_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskRelayClient, opdesk_relay_client, OPDESK, RELAY_CLIENT, GObject)
+
+/* connects right away and reconnects whenever the relay goes away */
+OPDeskRelayClient *opdesk_relay_client_new(OPDeskAppConfig *config, GList *servers);
+
+G_END_DECLS
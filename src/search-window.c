@@ -0,0 +1,222 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-search"
+#include <glib.h>
+
+#include "search-window.h"
+#include "server.h"
+
+#define SEARCH_RESULT_LIMIT 100
+
+struct _OPDeskSearchWindow {
+    GtkWindow parent_inst;
+
+    OPDeskFileIndex *file_index;
+
+    GtkWidget *entry;
+    GtkWidget *list;
+    GtkWidget *status;
+};
+
+G_DEFINE_TYPE(OPDeskSearchWindow, opdesk_search_window, GTK_TYPE_WINDOW);
+
+typedef enum {
+    WINDOW_PROP_FILE_INDEX = 1,
+    N_PROPERTIES
+} OPDeskSearchWindowProperties;
+
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
+
+static void opdesk_search_window_set_property(GObject *object, guint property_id, const GValue *value, GParamSpec *pspec) {
+    OPDeskSearchWindow *self = OPDESK_SEARCH_WINDOW(object);
+
+    switch ((OPDeskSearchWindowProperties)property_id) {
+    case WINDOW_PROP_FILE_INDEX:
+        if(self->file_index) g_object_unref(self->file_index);
+        self->file_index = g_value_get_object(value);
+        if(self->file_index) g_object_ref(self->file_index);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+        break;
+    }
+}
+
+static void opdesk_search_window_get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec) {
+    OPDeskSearchWindow *self = OPDESK_SEARCH_WINDOW(object);
+    switch ((OPDeskSearchWindowProperties)property_id) {
+    case WINDOW_PROP_FILE_INDEX:
+        g_value_set_object(value, self->file_index);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+        break;
+    }
+}
+
+static void opdesk_search_window_finalize(GObject *object) {
+    OPDeskSearchWindow *self = OPDESK_SEARCH_WINDOW(object);
+
+    if(self->file_index) g_object_unref(self->file_index);
+
+    G_OBJECT_CLASS(opdesk_search_window_parent_class)->finalize(object);
+}
+
+static void opdesk_search_window_class_init(OPDeskSearchWindowClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->get_property = opdesk_search_window_get_property;
+    object_class->set_property = opdesk_search_window_set_property;
+    object_class->finalize = opdesk_search_window_finalize;
+
+    obj_properties[WINDOW_PROP_FILE_INDEX] = g_param_spec_object("file-index", "file index", "Files to search", OPDESK_TYPE_FILE_INDEX, G_PARAM_READWRITE);
+
+    g_object_class_install_properties(object_class, N_PROPERTIES, obj_properties);
+}
+
+static GtkWidget *search_result_row_new(const OPDeskFileIndexEntry *entry) {
+    OPDeskServer *server = entry->server;
+
+    char *name = g_markup_escape_text(entry->name, -1);
+    char *printer = g_markup_escape_text(opdesk_config_get_printer_name(opdesk_server_get_config(server)), -1);
+    char *path = g_markup_escape_text(entry->path, -1);
+    char *markup;
+    if(entry->size >= 0) {
+        char *size = g_format_size(entry->size);
+        markup = g_strdup_printf("<b>%s</b>\n<small>%s: %s/%s, %s</small>", name, printer, entry->origin, path, size);
+        g_free(size);
+    } else {
+        markup = g_strdup_printf("<b>%s</b>\n<small>%s: %s/%s</small>", name, printer, entry->origin, path);
+    }
+
+    GtkWidget *label = gtk_label_new(NULL);
+    gtk_label_set_markup(GTK_LABEL(label), markup);
+    gtk_label_set_xalign(GTK_LABEL(label), 0.0);
+    gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_MIDDLE);
+    gtk_widget_set_margin_start(label, 6);
+    gtk_widget_set_margin_end(label, 6);
+    gtk_widget_set_margin_top(label, 3);
+    gtk_widget_set_margin_bottom(label, 3);
+
+    g_free(markup);
+    g_free(path);
+    g_free(printer);
+    g_free(name);
+
+    // entries only live until the index changes, rows keep their own copy
+    GtkWidget *row = gtk_list_box_row_new();
+    gtk_container_add(GTK_CONTAINER(row), label);
+    g_object_set_data_full(G_OBJECT(row), "opdesk-server", g_object_ref(server), g_object_unref);
+    g_object_set_data_full(G_OBJECT(row), "opdesk-origin", g_strdup(entry->origin), g_free);
+    g_object_set_data_full(G_OBJECT(row), "opdesk-path", g_strdup(entry->path), g_free);
+    return row;
+}
+
+static void on_entry_search_changed(GtkSearchEntry *entry, OPDeskSearchWindow *win) {
+    GList *rows = gtk_container_get_children(GTK_CONTAINER(win->list));
+    for(GList *row = rows; row; row = row->next) gtk_widget_destroy(row->data);
+    g_list_free(rows);
+
+    const char *query = gtk_entry_get_text(GTK_ENTRY(entry));
+    if(!*query) {
+        char *status = g_strdup_printf("%u files on all printers", opdesk_file_index_get_count(win->file_index));
+        gtk_label_set_text(GTK_LABEL(win->status), status);
+        g_free(status);
+        return;
+    }
+
+    gint64 start = g_get_monotonic_time();
+    GPtrArray *results = opdesk_file_index_search(win->file_index, query, SEARCH_RESULT_LIMIT);
+    gint64 took = g_get_monotonic_time() - start;
+
+    for(guint r=0;r<results->len;r++) gtk_container_add(GTK_CONTAINER(win->list), search_result_row_new(g_ptr_array_index(results, r)));
+    gtk_widget_show_all(win->list);
+
+    char *status;
+    if(results->len==SEARCH_RESULT_LIMIT) status = g_strdup_printf("First %u matches (%.1f ms)", results->len, took / 1000.0);
+    else status = g_strdup_printf("%u matches (%.1f ms)", results->len, took / 1000.0);
+    gtk_label_set_text(GTK_LABEL(win->status), status);
+    g_free(status);
+
+    g_ptr_array_unref(results);
+}
+
+static void on_print_started(OctoPrintClient *client, guint status, JsonObject *response, gpointer user_data) {
+    OPDeskServer *server = user_data;
+    if(!SOUP_STATUS_IS_SUCCESSFUL(status)) {
+        // 409 when the printer isn't operational or is already printing
+        opdesk_server_send_notification(server, G_NOTIFICATION_PRIORITY_HIGH, "search-print", "Couldn't start the print (%u)", status);
+    }
+    g_object_unref(server);
+}
+
+static void on_list_row_activated(GtkListBox *list, GtkListBoxRow *row, OPDeskSearchWindow *win) {
+    OPDeskServer *server = g_object_get_data(G_OBJECT(row), "opdesk-server");
+    const char *origin = g_object_get_data(G_OBJECT(row), "opdesk-origin");
+    const char *path = g_object_get_data(G_OBJECT(row), "opdesk-path");
+    const char *printer = opdesk_config_get_printer_name(opdesk_server_get_config(server));
+
+    if(!opdesk_server_is_operational(server) || opdesk_server_is_printing(server)) {
+        GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(win), GTK_DIALOG_MODAL, GTK_MESSAGE_INFO, GTK_BUTTONS_OK,
+            "%s isn't ready to print.", printer);
+        gtk_dialog_run(GTK_DIALOG(dialog));
+        gtk_widget_destroy(dialog);
+        return;
+    }
+
+    GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(win), GTK_DIALOG_MODAL, GTK_MESSAGE_QUESTION, GTK_BUTTONS_YES_NO,
+        "Start printing %s on %s?", path, printer);
+    gint response = gtk_dialog_run(GTK_DIALOG(dialog));
+    gtk_widget_destroy(dialog);
+    if(response!=GTK_RESPONSE_YES) return;
+
+    opdesk_server_print_file(server, origin, path, on_print_started, g_object_ref(server));
+}
+
+static void opdesk_search_window_init(OPDeskSearchWindow *win) {
+    gtk_window_set_default_size(GTK_WINDOW(win), 480, 480);
+    gtk_window_set_title(GTK_WINDOW(win), "Find File");
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+    gtk_container_set_border_width(GTK_CONTAINER(box), 6);
+    gtk_container_add(GTK_CONTAINER(win), box);
+
+    win->entry = gtk_search_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(win->entry), "File name on any printer");
+    g_signal_connect(win->entry, "search-changed", G_CALLBACK(on_entry_search_changed), win);
+    gtk_box_pack_start(GTK_BOX(box), win->entry, FALSE, FALSE, 0);
+
+    GtkWidget *scroll = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroll), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_box_pack_start(GTK_BOX(box), scroll, TRUE, TRUE, 0);
+
+    win->list = gtk_list_box_new();
+    gtk_list_box_set_activate_on_single_click(GTK_LIST_BOX(win->list), FALSE);
+    g_signal_connect(win->list, "row-activated", G_CALLBACK(on_list_row_activated), win);
+    gtk_container_add(GTK_CONTAINER(scroll), win->list);
+
+    win->status = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(win->status), 0.0);
+    gtk_box_pack_start(GTK_BOX(box), win->status, FALSE, FALSE, 0);
+}
+
+OPDeskSearchWindow *opdesk_search_window_new(OPDeskFileIndex *file_index) {
+    OPDeskSearchWindow *win = g_object_new(OPDESK_TYPE_SEARCH_WINDOW, "file-index", file_index, NULL);
+    on_entry_search_changed(GTK_SEARCH_ENTRY(win->entry), win);
+    return win;
+}
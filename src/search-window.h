@@ -0,0 +1,31 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gtk/gtk.h>
+
+#include "file-index.h"
+
+G_BEGIN_DECLS
+
+/* Searches the files on every printer as you type, activating a result starts printing it
+   after confirmation. */
+#define OPDESK_TYPE_SEARCH_WINDOW (opdesk_search_window_get_type())
+G_DECLARE_FINAL_TYPE(OPDeskSearchWindow, opdesk_search_window, OPDESK, SEARCH_WINDOW, GtkWindow)
+
+OPDeskSearchWindow *opdesk_search_window_new(OPDeskFileIndex *file_index);
+
+G_END_DECLS
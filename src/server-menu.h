@@ -17,15 +17,16 @@
 #pragma once
 #include <gtk/gtk.h>
 
-#include "config.h"
+#include "server.h"
 
 G_BEGIN_DECLS
 
 #define OPDESK_TYPE_SERVER_MENU (opdesk_server_menu_get_type())
 G_DECLARE_FINAL_TYPE(OPDeskServerMenu, opdesk_server_menu, OPDESK, SERVER_MENU, GtkMenuItem)
 
-OPDeskServerMenu *opdesk_server_menu_new(OPDeskConfig *config);
+/* A view of an OPDeskServer, the submenu is only populated while it's in use */
+OPDeskServerMenu *opdesk_server_menu_new(OPDeskServer *server, guint idle_timeout);
 
-const char *opdesk_server_menu_get_status_markup(OPDeskServerMenu *menu);
+OPDeskServer *opdesk_server_menu_get_server(OPDeskServerMenu *menu);
 
 G_END_DECLS
\ No newline at end of file
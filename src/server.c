@@ -0,0 +1,1530 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-server"
+#include <glib.h>
+#include <string.h>
+
+#include "server.h"
+#include "event-rules.h"
+
+struct _OPDeskServer {
+    GObject parent_instance;
+
+    OPDeskConfig *config;
+    OPDeskNotificationScheduler *notification_scheduler;
+    OPDeskFileIndex *file_index;
+
+    OctoPrintClient *client;
+    OctoPrintSocket *socket;
+    OPDeskServerStats *stats;
+    // state comes from opdesk_server_feed_*, there's no socket
+    gboolean fed;
+    // the socket's, NULL for the main context
+    OctoPrintIOThread *io_thread;
+
+    gboolean connected_to_op;
+    gboolean no_retry;
+    guint retry_source;
+
+    struct {
+        gboolean operational;
+        gboolean paused;
+        gboolean printing;
+        gboolean pausing;
+        gboolean cancelling;
+        gboolean sd_ready;
+        gboolean error;
+        gboolean ready;
+    } state;
+
+    guint connected;
+    guint history;
+    guint current;
+    guint event;
+    guint plugin;
+    guint error;
+    guint disconnected;
+    guint render_progress_handler;
+
+    char *print_filename;
+    // the selected job's file in OctoPrint's storage, for downloading it
+    char *print_origin;
+    char *print_path;
+    float print_progress;
+    float time_left;
+    char *status_text;
+
+    GHashTable *current_temps;
+
+    gboolean have_display_layer_progress;
+    gint64 current_layer;
+    gint64 total_layers;
+
+    // timelapse rendering, -1 when there's nothing rendering
+    gdouble render_progress;
+
+    // plugins supported
+    gboolean have_psu_control;
+    gboolean psu_is_on;
+
+    // fetched the first time a view needs it, cleared when OctoPrint reports a change
+    JsonObject *printer_profile;
+    gboolean printer_profile_loading;
+    guint printer_profile_generation; // bumped on every change, so a fetch that raced one is redone
+    OctoPrintSettings *settings;
+    gboolean settings_loading;
+    guint settings_generation; // like printer_profile_generation
+
+    GList *uploads; // OctoPrintUpload, queued or sending
+    // uploaded file name -> layer count, {print-totalLayers} without DisplayLayerProgress
+    GHashTable *file_layers;
+
+    // a listing for the file index is in flight, file events are held until it's applied
+    GCancellable *files_cancellable;
+    GPtrArray *pending_file_events; // JsonObject
+
+    JsonObject *event_payload;
+
+    GRegex *message_pat;
+    GRegex *template_var_pat;
+};
+
+G_DEFINE_TYPE (OPDeskServer, opdesk_server, G_TYPE_OBJECT)
+
+typedef enum {
+    PROP_CONFIG = 1,
+    PROP_NOTIFICATION_SCHEDULER,
+    PROP_FILE_INDEX,
+    PROP_FED,
+    PROP_IO_THREAD,
+    N_PROPERTIES
+} OPDeskServerProperty;
+
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
+
+typedef enum {
+    STATUS_UPDATED,
+    STATE_UPDATED,
+    CONNECTED,
+    DISCONNECTED,
+    EVENT,
+    PSU_UPDATED,
+    TEMPS_UPDATED,
+    PRINTER_PROFILE_CHANGED,
+    SETTINGS_CHANGED,
+    UPLOAD_STARTED,
+    RENDER_PROGRESS,
+    N_SIGNALS
+} OPDeskServerSignal;
+
+static guint obj_signals[N_SIGNALS] = { 0, };
+
+// events that invalidate the cached printer profile, interned once
+static GQuark event_printer_profile_modified_q;
+static GQuark event_settings_updated_q;
+// events that change the file index
+static GQuark event_upload_q;
+static GQuark event_file_added_q;
+static GQuark event_file_removed_q;
+static GQuark event_folder_removed_q;
+static GQuark event_updated_files_q;
+// timelapse rendering
+static GQuark event_movie_rendering_q;
+static GQuark event_movie_done_q;
+static GQuark event_movie_failed_q;
+
+static void opdesk_server_dispose_config(OPDeskServer *server);
+static void opdesk_server_setup_config(OPDeskServer *server);
+
+struct OPDeskServerTempData {
+    char *name;
+    float target;
+    float actual;
+    float offset;
+};
+typedef struct OPDeskServerTempData OPDeskServerTempData;
+
+static void opdesk_server_temp_data_free(OPDeskServerTempData *data) {
+    g_free(data->name);
+    g_free(data);
+}
+
+static gchar *format_time_left(guint64 time_left) {
+    guint days = 0;
+    guint hours = 0;
+    guint minutes = 0;
+
+    days = time_left / 60 / 60 / 24;
+    hours = (time_left - (days * 60 * 60 * 24)) / 60 / 60;
+    minutes = (time_left - (days * 60 * 60 * 24) - (hours * 60 * 60)) / 60;
+
+    gchar *days_str;
+    gchar *hours_str;
+    gchar *minutes_str;
+
+    if (days) days_str = g_strdup_printf("%d days", days);
+    else days_str = g_strdup("");
+    if (hours) hours_str = g_strdup_printf("%d hours", hours);
+    else hours_str = g_strdup("");
+    minutes_str = g_strdup_printf("%d minutes", minutes);
+
+    gchar *str = g_strdup_printf("%s %s %s", days_str, hours_str, minutes_str);
+    g_strstrip(str);
+
+    g_free(days_str);
+    g_free(hours_str);
+    g_free(minutes_str);
+
+    return str;
+}
+
+static void opdesk_server_update_status(OPDeskServer *server) {
+    gchar *new_status;
+    OPDeskConfigStatusTemplateType template_type;
+
+    if (!server->connected_to_op) {
+        template_type = STATUS_TEMPLATE_NOT_CONNECTED;
+    } else if (!server->state.operational) {
+        if (server->state.error) {
+            template_type = STATUS_TEMPLATE_OFFLINE_ERROR;
+        } else {
+            template_type = STATUS_TEMPLATE_OFFLINE;
+        }
+    } else {
+        if (server->state.cancelling) {
+            template_type = STATUS_TEMPLATE_CANCELLING;
+        } else if (server->state.pausing) {
+            template_type = STATUS_TEMPLATE_PAUSING;
+        } else if (server->state.paused) {
+            template_type = STATUS_TEMPLATE_PAUSED;
+        } else if (server->state.printing) {
+            template_type = STATUS_TEMPLATE_PRINTING;
+        } else {
+            template_type = STATUS_TEMPLATE_READY;
+        }
+    }
+    const gchar *template = opdesk_config_get_status_template(server->config, template_type);
+    new_status = opdesk_server_format_message(server, template);
+
+    // every state change ends up here, even when the status text stays the same
+    g_signal_emit(server, obj_signals[STATE_UPDATED], 0);
+
+    if (g_strcmp0(server->status_text, new_status)==0) {
+        // no change in status
+        g_free(new_status);
+        return;
+    }
+
+    g_free(server->status_text);
+    server->status_text = new_status;
+
+    g_signal_emit(server, obj_signals[STATUS_UPDATED], 0);
+}
+
+static void opdesk_server_set_property(GObject *object, guint property_id, const GValue *value, GParamSpec *pspec) {
+    OPDeskServer *self = OPDESK_SERVER(object);
+
+    switch ((OPDeskServerProperty)property_id) {
+    case PROP_CONFIG:
+        opdesk_server_dispose_config(self);
+        self->config = g_value_get_object(value);
+        if(self->config) {
+            g_object_ref(self->config);
+            opdesk_server_setup_config(self);
+        }
+        break;
+    case PROP_NOTIFICATION_SCHEDULER:
+        if(self->notification_scheduler) g_object_unref(self->notification_scheduler);
+        self->notification_scheduler = g_value_get_object(value);
+        if(self->notification_scheduler) g_object_ref(self->notification_scheduler);
+        break;
+    case PROP_FILE_INDEX:
+        if(self->file_index) {
+            opdesk_file_index_remove_server(self->file_index, self, NULL);
+            g_object_unref(self->file_index);
+        }
+        self->file_index = g_value_get_object(value);
+        if(self->file_index) g_object_ref(self->file_index);
+        break;
+    case PROP_FED:
+        self->fed = g_value_get_boolean(value);
+        break;
+    case PROP_IO_THREAD:
+        self->io_thread = g_value_dup_object(value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+        break;
+    }
+}
+
+static void opdesk_server_get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec) {
+    OPDeskServer *self = OPDESK_SERVER(object);
+    switch ((OPDeskServerProperty)property_id) {
+    case PROP_CONFIG:
+        g_value_set_object(value, self->config);
+        break;
+    case PROP_NOTIFICATION_SCHEDULER:
+        g_value_set_object(value, self->notification_scheduler);
+        break;
+    case PROP_FILE_INDEX:
+        g_value_set_object(value, self->file_index);
+        break;
+    case PROP_FED:
+        g_value_set_boolean(value, self->fed);
+        break;
+    case PROP_IO_THREAD:
+        g_value_set_object(value, self->io_thread);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+        break;
+    }
+}
+
+static void opdesk_server_dispose(GObject *object) {
+
+    G_OBJECT_CLASS(opdesk_server_parent_class)->dispose(object);
+}
+
+static void opdesk_server_finalize(GObject *object) {
+    OPDeskServer *self = OPDESK_SERVER(object);
+    opdesk_server_dispose_config(self);
+    if(self->io_thread) g_object_unref(self->io_thread);
+    if(self->notification_scheduler) g_object_unref(self->notification_scheduler);
+    if(self->file_index) {
+        opdesk_file_index_remove_server(self->file_index, self, NULL);
+        g_object_unref(self->file_index);
+    }
+    g_ptr_array_unref(self->pending_file_events);
+    g_hash_table_destroy(self->current_temps);
+    g_hash_table_destroy(self->file_layers);
+    g_free(self->print_filename);
+    g_free(self->print_origin);
+    g_free(self->print_path);
+    g_free(self->status_text);
+    g_regex_unref(self->message_pat);
+    g_regex_unref(self->template_var_pat);
+    G_OBJECT_CLASS(opdesk_server_parent_class)->finalize(object);
+}
+
+#define opdesk_server_signal(a, b, c, ...) \
+        g_signal_new( \
+            a, \
+            G_TYPE_FROM_CLASS(b), \
+            G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, \
+            0, \
+            NULL, \
+            NULL, \
+            NULL, \
+            G_TYPE_NONE, \
+            c, \
+            __VA_ARGS__)
+
+static void opdesk_server_class_init(OPDeskServerClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->get_property = opdesk_server_get_property;
+    object_class->set_property = opdesk_server_set_property;
+    object_class->dispose = opdesk_server_dispose;
+    object_class->finalize = opdesk_server_finalize;
+
+    obj_properties[PROP_CONFIG] = g_param_spec_object("config", "config", "OctoPrint Server Config", OPDESK_TYPE_CONFIG, G_PARAM_READWRITE);
+    obj_properties[PROP_NOTIFICATION_SCHEDULER] = g_param_spec_object("notification-scheduler", "notification scheduler", "Desktop notification scheduler", OPDESK_TYPE_NOTIFICATION_SCHEDULER, G_PARAM_READWRITE);
+    obj_properties[PROP_FILE_INDEX] = g_param_spec_object("file-index", "file index", "Fleet wide file index", OPDESK_TYPE_FILE_INDEX, G_PARAM_READWRITE);
+    obj_properties[PROP_IO_THREAD] = g_param_spec_object("io-thread", "I/O thread", "Thread the websocket runs on", OCTOPRINT_TYPE_IO_THREAD, G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties[PROP_FED] = g_param_spec_boolean("fed", "fed", "State is fed from elsewhere instead of a websocket", FALSE, G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+    g_object_class_install_properties (object_class, N_PROPERTIES, obj_properties);
+
+    obj_signals[STATUS_UPDATED] = opdesk_server_signal("status-updated", object_class, 0, NULL);
+    obj_signals[STATE_UPDATED] = opdesk_server_signal("state-updated", object_class, 0, NULL);
+    obj_signals[CONNECTED] = opdesk_server_signal("connected", object_class, 0, NULL);
+    obj_signals[DISCONNECTED] = opdesk_server_signal("disconnected", object_class, 0, NULL);
+    obj_signals[EVENT] = opdesk_server_signal("event", object_class, 1, JSON_TYPE_OBJECT);
+    obj_signals[PSU_UPDATED] = opdesk_server_signal("psu-updated", object_class, 0, NULL);
+    obj_signals[TEMPS_UPDATED] = opdesk_server_signal("temps-updated", object_class, 0, NULL);
+    obj_signals[PRINTER_PROFILE_CHANGED] = opdesk_server_signal("printer-profile-changed", object_class, 0, NULL);
+    obj_signals[SETTINGS_CHANGED] = opdesk_server_signal("settings-changed", object_class, 0, NULL);
+    obj_signals[UPLOAD_STARTED] = opdesk_server_signal("upload-started", object_class, 1, OCTOPRINT_TYPE_UPLOAD);
+    obj_signals[RENDER_PROGRESS] = opdesk_server_signal("render-progress", object_class, 0, NULL);
+
+    event_printer_profile_modified_q = g_quark_from_static_string("PrinterProfileModified");
+    event_settings_updated_q = g_quark_from_static_string("SettingsUpdated");
+    event_upload_q = g_quark_from_static_string("Upload");
+    event_file_added_q = g_quark_from_static_string("FileAdded");
+    event_file_removed_q = g_quark_from_static_string("FileRemoved");
+    event_folder_removed_q = g_quark_from_static_string("FolderRemoved");
+    event_updated_files_q = g_quark_from_static_string("UpdatedFiles");
+    event_movie_rendering_q = g_quark_from_static_string("MovieRendering");
+    event_movie_done_q = g_quark_from_static_string("MovieDone");
+    event_movie_failed_q = g_quark_from_static_string("MovieFailed");
+}
+
+static void opdesk_server_init(OPDeskServer *server) {
+    server->current_temps = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (void(*)(void*))opdesk_server_temp_data_free);
+    server->file_layers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    server->pending_file_events = g_ptr_array_new_with_free_func((GDestroyNotify)json_object_unref);
+    server->render_progress = -1;
+    server->message_pat = g_regex_new("(\\{[\\w.-]*\\})", G_REGEX_MULTILINE, 0, NULL);
+    server->template_var_pat = g_regex_new("\\{(\\w*)-([\\w.]*)-?(\\w*)?\\}", G_REGEX_MULTILINE, 0, NULL);
+}
+
+OPDeskServer *opdesk_server_new(OPDeskConfig *config, OPDeskNotificationScheduler *notification_scheduler, OPDeskFileIndex *file_index, OctoPrintIOThread *io_thread) {
+    return g_object_new(OPDESK_TYPE_SERVER,
+        "io-thread", io_thread,
+        "notification-scheduler", notification_scheduler,
+        "file-index", file_index,
+        "config", config,
+        NULL);
+}
+
+OPDeskServer *opdesk_server_new_fed(OPDeskConfig *config, OPDeskNotificationScheduler *notification_scheduler) {
+    return g_object_new(OPDESK_TYPE_SERVER,
+        "fed", TRUE,
+        "notification-scheduler", notification_scheduler,
+        "config", config,
+        NULL);
+}
+
+static void opdesk_server_dispose_config(OPDeskServer *server) {
+    if(!server->config) return;
+    g_message("Shutting down server connection for %s", opdesk_config_get_printer_name(server->config));
+
+    if(server->retry_source) {
+        g_source_remove(server->retry_source);
+        server->retry_source = 0;
+    }
+
+    // uploads hold their own reference until they finish cancelling
+    for(GList *upload = server->uploads; upload; upload = upload->next) {
+        g_signal_handlers_disconnect_by_data(upload->data, server);
+        octoprint_upload_cancel(upload->data);
+    }
+    g_list_free_full(server->uploads, g_object_unref);
+    server->uploads = NULL;
+
+    if(server->files_cancellable) {
+        g_cancellable_cancel(server->files_cancellable);
+        g_clear_object(&server->files_cancellable);
+    }
+    g_ptr_array_set_size(server->pending_file_events, 0);
+    if(server->file_index) opdesk_file_index_remove_server(server->file_index, server, NULL);
+
+    if (server->socket) {
+        g_signal_handler_disconnect(server->socket, server->connected);
+        g_signal_handler_disconnect(server->socket, server->disconnected);
+        g_signal_handler_disconnect(server->socket, server->error);
+        g_signal_handler_disconnect(server->socket, server->current);
+        g_signal_handler_disconnect(server->socket, server->history);
+        g_signal_handler_disconnect(server->socket, server->plugin);
+        g_signal_handler_disconnect(server->socket, server->event);
+        g_signal_handler_disconnect(server->socket, server->render_progress_handler);
+        if(octoprint_socket_is_connected(server->socket)) octoprint_socket_disconnect(server->socket);
+        g_object_unref(server->socket);
+    }
+    if (server->client) g_object_unref(server->client);
+    if (server->config) g_object_unref(server->config);
+    if (server->printer_profile) json_object_unref(server->printer_profile);
+    if (server->settings) g_object_unref(server->settings);
+
+    server->printer_profile = NULL;
+    server->settings = NULL;
+
+    server->socket = NULL;
+    server->client = NULL;
+    server->config = NULL;
+}
+
+void opdesk_server_send_notification(OPDeskServer *server, GNotificationPriority priority, const char *const id, const char *const message, ...) {
+    if(!server->config || !server->notification_scheduler) return; // during startup/shutdown
+
+    va_list vl;
+    va_start(vl, message);
+    gchar *full_msg = g_strdup_vprintf(message, vl);
+    va_end(vl);
+
+    g_message("%s", full_msg);
+
+    opdesk_notification_scheduler_submit(server->notification_scheduler, opdesk_config_get_printer_name(server->config), priority, id, full_msg);
+    g_free(full_msg);
+}
+
+static gboolean message_eval_cb(const GMatchInfo *info, GString *res, gpointer data) {
+    OPDeskServer *server = data;
+    gchar *match = g_match_info_fetch(info, 0);
+    gchar *val = NULL;
+
+    GMatchInfo *var_info;
+    if(!g_regex_match(server->template_var_pat, match, 0, &var_info)) {
+        g_warning("Unrecognized template variable format: %s, expecting '{category-name} or {category-name-detail}", match);
+        g_free(match);
+        return FALSE;
+    }
+
+    gchar *var_cat = g_match_info_fetch(var_info, 1);
+    gchar *var_name = g_match_info_fetch(var_info, 2);
+    gchar *var_detail = g_match_info_fetch(var_info, 3);
+
+    if(g_strcmp0(var_cat, "printer")==0 && g_strcmp0(var_name, "name")==0) { // {printer-name}
+        val = g_strdup(opdesk_config_get_printer_name(server->config));
+    } else if(g_strcmp0(var_cat, "temp")==0) {
+        if (g_hash_table_contains(server->current_temps, var_name)) {
+            OPDeskServerTempData *temp = g_hash_table_lookup(server->current_temps, var_name);
+            if(g_strcmp0(var_detail,"actual")==0) {
+                val = g_strdup_printf("%0.0f", temp->actual);
+            } else if(g_strcmp0(var_detail, "target")==0) {
+                val = g_strdup_printf("%0.0f", temp->target);
+            } else if(g_strcmp0(var_detail, "offset")==0) {
+                val = g_strdup_printf("%0.0f", temp->offset);
+            } else {
+                g_warning("Unknown detail for temperature value, should be one of: actual, target, offset");
+                val = g_strdup("<unk-temp>");
+            }
+        } else {
+            g_warning("Unknown temp variable name: %s", var_name);
+            val = g_strdup("<unk-temp>");
+        }
+    } else if(g_strcmp0(var_cat, "print")==0) {
+        if(g_strcmp0(var_name,"filename")==0) {
+            val = g_strdup(server->print_filename);
+        } else if(g_strcmp0(var_name, "progress")==0) {
+            val = g_strdup_printf("%0.1f%%", server->print_progress * 100);
+        } else if(g_strcmp0(var_name, "timeleft")==0) {
+            val = format_time_left(server->time_left);
+        } else if(g_strcmp0(var_name, "currentLayer")==0) {
+            if(server->have_display_layer_progress) {
+                val = g_strdup_printf("%d", server->current_layer);
+            } else {
+                val = g_strdup("<NULL>");
+            }
+        } else if(g_strcmp0(var_name, "totalLayers")==0) {
+            if(server->have_display_layer_progress) {
+                val = g_strdup_printf("%d", server->total_layers);
+            } else if(server->print_filename && g_hash_table_contains(server->file_layers, server->print_filename)) {
+                val = g_strdup_printf("%u", GPOINTER_TO_UINT(g_hash_table_lookup(server->file_layers, server->print_filename)));
+            } else {
+                val = g_strdup("<NULL>");
+            }
+        } else {
+            g_warning("Unknown print variable name: %s", var_name);
+            val = g_strdup("<unk-print>");
+        }
+    } else if(g_strcmp0(var_cat, "payload")==0) {
+        JsonNode *payload_val = opdesk_json_object_get_path(server->event_payload, var_name);
+        if(payload_val) {
+            val = opdesk_json_node_to_string(payload_val);
+        } else {
+            g_warning("Invalid payload variable: %s", var_name);
+            val = g_strdup("<unk-payload>");
+        }
+    } else {
+        g_warning("unknown template variable: %s", match);
+        val = g_strdup("<unk>");
+    }
+
+    g_string_append(res, val);
+    g_match_info_unref(var_info);
+    g_free(match);
+    g_free(val);
+    g_free(var_cat);
+    g_free(var_name);
+    g_free(var_detail);
+
+    return FALSE;
+}
+
+char *opdesk_server_format_message(OPDeskServer *server, const char *message) {
+    if(server->stats) g_atomic_pointer_add(&server->stats->template_renders, 1);
+    return g_regex_replace_eval(server->message_pat, message, -1, 0, 0, message_eval_cb, server, NULL);
+}
+
+gboolean opdesk_server_send_gcode(OPDeskServer *server, const char *const *lines, OctoPrintClientCallback callback, gpointer user_data) {
+    GPtrArray *commands = g_ptr_array_new_with_free_func(g_free);
+
+    for(const char *const *line=lines;*line;line++) {
+        // a line can hold several commands, ie. ad-hoc G-code pasted as one string.
+        // Comments are stripped before expanding so a ';' in a value isn't taken for one
+        gchar **split = g_strsplit(*line, "\n", -1);
+        for(gchar **cmd=split;*cmd;cmd++) {
+            char *comment = strchr(*cmd, ';');
+            if(comment) *comment = '\0';
+            g_strstrip(*cmd);
+            if(!**cmd) continue;
+
+            char *expanded = opdesk_server_format_message(server, *cmd);
+            g_strstrip(expanded);
+            if(*expanded) g_ptr_array_add(commands, expanded);
+            else g_free(expanded);
+        }
+        g_strfreev(split);
+    }
+
+    if(!commands->len) {
+        g_ptr_array_unref(commands);
+        return FALSE;
+    }
+
+    g_ptr_array_add(commands, NULL);
+    g_debug("Sending %u G-code commands", commands->len - 1);
+    octoprint_client_send_commands_async(server->client, (const char *const *)commands->pdata, callback, user_data);
+    g_ptr_array_unref(commands);
+
+    return TRUE;
+}
+
+gboolean opdesk_server_run_macro(OPDeskServer *server, const char *const name, OctoPrintClientCallback callback, gpointer user_data) {
+    const char *const *lines = opdesk_config_get_macro(server->config, name);
+    if(!lines) {
+        g_warning("Unknown macro %s", name);
+        return FALSE;
+    }
+
+    g_message("Running macro %s", name);
+    return opdesk_server_send_gcode(server, lines, callback, user_data);
+}
+
+static void on_upload_finished(OctoPrintUpload *upload, OPDeskServer *server) {
+    server->uploads = g_list_remove(server->uploads, upload);
+
+    const char *name = octoprint_upload_get_name(upload);
+    gboolean notify = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(upload), "opdesk-notify"));
+    switch(octoprint_upload_get_state(upload)) {
+    case OCTOPRINT_UPLOAD_DONE: {
+        if(!notify) break;
+        char *size = g_format_size(octoprint_upload_get_total(upload));
+        char *rate = g_format_size((guint64)octoprint_upload_get_rate(upload));
+        opdesk_server_send_notification(server, G_NOTIFICATION_PRIORITY_NORMAL, "upload-done", "Uploaded %s\n%s in %0.0f s, %s/s", name, size, octoprint_upload_get_elapsed(upload), rate);
+        g_free(size);
+        g_free(rate);
+        break;
+    }
+    case OCTOPRINT_UPLOAD_CANCELLED:
+        g_message("Upload of %s cancelled", name);
+        break;
+    default:
+        if(notify) opdesk_server_send_notification(server, G_NOTIFICATION_PRIORITY_HIGH, "upload-failed", "Upload of %s failed: %s", name, octoprint_upload_get_error(upload));
+        break;
+    }
+
+    g_signal_handlers_disconnect_by_data(upload, server);
+    g_object_unref(upload);
+}
+
+gboolean opdesk_server_start_upload(OPDeskServer *server, OctoPrintUpload *upload, gboolean notify, GError **error) {
+    if(!octoprint_upload_start(upload, error)) return FALSE;
+
+    g_object_set_data(G_OBJECT(upload), "opdesk-notify", GINT_TO_POINTER(notify));
+    server->uploads = g_list_append(server->uploads, g_object_ref(upload));
+    g_signal_connect(upload, "finished", G_CALLBACK(on_upload_finished), server);
+    g_signal_emit(server, obj_signals[UPLOAD_STARTED], 0, upload);
+
+    return TRUE;
+}
+
+typedef struct {
+    OPDeskServer *server;
+    char *name;
+} OPDeskServerAnalyzeData;
+
+static void on_upload_analyzed(GObject *source, GAsyncResult *result, OPDeskServerAnalyzeData *data) {
+    GError *err = NULL;
+    OPDeskGCodeAnalysis *analysis = opdesk_gcode_analyze_file_finish(result, &err);
+    if(analysis) {
+        opdesk_server_set_file_analysis(data->server, data->name, analysis);
+        g_free(analysis);
+    } else {
+        g_debug("Not analyzing %s: %s", data->name, err->message);
+        g_error_free(err);
+    }
+
+    g_object_unref(data->server);
+    g_free(data->name);
+    g_free(data);
+}
+
+void opdesk_server_set_file_analysis(OPDeskServer *server, const char *name, const OPDeskGCodeAnalysis *analysis) {
+    g_hash_table_insert(server->file_layers, g_strdup(name), GUINT_TO_POINTER(analysis->layers));
+    if(g_strcmp0(name, server->print_filename)==0) opdesk_server_update_status(server);
+}
+
+OctoPrintUpload *opdesk_server_upload_file(OPDeskServer *server, GFile *file, gboolean print) {
+    OctoPrintUpload *upload = octoprint_upload_new(server->client, file, print);
+
+    GError *err = NULL;
+    if(!opdesk_server_start_upload(server, upload, TRUE, &err)) {
+        char *name = g_file_get_parse_name(file);
+        opdesk_server_send_notification(server, G_NOTIFICATION_PRIORITY_HIGH, "upload-failed", "Unable to upload %s: %s", name, err->message);
+        g_free(name);
+        g_error_free(err);
+        g_object_unref(upload);
+        return NULL;
+    }
+
+    if(!server->have_display_layer_progress) {
+        OPDeskServerAnalyzeData *data = g_malloc0(sizeof(OPDeskServerAnalyzeData));
+        data->server = g_object_ref(server);
+        data->name = g_strdup(octoprint_upload_get_name(upload));
+        opdesk_gcode_analyze_file_async(file, NULL, (GAsyncReadyCallback)on_upload_analyzed, data);
+    }
+
+    // the server's reference keeps it until it finishes
+    g_object_unref(upload);
+    return upload;
+}
+
+const char *opdesk_server_get_print_path(OPDeskServer *server, const char **origin) {
+    if(origin) *origin = server->print_origin;
+    return server->print_path;
+}
+
+gint opdesk_server_get_current_layer(OPDeskServer *server) {
+    if(!server->have_display_layer_progress || !server->state.printing) return -1;
+    return server->current_layer;
+}
+
+GList *opdesk_server_get_uploads(OPDeskServer *server) {
+    return server->uploads;
+}
+
+void opdesk_server_print_file(OPDeskServer *server, const char *origin, const char *path, OctoPrintClientCallback callback, gpointer user_data) {
+    g_message("Starting print of %s/%s", origin, path);
+    octoprint_client_select_file_async(server->client, origin, path, TRUE, callback, user_data);
+}
+
+typedef struct {
+    OPDeskServer *server;
+    GCancellable *cancellable;
+    char *origin; // NULL for every origin
+} OPDeskServerFilesData;
+
+static void opdesk_server_apply_file_event(OPDeskServer *server, JsonObject *event);
+
+static void on_files_listed(OctoPrintClient *client, guint status, JsonObject *response, gpointer user_data) {
+    OPDeskServerFilesData *data = user_data;
+    OPDeskServer *server = data->server;
+
+    if(!g_cancellable_is_cancelled(data->cancellable)) {
+        g_clear_object(&server->files_cancellable);
+
+        if(SOUP_STATUS_IS_SUCCESSFUL(status) && response && json_object_has_member(response, "files")) {
+            opdesk_file_index_remove_server(server->file_index, server, data->origin);
+            opdesk_file_index_add_listing(server->file_index, server, json_object_get_array_member(response, "files"));
+            g_message("Listed %s files, %u files indexed", data->origin ? data->origin : "all", opdesk_file_index_get_count(server->file_index));
+        } else {
+            g_warning("Couldn't list files for the file index, status %u", status);
+        }
+
+        // apply what changed while the listing was in flight, in order, on top of it
+        GPtrArray *pending = server->pending_file_events;
+        server->pending_file_events = g_ptr_array_new_with_free_func((GDestroyNotify)json_object_unref);
+        for(guint e=0;e<pending->len;e++) opdesk_server_apply_file_event(server, g_ptr_array_index(pending, e));
+        g_ptr_array_unref(pending);
+    }
+
+    g_object_unref(data->cancellable);
+    g_object_unref(data->server);
+    g_free(data->origin);
+    g_free(data);
+}
+
+static void opdesk_server_list_files(OPDeskServer *server, const char *origin) {
+    if(!server->file_index) return;
+    if(server->files_cancellable) g_cancellable_cancel(server->files_cancellable);
+    g_clear_object(&server->files_cancellable);
+    server->files_cancellable = g_cancellable_new();
+
+    OPDeskServerFilesData *data = g_new0(OPDeskServerFilesData, 1);
+    data->server = g_object_ref(server);
+    data->cancellable = g_object_ref(server->files_cancellable);
+    data->origin = g_strdup(origin);
+
+    char *path = origin ? g_strdup_printf("/api/files/%s", origin) : g_strdup("/api/files?recursive=true");
+    octoprint_client_request_async(server->client, OCTOPRINT_REQUEST_BACKGROUND, "GET", path, NULL, 60000, server->files_cancellable, on_files_listed, data);
+    g_free(path);
+}
+
+static gboolean payload_type_is_machinecode(JsonObject *payload) {
+    if(!json_object_has_member(payload, "type")) return FALSE;
+    JsonNode *type = json_object_get_member(payload, "type");
+    // FileAdded has the type path, ie. ["machinecode", "gcode"]
+    if(JSON_NODE_HOLDS_ARRAY(type)) {
+        JsonArray *types = json_node_get_array(type);
+        return json_array_get_length(types) && g_strcmp0(json_array_get_string_element(types, 0), "machinecode")==0;
+    }
+    return g_strcmp0(json_node_get_string(type), "machinecode")==0;
+}
+
+static void opdesk_server_apply_file_event(OPDeskServer *server, JsonObject *event) {
+    if(server->files_cancellable) {
+        g_ptr_array_add(server->pending_file_events, json_object_ref(event));
+        return;
+    }
+
+    GQuark etype_q = g_quark_try_string(json_object_get_string_member(event, "type"));
+    JsonObject *payload = json_object_has_member(event, "payload") ? json_object_get_object_member(event, "payload") : NULL;
+    if(!payload) return;
+
+    const char *path = json_object_get_string_member_with_default(payload, "path", NULL);
+    const char *storage = json_object_get_string_member_with_default(payload, "storage", "local");
+
+    if(etype_q==event_upload_q) {
+        // uploads to the SD card are copied by the printer and turn up in a later UpdatedFiles
+        const char *target = json_object_get_string_member_with_default(payload, "target", "local");
+        if(path && strcmp(target, "local")==0) opdesk_file_index_add(server->file_index, server, target, path, -1, g_get_real_time() / G_USEC_PER_SEC);
+    } else if(etype_q==event_file_added_q) {
+        if(path && payload_type_is_machinecode(payload)) opdesk_file_index_add(server->file_index, server, storage, path, -1, g_get_real_time() / G_USEC_PER_SEC);
+    } else if(etype_q==event_file_removed_q) {
+        if(path) opdesk_file_index_remove(server->file_index, server, storage, path);
+    } else if(etype_q==event_folder_removed_q) {
+        if(path) opdesk_file_index_remove_folder(server->file_index, server, storage, path);
+    } else if(etype_q==event_updated_files_q) {
+        // local changes have their own events, the SD card only this one
+        if(server->state.sd_ready) opdesk_server_list_files(server, "sdcard");
+    }
+}
+
+static gboolean retry_connect(OPDeskServer *server) {
+    server->retry_source = 0;
+    if(!server->socket) return G_SOURCE_REMOVE;
+    if(octoprint_socket_is_connected(server->socket)) {
+        g_warning("Already connected, not retrying!");
+        return G_SOURCE_REMOVE;
+    }
+    if(server->stats) g_atomic_pointer_add(&server->stats->reconnects, 1);
+    octoprint_socket_connect(server->socket);
+    return G_SOURCE_REMOVE;
+}
+
+static void opdesk_server_schedule_retry(OPDeskServer *server) {
+    if(server->retry_source) return;
+    server->retry_source = g_timeout_add_seconds(30, G_SOURCE_FUNC(retry_connect), server);
+}
+
+// a login in progress, dropped if the server has moved on to another socket or lost this one
+typedef struct {
+    OPDeskServer *server;
+    OctoPrintSocket *socket;
+} OPDeskSocketLogin;
+
+static void opdesk_socket_login_free(OPDeskSocketLogin *login) {
+    g_object_unref(login->server);
+    g_object_unref(login->socket);
+    g_free(login);
+}
+
+static gboolean opdesk_socket_login_current(OPDeskSocketLogin *login) {
+    return login->server->socket==login->socket && octoprint_socket_is_connected(login->socket);
+}
+
+static void on_socket_plugins(OctoPrintClient *client, guint status, JsonObject *response, gpointer user_data) {
+    OPDeskSocketLogin *login = user_data;
+    OPDeskServer *server = login->server;
+
+    if(!opdesk_socket_login_current(login)) {
+        opdesk_socket_login_free(login);
+        return;
+    }
+
+    if(!response) g_warning("Couldn't determine which plugins are enabled");
+
+    server->have_display_layer_progress = response && octoprint_client_plugin_enabled_in(response, "DisplayLayerProgress");
+
+    if (server->have_display_layer_progress) {
+        g_message("Display Layer Progress plugin detected, layer info available");
+    } else {
+        g_message("Display Layer Progress plugin not detected, layer info not available");
+    }
+
+    // eventually check for other plugins, but for now PSU control
+    server->have_psu_control = response && octoprint_client_plugin_enabled_in(response, "psucontrol");
+    if(server->have_psu_control) {
+        g_message("PSU Control plugin detected, PSU menu item enabled");
+    } else {
+        g_message("No compatible PSU plugins found, PSU menu item disabled");
+    }
+    g_signal_emit(server, obj_signals[PSU_UPDATED], 0);
+
+    server->connected_to_op = TRUE;
+    g_signal_emit(server, obj_signals[CONNECTED], 0);
+
+    // anything could have changed while disconnected
+    opdesk_server_list_files(server, NULL);
+
+    opdesk_socket_login_free(login);
+}
+
+static void on_socket_login(OctoPrintClient *client, guint status, JsonObject *response, gpointer user_data) {
+    OPDeskSocketLogin *login = user_data;
+    OPDeskServer *server = login->server;
+
+    if(!response || !opdesk_socket_login_current(login)) {
+        opdesk_socket_login_free(login);
+        return;
+    }
+
+    const gchar *name = json_object_get_string_member(response, "name");
+    const gchar *session = json_object_get_string_member(response, "session");
+
+    octoprint_socket_auth(login->socket, name, session);
+
+    opdesk_server_send_notification(server, G_NOTIFICATION_PRIORITY_LOW, "socket-connected", "Connected to OctoPrint server");
+
+    // login continues in on_socket_plugins
+    octoprint_client_pluginmanager_plugins_async(client, on_socket_plugins, login);
+}
+
+static void on_socket_connected(OctoPrintSocket *socket, JsonObject *connected, OPDeskServer *server) {
+    // queued, a reconnect doesn't block the main thread
+    OPDeskSocketLogin *login = g_new0(OPDeskSocketLogin, 1);
+    login->server = g_object_ref(server);
+    login->socket = g_object_ref(socket);
+
+    octoprint_client_login_async(server->client, on_socket_login, login);
+}
+
+static void opdesk_server_lost_connection(OPDeskServer *server) {
+    opdesk_server_send_notification(server, G_NOTIFICATION_PRIORITY_URGENT, "socket-disconnect", "Disconnected from OctoPrint Server");
+    server->connected_to_op = FALSE;
+
+    // forget what we know about plugins
+    server->have_psu_control = FALSE;
+    server->psu_is_on = FALSE;
+    g_signal_emit(server, obj_signals[PSU_UPDATED], 0);
+    // the end of a render could be missed
+    server->render_progress = -1;
+}
+
+static void on_socket_disconnected(OctoPrintSocket *socket, OPDeskServer *server) {
+    opdesk_server_lost_connection(server);
+
+    if(server->no_retry) {
+        server->no_retry = FALSE;
+    } else {
+        opdesk_server_schedule_retry(server);
+    }
+
+    g_signal_emit(server, obj_signals[DISCONNECTED], 0);
+    opdesk_server_update_status(server);
+}
+
+static void on_socket_error(OctoPrintSocket *socket, gchar *error, OPDeskServer *server) {
+    opdesk_server_send_notification(server, G_NOTIFICATION_PRIORITY_URGENT, "socket-error", "OctoPrint server error: %s", error);
+
+    opdesk_server_schedule_retry(server);
+}
+
+static void on_socket_current(OctoPrintSocket *socket, JsonObject *current, OPDeskServer *server) {
+    JsonObject *state = json_object_get_object_member(current, "state");
+    JsonObject *flags = json_object_get_object_member(state, "flags");
+
+    server->state.operational = json_object_get_boolean_member(flags, "operational");
+    server->state.paused = json_object_get_boolean_member(flags, "paused");
+    server->state.printing = json_object_get_boolean_member(flags, "printing");
+    server->state.pausing = json_object_get_boolean_member(flags, "pausing");
+    server->state.cancelling = json_object_get_boolean_member(flags, "cancelling");
+    server->state.sd_ready = json_object_get_boolean_member(flags, "sdReady");
+    server->state.error = json_object_get_boolean_member(flags, "error");
+    server->state.ready = json_object_get_boolean_member(flags, "ready");
+
+
+    JsonObject *job = json_object_get_object_member(current, "job");
+    JsonObject *file = json_object_get_object_member(job, "file");
+    if(file && json_object_has_member(file, "display")) {
+        const gchar *filename = json_object_get_string_member(file, "display");
+
+        if (g_strcmp0(server->print_filename, filename)) {
+            g_free(server->print_filename);
+            server->print_filename = g_strdup(filename);
+        }
+    }
+    if(file && json_object_has_member(file, "path") && json_object_has_member(file, "origin")) {
+        const gchar *path = json_object_get_string_member(file, "path");
+        if (g_strcmp0(server->print_path, path)) {
+            g_free(server->print_path);
+            g_free(server->print_origin);
+            server->print_path = g_strdup(path);
+            server->print_origin = g_strdup(json_object_get_string_member(file, "origin"));
+        }
+    }
+
+    JsonObject *progress = json_object_get_object_member(current, "progress");
+    gint64 print_time = json_object_get_int_member(progress, "printTime");
+    gint64 print_time_left = json_object_get_int_member(progress, "printTimeLeft");
+
+    server->time_left = print_time_left;
+
+    if (print_time + print_time_left) server->print_progress = (float)print_time / (float)(print_time + print_time_left);
+    else server->print_progress = .0f;
+
+    if (json_object_has_member(current, "temps")) {
+        JsonArray *temps = json_object_get_array_member(current, "temps");
+        GList *temp_first = json_array_get_elements(temps);
+        GList *temp = temp_first;
+        JsonObject *last_temp = NULL;
+        guint64 last_temp_time = 0;
+        while(temp) {
+            JsonObject *t = json_node_get_object(temp->data);
+            guint t_time = json_object_get_int_member(t, "time");
+            if (last_temp_time < t_time) {
+                last_temp = t;
+                last_temp_time = t_time;
+            }
+            temp = temp->next;
+        }
+        g_list_free(temp_first);
+
+        if (last_temp) {
+            GList *temp_names_first = json_object_get_members(last_temp);
+            GList *temp_names = temp_names_first;
+            while(temp_names) {
+                if(g_strcmp0(temp_names->data, "time")==0) {
+                    temp_names = temp_names->next;
+                    continue;
+                }
+
+                JsonObject *data = json_object_get_object_member(last_temp, temp_names->data);
+                OPDeskServerTempData *td = g_malloc0(sizeof(OPDeskServerTempData));
+                td->name = g_strdup(temp_names->data);
+                td->actual = json_object_get_double_member(data, "actual");
+                if(json_object_has_member(data, "offset")) td->offset = json_object_get_double_member(data, "offset");
+                td->target = json_object_get_double_member(data, "target");
+
+                g_hash_table_insert(server->current_temps, g_strdup(temp_names->data), td);
+
+                temp_names = temp_names->next;
+            }
+            g_list_free(temp_names_first);
+            g_signal_emit(server, obj_signals[TEMPS_UPDATED], 0);
+        }
+    }
+
+    opdesk_server_update_status(server);
+}
+
+static void on_socket_plugin(OctoPrintSocket *socket, JsonObject *plugin, OPDeskServer *server) {
+    JsonGenerator *gen = json_generator_new();
+    JsonNode *node = json_node_new(JSON_NODE_OBJECT);
+    json_node_set_object(node, plugin);
+    json_generator_set_root(gen, node);
+    gchar *str = json_generator_to_data(gen, NULL);
+    g_debug("Got plugin: %s", str);
+    json_node_unref(node);
+    g_object_unref(gen);
+    g_free(str);
+
+    const gchar *plugin_id = json_object_get_string_member(plugin, "plugin");
+
+    if(g_strcmp0(plugin_id, "DisplayLayerProgress-websocket-payload")==0) {
+        JsonObject *data = json_object_get_object_member(plugin, "data");
+        const gchar *cl = json_object_get_string_member(data, "currentLayer");
+        const gchar *tl = json_object_get_string_member(data, "totalLayer");
+        server->current_layer = g_ascii_strtoll(cl, NULL, 10);
+        server->total_layers = g_ascii_strtoll(tl, NULL, 10);
+        opdesk_server_update_status(server);
+    } else if(g_strcmp0(plugin_id, "psucontrol")==0) {
+        JsonObject *data = json_object_get_object_member(plugin, "data");
+        server->psu_is_on = json_object_get_boolean_member(data, "isPSUOn");
+        g_debug("PSU status = %s", server->psu_is_on ? "ON" : "OFF");
+        g_signal_emit(server, obj_signals[PSU_UPDATED], 0);
+    }
+}
+
+static void on_socket_event(OctoPrintSocket *socket, JsonObject *event, OPDeskServer *server) {
+    const gchar *etype = json_object_get_string_member(event, "type");
+    g_debug("Got event of type %s", etype);
+
+    GQuark etype_q = g_quark_try_string(etype);
+    if(etype_q && (etype_q==event_printer_profile_modified_q || etype_q==event_settings_updated_q)) {
+        if(server->printer_profile) {
+            g_debug("Printer profile changed, clearing cached profile");
+            json_object_unref(server->printer_profile);
+            server->printer_profile = NULL;
+        }
+        server->printer_profile_generation++;
+        g_signal_emit(server, obj_signals[PRINTER_PROFILE_CHANGED], 0);
+    }
+    if(etype_q && etype_q==event_settings_updated_q) {
+        if(server->settings) {
+            g_debug("Settings updated, clearing settings snapshot");
+            g_clear_object(&server->settings);
+        }
+        server->settings_generation++;
+        g_signal_emit(server, obj_signals[SETTINGS_CHANGED], 0);
+    }
+
+    if(etype_q && (etype_q==event_movie_rendering_q || etype_q==event_movie_done_q || etype_q==event_movie_failed_q)) {
+        server->render_progress = etype_q==event_movie_rendering_q ? 0.0 : -1.0;
+        g_signal_emit(server, obj_signals[RENDER_PROGRESS], 0);
+    }
+
+    if(server->file_index && etype_q && (etype_q==event_upload_q || etype_q==event_file_added_q || etype_q==event_file_removed_q || etype_q==event_folder_removed_q || etype_q==event_updated_files_q)) {
+        opdesk_server_apply_file_event(server, event);
+    }
+
+    g_signal_emit(server, obj_signals[EVENT], 0, event);
+
+    GPtrArray *rules = opdesk_event_rules_lookup(opdesk_config_get_event_rules(server->config), etype);
+    if(!rules) return;
+
+    JsonObject *payload = NULL;
+    if(json_object_has_member(event, "payload")) payload = json_object_get_object_member(event, "payload");
+
+    for(guint r=0;r<rules->len;r++) {
+        OPDeskEventRule *rule = g_ptr_array_index(rules, r);
+        if(!opdesk_event_rule_try_fire(rule, payload)) continue;
+
+        server->event_payload = payload;
+        char *msg = opdesk_server_format_message(server, opdesk_event_rule_get_template(rule));
+        server->event_payload = NULL;
+
+        opdesk_server_send_notification(server, opdesk_event_rule_get_priority(rule), opdesk_event_rule_get_id(rule), "%s", msg);
+
+        g_free(msg);
+    }
+}
+
+static void on_socket_render_progress(OctoPrintSocket *socket, JsonObject *progress, OPDeskServer *server) {
+    server->render_progress = json_object_get_double_member_with_default(progress, "progress", 0.0);
+    g_signal_emit(server, obj_signals[RENDER_PROGRESS], 0);
+}
+
+static void opdesk_server_setup_config(OPDeskServer *server) {
+    g_message("Setting up server connection for %s", opdesk_config_get_printer_name(server->config));
+
+    const char *url = opdesk_config_get_octoprint_url(server->config);
+    const char *key = opdesk_config_get_octoprint_api_key(server->config);
+
+    server->client = octoprint_client_new(url, key);
+    octoprint_client_set_cache_size(server->client, opdesk_config_get_http_cache_size(server->config));
+
+    GHashTableIter ttl_iter;
+    gpointer ttl_path, ttl;
+    g_hash_table_iter_init(&ttl_iter, opdesk_config_get_http_cache_ttls(server->config));
+    while(g_hash_table_iter_next(&ttl_iter, &ttl_path, &ttl)) {
+        octoprint_client_set_cache_ttl(server->client, ttl_path, GPOINTER_TO_UINT(ttl));
+    }
+    if(server->stats) octoprint_client_set_stats(server->client, &server->stats->octoprint);
+    if(server->fed) {
+        opdesk_server_update_status(server);
+        return;
+    }
+
+    server->socket = octoprint_socket_new(url, server->io_thread);
+    if(server->stats) octoprint_socket_set_stats(server->socket, &server->stats->octoprint);
+
+    server->connected = g_signal_connect(server->socket, "connected", G_CALLBACK(on_socket_connected), server);
+    server->disconnected = g_signal_connect(server->socket, "disconnected", G_CALLBACK(on_socket_disconnected), server);
+    server->error = g_signal_connect(server->socket, "error", G_CALLBACK(on_socket_error), server);
+    server->history = g_signal_connect(server->socket, "history", G_CALLBACK(on_socket_current), server);
+    server->current = g_signal_connect(server->socket, "current", G_CALLBACK(on_socket_current), server);
+    server->plugin = g_signal_connect(server->socket, "plugin", G_CALLBACK(on_socket_plugin), server);
+    server->event = g_signal_connect(server->socket, "event", G_CALLBACK(on_socket_event), server);
+    server->render_progress_handler = g_signal_connect(server->socket, "renderProgress", G_CALLBACK(on_socket_render_progress), server);
+
+    opdesk_server_update_status(server);
+
+    octoprint_socket_connect(server->socket);
+}
+
+void opdesk_server_set_stats(OPDeskServer *server, OPDeskServerStats *stats) {
+    server->stats = stats;
+    if(server->client) octoprint_client_set_stats(server->client, stats ? &stats->octoprint : NULL);
+    if(server->socket) octoprint_socket_set_stats(server->socket, stats ? &stats->octoprint : NULL);
+}
+
+OPDeskConfig *opdesk_server_get_config(OPDeskServer *server) {
+    return server->config;
+}
+
+OctoPrintClient *opdesk_server_get_client(OPDeskServer *server) {
+    return server->client;
+}
+
+const char *opdesk_server_get_status_markup(OPDeskServer *server) {
+    return server->status_text;
+}
+
+gboolean opdesk_server_is_connected(OPDeskServer *server) {
+    return server->connected_to_op;
+}
+
+gboolean opdesk_server_is_operational(OPDeskServer *server) {
+    return server->connected_to_op && server->state.operational;
+}
+
+gboolean opdesk_server_is_printing(OPDeskServer *server) {
+    return server->connected_to_op && server->state.printing;
+}
+
+gboolean opdesk_server_is_paused(OPDeskServer *server) {
+    return server->connected_to_op && (server->state.paused || server->state.pausing);
+}
+
+gboolean opdesk_server_has_error(OPDeskServer *server) {
+    return server->connected_to_op && server->state.error;
+}
+
+gdouble opdesk_server_get_print_progress(OPDeskServer *server) {
+    if(!server->connected_to_op || !(server->state.printing || server->state.paused || server->state.pausing)) return -1.0;
+    return server->print_progress;
+}
+
+gint64 opdesk_server_get_time_left(OPDeskServer *server) {
+    if(!server->connected_to_op || !(server->state.printing || server->state.paused || server->state.pausing)) return -1;
+    return server->time_left;
+}
+
+const char *opdesk_server_get_print_filename(OPDeskServer *server) {
+    return server->print_filename;
+}
+
+gboolean opdesk_server_is_idle(OPDeskServer *server) {
+    if(!server->connected_to_op) return FALSE;
+    if(server->state.printing || server->state.paused || server->state.pausing || server->state.cancelling) return FALSE;
+    return server->render_progress < 0;
+}
+
+gdouble opdesk_server_get_render_progress(OPDeskServer *server) {
+    return server->render_progress;
+}
+
+gboolean opdesk_server_has_psu_control(OPDeskServer *server) {
+    return server->have_psu_control;
+}
+
+gboolean opdesk_server_psu_is_on(OPDeskServer *server) {
+    return server->psu_is_on;
+}
+
+void opdesk_server_reconnect(OPDeskServer *server) {
+    // whatever feeds the state reconnects on its own
+    if(!server->socket) return;
+
+    if(server->connected_to_op) {
+        server->no_retry = TRUE;
+        octoprint_socket_disconnect(server->socket);
+    }
+
+    if(server->stats) g_atomic_pointer_add(&server->stats->reconnects, 1);
+    octoprint_socket_connect(server->socket);
+}
+
+gboolean opdesk_server_get_temp(OPDeskServer *server, const char *name, float *actual, float *target) {
+    OPDeskServerTempData *temp = g_hash_table_lookup(server->current_temps, name);
+    if(!temp) return FALSE;
+
+    if(actual) *actual = temp->actual;
+    if(target) *target = temp->target;
+    return TRUE;
+}
+
+GList *opdesk_server_get_temp_names(OPDeskServer *server) {
+    return g_list_sort(g_hash_table_get_keys(server->current_temps), (GCompareFunc)g_strcmp0);
+}
+
+// a background fetch of something cached until OctoPrint reports a change, see printer_profile_generation
+typedef struct {
+    OPDeskServer *server;
+    guint generation;
+} OPDeskServerFetch;
+
+static void opdesk_server_fetch_printer_profile(OPDeskServer *server);
+
+static void on_printer_profile_loaded(OctoPrintClient *client, guint status, JsonObject *response, gpointer user_data) {
+    OPDeskServerFetch *fetch = user_data;
+    OPDeskServer *server = fetch->server;
+
+    if(fetch->generation!=server->printer_profile_generation) {
+        g_debug("Printer profile changed while it was fetched, fetching it again");
+        opdesk_server_fetch_printer_profile(server);
+    } else {
+        server->printer_profile_loading = FALSE;
+        if(SOUP_STATUS_IS_SUCCESSFUL(status) && response && !server->printer_profile) {
+            server->printer_profile = json_object_ref(response);
+            g_signal_emit(server, obj_signals[PRINTER_PROFILE_CHANGED], 0);
+        }
+    }
+
+    g_object_unref(server);
+    g_free(fetch);
+}
+
+static void on_printer_profile_connection(OctoPrintClient *client, guint status, JsonObject *response, gpointer user_data) {
+    OPDeskServerFetch *fetch = user_data;
+    OPDeskServer *server = fetch->server;
+
+    const char *profile_id = NULL;
+    if(SOUP_STATUS_IS_SUCCESSFUL(status) && response && json_object_has_member(response, "current")) {
+        JsonObject *current = json_object_get_object_member(response, "current");
+        profile_id = json_object_get_string_member_with_default(current, "printerProfile", NULL);
+    }
+
+    if(!profile_id) {
+        server->printer_profile_loading = FALSE;
+        g_object_unref(server);
+        g_free(fetch);
+        return;
+    }
+
+    gchar *path = g_strdup_printf("/api/printerprofiles/%s", profile_id);
+    octoprint_client_request_async(client, OCTOPRINT_REQUEST_INTERACTIVE, "GET", path, NULL, 30000, NULL, on_printer_profile_loaded, fetch);
+    g_free(path);
+}
+
+static void opdesk_server_fetch_printer_profile(OPDeskServer *server) {
+    OPDeskServerFetch *fetch = g_new0(OPDeskServerFetch, 1);
+    fetch->server = g_object_ref(server);
+    fetch->generation = server->printer_profile_generation;
+
+    server->printer_profile_loading = TRUE;
+    octoprint_client_request_async(server->client, OCTOPRINT_REQUEST_INTERACTIVE, "GET", "/api/connection", NULL, 30000, NULL, on_printer_profile_connection, fetch);
+}
+
+JsonObject *opdesk_server_peek_printer_profile(OPDeskServer *server) {
+    if(!server->printer_profile && server->connected_to_op && !server->printer_profile_loading) {
+        g_debug("Fetching printer profile for %s in the background", opdesk_config_get_printer_name(server->config));
+        opdesk_server_fetch_printer_profile(server);
+    }
+
+    return server->printer_profile;
+}
+
+static void opdesk_server_fetch_settings(OPDeskServer *server);
+
+static void on_settings_loaded(OctoPrintClient *client, guint status, JsonObject *response, gpointer user_data) {
+    OPDeskServerFetch *fetch = user_data;
+    OPDeskServer *server = fetch->server;
+
+    if(fetch->generation!=server->settings_generation) {
+        g_debug("Settings changed while they were fetched, fetching them again");
+        opdesk_server_fetch_settings(server);
+    } else {
+        server->settings_loading = FALSE;
+        if(SOUP_STATUS_IS_SUCCESSFUL(status) && response && !server->settings) {
+            server->settings = octoprint_settings_new(response);
+            g_signal_emit(server, obj_signals[SETTINGS_CHANGED], 0);
+        }
+    }
+
+    g_object_unref(server);
+    g_free(fetch);
+}
+
+static void opdesk_server_fetch_settings(OPDeskServer *server) {
+    OPDeskServerFetch *fetch = g_new0(OPDeskServerFetch, 1);
+    fetch->server = g_object_ref(server);
+    fetch->generation = server->settings_generation;
+
+    server->settings_loading = TRUE;
+    octoprint_client_request_async(server->client, OCTOPRINT_REQUEST_BACKGROUND, "GET", "/api/settings", NULL, 30000, NULL, on_settings_loaded, fetch);
+}
+
+OctoPrintSettings *opdesk_server_peek_settings(OPDeskServer *server) {
+    if(!server->settings && server->connected_to_op && !server->settings_loading) {
+        g_debug("Fetching settings for %s in the background", opdesk_config_get_printer_name(server->config));
+        opdesk_server_fetch_settings(server);
+    }
+
+    return server->settings;
+}
+
+gint opdesk_server_get_tool_count(OPDeskServer *server) {
+    // only use a profile that's already cached, this shouldn't cost a request
+    if(!server->printer_profile || !json_object_has_member(server->printer_profile, "extruder")) return 1;
+
+    JsonObject *extruder = json_object_get_object_member(server->printer_profile, "extruder");
+    return json_object_get_int_member_with_default(extruder, "count", 1);
+}
+
+/* Feeds
+   Everything the socket handlers decode, as a{sv}. Relays and other ingest backends set the same
+   fields on servers created with opdesk_server_new_fed. */
+
+static const struct {
+    const char *key;
+    glong offset;
+} state_flags[] = {
+    { "connected", G_STRUCT_OFFSET(OPDeskServer, connected_to_op) },
+    { "operational", G_STRUCT_OFFSET(OPDeskServer, state.operational) },
+    { "paused", G_STRUCT_OFFSET(OPDeskServer, state.paused) },
+    { "printing", G_STRUCT_OFFSET(OPDeskServer, state.printing) },
+    { "pausing", G_STRUCT_OFFSET(OPDeskServer, state.pausing) },
+    { "cancelling", G_STRUCT_OFFSET(OPDeskServer, state.cancelling) },
+    { "sdReady", G_STRUCT_OFFSET(OPDeskServer, state.sd_ready) },
+    { "error", G_STRUCT_OFFSET(OPDeskServer, state.error) },
+    { "ready", G_STRUCT_OFFSET(OPDeskServer, state.ready) },
+    { "layerProgress", G_STRUCT_OFFSET(OPDeskServer, have_display_layer_progress) },
+    { "psuControl", G_STRUCT_OFFSET(OPDeskServer, have_psu_control) },
+    { "psuOn", G_STRUCT_OFFSET(OPDeskServer, psu_is_on) },
+};
+
+static const struct {
+    const char *key;
+    glong offset;
+} state_strings[] = {
+    { "file", G_STRUCT_OFFSET(OPDeskServer, print_filename) },
+    { "path", G_STRUCT_OFFSET(OPDeskServer, print_path) },
+    { "origin", G_STRUCT_OFFSET(OPDeskServer, print_origin) },
+};
+
+GVariant *opdesk_server_get_state(OPDeskServer *server) {
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+
+    for(guint f=0;f<G_N_ELEMENTS(state_flags);f++) {
+        g_variant_builder_add(&builder, "{sv}", state_flags[f].key, g_variant_new_boolean(G_STRUCT_MEMBER(gboolean, server, state_flags[f].offset)));
+    }
+    for(guint f=0;f<G_N_ELEMENTS(state_strings);f++) {
+        const char *value = G_STRUCT_MEMBER(char*, server, state_strings[f].offset);
+        g_variant_builder_add(&builder, "{sv}", state_strings[f].key, g_variant_new_string(value ? value : ""));
+    }
+
+    g_variant_builder_add(&builder, "{sv}", "progress", g_variant_new_double(server->print_progress));
+    g_variant_builder_add(&builder, "{sv}", "timeLeft", g_variant_new_int64((gint64)server->time_left));
+    g_variant_builder_add(&builder, "{sv}", "layer", g_variant_new_int64(server->current_layer));
+    g_variant_builder_add(&builder, "{sv}", "totalLayers", g_variant_new_int64(server->total_layers));
+    g_variant_builder_add(&builder, "{sv}", "renderProgress", g_variant_new_double(server->render_progress));
+
+    // heater name -> (actual, target, offset)
+    GVariantBuilder temps;
+    g_variant_builder_init(&temps, G_VARIANT_TYPE("a{s(ddd)}"));
+    GList *names = opdesk_server_get_temp_names(server);
+    for(GList *name = names; name; name = name->next) {
+        OPDeskServerTempData *temp = g_hash_table_lookup(server->current_temps, name->data);
+        g_variant_builder_add(&temps, "{s(ddd)}", name->data, (gdouble)temp->actual, (gdouble)temp->target, (gdouble)temp->offset);
+    }
+    g_list_free(names);
+    g_variant_builder_add(&builder, "{sv}", "temps", g_variant_builder_end(&temps));
+
+    return g_variant_builder_end(&builder);
+}
+
+GVariant *opdesk_server_state_diff(GVariant *state, GVariant *previous) {
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+    gboolean changed = FALSE;
+
+    GVariantIter iter;
+    const char *key;
+    GVariant *value;
+    g_variant_iter_init(&iter, state);
+    while(g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+        GVariant *old = previous ? g_variant_lookup_value(previous, key, NULL) : NULL;
+        if(!old || !g_variant_equal(old, value)) {
+            g_variant_builder_add(&builder, "{sv}", key, value);
+            changed = TRUE;
+        }
+        if(old) g_variant_unref(old);
+        g_variant_unref(value);
+    }
+
+    if(!changed) {
+        g_variant_builder_clear(&builder);
+        return NULL;
+    }
+    return g_variant_builder_end(&builder);
+}
+
+static gboolean opdesk_server_feed_value(OPDeskServer *server, const char *key, GVariant *value) {
+    if(g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)) {
+        for(guint f=0;f<G_N_ELEMENTS(state_flags);f++) {
+            if(strcmp(key, state_flags[f].key)) continue;
+            G_STRUCT_MEMBER(gboolean, server, state_flags[f].offset) = g_variant_get_boolean(value);
+            return TRUE;
+        }
+    } else if(g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+        for(guint f=0;f<G_N_ELEMENTS(state_strings);f++) {
+            if(strcmp(key, state_strings[f].key)) continue;
+            char **field = &G_STRUCT_MEMBER(char*, server, state_strings[f].offset);
+            const char *str = g_variant_get_string(value, NULL);
+            g_free(*field);
+            *field = *str ? g_strdup(str) : NULL;
+            return TRUE;
+        }
+    } else if(g_variant_is_of_type(value, G_VARIANT_TYPE_DOUBLE)) {
+        if(strcmp(key, "progress")==0) server->print_progress = g_variant_get_double(value);
+        else if(strcmp(key, "renderProgress")==0) server->render_progress = g_variant_get_double(value);
+        else return FALSE;
+        return TRUE;
+    } else if(g_variant_is_of_type(value, G_VARIANT_TYPE_INT64)) {
+        if(strcmp(key, "timeLeft")==0) server->time_left = g_variant_get_int64(value);
+        else if(strcmp(key, "layer")==0) server->current_layer = g_variant_get_int64(value);
+        else if(strcmp(key, "totalLayers")==0) server->total_layers = g_variant_get_int64(value);
+        else return FALSE;
+        return TRUE;
+    } else if(g_variant_is_of_type(value, G_VARIANT_TYPE("a{s(ddd)}")) && strcmp(key, "temps")==0) {
+        // always the complete set
+        g_hash_table_remove_all(server->current_temps);
+        GVariantIter iter;
+        const char *name;
+        gdouble actual, target, offset;
+        g_variant_iter_init(&iter, value);
+        while(g_variant_iter_next(&iter, "{&s(ddd)}", &name, &actual, &target, &offset)) {
+            OPDeskServerTempData *td = g_malloc0(sizeof(OPDeskServerTempData));
+            td->name = g_strdup(name);
+            td->actual = actual;
+            td->target = target;
+            td->offset = offset;
+            g_hash_table_insert(server->current_temps, g_strdup(name), td);
+        }
+        return TRUE;
+    }
+
+    g_debug("Ignoring fed state %s of type %s", key, g_variant_get_type_string(value));
+    return FALSE;
+}
+
+void opdesk_server_feed_state(OPDeskServer *server, GVariant *changes) {
+    gboolean was_connected = server->connected_to_op;
+    gboolean temps = FALSE, psu = FALSE, render = FALSE;
+
+    GVariantIter iter;
+    const char *key;
+    GVariant *value;
+    g_variant_iter_init(&iter, changes);
+    while(g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+        if(opdesk_server_feed_value(server, key, value)) {
+            if(strcmp(key, "temps")==0) temps = TRUE;
+            else if(g_str_has_prefix(key, "psu")) psu = TRUE;
+            else if(strcmp(key, "renderProgress")==0) render = TRUE;
+        }
+        g_variant_unref(value);
+    }
+
+    if(was_connected && !server->connected_to_op) {
+        opdesk_server_lost_connection(server);
+        g_signal_emit(server, obj_signals[DISCONNECTED], 0);
+    } else if(!was_connected && server->connected_to_op) {
+        opdesk_server_send_notification(server, G_NOTIFICATION_PRIORITY_LOW, "socket-connected", "Connected to OctoPrint server");
+        g_signal_emit(server, obj_signals[CONNECTED], 0);
+    }
+    if(psu) g_signal_emit(server, obj_signals[PSU_UPDATED], 0);
+    if(temps) g_signal_emit(server, obj_signals[TEMPS_UPDATED], 0);
+    if(render) g_signal_emit(server, obj_signals[RENDER_PROGRESS], 0);
+
+    opdesk_server_update_status(server);
+}
+
+void opdesk_server_feed_event(OPDeskServer *server, JsonObject *event) {
+    on_socket_event(NULL, event, server);
+}
+
+gboolean opdesk_server_is_fed(OPDeskServer *server) {
+    return server->fed;
+}
@@ -0,0 +1,144 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <glib-object.h>
+
+#include "config.h"
+#include "notification-scheduler.h"
+#include "octoprint/client.h"
+#include "octoprint/settings.h"
+#include "octoprint/socket.h"
+#include "octoprint/upload.h"
+#include "gcode-analyzer.h"
+#include "file-index.h"
+
+G_BEGIN_DECLS
+
+/* The connection to, and state of, a single OctoPrint server.
+   This keeps running whether or not any menu widgets exist for the server. */
+#define OPDESK_TYPE_SERVER opdesk_server_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskServer, opdesk_server, OPDESK, SERVER, GObject)
+
+/* Counters for the metrics endpoint, see octoprint/stats.h */
+typedef struct {
+    OctoPrintStats octoprint;
+    gsize reconnects;
+    gsize template_renders;
+} OPDeskServerStats;
+
+/* file_index may be NULL, otherwise the server's files are listed into it on connect and kept current from file events.
+   io_thread may be NULL to run the websocket on the main context */
+OPDeskServer *opdesk_server_new(OPDeskConfig *config, OPDeskNotificationScheduler *notification_scheduler, OPDeskFileIndex *file_index, OctoPrintIOThread *io_thread);
+
+/* The same, but the state comes from opdesk_server_feed_state and _feed_event instead of a websocket of its own,
+   ie. from a relay. REST requests for actions and views still go to OctoPrint directly */
+OPDeskServer *opdesk_server_new_fed(OPDeskConfig *config, OPDeskNotificationScheduler *notification_scheduler);
+gboolean opdesk_server_is_fed(OPDeskServer *server);
+
+/* stats must outlive the server, or be unset with NULL first */
+void opdesk_server_set_stats(OPDeskServer *server, OPDeskServerStats *stats);
+
+OPDeskConfig *opdesk_server_get_config(OPDeskServer *server);
+OctoPrintClient *opdesk_server_get_client(OPDeskServer *server);
+
+const char *opdesk_server_get_status_markup(OPDeskServer *server);
+
+gboolean opdesk_server_is_connected(OPDeskServer *server);
+gboolean opdesk_server_is_operational(OPDeskServer *server);
+gboolean opdesk_server_is_printing(OPDeskServer *server);
+gboolean opdesk_server_is_paused(OPDeskServer *server);
+/* OctoPrint reports the printer in an error state */
+gboolean opdesk_server_has_error(OPDeskServer *server);
+/* 0.0 - 1.0 while a job is printing or paused, otherwise -1 */
+gdouble opdesk_server_get_print_progress(OPDeskServer *server);
+/* seconds OctoPrint estimates are left while a job is printing or paused, otherwise -1 */
+gint64 opdesk_server_get_time_left(OPDeskServer *server);
+/* display name of the selected job's file, NULL if none has been selected */
+const char *opdesk_server_get_print_filename(OPDeskServer *server);
+/* connected with no job running, paused or being cancelled, and no timelapse rendering */
+gboolean opdesk_server_is_idle(OPDeskServer *server);
+/* 0 - 100 while OctoPrint renders a timelapse, otherwise -1 */
+gdouble opdesk_server_get_render_progress(OPDeskServer *server);
+
+/* name is the OctoPrint heater name, ie. 'bed' or 'tool0'. FALSE if no temperature is known */
+gboolean opdesk_server_get_temp(OPDeskServer *server, const char *name, float *actual, float *target);
+/* heater names with a known temperature, sorted. Free the list with g_list_free, the names are owned by the server */
+GList *opdesk_server_get_temp_names(OPDeskServer *server);
+
+/* the current printer profile, cached until it changes. NULL until it has been fetched in the background,
+   then "printer-profile-changed" is emitted */
+JsonObject *opdesk_server_peek_printer_profile(OPDeskServer *server);
+
+/* hotends in the cached printer profile, 1 if the profile hasn't been loaded */
+gint opdesk_server_get_tool_count(OPDeskServer *server);
+
+/* the server's settings, kept until a SettingsUpdated event. NULL until they've been fetched in the background,
+   then "settings-changed" is emitted. Views should connect to "settings-changed" and peek the settings again
+   instead of holding on to them. */
+OctoPrintSettings *opdesk_server_peek_settings(OPDeskServer *server);
+
+/* the selected job's file path in OctoPrint's storage, NULL if no file is selected.
+   origin is set to "local" or "sdcard" */
+const char *opdesk_server_get_print_path(OPDeskServer *server, const char **origin);
+/* the layer being printed as reported by DisplayLayerProgress, -1 without the plugin or when not printing */
+gint opdesk_server_get_current_layer(OPDeskServer *server);
+
+gboolean opdesk_server_has_psu_control(OPDeskServer *server);
+gboolean opdesk_server_psu_is_on(OPDeskServer *server);
+
+/* Streams file to OctoPrint's local storage, optionally printing it once uploaded.
+   "upload-started" is emitted and a notification sent when it finishes. NULL (with a notification) if the file can't be read.
+   The upload is owned by the server */
+OctoPrintUpload *opdesk_server_upload_file(OPDeskServer *server, GFile *file, gboolean print);
+/* Starts an upload created for this server's client and tracks it like opdesk_server_upload_file.
+   notify FALSE leaves reporting the result to the caller */
+gboolean opdesk_server_start_upload(OPDeskServer *server, OctoPrintUpload *upload, gboolean notify, GError **error);
+/* Remembers what a local analysis found for a file uploaded as name, the layer count
+   fills {print-totalLayers} when DisplayLayerProgress isn't installed */
+void opdesk_server_set_file_analysis(OPDeskServer *server, const char *name, const OPDeskGCodeAnalysis *analysis);
+/* uploads in progress, owned by the server */
+GList *opdesk_server_get_uploads(OPDeskServer *server);
+
+/* select a file already on the server and start printing it */
+void opdesk_server_print_file(OPDeskServer *server, const char *origin, const char *path, OctoPrintClientCallback callback, gpointer user_data);
+
+void opdesk_server_reconnect(OPDeskServer *server);
+
+/* Template variables are expanded in each line and comments and blank lines dropped,
+   then everything is sent in a single request. FALSE if there was nothing to send */
+gboolean opdesk_server_send_gcode(OPDeskServer *server, const char *const *lines, OctoPrintClientCallback callback, gpointer user_data);
+/* FALSE if the macro isn't configured for this server (or is empty) */
+gboolean opdesk_server_run_macro(OPDeskServer *server, const char *const name, OctoPrintClientCallback callback, gpointer user_data);
+
+char *opdesk_server_format_message(OPDeskServer *server, const char *message);
+void opdesk_server_send_notification(OPDeskServer *server, GNotificationPriority priority, const char *const id, const char *const message, ...);
+
+/* Everything the server knows about the printer as a floating a{sv}, the same fields a feed sets:
+   connected, operational, paused, printing, pausing, cancelling, sdReady, error, ready, layerProgress,
+   psuControl, psuOn (b), file, path, origin (s), progress, renderProgress (d), timeLeft, layer,
+   totalLayers (x) and temps (a{s(ddd)}, heater name to actual, target and offset, always complete).
+   "state-updated" is emitted after any of them change, "psu-updated" and "render-progress" for those */
+GVariant *opdesk_server_get_state(OPDeskServer *server);
+/* the fields of state that differ from previous (or all of them if it's NULL) as a floating a{sv}, NULL if none do */
+GVariant *opdesk_server_state_diff(GVariant *state, GVariant *previous);
+
+/* Only for fed servers. changes is a{sv} with any of the fields above, signals are emitted as if they came from a websocket */
+void opdesk_server_feed_state(OPDeskServer *server, GVariant *changes);
+/* an OctoPrint event message, with type and payload */
+void opdesk_server_feed_event(OPDeskServer *server, JsonObject *event);
+
+G_END_DECLS
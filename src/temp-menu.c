@@ -38,6 +38,7 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE(OPDeskTempMenuItem, opdesk_temp_menu_item, OPDESK, TEMP_MENU_ITEM, GtkMenuItem)
 
 GtkWidget *opdesk_temp_menu_item_new(OctoPrintClient *client, HeaterType heater_type, gint heater_num);
+void opdesk_temp_menu_item_update_label(OPDeskTempMenuItem *mi, OPDeskServer *server);
 
 G_END_DECLS
 
@@ -46,28 +47,43 @@ G_END_DECLS
 struct _OPDeskTempMenu {
     GtkMenuItem parent_inst;
 
-    OctoPrintClient *client;
+    OPDeskServer *server;
 
     GtkWidget *sub_menu_root;
+    // shown until the printer profile has been fetched
+    GtkWidget *placeholder;
 };
 
 G_DEFINE_TYPE(OPDeskTempMenu, opdesk_temp_menu, GTK_TYPE_MENU_ITEM);
 
 typedef enum {
-    MENU_PROP_CLIENT = 1,
+    MENU_PROP_SERVER = 1,
     N_PROPERTIES
 } OPDeskTempMenuProperties;
 
 static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
 
+static void opdesk_temp_menu_server_status_updated(OPDeskServer *server, OPDeskTempMenu *temp_menu);
+static void opdesk_temp_menu_server_temps_updated(OPDeskServer *server, OPDeskTempMenu *temp_menu);
+static void opdesk_temp_menu_server_printer_profile_changed(OPDeskServer *server, OPDeskTempMenu *temp_menu);
+
 static void opdesk_temp_menu_set_property(GObject *object, guint property_id, const GValue *value, GParamSpec *pspec) {
     OPDeskTempMenu *self = OPDESK_TEMP_MENU(object);
 
     switch ((OPDeskTempMenuProperties)property_id) {
-    case MENU_PROP_CLIENT:
-        if(self->client) g_object_unref(self->client);
-        self->client = g_value_get_object(value);
-        if(self->client) g_object_ref(self->client);
+    case MENU_PROP_SERVER:
+        if(self->server) {
+            g_signal_handlers_disconnect_by_data(self->server, self);
+            g_object_unref(self->server);
+        }
+        self->server = g_value_get_object(value);
+        if(self->server) {
+            g_object_ref(self->server);
+            g_signal_connect_object(self->server, "status-updated", G_CALLBACK(opdesk_temp_menu_server_status_updated), self, 0);
+            g_signal_connect_object(self->server, "temps-updated", G_CALLBACK(opdesk_temp_menu_server_temps_updated), self, 0);
+            g_signal_connect_object(self->server, "printer-profile-changed", G_CALLBACK(opdesk_temp_menu_server_printer_profile_changed), self, 0);
+            opdesk_temp_menu_server_status_updated(self->server, self);
+        }
         break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
@@ -78,8 +94,8 @@ static void opdesk_temp_menu_set_property(GObject *object, guint property_id, co
 static void opdesk_temp_menu_get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec) {
     OPDeskTempMenu *self = OPDESK_TEMP_MENU(object);
     switch ((OPDeskTempMenuProperties)property_id) {
-    case MENU_PROP_CLIENT:
-        g_value_set_object(value, self->client);
+    case MENU_PROP_SERVER:
+        g_value_set_object(value, self->server);
         break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
@@ -95,7 +111,7 @@ static void opdesk_temp_menu_dispose(GObject *object) {
 static void opdesk_temp_menu_finalize(GObject *object) {
     OPDeskTempMenu *self = OPDESK_TEMP_MENU(object);
 
-    if(self->client) g_object_unref(self->client);
+    if(self->server) g_object_unref(self->server);
     G_OBJECT_CLASS(opdesk_temp_menu_parent_class)->finalize(object);
 }
 
@@ -107,19 +123,46 @@ static void opdesk_temp_menu_class_init(OPDeskTempMenuClass *klass) {
     object_class->dispose = opdesk_temp_menu_dispose;
     object_class->finalize = opdesk_temp_menu_finalize;
 
-    obj_properties[MENU_PROP_CLIENT] = g_param_spec_object("client", "client", "OctoPrint Client instance", OCTOPRINT_TYPE_CLIENT, G_PARAM_READWRITE);
+    obj_properties[MENU_PROP_SERVER] = g_param_spec_object("server", "server", "OctoPrint server", OPDESK_TYPE_SERVER, G_PARAM_READWRITE);
 
     g_object_class_install_properties (object_class, N_PROPERTIES, obj_properties);
 }
 
+static void on_sub_menu_show(GtkWidget *sub_menu, OPDeskTempMenu *temp_menu) {
+    GList *children = gtk_container_get_children(GTK_CONTAINER(sub_menu));
+    if(!children || temp_menu->placeholder) opdesk_temp_menu_build_menus(temp_menu);
+    g_list_free(children);
+}
+
 static void opdesk_temp_menu_init(OPDeskTempMenu *temp_menu) {
+    // heater items are created when the submenu is first shown, see on_sub_menu_show
     temp_menu->sub_menu_root = gtk_menu_new();
     gtk_menu_item_set_label(GTK_MENU_ITEM(temp_menu), "Set Temperature");
     gtk_menu_item_set_submenu(GTK_MENU_ITEM(temp_menu), temp_menu->sub_menu_root);
+    gtk_widget_set_sensitive(GTK_WIDGET(temp_menu), FALSE);
+    g_signal_connect(temp_menu->sub_menu_root, "show", G_CALLBACK(on_sub_menu_show), temp_menu);
+}
+
+OPDeskTempMenu *opdesk_temp_menu_new(OPDeskServer *server) {
+    return g_object_new(OPDESK_TYPE_TEMP_MENU, "server", server, NULL);
+}
+
+static void opdesk_temp_menu_server_status_updated(OPDeskServer *server, OPDeskTempMenu *temp_menu) {
+    gtk_widget_set_sensitive(GTK_WIDGET(temp_menu), opdesk_server_is_operational(server));
+}
+
+static void update_item_label(GtkWidget *widget, OPDeskServer *server) {
+    if(OPDESK_IS_TEMP_MENU_ITEM(widget)) opdesk_temp_menu_item_update_label(OPDESK_TEMP_MENU_ITEM(widget), server);
 }
 
-OPDeskTempMenu *opdesk_temp_menu_new() {
-    return g_object_new(OPDESK_TYPE_TEMP_MENU, NULL);
+static void opdesk_temp_menu_server_temps_updated(OPDeskServer *server, OPDeskTempMenu *temp_menu) {
+    gtk_container_foreach(GTK_CONTAINER(temp_menu->sub_menu_root), (GtkCallback)update_item_label, server);
+}
+
+static void opdesk_temp_menu_server_printer_profile_changed(OPDeskServer *server, OPDeskTempMenu *temp_menu) {
+    // rebuilt from the new profile now if the submenu is open, otherwise next time it is shown
+    opdesk_temp_menu_clear_menus(temp_menu);
+    if(gtk_widget_get_visible(temp_menu->sub_menu_root)) opdesk_temp_menu_build_menus(temp_menu);
 }
 
 static void clear_menus_destroy_item(GtkWidget *widget, gpointer data) {
@@ -128,15 +171,22 @@ static void clear_menus_destroy_item(GtkWidget *widget, gpointer data) {
 
 void opdesk_temp_menu_clear_menus(OPDeskTempMenu *temp_menu) {
     gtk_container_foreach(GTK_CONTAINER(temp_menu->sub_menu_root), clear_menus_destroy_item, NULL);
+    temp_menu->placeholder = NULL;
 }
 
 void opdesk_temp_menu_build_menus(OPDeskTempMenu *temp_menu) {
     opdesk_temp_menu_clear_menus(temp_menu);
-    gchar *profile_id = octoprint_client_get_current_profile(temp_menu->client);
-    JsonObject *profile = octoprint_client_get_printer_profile(temp_menu->client, profile_id);
-    g_free(profile_id);
-
-    if(!profile) return;
+    OctoPrintClient *client = opdesk_server_get_client(temp_menu->server);
+    JsonObject *profile = opdesk_server_peek_printer_profile(temp_menu->server);
+
+    if(!profile) {
+        // built again on "printer-profile-changed" once it's loaded
+        temp_menu->placeholder = gtk_menu_item_new_with_label("Loading...");
+        gtk_widget_set_sensitive(temp_menu->placeholder, FALSE);
+        gtk_menu_shell_append(GTK_MENU_SHELL(temp_menu->sub_menu_root), temp_menu->placeholder);
+        gtk_widget_show(temp_menu->placeholder);
+        return;
+    }
 
     gboolean has_bed = json_object_get_boolean_member_with_default(profile, "heatedBed", FALSE);
     gboolean has_chamber = json_object_get_boolean_member_with_default(profile, "heatedChamber", FALSE);
@@ -145,29 +195,25 @@ void opdesk_temp_menu_build_menus(OPDeskTempMenu *temp_menu) {
     gint64 hotends = json_object_get_int_member(extruder, "count");
 
     if(has_bed) {
-        GtkWidget *bed_item = opdesk_temp_menu_item_new(temp_menu->client, HEATER_TYPE_BED, 0);
-        gtk_menu_item_set_label(GTK_MENU_ITEM(bed_item), "Bed");
+        GtkWidget *bed_item = opdesk_temp_menu_item_new(client, HEATER_TYPE_BED, 0);
+        opdesk_temp_menu_item_update_label(OPDESK_TEMP_MENU_ITEM(bed_item), temp_menu->server);
         gtk_menu_shell_append(GTK_MENU_SHELL(temp_menu->sub_menu_root), bed_item);
         gtk_widget_show(bed_item);
     }
 
     if(has_chamber) {
-        GtkWidget *chamber_item = opdesk_temp_menu_item_new(temp_menu->client, HEATER_TYPE_CHAMBER, 0);
-        gtk_menu_item_set_label(GTK_MENU_ITEM(chamber_item), "Bed");
+        GtkWidget *chamber_item = opdesk_temp_menu_item_new(client, HEATER_TYPE_CHAMBER, 0);
+        opdesk_temp_menu_item_update_label(OPDESK_TEMP_MENU_ITEM(chamber_item), temp_menu->server);
         gtk_menu_shell_append(GTK_MENU_SHELL(temp_menu->sub_menu_root), chamber_item);
         gtk_widget_show(chamber_item);
     }
 
     for(gint64 t=0;t<hotends;t++) {
-        gchar *lbl = g_strdup_printf("Hotend %d", t);
-        GtkWidget *tool_item = opdesk_temp_menu_item_new(temp_menu->client, HEATER_TYPE_TOOL, t);
-        gtk_menu_item_set_label(GTK_MENU_ITEM(tool_item), lbl);
-        g_free(lbl);
+        GtkWidget *tool_item = opdesk_temp_menu_item_new(client, HEATER_TYPE_TOOL, t);
+        opdesk_temp_menu_item_update_label(OPDESK_TEMP_MENU_ITEM(tool_item), temp_menu->server);
         gtk_menu_shell_append(GTK_MENU_SHELL(temp_menu->sub_menu_root), tool_item);
         gtk_widget_show(tool_item);
     }
-
-    json_object_unref(profile);
 }
 
 
@@ -259,6 +305,51 @@ static void opdesk_temp_menu_item_class_init(OPDeskTempMenuItemClass *klass) {
     g_object_class_install_properties (object_class, MENU_ITEM_N_PROPERTIES, item_obj_properties);
 }
 
+// the display name, ie. 'Hotend 0'
+static char *opdesk_temp_menu_item_get_heater_name(OPDeskTempMenuItem *mi) {
+    switch(mi->heater_type) {
+    case HEATER_TYPE_BED:
+        return g_strdup("Bed");
+    case HEATER_TYPE_CHAMBER:
+        return g_strdup("Chamber");
+    case HEATER_TYPE_TOOL:
+        return g_strdup_printf("Hotend %d", mi->heater_num);
+    default:
+        return g_strdup("Error");
+    }
+}
+
+void opdesk_temp_menu_item_update_label(OPDeskTempMenuItem *mi, OPDeskServer *server) {
+    char *heater_id = NULL;
+    switch(mi->heater_type) {
+    case HEATER_TYPE_BED:
+        heater_id = g_strdup("bed");
+        break;
+    case HEATER_TYPE_CHAMBER:
+        heater_id = g_strdup("chamber");
+        break;
+    default:
+        heater_id = g_strdup_printf("tool%d", mi->heater_num);
+        break;
+    }
+
+    char *heater_name = opdesk_temp_menu_item_get_heater_name(mi);
+    float actual, target;
+    char *lbl;
+    if(opdesk_server_get_temp(server, heater_id, &actual, &target)) {
+        lbl = g_strdup_printf("%s: %0.0f° / %0.0f°", heater_name, actual, target);
+    } else {
+        lbl = g_strdup(heater_name);
+    }
+
+    // avoid a relayout of an open menu if nothing visible changed
+    if(g_strcmp0(gtk_menu_item_get_label(GTK_MENU_ITEM(mi)), lbl)) gtk_menu_item_set_label(GTK_MENU_ITEM(mi), lbl);
+
+    g_free(lbl);
+    g_free(heater_name);
+    g_free(heater_id);
+}
+
 static void opdesk_temp_menu_item_on_activate(OPDeskTempMenuItem *mi, gpointer data) {
     
 
@@ -271,22 +362,7 @@ static void opdesk_temp_menu_item_on_activate(OPDeskTempMenuItem *mi, gpointer d
     );
 
     GtkWidget *content = gtk_dialog_get_content_area(GTK_DIALOG(dialog));
-    char *heater_name_str = NULL;
-
-    switch(mi->heater_type) {
-    case HEATER_TYPE_BED:
-        heater_name_str = g_strdup("Bed");
-        break;
-    case HEATER_TYPE_CHAMBER:
-        heater_name_str = g_strdup("Chamber");
-        break;
-    case HEATER_TYPE_TOOL:
-        heater_name_str = g_strdup_printf("Hotend %d", mi->heater_num);
-        break;
-    default:
-        heater_name_str = g_strdup("Error");
-        break;
-    }
+    char *heater_name_str = opdesk_temp_menu_item_get_heater_name(mi);
 
     GtkWidget *lbl = gtk_label_new(heater_name_str);
     g_free(heater_name_str);
@@ -16,7 +16,7 @@
 // along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
 #pragma once
 #include <gtk/gtk.h>
-#include "octoprint/client.h"
+#include "server.h"
 
 /* The temperature menu itself */
 G_BEGIN_DECLS
@@ -24,7 +24,7 @@ G_BEGIN_DECLS
 #define OPDESK_TYPE_TEMP_MENU (opdesk_temp_menu_get_type())
 G_DECLARE_FINAL_TYPE(OPDeskTempMenu, opdesk_temp_menu, OPDESK, TEMP_MENU, GtkMenuItem)
 
-OPDeskTempMenu *opdesk_temp_menu_new();
+OPDeskTempMenu *opdesk_temp_menu_new(OPDeskServer *server);
 
 void opdesk_temp_menu_clear_menus(OPDeskTempMenu *temp_menu);
 void opdesk_temp_menu_build_menus(OPDeskTempMenu *temp_menu);
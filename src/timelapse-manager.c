@@ -0,0 +1,376 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-timelapse"
+#include <glib.h>
+#include <string.h>
+
+#include <libsoup/soup.h>
+#include "timelapse-manager.h"
+#include "octoprint/download.h"
+
+#define MAX_DOWNLOADS_DEFAULT 2
+#define DOWNLOAD_ATTEMPTS     5
+#define RETRY_DELAY           60 // seconds, doubled after each failure
+
+struct _OPDeskTimelapseManager {
+    GObject parent_instance;
+
+    gboolean enabled;
+    GFile *folder;
+    guint max_downloads;
+    guint rate_limit; // bytes/s, shared by every download
+
+    GPtrArray *servers;
+
+    GQueue queued;  // OPDeskTimelapseJob waiting for an idle printer
+    GList *active;  // OPDeskTimelapseJob downloading
+    guint retry_source;
+};
+
+G_DEFINE_TYPE (OPDeskTimelapseManager, opdesk_timelapse_manager, G_TYPE_OBJECT)
+
+/* One movie from one server, lives until it's saved or given up on */
+struct OPDeskTimelapseJob {
+    OPDeskTimelapseManager *manager;
+    OPDeskServer *server; // borrowed from the manager
+    char *name;
+    GFile *file;
+    GFile *part;
+
+    OctoPrintDownload *download;
+    guint failures;
+    gint64 not_before; // monotonic time
+    // cancelled because the printer got busy, queued again once it finishes
+    gboolean preempted;
+};
+typedef struct OPDeskTimelapseJob OPDeskTimelapseJob;
+
+static void opdesk_timelapse_manager_schedule(OPDeskTimelapseManager *manager);
+
+static void opdesk_timelapse_job_free(OPDeskTimelapseJob *job) {
+    if(job->download) {
+        g_signal_handlers_disconnect_by_data(job->download, job);
+        octoprint_download_cancel(job->download);
+        g_object_unref(job->download);
+    }
+    g_free(job->name);
+    g_object_unref(job->file);
+    g_object_unref(job->part);
+    g_free(job);
+}
+
+static void opdesk_timelapse_manager_dispose(GObject *object) {
+    OPDeskTimelapseManager *self = OPDESK_TIMELAPSE_MANAGER(object);
+
+    if(self->retry_source) {
+        g_source_remove(self->retry_source);
+        self->retry_source = 0;
+    }
+
+    // active downloads keep their .part files for next time
+    g_list_free_full(self->active, (GDestroyNotify)opdesk_timelapse_job_free);
+    self->active = NULL;
+    g_queue_clear_full(&self->queued, (GDestroyNotify)opdesk_timelapse_job_free);
+
+    if(self->servers) {
+        for(guint s=0;s<self->servers->len;s++) {
+            GObject *server = g_ptr_array_index(self->servers, s);
+            g_signal_handlers_disconnect_by_data(server, self);
+            g_object_set_data(server, "opdesk-timelapse-manager", NULL);
+        }
+        g_clear_pointer(&self->servers, g_ptr_array_unref);
+    }
+
+    G_OBJECT_CLASS(opdesk_timelapse_manager_parent_class)->dispose(object);
+}
+
+static void opdesk_timelapse_manager_finalize(GObject *object) {
+    OPDeskTimelapseManager *self = OPDESK_TIMELAPSE_MANAGER(object);
+
+    if(self->folder) g_object_unref(self->folder);
+
+    G_OBJECT_CLASS(opdesk_timelapse_manager_parent_class)->finalize(object);
+}
+
+static void opdesk_timelapse_manager_class_init(OPDeskTimelapseManagerClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_timelapse_manager_dispose;
+    object_class->finalize = opdesk_timelapse_manager_finalize;
+}
+
+static void opdesk_timelapse_manager_init(OPDeskTimelapseManager *manager) {
+    manager->servers = g_ptr_array_new_with_free_func(g_object_unref);
+    g_queue_init(&manager->queued);
+}
+
+OPDeskTimelapseManager *opdesk_timelapse_manager_new(OPDeskAppConfig *config) {
+    OPDeskTimelapseManager *manager = g_object_new(OPDESK_TYPE_TIMELAPSE_MANAGER, NULL);
+
+    manager->enabled = opdesk_app_config_get_boolean(config, "timelapse.download", TRUE);
+    manager->max_downloads = opdesk_app_config_get_int(config, "timelapse.maxDownloads", MAX_DOWNLOADS_DEFAULT);
+    if(!manager->max_downloads) manager->max_downloads = 1;
+    manager->rate_limit = opdesk_app_config_get_int(config, "timelapse.rateLimit", 0) * 1024;
+
+    const char *folder = opdesk_app_config_get_string(config, "timelapse.folder", NULL);
+    if(folder) {
+        manager->folder = g_file_new_for_path(folder);
+    } else {
+        const char *videos = g_get_user_special_dir(G_USER_DIRECTORY_VIDEOS);
+        char *path = g_build_filename(videos ? videos : g_get_home_dir(), "OctoPrint Timelapses", NULL);
+        manager->folder = g_file_new_for_path(path);
+        g_free(path);
+    }
+
+    if(manager->enabled) {
+        char *path = g_file_get_path(manager->folder);
+        g_message("Saving timelapses to %s", path);
+        g_free(path);
+    }
+
+    return manager;
+}
+
+// names from the server become local file names, keep them to a single component
+static char *safe_file_name(const char *name) {
+    char *safe = g_strdup(name);
+    g_strdelimit(safe, "/\\:", '_');
+    if(safe[0]=='.') safe[0] = '_';
+    return safe;
+}
+
+static OPDeskTimelapseJob *opdesk_timelapse_manager_find_job(OPDeskTimelapseManager *manager, OPDeskServer *server, const char *name) {
+    for(GList *j = manager->queued.head; j; j = j->next) {
+        OPDeskTimelapseJob *job = j->data;
+        if(job->server==server && strcmp(job->name, name)==0) return job;
+    }
+    for(GList *j = manager->active; j; j = j->next) {
+        OPDeskTimelapseJob *job = j->data;
+        if(job->server==server && strcmp(job->name, name)==0) return job;
+    }
+    return NULL;
+}
+
+// only_partial only queues movies with a .part file left over from an interrupted download
+static void opdesk_timelapse_manager_queue(OPDeskTimelapseManager *manager, OPDeskServer *server, const char *name, gboolean only_partial) {
+    if(opdesk_timelapse_manager_find_job(manager, server, name)) return;
+
+    char *printer = safe_file_name(opdesk_config_get_printer_name(opdesk_server_get_config(server)));
+    char *file_name = safe_file_name(name);
+    char *part_name = g_strconcat(file_name, ".part", NULL);
+    GFile *dir = g_file_get_child(manager->folder, printer);
+    GFile *file = g_file_get_child(dir, file_name);
+    GFile *part = g_file_get_child(dir, part_name);
+    g_object_unref(dir);
+    g_free(part_name);
+    g_free(file_name);
+    g_free(printer);
+
+    if(g_file_query_exists(file, NULL) || (only_partial && !g_file_query_exists(part, NULL))) {
+        g_object_unref(file);
+        g_object_unref(part);
+        return;
+    }
+
+    OPDeskTimelapseJob *job = g_malloc0(sizeof(OPDeskTimelapseJob));
+    job->manager = manager;
+    job->server = server;
+    job->name = g_strdup(name);
+    job->file = file;
+    job->part = part;
+
+    g_message("Queued timelapse %s from %s", name, opdesk_config_get_printer_name(opdesk_server_get_config(server)));
+    g_queue_push_tail(&manager->queued, job);
+    opdesk_timelapse_manager_schedule(manager);
+}
+
+static void on_download_finished(OctoPrintDownload *download, OPDeskTimelapseJob *job) {
+    OPDeskTimelapseManager *manager = job->manager;
+    manager->active = g_list_remove(manager->active, job);
+
+    OctoPrintDownloadState state = octoprint_download_get_state(download);
+    g_signal_handlers_disconnect_by_data(download, job);
+    g_clear_object(&job->download);
+
+    GError *err = NULL;
+    switch(state) {
+    case OCTOPRINT_DOWNLOAD_DONE:
+        if(!g_file_move(job->part, job->file, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, &err)) {
+            opdesk_server_send_notification(job->server, G_NOTIFICATION_PRIORITY_NORMAL, "timelapse-failed", "Couldn't save timelapse %s: %s", job->name, err->message);
+            g_error_free(err);
+        } else {
+            char *path = g_file_get_path(job->file);
+            opdesk_server_send_notification(job->server, G_NOTIFICATION_PRIORITY_LOW, "timelapse-saved", "Timelapse saved to %s", path);
+            g_free(path);
+        }
+        opdesk_timelapse_job_free(job);
+        break;
+    case OCTOPRINT_DOWNLOAD_CANCELLED:
+        if(!job->preempted) {
+            opdesk_timelapse_job_free(job);
+            break;
+        }
+        // picks up from the .part file once the printer is idle again
+        job->preempted = FALSE;
+        g_queue_push_head(&manager->queued, job);
+        break;
+    default:
+        job->failures++;
+        if(job->failures >= DOWNLOAD_ATTEMPTS) {
+            opdesk_server_send_notification(job->server, G_NOTIFICATION_PRIORITY_NORMAL, "timelapse-failed", "Couldn't download timelapse %s: %s",
+                job->name, octoprint_download_get_error(download));
+            opdesk_timelapse_job_free(job);
+            break;
+        }
+        job->not_before = g_get_monotonic_time() + (gint64)(RETRY_DELAY << (job->failures - 1)) * G_USEC_PER_SEC;
+        g_message("Download of timelapse %s failed (%s), retrying in %d seconds", job->name, octoprint_download_get_error(download), RETRY_DELAY << (job->failures - 1));
+        g_queue_push_tail(&manager->queued, job);
+        break;
+    }
+
+    opdesk_timelapse_manager_schedule(manager);
+}
+
+static gboolean opdesk_timelapse_job_start(OPDeskTimelapseJob *job) {
+    GError *err = NULL;
+    GFile *dir = g_file_get_parent(job->part);
+    if(!g_file_make_directory_with_parents(dir, NULL, &err) && !g_error_matches(err, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
+        opdesk_server_send_notification(job->server, G_NOTIFICATION_PRIORITY_NORMAL, "timelapse-failed", "Couldn't save timelapse %s: %s", job->name, err->message);
+        g_error_free(err);
+        g_object_unref(dir);
+        return FALSE;
+    }
+    g_clear_error(&err);
+    g_object_unref(dir);
+
+    char *escaped = g_uri_escape_string(job->name, NULL, FALSE);
+    char *path = g_strdup_printf("/downloads/timelapse/%s", escaped);
+    job->download = octoprint_download_new(opdesk_server_get_client(job->server), path, job->part);
+    g_free(path);
+    g_free(escaped);
+
+    octoprint_download_set_resumable(job->download, TRUE);
+    g_signal_connect(job->download, "finished", G_CALLBACK(on_download_finished), job);
+
+    if(!octoprint_download_start(job->download, &err)) {
+        opdesk_server_send_notification(job->server, G_NOTIFICATION_PRIORITY_NORMAL, "timelapse-failed", "Couldn't save timelapse %s: %s", job->name, err->message);
+        g_error_free(err);
+        g_signal_handlers_disconnect_by_data(job->download, job);
+        g_clear_object(&job->download);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean on_retry_timeout(OPDeskTimelapseManager *manager) {
+    manager->retry_source = 0;
+    opdesk_timelapse_manager_schedule(manager);
+    return G_SOURCE_REMOVE;
+}
+
+static void opdesk_timelapse_manager_schedule(OPDeskTimelapseManager *manager) {
+    // a job started on the printer, get out of its way
+    for(GList *a = manager->active; a; a = a->next) {
+        OPDeskTimelapseJob *job = a->data;
+        if(job->preempted || opdesk_server_is_idle(job->server)) continue;
+        g_message("%s is busy, pausing download of timelapse %s", opdesk_config_get_printer_name(opdesk_server_get_config(job->server)), job->name);
+        job->preempted = TRUE;
+        octoprint_download_cancel(job->download);
+    }
+
+    gint64 now = g_get_monotonic_time();
+    gint64 next_retry = 0;
+    GList *j = manager->queued.head;
+    while(j && g_list_length(manager->active) < manager->max_downloads) {
+        GList *next = j->next;
+        OPDeskTimelapseJob *job = j->data;
+
+        if(job->not_before > now) {
+            if(!next_retry || job->not_before < next_retry) next_retry = job->not_before;
+        } else if(opdesk_server_is_idle(job->server)) {
+            g_queue_delete_link(&manager->queued, j);
+            if(opdesk_timelapse_job_start(job)) manager->active = g_list_append(manager->active, job);
+            else opdesk_timelapse_job_free(job);
+        }
+
+        j = next;
+    }
+
+    if(next_retry && !manager->retry_source) {
+        manager->retry_source = g_timeout_add_seconds((next_retry - now) / G_USEC_PER_SEC + 1, G_SOURCE_FUNC(on_retry_timeout), manager);
+    }
+
+    // split the cap between the downloads that are running
+    guint running = 0;
+    for(GList *a = manager->active; a; a = a->next) if(!((OPDeskTimelapseJob*)a->data)->preempted) running++;
+    for(GList *a = manager->active; a; a = a->next) {
+        OPDeskTimelapseJob *job = a->data;
+        if(!job->preempted) octoprint_download_set_rate_limit(job->download, manager->rate_limit / running);
+    }
+}
+
+static void on_timelapse_list(OctoPrintClient *client, guint status, JsonObject *response, gpointer user_data) {
+    OPDeskServer *server = user_data;
+    OPDeskTimelapseManager *manager = g_object_get_data(G_OBJECT(server), "opdesk-timelapse-manager");
+
+    if(manager && SOUP_STATUS_IS_SUCCESSFUL(status) && response && json_object_has_member(response, "files")) {
+        JsonArray *files = json_object_get_array_member(response, "files");
+        guint len = json_array_get_length(files);
+        for(guint f=0;f<len;f++) {
+            JsonObject *file = json_array_get_object_element(files, f);
+            const char *name = file ? json_object_get_string_member_with_default(file, "name", NULL) : NULL;
+            if(name) opdesk_timelapse_manager_queue(manager, server, name, TRUE);
+        }
+    }
+
+    g_object_unref(server);
+}
+
+static void on_server_connected(OPDeskServer *server, OPDeskTimelapseManager *manager) {
+    // finish downloads a restart or a long disconnect interrupted
+    octoprint_client_request_async(opdesk_server_get_client(server), OCTOPRINT_REQUEST_BACKGROUND, "GET", "/api/timelapse", NULL, 60000, NULL,
+        on_timelapse_list, g_object_ref(server));
+    opdesk_timelapse_manager_schedule(manager);
+}
+
+static void on_server_event(OPDeskServer *server, JsonObject *event, OPDeskTimelapseManager *manager) {
+    if(g_strcmp0(json_object_get_string_member(event, "type"), "MovieDone")) return;
+    if(!json_object_has_member(event, "payload")) return;
+
+    JsonObject *payload = json_object_get_object_member(event, "payload");
+    const char *name = json_object_get_string_member_with_default(payload, "movie_basename", NULL);
+    if(name) opdesk_timelapse_manager_queue(manager, server, name, FALSE);
+}
+
+static void on_server_state_changed(OPDeskServer *server, OPDeskTimelapseManager *manager) {
+    opdesk_timelapse_manager_schedule(manager);
+}
+
+void opdesk_timelapse_manager_add_server(OPDeskTimelapseManager *manager, OPDeskServer *server) {
+    if(!manager->enabled) return;
+
+    g_ptr_array_add(manager->servers, g_object_ref(server));
+    g_object_set_data(G_OBJECT(server), "opdesk-timelapse-manager", manager);
+
+    g_signal_connect(server, "connected", G_CALLBACK(on_server_connected), manager);
+    g_signal_connect(server, "event", G_CALLBACK(on_server_event), manager);
+    g_signal_connect(server, "status-updated", G_CALLBACK(on_server_state_changed), manager);
+    g_signal_connect(server, "render-progress", G_CALLBACK(on_server_state_changed), manager);
+    g_signal_connect(server, "disconnected", G_CALLBACK(on_server_state_changed), manager);
+}
@@ -0,0 +1,36 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <glib-object.h>
+
+#include "config.h"
+#include "server.h"
+
+G_BEGIN_DECLS
+
+/* Downloads finished timelapses from every server to timelapse.folder/<printer name>.
+   Downloads only run while their printer is idle, up to timelapse.maxDownloads at once across
+   the fleet sharing timelapse.rateLimit. Interrupted downloads are kept as .part files and
+   resumed, including after a restart. */
+#define OPDESK_TYPE_TIMELAPSE_MANAGER opdesk_timelapse_manager_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskTimelapseManager, opdesk_timelapse_manager, OPDESK, TIMELAPSE_MANAGER, GObject)
+
+OPDeskTimelapseManager *opdesk_timelapse_manager_new(OPDeskAppConfig *config);
+
+void opdesk_timelapse_manager_add_server(OPDeskTimelapseManager *manager, OPDeskServer *server);
+
+G_END_DECLS
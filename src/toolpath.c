@@ -0,0 +1,372 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-toolpath"
+#include "toolpath.h"
+#include "gcode-parser.h"
+
+/* full detail runs are kept short so their boxes are tight enough to cull */
+#define RUN_POINTS 32
+#define SIMPLIFIED_RUN_POINTS 256
+#define Z_EPSILON 0.0001
+
+/* Level 0 has every point, the others drop points closer than the tolerance (mm) to the last one kept */
+#define N_LEVELS 4
+static const gdouble level_tolerance[N_LEVELS] = { 0.0, 0.1, 0.5, 2.5 };
+
+typedef struct {
+    gfloat x;
+    gfloat y;
+} Point;
+
+typedef struct {
+    gfloat min_x, min_y, max_x, max_y;
+    guint32 start;
+    guint32 length;
+    /* starts where the previous run of the layer ended */
+    gboolean continues;
+} Run;
+
+typedef struct {
+    GArray *points;
+    GArray *runs;
+} Level;
+
+typedef struct {
+    gdouble z;
+    guint first_run[N_LEVELS];
+    guint n_runs[N_LEVELS];
+} Layer;
+
+struct _OPDeskToolpath {
+    Level levels[N_LEVELS];
+    GArray *layers;
+    gsize segments;
+
+    gboolean have_bounds;
+    gdouble min_x, min_y, max_x, max_y;
+};
+
+typedef struct {
+    OPDeskToolpath *toolpath;
+    gboolean relative;
+    gboolean relative_e;
+    gdouble pos[4];
+    /* the last run of the current layer can be extended */
+    gboolean in_run;
+} Builder;
+
+static void run_add_point(Level *level, Point p) {
+    Run *run = &g_array_index(level->runs, Run, level->runs->len - 1);
+    if(!run->length) {
+        run->min_x = run->max_x = p.x;
+        run->min_y = run->max_y = p.y;
+    } else {
+        run->min_x = MIN(run->min_x, p.x);
+        run->max_x = MAX(run->max_x, p.x);
+        run->min_y = MIN(run->min_y, p.y);
+        run->max_y = MAX(run->max_y, p.y);
+    }
+    run->length++;
+    g_array_append_val(level->points, p);
+}
+
+static void level_start_run(Level *level, gboolean continues) {
+    Run run = { 0, };
+    run.start = level->points->len;
+    run.continues = continues;
+    g_array_append_val(level->runs, run);
+}
+
+static void toolpath_add_bounds(OPDeskToolpath *toolpath, gdouble x, gdouble y) {
+    if(!toolpath->have_bounds) {
+        toolpath->have_bounds = TRUE;
+        toolpath->min_x = toolpath->max_x = x;
+        toolpath->min_y = toolpath->max_y = y;
+        return;
+    }
+    toolpath->min_x = MIN(toolpath->min_x, x);
+    toolpath->max_x = MAX(toolpath->max_x, x);
+    toolpath->min_y = MIN(toolpath->min_y, y);
+    toolpath->max_y = MAX(toolpath->max_y, y);
+}
+
+static void builder_extrude(Builder *b, const gdouble *to) {
+    OPDeskToolpath *toolpath = b->toolpath;
+    Level *level = &toolpath->levels[0];
+    Layer *layer = toolpath->layers->len ? &g_array_index(toolpath->layers, Layer, toolpath->layers->len - 1) : NULL;
+
+    // a step up starts a layer, dropping back down (ie. after a Z hop) doesn't
+    if(!layer || to[2] > layer->z + Z_EPSILON) {
+        Layer new_layer = { 0, };
+        new_layer.z = to[2];
+        new_layer.first_run[0] = level->runs->len;
+        g_array_append_val(toolpath->layers, new_layer);
+        layer = &g_array_index(toolpath->layers, Layer, toolpath->layers->len - 1);
+        b->in_run = FALSE;
+    }
+
+    Point from = { b->pos[0], b->pos[1] };
+    Point p = { to[0], to[1] };
+    gboolean connected = FALSE;
+    gboolean full = FALSE;
+    if(b->in_run) {
+        Run *run = &g_array_index(level->runs, Run, level->runs->len - 1);
+        Point *last = &g_array_index(level->points, Point, run->start + run->length - 1);
+        connected = last->x==from.x && last->y==from.y;
+        full = run->length >= RUN_POINTS;
+    }
+
+    if(!connected || full) {
+        level_start_run(level, connected);
+        run_add_point(level, from);
+        layer->n_runs[0]++;
+        toolpath_add_bounds(toolpath, b->pos[0], b->pos[1]);
+    }
+    run_add_point(level, p);
+    toolpath_add_bounds(toolpath, to[0], to[1]);
+
+    toolpath->segments++;
+    b->in_run = TRUE;
+}
+
+static void builder_move(Builder *b, const OPDeskGCodeCommand *cmd) {
+    static const char axes[4] = { 'X', 'Y', 'Z', 'E' };
+    gdouble to[4];
+
+    for(guint a=0;a<4;a++) {
+        to[a] = b->pos[a];
+        if(!OPDESK_GCODE_HAS_PARAM(cmd, axes[a])) continue;
+        gdouble v = OPDESK_GCODE_PARAM(cmd, axes[a]);
+        if(a==3 ? b->relative_e : b->relative) to[a] += v;
+        else to[a] = v;
+    }
+
+    if(to[3] > b->pos[3] && (to[0]!=b->pos[0] || to[1]!=b->pos[1])) builder_extrude(b, to);
+    memcpy(b->pos, to, sizeof(b->pos));
+}
+
+static void builder_line(Builder *b, const char *p, const char *end) {
+    OPDeskGCodeCommand cmd;
+    if(!opdesk_gcode_parse_command(p, end, &cmd)) return;
+
+    if(cmd.letter=='G') {
+        switch(cmd.code) {
+        case 0:
+        case 1:
+        // arcs are drawn as straight lines
+        case 2:
+        case 3:
+            builder_move(b, &cmd);
+            break;
+        case 28:
+            if(!(cmd.seen & (OPDESK_GCODE_PARAM_BIT('X') | OPDESK_GCODE_PARAM_BIT('Y') | OPDESK_GCODE_PARAM_BIT('Z')))) {
+                b->pos[0] = b->pos[1] = b->pos[2] = 0;
+            } else {
+                if(OPDESK_GCODE_HAS_PARAM(&cmd, 'X')) b->pos[0] = 0;
+                if(OPDESK_GCODE_HAS_PARAM(&cmd, 'Y')) b->pos[1] = 0;
+                if(OPDESK_GCODE_HAS_PARAM(&cmd, 'Z')) b->pos[2] = 0;
+            }
+            break;
+        case 90:
+            b->relative = b->relative_e = FALSE;
+            break;
+        case 91:
+            b->relative = b->relative_e = TRUE;
+            break;
+        case 92:
+            if(!(cmd.seen & (OPDESK_GCODE_PARAM_BIT('X') | OPDESK_GCODE_PARAM_BIT('Y') | OPDESK_GCODE_PARAM_BIT('Z') | OPDESK_GCODE_PARAM_BIT('E')))) {
+                memset(b->pos, 0, sizeof(b->pos));
+            } else {
+                if(OPDESK_GCODE_HAS_PARAM(&cmd, 'X')) b->pos[0] = OPDESK_GCODE_PARAM(&cmd, 'X');
+                if(OPDESK_GCODE_HAS_PARAM(&cmd, 'Y')) b->pos[1] = OPDESK_GCODE_PARAM(&cmd, 'Y');
+                if(OPDESK_GCODE_HAS_PARAM(&cmd, 'Z')) b->pos[2] = OPDESK_GCODE_PARAM(&cmd, 'Z');
+                if(OPDESK_GCODE_HAS_PARAM(&cmd, 'E')) b->pos[3] = OPDESK_GCODE_PARAM(&cmd, 'E');
+            }
+            break;
+        }
+    } else if(cmd.code==82) {
+        b->relative_e = FALSE;
+    } else if(cmd.code==83) {
+        b->relative_e = TRUE;
+    }
+}
+
+static inline gfloat point_distance2(Point a, Point b) {
+    return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y);
+}
+
+/* Radial distance simplification of every layer. Connected runs are joined back together so
+   a simplified level has far fewer runs as well as points. */
+static void toolpath_build_level(OPDeskToolpath *toolpath, guint l) {
+    Level *base = &toolpath->levels[0];
+    Level *level = &toolpath->levels[l];
+    gfloat tolerance2 = level_tolerance[l] * level_tolerance[l];
+
+    for(guint i=0;i<toolpath->layers->len;i++) {
+        Layer *layer = &g_array_index(toolpath->layers, Layer, i);
+        layer->first_run[l] = level->runs->len;
+
+        gboolean open = FALSE;
+        Point kept = { 0, 0 };
+        for(guint r=0;r<layer->n_runs[0];r++) {
+            Run *run = &g_array_index(base->runs, Run, layer->first_run[0] + r);
+            Point *points = &g_array_index(base->points, Point, run->start);
+            gboolean chain_ends = r==layer->n_runs[0] - 1 || !g_array_index(base->runs, Run, layer->first_run[0] + r + 1).continues;
+
+            gboolean continues = open && run->continues;
+            if(!continues || g_array_index(level->runs, Run, level->runs->len - 1).length >= SIMPLIFIED_RUN_POINTS) {
+                // a continued run picks up from the last point kept so there's no gap
+                Point first = continues ? kept : points[0];
+                level_start_run(level, continues);
+                run_add_point(level, first);
+                layer->n_runs[l]++;
+                kept = first;
+                open = TRUE;
+            }
+
+            for(guint p=1;p<run->length;p++) {
+                if((p==run->length - 1 && chain_ends) || point_distance2(points[p], kept) >= tolerance2) {
+                    run_add_point(level, points[p]);
+                    kept = points[p];
+                }
+            }
+        }
+    }
+}
+
+OPDeskToolpath *opdesk_toolpath_new_from_data(const char *data, gsize length, GCancellable *cancellable) {
+    OPDeskToolpath *toolpath = g_malloc0(sizeof(OPDeskToolpath));
+    for(guint l=0;l<N_LEVELS;l++) {
+        toolpath->levels[l].points = g_array_new(FALSE, FALSE, sizeof(Point));
+        toolpath->levels[l].runs = g_array_new(FALSE, FALSE, sizeof(Run));
+    }
+    toolpath->layers = g_array_new(FALSE, FALSE, sizeof(Layer));
+
+    Builder builder = { 0, };
+    builder.toolpath = toolpath;
+
+    const char *end = data + length;
+    const char *p = data;
+    guint64 lines = 0;
+    while(p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if(!eol) eol = end;
+
+        builder_line(&builder, p, eol);
+        p = eol + 1;
+
+        if((++lines & 0xffff)==0 && g_cancellable_is_cancelled(cancellable)) {
+            opdesk_toolpath_free(toolpath);
+            return NULL;
+        }
+    }
+
+    for(guint l=1;l<N_LEVELS;l++) toolpath_build_level(toolpath, l);
+
+    g_debug("%" G_GSIZE_FORMAT " segments in %u layers, %u/%u/%u/%u points per level", toolpath->segments, toolpath->layers->len,
+        toolpath->levels[0].points->len, toolpath->levels[1].points->len, toolpath->levels[2].points->len, toolpath->levels[3].points->len);
+
+    return toolpath;
+}
+
+OPDeskToolpath *opdesk_toolpath_load_file(const char *filename, GCancellable *cancellable, GError **error) {
+    GMappedFile *mapped = g_mapped_file_new(filename, FALSE, error);
+    if(!mapped) return NULL;
+
+    OPDeskToolpath *toolpath = opdesk_toolpath_new_from_data(g_mapped_file_get_contents(mapped), g_mapped_file_get_length(mapped), cancellable);
+    if(!toolpath) g_set_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED, "Loading cancelled");
+
+    g_mapped_file_unref(mapped);
+    return toolpath;
+}
+
+static void load_file_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    GError *err = NULL;
+    OPDeskToolpath *toolpath = opdesk_toolpath_load_file(task_data, cancellable, &err);
+    if(toolpath) g_task_return_pointer(task, toolpath, (GDestroyNotify)opdesk_toolpath_free);
+    else g_task_return_error(task, err);
+}
+
+void opdesk_toolpath_load_file_async(GFile *file, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data) {
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    char *path = g_file_get_path(file);
+    if(!path) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Only local files can be previewed");
+        g_object_unref(task);
+        return;
+    }
+
+    g_task_set_task_data(task, path, g_free);
+    g_task_run_in_thread(task, load_file_thread);
+    g_object_unref(task);
+}
+
+OPDeskToolpath *opdesk_toolpath_load_file_finish(GAsyncResult *result, GError **error) {
+    return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+void opdesk_toolpath_free(OPDeskToolpath *toolpath) {
+    for(guint l=0;l<N_LEVELS;l++) {
+        g_array_free(toolpath->levels[l].points, TRUE);
+        g_array_free(toolpath->levels[l].runs, TRUE);
+    }
+    g_array_free(toolpath->layers, TRUE);
+    g_free(toolpath);
+}
+
+guint opdesk_toolpath_get_layer_count(OPDeskToolpath *toolpath) {
+    return toolpath->layers->len;
+}
+
+gdouble opdesk_toolpath_get_layer_z(OPDeskToolpath *toolpath, guint layer) {
+    g_return_val_if_fail(layer < toolpath->layers->len, 0.0);
+    return g_array_index(toolpath->layers, Layer, layer).z;
+}
+
+gsize opdesk_toolpath_get_segment_count(OPDeskToolpath *toolpath) {
+    return toolpath->segments;
+}
+
+gboolean opdesk_toolpath_get_bounds(OPDeskToolpath *toolpath, gdouble *min_x, gdouble *min_y, gdouble *max_x, gdouble *max_y) {
+    if(!toolpath->have_bounds) return FALSE;
+    *min_x = toolpath->min_x;
+    *min_y = toolpath->min_y;
+    *max_x = toolpath->max_x;
+    *max_y = toolpath->max_y;
+    return TRUE;
+}
+
+void opdesk_toolpath_append_layer(OPDeskToolpath *toolpath, cairo_t *cr, guint layer_index,
+                                  gdouble min_x, gdouble min_y, gdouble max_x, gdouble max_y, gdouble pixel_size) {
+    g_return_if_fail(layer_index < toolpath->layers->len);
+
+    // the coarsest level that doesn't lose anything visible
+    guint l = N_LEVELS - 1;
+    while(l > 0 && level_tolerance[l] > pixel_size) l--;
+
+    Layer *layer = &g_array_index(toolpath->layers, Layer, layer_index);
+    Level *level = &toolpath->levels[l];
+    for(guint r=0;r<layer->n_runs[l];r++) {
+        Run *run = &g_array_index(level->runs, Run, layer->first_run[l] + r);
+        if(run->max_x < min_x || run->min_x > max_x || run->max_y < min_y || run->min_y > max_y) continue;
+
+        Point *points = &g_array_index(level->points, Point, run->start);
+        cairo_move_to(cr, points[0].x, points[0].y);
+        for(guint p=1;p<run->length;p++) cairo_line_to(cr, points[p].x, points[p].y);
+    }
+}
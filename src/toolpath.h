@@ -0,0 +1,48 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gio/gio.h>
+#include <cairo/cairo.h>
+
+G_BEGIN_DECLS
+
+/* The extrusions of a G-code file as 2D polylines per layer, loaded in one pass.
+   Points are stored as float pairs in a single array, grouped into short runs with a bounding box
+   so drawing can skip what's out of view. Simplified copies of every layer are kept for drawing
+   zoomed out, where most of the detail would land within a single pixel. */
+typedef struct _OPDeskToolpath OPDeskToolpath;
+
+/* NULL only if cancelled */
+OPDeskToolpath *opdesk_toolpath_new_from_data(const char *data, gsize length, GCancellable *cancellable);
+OPDeskToolpath *opdesk_toolpath_load_file(const char *filename, GCancellable *cancellable, GError **error);
+/* on a worker thread, file must be local */
+void opdesk_toolpath_load_file_async(GFile *file, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+OPDeskToolpath *opdesk_toolpath_load_file_finish(GAsyncResult *result, GError **error);
+void opdesk_toolpath_free(OPDeskToolpath *toolpath);
+
+guint opdesk_toolpath_get_layer_count(OPDeskToolpath *toolpath);
+gdouble opdesk_toolpath_get_layer_z(OPDeskToolpath *toolpath, guint layer);
+gsize opdesk_toolpath_get_segment_count(OPDeskToolpath *toolpath);
+/* FALSE if there are no extrusions */
+gboolean opdesk_toolpath_get_bounds(OPDeskToolpath *toolpath, gdouble *min_x, gdouble *min_y, gdouble *max_x, gdouble *max_y);
+
+/* Adds layer's extrusions that fall within the visible area (in G-code mm) to cr's path.
+   pixel_size is the size of one device pixel in mm, detail smaller than that is left out */
+void opdesk_toolpath_append_layer(OPDeskToolpath *toolpath, cairo_t *cr, guint layer,
+                                  gdouble min_x, gdouble min_y, gdouble max_x, gdouble max_y, gdouble pixel_size);
+
+G_END_DECLS
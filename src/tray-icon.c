@@ -0,0 +1,214 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-tray-icon"
+#include <glib.h>
+
+#include "tray-icon.h"
+#include "server.h"
+
+#define TRAY_ICON_NAME "octoprint-tentacle"
+#define TRAY_ICON_DEFAULT_SIZE 22
+
+typedef enum {
+    BADGE_OFFLINE = 1 << 0,
+    BADGE_PAUSED = 1 << 1,
+    BADGE_ERROR = 1 << 2,
+} OPDeskTrayIconBadges;
+
+// what the icon shows, rounded to what can be told apart at tray size
+typedef struct {
+    gint progress; // 0 - OPDESK_TRAY_ICON_PROGRESS_STEPS, -1 for no ring
+    guint badges;
+} OPDeskTrayIconState;
+
+struct _OPDeskTrayIcon {
+    GObject parent_instance;
+
+    GtkStatusIcon *status_icon;
+
+    // size << 16 | (progress + 1) << 8 | badges -> GdkPixbuf
+    GHashTable *cache;
+
+    gboolean shown;
+    gint shown_size;
+    OPDeskTrayIconState shown_state;
+    OPDeskTrayIconState state;
+};
+
+G_DEFINE_TYPE (OPDeskTrayIcon, opdesk_tray_icon, G_TYPE_OBJECT)
+
+static void on_icon_theme_changed(GtkIconTheme *theme, OPDeskTrayIcon *icon);
+
+static void opdesk_tray_icon_dispose(GObject *object) {
+    OPDeskTrayIcon *self = OPDESK_TRAY_ICON(object);
+
+    g_signal_handlers_disconnect_by_func(gtk_icon_theme_get_default(), on_icon_theme_changed, self);
+    if(self->status_icon) {
+        g_signal_handlers_disconnect_by_data(self->status_icon, self);
+        g_clear_object(&self->status_icon);
+    }
+
+    G_OBJECT_CLASS(opdesk_tray_icon_parent_class)->dispose(object);
+}
+
+static void opdesk_tray_icon_finalize(GObject *object) {
+    OPDeskTrayIcon *self = OPDESK_TRAY_ICON(object);
+
+    g_hash_table_destroy(self->cache);
+
+    G_OBJECT_CLASS(opdesk_tray_icon_parent_class)->finalize(object);
+}
+
+static void opdesk_tray_icon_class_init(OPDeskTrayIconClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_tray_icon_dispose;
+    object_class->finalize = opdesk_tray_icon_finalize;
+}
+
+static void opdesk_tray_icon_init(OPDeskTrayIcon *icon) {
+    icon->cache = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_object_unref);
+    icon->state.progress = -1;
+}
+
+static void draw_badge(cairo_t *cr, gdouble x, gdouble y, gdouble radius, gdouble r, gdouble g, gdouble b) {
+    cairo_arc(cr, x, y, radius, 0, 2 * G_PI);
+    cairo_set_source_rgb(cr, r, g, b);
+    cairo_fill_preserve(cr);
+    // stays visible on light and dark panels
+    cairo_set_line_width(cr, 1.0);
+    cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.6);
+    cairo_stroke(cr);
+}
+
+static GdkPixbuf *opdesk_tray_icon_render(gint size, const OPDeskTrayIconState *state) {
+    cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
+    cairo_t *cr = cairo_create(surface);
+
+    // the tentacle, smaller to make room for the ring
+    gdouble ring = state->progress >= 0 ? MAX(2.0, size / 8.0) : 0.0;
+    gint inner = MAX(1, size - 2 * (gint)ring);
+    GdkPixbuf *base = gtk_icon_theme_load_icon(gtk_icon_theme_get_default(), TRAY_ICON_NAME, inner, GTK_ICON_LOOKUP_FORCE_SIZE, NULL);
+    if(base) {
+        gdk_cairo_set_source_pixbuf(cr, base, (size - gdk_pixbuf_get_width(base)) / 2.0, (size - gdk_pixbuf_get_height(base)) / 2.0);
+        cairo_paint(cr);
+        g_object_unref(base);
+    }
+
+    if(state->progress >= 0) {
+        gdouble center = size / 2.0;
+        gdouble radius = center - ring / 2.0;
+        cairo_set_line_width(cr, ring);
+
+        cairo_arc(cr, center, center, radius, 0, 2 * G_PI);
+        cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.35);
+        cairo_stroke(cr);
+
+        if(state->progress > 0) {
+            // clockwise from the top
+            cairo_arc(cr, center, center, radius, -G_PI / 2, -G_PI / 2 + 2 * G_PI * state->progress / OPDESK_TRAY_ICON_PROGRESS_STEPS);
+            cairo_set_source_rgb(cr, 0.07, 0.76, 0.0);
+            cairo_stroke(cr);
+        }
+    }
+
+    gdouble badge = MAX(2.5, size / 7.0);
+    if(state->badges & BADGE_OFFLINE) draw_badge(cr, size - badge - 0.5, badge + 0.5, badge, 0.55, 0.55, 0.55);
+    if(state->badges & BADGE_PAUSED) draw_badge(cr, badge + 0.5, size - badge - 0.5, badge, 1.0, 0.7, 0.0);
+    if(state->badges & BADGE_ERROR) draw_badge(cr, size - badge - 0.5, size - badge - 0.5, badge, 0.9, 0.1, 0.1);
+
+    cairo_destroy(cr);
+    GdkPixbuf *pixbuf = gdk_pixbuf_get_from_surface(surface, 0, 0, size, size);
+    cairo_surface_destroy(surface);
+
+    return pixbuf;
+}
+
+static gint opdesk_tray_icon_get_size(OPDeskTrayIcon *icon) {
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    // 0 until it's embedded in a tray
+    gint size = gtk_status_icon_get_size(icon->status_icon);
+    #pragma GCC diagnostic pop
+    return size > 0 ? size : TRAY_ICON_DEFAULT_SIZE;
+}
+
+static void opdesk_tray_icon_show(OPDeskTrayIcon *icon) {
+    gint size = opdesk_tray_icon_get_size(icon);
+    if(icon->shown && size==icon->shown_size
+        && icon->state.progress==icon->shown_state.progress && icon->state.badges==icon->shown_state.badges) return;
+
+    guint key = (guint)size << 16 | (guint)(icon->state.progress + 1) << 8 | icon->state.badges;
+    GdkPixbuf *pixbuf = g_hash_table_lookup(icon->cache, GUINT_TO_POINTER(key));
+    if(!pixbuf) {
+        g_debug("Rendering %dpx tray icon, progress %d/%d, badges %x", size, icon->state.progress, OPDESK_TRAY_ICON_PROGRESS_STEPS, icon->state.badges);
+        pixbuf = opdesk_tray_icon_render(size, &icon->state);
+        g_hash_table_insert(icon->cache, GUINT_TO_POINTER(key), pixbuf);
+    }
+
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    gtk_status_icon_set_from_pixbuf(icon->status_icon, pixbuf);
+    #pragma GCC diagnostic pop
+
+    icon->shown = TRUE;
+    icon->shown_size = size;
+    icon->shown_state = icon->state;
+}
+
+static gboolean on_status_icon_size_changed(GtkStatusIcon *status_icon, gint size, OPDeskTrayIcon *icon) {
+    opdesk_tray_icon_show(icon);
+    return TRUE;
+}
+
+static void on_icon_theme_changed(GtkIconTheme *theme, OPDeskTrayIcon *icon) {
+    g_hash_table_remove_all(icon->cache);
+    icon->shown = FALSE;
+    opdesk_tray_icon_show(icon);
+}
+
+OPDeskTrayIcon *opdesk_tray_icon_new(GtkStatusIcon *status_icon) {
+    OPDeskTrayIcon *icon = g_object_new(OPDESK_TYPE_TRAY_ICON, NULL);
+    icon->status_icon = g_object_ref(status_icon);
+
+    g_signal_connect(status_icon, "size-changed", G_CALLBACK(on_status_icon_size_changed), icon);
+    g_signal_connect(gtk_icon_theme_get_default(), "changed", G_CALLBACK(on_icon_theme_changed), icon);
+
+    opdesk_tray_icon_show(icon);
+    return icon;
+}
+
+void opdesk_tray_icon_update(OPDeskTrayIcon *icon, GList *servers) {
+    gdouble progress = -1.0;
+    guint badges = 0;
+
+    for(; servers; servers = servers->next) {
+        OPDeskServer *server = servers->data;
+
+        if(opdesk_server_has_error(server)) badges |= BADGE_ERROR;
+        else if(!opdesk_server_is_operational(server)) badges |= BADGE_OFFLINE;
+        if(opdesk_server_is_paused(server)) badges |= BADGE_PAUSED;
+
+        progress = MAX(progress, opdesk_server_get_print_progress(server));
+    }
+
+    icon->state.progress = progress < 0 ? -1 : CLAMP((gint)(progress * OPDESK_TRAY_ICON_PROGRESS_STEPS), 0, OPDESK_TRAY_ICON_PROGRESS_STEPS);
+    icon->state.badges = badges;
+
+    opdesk_tray_icon_show(icon);
+}
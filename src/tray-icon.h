@@ -0,0 +1,36 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/* Draws the fleet's state on the tray icon: a ring for the job closest to completion and
+   badges for printers in an error state, paused or offline. Progress is rounded to
+   OPDESK_TRAY_ICON_PROGRESS_STEPS and rendered icons are cached by state and size, so nothing is drawn
+   or set on the status icon unless what it shows changes. */
+#define OPDESK_TYPE_TRAY_ICON opdesk_tray_icon_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskTrayIcon, opdesk_tray_icon, OPDESK, TRAY_ICON, GObject)
+
+#define OPDESK_TRAY_ICON_PROGRESS_STEPS 32
+
+OPDeskTrayIcon *opdesk_tray_icon_new(GtkStatusIcon *status_icon);
+
+/* servers is a list of OPDeskServer */
+void opdesk_tray_icon_update(OPDeskTrayIcon *icon, GList *servers);
+
+G_END_DECLS
@@ -0,0 +1,94 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-upload-dialog"
+#include "upload-dialog.h"
+#include "gcode-analyzer.h"
+
+static void cancel_analysis(GCancellable *cancellable) {
+    g_cancellable_cancel(cancellable);
+    g_object_unref(cancellable);
+}
+
+static void on_analyzed(GObject *source, GAsyncResult *result, GtkLabel *label) {
+    GError *err = NULL;
+    OPDeskGCodeAnalysis *analysis = opdesk_gcode_analyze_file_finish(result, &err);
+
+    if(analysis) {
+        char *summary = opdesk_gcode_analysis_to_string(analysis);
+        gtk_label_set_text(label, summary);
+        g_free(summary);
+        g_free(analysis);
+    } else {
+        // a newer selection or the dialog closing, nothing to show
+        if(!g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)) gtk_label_set_text(label, err->message);
+        g_error_free(err);
+    }
+
+    g_object_unref(label);
+}
+
+static void on_selection_changed(GtkFileChooser *chooser, GtkLabel *label) {
+    GFile *file = gtk_file_chooser_get_file(chooser);
+    if(!file || g_file_query_file_type(file, G_FILE_QUERY_INFO_NONE, NULL)!=G_FILE_TYPE_REGULAR) {
+        // the previous analysis doesn't apply anymore
+        g_object_set_data(G_OBJECT(chooser), "opdesk-analysis", NULL);
+        gtk_label_set_text(label, "");
+        if(file) g_object_unref(file);
+        return;
+    }
+
+    GCancellable *cancellable = g_cancellable_new();
+    // replacing the data cancels the analysis for the previous selection
+    g_object_set_data_full(G_OBJECT(chooser), "opdesk-analysis", g_object_ref(cancellable), (GDestroyNotify)cancel_analysis);
+    gtk_label_set_text(label, "Analyzing...");
+    opdesk_gcode_analyze_file_async(file, cancellable, (GAsyncReadyCallback)on_analyzed, g_object_ref(label));
+
+    g_object_unref(cancellable);
+    g_object_unref(file);
+}
+
+GtkWidget *opdesk_upload_dialog_new(const char *title) {
+    GtkWidget *dialog = gtk_file_chooser_dialog_new(title, NULL, GTK_FILE_CHOOSER_ACTION_OPEN,
+        "_Cancel", GTK_RESPONSE_CANCEL, "_Upload", GTK_RESPONSE_ACCEPT, NULL);
+
+    GtkFileFilter *gcode = gtk_file_filter_new();
+    gtk_file_filter_set_name(gcode, "G-code");
+    gtk_file_filter_add_pattern(gcode, "*.gcode");
+    gtk_file_filter_add_pattern(gcode, "*.gco");
+    gtk_file_filter_add_pattern(gcode, "*.g");
+    gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(dialog), gcode);
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+    GtkWidget *print = gtk_check_button_new_with_label("Start printing once uploaded");
+    GtkWidget *summary = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(summary), 0.0);
+    gtk_label_set_selectable(GTK_LABEL(summary), TRUE);
+    gtk_box_pack_start(GTK_BOX(box), print, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(box), summary, FALSE, FALSE, 0);
+    gtk_widget_show_all(box);
+    gtk_file_chooser_set_extra_widget(GTK_FILE_CHOOSER(dialog), box);
+
+    g_object_set_data(G_OBJECT(dialog), "opdesk-print", print);
+    g_signal_connect(dialog, "selection-changed", G_CALLBACK(on_selection_changed), summary);
+
+    return dialog;
+}
+
+gboolean opdesk_upload_dialog_get_print(GtkWidget *dialog) {
+    return gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(g_object_get_data(G_OBJECT(dialog), "opdesk-print")));
+}
@@ -0,0 +1,27 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/* File chooser for G-code uploads with a "Start printing once uploaded" option.
+   The selected file is analyzed in the background and summarized under the option. */
+GtkWidget *opdesk_upload_dialog_new(const char *title);
+gboolean opdesk_upload_dialog_get_print(GtkWidget *dialog);
+
+G_END_DECLS
@@ -0,0 +1,137 @@
+// Copyright 2021 Taylor Talkington
+// 
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-upload-menu"
+#include <glib.h>
+
+#include "upload-menu.h"
+
+struct _OPDeskUploadMenu {
+    GtkMenuItem parent_inst;
+
+    OctoPrintUpload *upload;
+};
+
+G_DEFINE_TYPE(OPDeskUploadMenu, opdesk_upload_menu, GTK_TYPE_MENU_ITEM);
+
+typedef enum {
+    MENU_PROP_UPLOAD = 1,
+    N_PROPERTIES
+} OPDeskUploadMenuProperties;
+
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
+
+static void on_upload_progress(OctoPrintUpload *upload, OPDeskUploadMenu *menu);
+static void on_upload_finished(OctoPrintUpload *upload, OPDeskUploadMenu *menu);
+
+static void opdesk_upload_menu_set_property(GObject *object, guint property_id, const GValue *value, GParamSpec *pspec) {
+    OPDeskUploadMenu *self = OPDESK_UPLOAD_MENU(object);
+
+    switch ((OPDeskUploadMenuProperties)property_id) {
+    case MENU_PROP_UPLOAD:
+        if(self->upload) {
+            g_signal_handlers_disconnect_by_data(self->upload, self);
+            g_object_unref(self->upload);
+        }
+        self->upload = g_value_get_object(value);
+        if(self->upload) {
+            g_object_ref(self->upload);
+            g_signal_connect_object(self->upload, "progress", G_CALLBACK(on_upload_progress), self, 0);
+            g_signal_connect_object(self->upload, "finished", G_CALLBACK(on_upload_finished), self, 0);
+            on_upload_progress(self->upload, self);
+        }
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+        break;
+    }
+}
+
+static void opdesk_upload_menu_get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec) {
+    OPDeskUploadMenu *self = OPDESK_UPLOAD_MENU(object);
+    switch ((OPDeskUploadMenuProperties)property_id) {
+    case MENU_PROP_UPLOAD:
+        g_value_set_object(value, self->upload);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+        break;
+    }
+}
+
+static void opdesk_upload_menu_finalize(GObject *object) {
+    OPDeskUploadMenu *self = OPDESK_UPLOAD_MENU(object);
+
+    if(self->upload) g_object_unref(self->upload);
+    G_OBJECT_CLASS(opdesk_upload_menu_parent_class)->finalize(object);
+}
+
+static void opdesk_upload_menu_class_init(OPDeskUploadMenuClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->get_property = opdesk_upload_menu_get_property;
+    object_class->set_property = opdesk_upload_menu_set_property;
+    object_class->finalize = opdesk_upload_menu_finalize;
+
+    obj_properties[MENU_PROP_UPLOAD] = g_param_spec_object("upload", "upload", "OctoPrint upload", OCTOPRINT_TYPE_UPLOAD, G_PARAM_READWRITE);
+
+    g_object_class_install_properties (object_class, N_PROPERTIES, obj_properties);
+}
+
+static void on_cancel_activate(GtkWidget *widget, OPDeskUploadMenu *menu) {
+    g_message("Cancelling upload of %s", octoprint_upload_get_name(menu->upload));
+    octoprint_upload_cancel(menu->upload);
+}
+
+static void opdesk_upload_menu_init(OPDeskUploadMenu *menu) {
+    GtkWidget *submenu = gtk_menu_new();
+    gtk_menu_item_set_submenu(GTK_MENU_ITEM(menu), submenu);
+
+    GtkWidget *cancel = gtk_menu_item_new_with_label("Cancel upload");
+    gtk_menu_shell_append(GTK_MENU_SHELL(submenu), cancel);
+    g_signal_connect(cancel, "activate", G_CALLBACK(on_cancel_activate), menu);
+    gtk_widget_show_all(submenu);
+}
+
+OPDeskUploadMenu *opdesk_upload_menu_new(OctoPrintUpload *upload) {
+    return g_object_new(OPDESK_TYPE_UPLOAD_MENU, "upload", upload, NULL);
+}
+
+static void on_upload_progress(OctoPrintUpload *upload, OPDeskUploadMenu *menu) {
+    char *lbl;
+
+    if(octoprint_upload_get_state(upload)==OCTOPRINT_UPLOAD_QUEUED) {
+        lbl = g_strdup_printf("Upload queued: %s", octoprint_upload_get_name(upload));
+    } else {
+        char *sent = g_format_size(octoprint_upload_get_sent(upload));
+        char *total = g_format_size(octoprint_upload_get_total(upload));
+        char *rate = g_format_size((guint64)octoprint_upload_get_rate(upload));
+        lbl = g_strdup_printf("Uploading %s: %0.0f%% (%s of %s, %s/s)", octoprint_upload_get_name(upload),
+            octoprint_upload_get_progress(upload) * 100, sent, total, rate);
+        g_free(sent);
+        g_free(total);
+        g_free(rate);
+    }
+
+    gtk_menu_item_set_label(GTK_MENU_ITEM(menu), lbl);
+    g_free(lbl);
+}
+
+static void on_upload_finished(OctoPrintUpload *upload, OPDeskUploadMenu *menu) {
+    // the server sends a notification with the result
+    gtk_widget_destroy(GTK_WIDGET(menu));
+}
@@ -0,0 +1,29 @@
+// Copyright 2021 Taylor Talkington
+// 
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gtk/gtk.h>
+#include "octoprint/upload.h"
+
+G_BEGIN_DECLS
+
+/* Progress of an upload with a Cancel item, destroys itself once the upload finishes */
+#define OPDESK_TYPE_UPLOAD_MENU (opdesk_upload_menu_get_type())
+G_DECLARE_FINAL_TYPE(OPDeskUploadMenu, opdesk_upload_menu, OPDESK, UPLOAD_MENU, GtkMenuItem)
+
+OPDeskUploadMenu *opdesk_upload_menu_new(OctoPrintUpload *upload);
+
+G_END_DECLS
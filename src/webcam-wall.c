@@ -0,0 +1,339 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-webcam-wall"
+#include <glib.h>
+
+#include "webcam-wall.h"
+#include "webcam-window.h"
+#include "webcam.h"
+#include "server.h"
+
+#define WALL_SPACING 4
+#define WALL_LABEL_HEIGHT 22
+#define WALL_ASPECT (4.0 / 3.0)
+// how much more often a printer is refreshed relative to an idle one
+#define WALL_PRINTING_WEIGHT 4.0
+#define WALL_OFFLINE_WEIGHT 0.1
+
+typedef struct {
+    OPDeskWebcamWall *wall;
+    OPDeskServer *server;
+    OPDeskWebcam *webcam;
+
+    // the latest snapshot, drawn scaled after a resize until one at the new size arrives
+    cairo_surface_t *surface;
+
+    gint64 last_fetch;
+    // fetched next, the printer's state just changed
+    gboolean urgent;
+    gboolean printing;
+    gboolean connected;
+} OPDeskWebcamTile;
+
+struct _OPDeskWebcamWall {
+    GtkWindow parent_inst;
+
+    GPtrArray *tiles; // OPDeskWebcamTile
+    GtkWidget *area;
+
+    // the budget for the whole wall, however many tiles there are
+    gdouble fps;
+    guint max_busy;
+    guint tick_source;
+    gboolean iconified;
+
+    gint columns;
+    gint offset_x;
+    // image size, the label is below it
+    gint tile_width;
+    gint tile_height;
+};
+
+G_DEFINE_TYPE(OPDeskWebcamWall, opdesk_webcam_wall, GTK_TYPE_WINDOW);
+
+static void opdesk_webcam_tile_free(OPDeskWebcamTile *tile) {
+    g_signal_handlers_disconnect_by_data(tile->server, tile);
+    g_signal_handlers_disconnect_by_data(tile->webcam, tile);
+    if(tile->surface) cairo_surface_destroy(tile->surface);
+    g_object_unref(tile->server);
+    g_free(tile);
+}
+
+static void opdesk_webcam_wall_dispose(GObject *object) {
+    OPDeskWebcamWall *self = OPDESK_WEBCAM_WALL(object);
+
+    if(self->tick_source) {
+        g_source_remove(self->tick_source);
+        self->tick_source = 0;
+    }
+    g_clear_pointer(&self->tiles, g_ptr_array_unref);
+
+    G_OBJECT_CLASS(opdesk_webcam_wall_parent_class)->dispose(object);
+}
+
+static void opdesk_webcam_wall_class_init(OPDeskWebcamWallClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_webcam_wall_dispose;
+}
+
+static void opdesk_webcam_wall_get_tile_rect(OPDeskWebcamWall *wall, guint index, GdkRectangle *rect) {
+    gint column = index % wall->columns;
+    gint row = index / wall->columns;
+
+    rect->x = wall->offset_x + WALL_SPACING + column * (wall->tile_width + WALL_SPACING);
+    rect->y = WALL_SPACING + row * (wall->tile_height + WALL_LABEL_HEIGHT + WALL_SPACING);
+    rect->width = wall->tile_width;
+    rect->height = wall->tile_height + WALL_LABEL_HEIGHT;
+}
+
+static void opdesk_webcam_wall_queue_draw_tile(OPDeskWebcamWall *wall, OPDeskWebcamTile *tile) {
+    guint index;
+    if(!g_ptr_array_find(wall->tiles, tile, &index)) return;
+
+    GdkRectangle rect;
+    opdesk_webcam_wall_get_tile_rect(wall, index, &rect);
+    gtk_widget_queue_draw_area(wall->area, rect.x, rect.y, rect.width, rect.height);
+}
+
+static void on_tile_snapshot_ready(OPDeskWebcam *webcam, gint width, gint height, OPDeskWebcamTile *tile) {
+    OPDeskWebcamWall *wall = tile->wall;
+    gint scale = gtk_widget_get_scale_factor(wall->area);
+    if(width!=wall->tile_width * scale || height!=wall->tile_height * scale) return;
+
+    cairo_surface_t *snapshot = opdesk_webcam_get_snapshot(webcam, width, height);
+    if(!snapshot) return;
+
+    if(tile->surface) cairo_surface_destroy(tile->surface);
+    tile->surface = cairo_surface_reference(snapshot);
+    opdesk_webcam_wall_queue_draw_tile(wall, tile);
+}
+
+static void on_tile_status_updated(OPDeskServer *server, OPDeskWebcamTile *tile) {
+    gboolean printing = opdesk_server_is_printing(server);
+    gboolean connected = opdesk_server_is_connected(server);
+    if(printing==tile->printing && connected==tile->connected) return;
+
+    tile->printing = printing;
+    tile->connected = connected;
+    tile->urgent = TRUE;
+    opdesk_webcam_wall_queue_draw_tile(tile->wall, tile);
+}
+
+// one snapshot per tick, oldest first weighted by what the printer is doing
+static gboolean on_tick(OPDeskWebcamWall *wall) {
+    if(!wall->tile_width) return G_SOURCE_CONTINUE;
+
+    gint64 now = g_get_monotonic_time();
+    guint busy = 0;
+    OPDeskWebcamTile *next = NULL;
+    gdouble next_score = -1.0;
+
+    for(guint t=0;t<wall->tiles->len;t++) {
+        OPDeskWebcamTile *tile = g_ptr_array_index(wall->tiles, t);
+        if(opdesk_webcam_is_busy(tile->webcam)) {
+            busy++;
+            continue;
+        }
+        if(!opdesk_webcam_get_snapshot_url(tile->webcam)) continue;
+
+        gdouble age = (now - tile->last_fetch) / (gdouble)G_USEC_PER_SEC;
+        gdouble score;
+        if(tile->urgent) score = 1e12 + age;
+        else if(tile->printing) score = age * WALL_PRINTING_WEIGHT;
+        else if(tile->connected) score = age;
+        else score = age * WALL_OFFLINE_WEIGHT;
+
+        if(score > next_score) {
+            next = tile;
+            next_score = score;
+        }
+    }
+
+    // slow cameras don't get to pile up requests
+    if(!next || busy >= wall->max_busy) return G_SOURCE_CONTINUE;
+
+    next->urgent = FALSE;
+    next->last_fetch = now;
+    gint scale = gtk_widget_get_scale_factor(wall->area);
+    opdesk_webcam_refresh(next->webcam, wall->tile_width * scale, wall->tile_height * scale);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void opdesk_webcam_wall_update_refresh(OPDeskWebcamWall *wall) {
+    gboolean visible = gtk_widget_get_mapped(GTK_WIDGET(wall)) && !wall->iconified && wall->tiles;
+    if(visible && !wall->tick_source) {
+        g_debug("Refreshing %u webcams at %0.1f fps", wall->tiles->len, wall->fps);
+        wall->tick_source = g_timeout_add((guint)(1000 / wall->fps), G_SOURCE_FUNC(on_tick), wall);
+    } else if(!visible && wall->tick_source) {
+        g_source_remove(wall->tick_source);
+        wall->tick_source = 0;
+    }
+}
+
+static void on_window_map(GtkWidget *widget, OPDeskWebcamWall *wall) {
+    opdesk_webcam_wall_update_refresh(wall);
+}
+
+static void on_window_unmap(GtkWidget *widget, OPDeskWebcamWall *wall) {
+    opdesk_webcam_wall_update_refresh(wall);
+}
+
+static gboolean on_window_state_event(GtkWidget *widget, GdkEventWindowState *event, OPDeskWebcamWall *wall) {
+    wall->iconified = (event->new_window_state & GDK_WINDOW_STATE_ICONIFIED)!=0;
+    opdesk_webcam_wall_update_refresh(wall);
+    return GDK_EVENT_PROPAGATE;
+}
+
+// the column count that gives the largest tiles
+static void on_area_size_allocate(GtkWidget *area, GdkRectangle *alloc, OPDeskWebcamWall *wall) {
+    guint count = wall->tiles ? wall->tiles->len : 0;
+    gdouble best = 0.0;
+    wall->columns = 1;
+
+    for(guint columns=1;columns<=count;columns++) {
+        guint rows = (count + columns - 1) / columns;
+        gdouble width = (alloc->width - WALL_SPACING * (gdouble)(columns + 1)) / columns;
+        gdouble height = (alloc->height - WALL_SPACING * (gdouble)(rows + 1)) / rows - WALL_LABEL_HEIGHT;
+        width = MIN(width, height * WALL_ASPECT);
+        if(width > best) {
+            best = width;
+            wall->columns = columns;
+        }
+    }
+
+    wall->tile_width = (gint)best;
+    wall->tile_height = (gint)(best / WALL_ASPECT);
+    wall->offset_x = (alloc->width - wall->columns * (wall->tile_width + WALL_SPACING) - WALL_SPACING) / 2;
+}
+
+static void opdesk_webcam_wall_draw_tile(OPDeskWebcamWall *wall, cairo_t *cr, OPDeskWebcamTile *tile, GdkRectangle *rect) {
+    cairo_save(cr);
+
+    cairo_rectangle(cr, rect->x, rect->y, wall->tile_width, wall->tile_height);
+    cairo_set_source_rgb(cr, 0.15, 0.15, 0.15);
+    cairo_fill_preserve(cr);
+
+    if(tile->surface) {
+        cairo_clip(cr);
+        gdouble width = cairo_image_surface_get_width(tile->surface);
+        gdouble height = cairo_image_surface_get_height(tile->surface);
+        gdouble scale = MIN(wall->tile_width / width, wall->tile_height / height);
+
+        cairo_translate(cr, rect->x + (wall->tile_width - width * scale) / 2, rect->y + (wall->tile_height - height * scale) / 2);
+        cairo_scale(cr, scale, scale);
+        cairo_set_source_surface(cr, tile->surface, 0, 0);
+        cairo_paint(cr);
+    } else {
+        cairo_new_path(cr);
+    }
+    cairo_restore(cr);
+
+    // state dot and printer name
+    gdouble label_y = rect->y + wall->tile_height + WALL_LABEL_HEIGHT / 2.0;
+    if(tile->printing) cairo_set_source_rgb(cr, 1.0, 0.55, 0.1);
+    else if(tile->connected) cairo_set_source_rgb(cr, 0.3, 0.8, 0.3);
+    else cairo_set_source_rgb(cr, 0.5, 0.5, 0.5);
+    cairo_arc(cr, rect->x + 6, label_y, 4, 0, 2 * G_PI);
+    cairo_fill(cr);
+
+    PangoLayout *layout = gtk_widget_create_pango_layout(wall->area, opdesk_config_get_printer_name(opdesk_server_get_config(tile->server)));
+    pango_layout_set_width(layout, MAX(wall->tile_width - 14, 1) * PANGO_SCALE);
+    pango_layout_set_ellipsize(layout, PANGO_ELLIPSIZE_END);
+    gint text_height;
+    pango_layout_get_pixel_size(layout, NULL, &text_height);
+    cairo_move_to(cr, rect->x + 14, label_y - text_height / 2.0);
+    cairo_set_source_rgb(cr, 0.9, 0.9, 0.9);
+    pango_cairo_show_layout(cr, layout);
+    g_object_unref(layout);
+}
+
+static gboolean on_area_draw(GtkWidget *area, cairo_t *cr, OPDeskWebcamWall *wall) {
+    cairo_set_source_rgb(cr, 0.08, 0.08, 0.08);
+    cairo_paint(cr);
+    if(!wall->tiles || !wall->tile_width) return FALSE;
+
+    // usually a single tile was updated, the rest is clipped away
+    GdkRectangle clip;
+    if(!gdk_cairo_get_clip_rectangle(cr, &clip)) return FALSE;
+
+    for(guint t=0;t<wall->tiles->len;t++) {
+        GdkRectangle rect;
+        opdesk_webcam_wall_get_tile_rect(wall, t, &rect);
+        if(!gdk_rectangle_intersect(&rect, &clip, NULL)) continue;
+        opdesk_webcam_wall_draw_tile(wall, cr, g_ptr_array_index(wall->tiles, t), &rect);
+    }
+
+    return FALSE;
+}
+
+static gboolean on_area_button_press(GtkWidget *area, GdkEventButton *event, OPDeskWebcamWall *wall) {
+    if(event->button!=GDK_BUTTON_PRIMARY || !wall->tiles) return GDK_EVENT_PROPAGATE;
+
+    for(guint t=0;t<wall->tiles->len;t++) {
+        GdkRectangle rect;
+        opdesk_webcam_wall_get_tile_rect(wall, t, &rect);
+        if(event->x < rect.x || event->x >= rect.x + rect.width || event->y < rect.y || event->y >= rect.y + rect.height) continue;
+
+        OPDeskWebcamTile *tile = g_ptr_array_index(wall->tiles, t);
+        gtk_widget_show_all(GTK_WIDGET(opdesk_webcam_window_new(tile->server)));
+        return GDK_EVENT_STOP;
+    }
+
+    return GDK_EVENT_PROPAGATE;
+}
+
+static void opdesk_webcam_wall_init(OPDeskWebcamWall *wall) {
+    gtk_window_set_default_size(GTK_WINDOW(wall), 960, 640);
+    gtk_window_set_title(GTK_WINDOW(wall), "Webcams");
+
+    wall->area = gtk_drawing_area_new();
+    gtk_widget_add_events(wall->area, GDK_BUTTON_PRESS_MASK);
+    g_signal_connect(wall->area, "draw", G_CALLBACK(on_area_draw), wall);
+    g_signal_connect(wall->area, "size-allocate", G_CALLBACK(on_area_size_allocate), wall);
+    g_signal_connect(wall->area, "button-press-event", G_CALLBACK(on_area_button_press), wall);
+    gtk_container_add(GTK_CONTAINER(wall), wall->area);
+
+    g_signal_connect(wall, "map", G_CALLBACK(on_window_map), wall);
+    g_signal_connect(wall, "unmap", G_CALLBACK(on_window_unmap), wall);
+    g_signal_connect(wall, "window-state-event", G_CALLBACK(on_window_state_event), wall);
+}
+
+OPDeskWebcamWall *opdesk_webcam_wall_new(OPDeskAppConfig *config, GList *servers) {
+    OPDeskWebcamWall *wall = g_object_new(OPDESK_TYPE_WEBCAM_WALL, NULL);
+
+    wall->fps = CLAMP(opdesk_app_config_get_double(config, "webcam.wallFps", 4.0), 0.1, 60.0);
+    wall->max_busy = MAX(2, (guint)wall->fps);
+
+    wall->tiles = g_ptr_array_new_with_free_func((GDestroyNotify)opdesk_webcam_tile_free);
+    for(; servers; servers = servers->next) {
+        OPDeskWebcamTile *tile = g_malloc0(sizeof(OPDeskWebcamTile));
+        tile->wall = wall;
+        tile->server = g_object_ref(servers->data);
+        tile->webcam = opdesk_webcam_get_for_server(tile->server);
+        tile->printing = opdesk_server_is_printing(tile->server);
+        tile->connected = opdesk_server_is_connected(tile->server);
+
+        g_signal_connect(tile->webcam, "snapshot-ready", G_CALLBACK(on_tile_snapshot_ready), tile);
+        g_signal_connect(tile->server, "status-updated", G_CALLBACK(on_tile_status_updated), tile);
+        g_ptr_array_add(wall->tiles, tile);
+    }
+
+    return wall;
+}
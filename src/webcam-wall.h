@@ -0,0 +1,34 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gtk/gtk.h>
+
+#include "config.h"
+
+G_BEGIN_DECLS
+
+/* Snapshots from every server's webcam, tiled in one window. Snapshots are fetched one at a time,
+   at webcam.wallFps across the whole wall, oldest first. Printers that are printing come around more often,
+   and a printer that just changed state is next. Nothing is fetched while the window is hidden.
+   Clicking a tile opens that printer's live stream. */
+#define OPDESK_TYPE_WEBCAM_WALL (opdesk_webcam_wall_get_type())
+G_DECLARE_FINAL_TYPE(OPDeskWebcamWall, opdesk_webcam_wall, OPDESK, WEBCAM_WALL, GtkWindow)
+
+/* servers is a list of OPDeskServer, each is referenced */
+OPDeskWebcamWall *opdesk_webcam_wall_new(OPDeskAppConfig *config, GList *servers);
+
+G_END_DECLS
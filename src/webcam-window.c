@@ -0,0 +1,253 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-webcam-window"
+#include <glib.h>
+
+#include "webcam-window.h"
+#include "webcam.h"
+#include "mjpeg-stream.h"
+
+struct _OPDeskWebcamWindow {
+    GtkWindow parent_inst;
+
+    OPDeskServer *server;
+    // created once the stream URL is known
+    OPDeskMJPEGStream *stream;
+
+    GtkWidget *area;
+    GtkWidget *status;
+
+    gboolean iconified;
+    guint stats_source;
+};
+
+G_DEFINE_TYPE(OPDeskWebcamWindow, opdesk_webcam_window, GTK_TYPE_WINDOW);
+
+typedef enum {
+    WINDOW_PROP_SERVER = 1,
+    N_PROPERTIES
+} OPDeskWebcamWindowProperties;
+
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
+
+static void on_server_settings_changed(OPDeskServer *server, OPDeskWebcamWindow *win);
+
+static void opdesk_webcam_window_set_property(GObject *object, guint property_id, const GValue *value, GParamSpec *pspec) {
+    OPDeskWebcamWindow *self = OPDESK_WEBCAM_WINDOW(object);
+
+    switch ((OPDeskWebcamWindowProperties)property_id) {
+    case WINDOW_PROP_SERVER:
+        if(self->server) {
+            g_signal_handlers_disconnect_by_data(self->server, self);
+            g_object_unref(self->server);
+        }
+        self->server = g_value_get_object(value);
+        if(self->server) {
+            g_object_ref(self->server);
+            g_signal_connect_object(self->server, "settings-changed", G_CALLBACK(on_server_settings_changed), self, 0);
+        }
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+        break;
+    }
+}
+
+static void opdesk_webcam_window_get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec) {
+    OPDeskWebcamWindow *self = OPDESK_WEBCAM_WINDOW(object);
+    switch ((OPDeskWebcamWindowProperties)property_id) {
+    case WINDOW_PROP_SERVER:
+        g_value_set_object(value, self->server);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+        break;
+    }
+}
+
+static void opdesk_webcam_window_dispose(GObject *object) {
+    OPDeskWebcamWindow *self = OPDESK_WEBCAM_WINDOW(object);
+
+    if(self->stats_source) {
+        g_source_remove(self->stats_source);
+        self->stats_source = 0;
+    }
+    if(self->stream) {
+        g_signal_handlers_disconnect_by_data(self->stream, self);
+        opdesk_mjpeg_stream_stop(self->stream);
+        g_clear_object(&self->stream);
+    }
+
+    G_OBJECT_CLASS(opdesk_webcam_window_parent_class)->dispose(object);
+}
+
+static void opdesk_webcam_window_finalize(GObject *object) {
+    OPDeskWebcamWindow *self = OPDESK_WEBCAM_WINDOW(object);
+    if(self->server) g_object_unref(self->server);
+    G_OBJECT_CLASS(opdesk_webcam_window_parent_class)->finalize(object);
+}
+
+static void opdesk_webcam_window_class_init(OPDeskWebcamWindowClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->get_property = opdesk_webcam_window_get_property;
+    object_class->set_property = opdesk_webcam_window_set_property;
+    object_class->dispose = opdesk_webcam_window_dispose;
+    object_class->finalize = opdesk_webcam_window_finalize;
+
+    obj_properties[WINDOW_PROP_SERVER] = g_param_spec_object("server", "server", "OctoPrint Server", OPDESK_TYPE_SERVER, G_PARAM_READWRITE);
+
+    g_object_class_install_properties (object_class, N_PROPERTIES, obj_properties);
+}
+
+static gboolean on_stats_timeout(OPDeskWebcamWindow *win) {
+    OPDeskMJPEGStats stats;
+    opdesk_mjpeg_stream_get_stats(win->stream, &stats);
+    if(!stats.frames) return G_SOURCE_CONTINUE;
+
+    char *text = g_strdup_printf("%0.1f fps, %s %0.0f ms, decode %0.1f ms, %" G_GUINT64_FORMAT " dropped",
+        stats.fps, stats.latency_from_camera ? "latency" : "receive to display", stats.latency_ms, stats.decode_ms, stats.dropped);
+    gtk_label_set_text(GTK_LABEL(win->status), text);
+    g_free(text);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void on_stream_frame(OPDeskMJPEGStream *stream, OPDeskWebcamWindow *win) {
+    gtk_widget_queue_draw(win->area);
+}
+
+static void on_stream_error(OPDeskMJPEGStream *stream, const char *message, OPDeskWebcamWindow *win) {
+    gtk_label_set_text(GTK_LABEL(win->status), message);
+}
+
+// streams only while the window can be seen
+static void opdesk_webcam_window_update_stream(OPDeskWebcamWindow *win) {
+    if(!win->stream && win->server) {
+        const char *url = opdesk_webcam_get_stream_url(opdesk_webcam_get_for_server(win->server));
+        if(!url) {
+            // "settings-changed" tries again once they're fetched
+            gtk_label_set_text(GTK_LABEL(win->status), opdesk_server_peek_settings(win->server) ? "No webcam stream" : "Waiting for OctoPrint...");
+            return;
+        }
+
+        win->stream = opdesk_mjpeg_stream_new(url);
+        g_signal_connect_object(win->stream, "frame", G_CALLBACK(on_stream_frame), win, 0);
+        g_signal_connect_object(win->stream, "error", G_CALLBACK(on_stream_error), win, 0);
+        gtk_label_set_text(GTK_LABEL(win->status), "Connecting...");
+
+        GtkAllocation alloc;
+        gtk_widget_get_allocation(win->area, &alloc);
+        gint scale = gtk_widget_get_scale_factor(win->area);
+        opdesk_mjpeg_stream_set_max_size(win->stream, alloc.width * scale, alloc.height * scale);
+    }
+    if(!win->stream) return;
+
+    gboolean visible = gtk_widget_get_mapped(GTK_WIDGET(win)) && !win->iconified;
+    if(visible && !opdesk_mjpeg_stream_is_running(win->stream)) {
+        opdesk_mjpeg_stream_start(win->stream);
+        win->stats_source = g_timeout_add_seconds(1, G_SOURCE_FUNC(on_stats_timeout), win);
+    } else if(!visible && opdesk_mjpeg_stream_is_running(win->stream)) {
+        opdesk_mjpeg_stream_stop(win->stream);
+        g_source_remove(win->stats_source);
+        win->stats_source = 0;
+        gtk_label_set_text(GTK_LABEL(win->status), "Paused");
+    }
+}
+
+static void on_server_settings_changed(OPDeskServer *server, OPDeskWebcamWindow *win) {
+    opdesk_webcam_window_update_stream(win);
+}
+
+static void on_window_map(GtkWidget *widget, OPDeskWebcamWindow *win) {
+    opdesk_webcam_window_update_stream(win);
+}
+
+static void on_window_unmap(GtkWidget *widget, OPDeskWebcamWindow *win) {
+    opdesk_webcam_window_update_stream(win);
+}
+
+static gboolean on_window_state_event(GtkWidget *widget, GdkEventWindowState *event, OPDeskWebcamWindow *win) {
+    win->iconified = (event->new_window_state & GDK_WINDOW_STATE_ICONIFIED)!=0;
+    opdesk_webcam_window_update_stream(win);
+    return GDK_EVENT_PROPAGATE;
+}
+
+static void on_area_size_allocate(GtkWidget *area, GdkRectangle *alloc, OPDeskWebcamWindow *win) {
+    if(!win->stream) return;
+    // decoding straight to the size shown is much cheaper than full size
+    gint scale = gtk_widget_get_scale_factor(area);
+    opdesk_mjpeg_stream_set_max_size(win->stream, alloc->width * scale, alloc->height * scale);
+}
+
+static gboolean on_area_draw(GtkWidget *area, cairo_t *cr, OPDeskWebcamWindow *win) {
+    gdouble width = gtk_widget_get_allocated_width(area);
+    gdouble height = gtk_widget_get_allocated_height(area);
+
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    cairo_paint(cr);
+
+    cairo_surface_t *frame = win->stream ? opdesk_mjpeg_stream_get_frame(win->stream) : NULL;
+    if(!frame) return FALSE;
+
+    gdouble frame_width = cairo_image_surface_get_width(frame);
+    gdouble frame_height = cairo_image_surface_get_height(frame);
+    gdouble scale = MIN(width / frame_width, height / frame_height);
+
+    cairo_translate(cr, (width - frame_width * scale) / 2, (height - frame_height * scale) / 2);
+    cairo_scale(cr, scale, scale);
+    cairo_set_source_surface(cr, frame, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+    cairo_paint(cr);
+
+    return FALSE;
+}
+
+static void opdesk_webcam_window_init(OPDeskWebcamWindow *win) {
+    gtk_window_set_default_size(GTK_WINDOW(win), 640, 520);
+    gtk_window_set_title(GTK_WINDOW(win), "Webcam");
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+    gtk_container_add(GTK_CONTAINER(win), box);
+
+    win->area = gtk_drawing_area_new();
+    g_signal_connect(win->area, "draw", G_CALLBACK(on_area_draw), win);
+    g_signal_connect(win->area, "size-allocate", G_CALLBACK(on_area_size_allocate), win);
+    gtk_box_pack_start(GTK_BOX(box), win->area, TRUE, TRUE, 0);
+
+    win->status = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(win->status), 0.0);
+    gtk_widget_set_margin_start(win->status, 6);
+    gtk_widget_set_margin_top(win->status, 6);
+    gtk_widget_set_margin_bottom(win->status, 6);
+    gtk_box_pack_start(GTK_BOX(box), win->status, FALSE, FALSE, 0);
+
+    g_signal_connect(win, "map", G_CALLBACK(on_window_map), win);
+    g_signal_connect(win, "unmap", G_CALLBACK(on_window_unmap), win);
+    g_signal_connect(win, "window-state-event", G_CALLBACK(on_window_state_event), win);
+}
+
+OPDeskWebcamWindow *opdesk_webcam_window_new(OPDeskServer *server) {
+    OPDeskWebcamWindow *win = g_object_new(OPDESK_TYPE_WEBCAM_WINDOW, "server", server, NULL);
+
+    char *title = g_strdup_printf("Webcam - %s", opdesk_config_get_printer_name(opdesk_server_get_config(server)));
+    gtk_window_set_title(GTK_WINDOW(win), title);
+    g_free(title);
+
+    return win;
+}
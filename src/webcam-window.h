@@ -0,0 +1,31 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <gtk/gtk.h>
+
+#include "server.h"
+
+G_BEGIN_DECLS
+
+/* A server's live webcam stream. Frames are scaled to the window while decoding and the stream is
+   closed while the window is hidden or minimized. Frame rate, latency and decode time are shown below it. */
+#define OPDESK_TYPE_WEBCAM_WINDOW (opdesk_webcam_window_get_type())
+G_DECLARE_FINAL_TYPE(OPDeskWebcamWindow, opdesk_webcam_window, OPDESK, WEBCAM_WINDOW, GtkWindow)
+
+OPDeskWebcamWindow *opdesk_webcam_window_new(OPDeskServer *server);
+
+G_END_DECLS
@@ -0,0 +1,410 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#define G_LOG_USE_STRUCTURED
+#define G_LOG_DOMAIN "opdesk-webcam"
+#include <glib.h>
+#include <string.h>
+
+#include <libsoup/soup.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include "webcam.h"
+
+#define SNAPSHOT_CACHE_SIZE   4
+#define SNAPSHOT_TIMEOUT      10 // seconds
+#define SNAPSHOT_MAX_PER_HOST 2
+
+struct _OPDeskWebcam {
+    GObject parent_instance;
+
+    OPDeskServer *server; // weak, the server owns the webcam
+
+    gboolean resolved;
+    char *snapshot_url;
+    char *stream_url;
+
+    // the fetch in flight, and every size waiting for it
+    SoupMessage *fetching;
+    GArray *wanted; // OPDeskWebcamSize
+    guint decoding;
+
+    GQueue cache; // OPDeskWebcamSnapshot, most recently used first
+};
+
+G_DEFINE_TYPE (OPDeskWebcam, opdesk_webcam, G_TYPE_OBJECT)
+
+typedef struct {
+    gint width;
+    gint height;
+} OPDeskWebcamSize;
+
+typedef struct {
+    OPDeskWebcamSize size; // asked for, the surface fits within it
+    cairo_surface_t *surface;
+} OPDeskWebcamSnapshot;
+
+typedef enum {
+    SNAPSHOT_READY,
+    N_SIGNALS
+} OPDeskWebcamSignals;
+
+static guint obj_signals[N_SIGNALS] = { 0, };
+
+// snapshots often come from a separate streamer, not through OctoPrint's client
+static SoupSession *snapshot_session = NULL;
+
+static void opdesk_webcam_snapshot_free(OPDeskWebcamSnapshot *snapshot) {
+    cairo_surface_destroy(snapshot->surface);
+    g_free(snapshot);
+}
+
+static void opdesk_webcam_dispose(GObject *object) {
+    OPDeskWebcam *self = OPDESK_WEBCAM(object);
+
+    if(self->server) {
+        g_signal_handlers_disconnect_by_data(self->server, self);
+        g_object_remove_weak_pointer(G_OBJECT(self->server), (gpointer*)&self->server);
+        self->server = NULL;
+    }
+
+    G_OBJECT_CLASS(opdesk_webcam_parent_class)->dispose(object);
+}
+
+static void opdesk_webcam_finalize(GObject *object) {
+    OPDeskWebcam *self = OPDESK_WEBCAM(object);
+
+    g_free(self->snapshot_url);
+    g_free(self->stream_url);
+    g_array_unref(self->wanted);
+    g_queue_clear_full(&self->cache, (GDestroyNotify)opdesk_webcam_snapshot_free);
+
+    G_OBJECT_CLASS(opdesk_webcam_parent_class)->finalize(object);
+}
+
+static void opdesk_webcam_class_init(OPDeskWebcamClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->dispose = opdesk_webcam_dispose;
+    object_class->finalize = opdesk_webcam_finalize;
+
+    obj_signals[SNAPSHOT_READY] = g_signal_new("snapshot-ready", G_TYPE_FROM_CLASS(klass),
+        G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_INT, G_TYPE_INT);
+}
+
+static void opdesk_webcam_init(OPDeskWebcam *webcam) {
+    webcam->wanted = g_array_new(FALSE, FALSE, sizeof(OPDeskWebcamSize));
+    g_queue_init(&webcam->cache);
+}
+
+static void on_server_settings_changed(OPDeskServer *server, OPDeskWebcam *webcam) {
+    webcam->resolved = FALSE;
+    g_clear_pointer(&webcam->snapshot_url, g_free);
+    g_clear_pointer(&webcam->stream_url, g_free);
+
+    // sizes asked for before the URL was known
+    if(webcam->wanted->len && !webcam->fetching) {
+        OPDeskWebcamSize size = g_array_index(webcam->wanted, OPDeskWebcamSize, 0);
+        opdesk_webcam_refresh(webcam, size.width, size.height);
+    }
+}
+
+OPDeskWebcam *opdesk_webcam_get_for_server(OPDeskServer *server) {
+    OPDeskWebcam *webcam = g_object_get_data(G_OBJECT(server), "opdesk-webcam");
+    if(webcam) return webcam;
+
+    webcam = g_object_new(OPDESK_TYPE_WEBCAM, NULL);
+    webcam->server = server;
+    g_object_add_weak_pointer(G_OBJECT(server), (gpointer*)&webcam->server);
+    g_signal_connect(server, "settings-changed", G_CALLBACK(on_server_settings_changed), webcam);
+    g_object_set_data_full(G_OBJECT(server), "opdesk-webcam", webcam, g_object_unref);
+
+    return webcam;
+}
+
+static gboolean is_loopback(const char *host) {
+    return host && (strcmp(host, "127.0.0.1")==0 || strcmp(host, "localhost")==0 || strcmp(host, "::1")==0);
+}
+
+// url can be relative to OctoPrint. Loopback addresses only work on the Pi itself, replace_loopback
+// points them at the OctoPrint host instead, otherwise they aren't used
+static char *opdesk_webcam_resolve_url(OPDeskWebcam *webcam, const char *url, gboolean replace_loopback) {
+    if(!url || !*url) return NULL;
+
+    SoupURI *base = soup_uri_new(opdesk_config_get_octoprint_url(opdesk_server_get_config(webcam->server)));
+    if(!base) return NULL;
+    SoupURI *uri = soup_uri_new_with_base(base, url);
+
+    char *ret = NULL;
+    if(uri && SOUP_URI_VALID_FOR_HTTP(uri)) {
+        if(is_loopback(soup_uri_get_host(uri)) && !is_loopback(soup_uri_get_host(base))) {
+            if(replace_loopback) soup_uri_set_host(uri, soup_uri_get_host(base));
+            else g_clear_pointer(&uri, soup_uri_free);
+        }
+        if(uri) ret = soup_uri_to_string(uri, FALSE);
+    }
+
+    if(uri) soup_uri_free(uri);
+    soup_uri_free(base);
+    return ret;
+}
+
+static void opdesk_webcam_resolve(OPDeskWebcam *webcam) {
+    if(webcam->resolved || !webcam->server) return;
+
+    OPDeskConfig *config = opdesk_server_get_config(webcam->server);
+    const char *snapshot = opdesk_config_get_webcam_snapshot_url(config);
+    const char *stream = opdesk_config_get_webcam_stream_url(config);
+
+    OctoPrintSettings *settings = NULL;
+    if(!snapshot || !stream) {
+        settings = opdesk_server_peek_settings(webcam->server);
+        if(!settings) return; // on_server_settings_changed tries again
+        if(!octoprint_settings_get_boolean(settings, "webcam.webcamEnabled", TRUE)) {
+            webcam->resolved = TRUE;
+            return;
+        }
+    }
+
+    if(snapshot) {
+        webcam->snapshot_url = opdesk_webcam_resolve_url(webcam, snapshot, TRUE);
+    } else {
+        // OctoPrint 1.9 moved them to the classic webcam plugin
+        const char *op_snapshot = octoprint_settings_get_string(settings, "webcam.snapshotUrl",
+            octoprint_settings_get_string(settings, "plugins.classicwebcam.snapshot", NULL));
+        const char *op_stream = octoprint_settings_get_string(settings, "webcam.streamUrl",
+            octoprint_settings_get_string(settings, "plugins.classicwebcam.stream", NULL));
+
+        // the snapshot URL is what OctoPrint itself uses, often 127.0.0.1 on a port that isn't reachable from here.
+        // mjpg-streamer and ustreamer answer snapshots next to the stream the browser uses
+        webcam->snapshot_url = opdesk_webcam_resolve_url(webcam, op_snapshot, FALSE);
+        const char *action = op_stream ? strstr(op_stream, "action=stream") : NULL;
+        if(!webcam->snapshot_url && action) {
+            char *from_stream = g_strdup_printf("%.*saction=snapshot%s", (int)(action - op_stream), op_stream, action + strlen("action=stream"));
+            webcam->snapshot_url = opdesk_webcam_resolve_url(webcam, from_stream, TRUE);
+            g_free(from_stream);
+        }
+        if(!webcam->snapshot_url) webcam->snapshot_url = opdesk_webcam_resolve_url(webcam, op_snapshot, TRUE);
+
+        if(!stream) stream = op_stream;
+    }
+    webcam->stream_url = opdesk_webcam_resolve_url(webcam, stream, TRUE);
+    webcam->resolved = TRUE;
+
+    g_debug("Webcam for %s: snapshot %s, stream %s", opdesk_config_get_printer_name(config), webcam->snapshot_url, webcam->stream_url);
+}
+
+gboolean opdesk_webcam_is_busy(OPDeskWebcam *webcam) {
+    return webcam->fetching || webcam->decoding;
+}
+
+const char *opdesk_webcam_get_snapshot_url(OPDeskWebcam *webcam) {
+    opdesk_webcam_resolve(webcam);
+    return webcam->snapshot_url;
+}
+
+const char *opdesk_webcam_get_stream_url(OPDeskWebcam *webcam) {
+    opdesk_webcam_resolve(webcam);
+    return webcam->stream_url;
+}
+
+cairo_surface_t *opdesk_webcam_get_snapshot(OPDeskWebcam *webcam, gint width, gint height) {
+    for(GList *s = webcam->cache.head; s; s = s->next) {
+        OPDeskWebcamSnapshot *snapshot = s->data;
+        if(snapshot->size.width!=width || snapshot->size.height!=height) continue;
+
+        g_queue_unlink(&webcam->cache, s);
+        g_queue_push_head_link(&webcam->cache, s);
+        return snapshot->surface;
+    }
+    return NULL;
+}
+
+static void opdesk_webcam_store(OPDeskWebcam *webcam, OPDeskWebcamSize size, cairo_surface_t *surface) {
+    for(GList *s = webcam->cache.head; s; s = s->next) {
+        OPDeskWebcamSnapshot *snapshot = s->data;
+        if(snapshot->size.width!=size.width || snapshot->size.height!=size.height) continue;
+
+        g_queue_delete_link(&webcam->cache, s);
+        opdesk_webcam_snapshot_free(snapshot);
+        break;
+    }
+
+    OPDeskWebcamSnapshot *snapshot = g_malloc0(sizeof(OPDeskWebcamSnapshot));
+    snapshot->size = size;
+    snapshot->surface = surface;
+    g_queue_push_head(&webcam->cache, snapshot);
+
+    while(webcam->cache.length > SNAPSHOT_CACHE_SIZE) opdesk_webcam_snapshot_free(g_queue_pop_tail(&webcam->cache));
+}
+
+static void on_size_prepared(GdkPixbufLoader *loader, gint width, gint height, OPDeskWebcamSize *max) {
+    gdouble scale = 1.0;
+    if(max->width > 0) scale = MIN(scale, (gdouble)max->width / width);
+    if(max->height > 0) scale = MIN(scale, (gdouble)max->height / height);
+    if(scale < 1.0) gdk_pixbuf_loader_set_size(loader, MAX(1, (gint)(width * scale)), MAX(1, (gint)(height * scale)));
+}
+
+static cairo_surface_t *surface_from_pixbuf(GdkPixbuf *pixbuf) {
+    gint width = gdk_pixbuf_get_width(pixbuf);
+    gint height = gdk_pixbuf_get_height(pixbuf);
+    gint channels = gdk_pixbuf_get_n_channels(pixbuf);
+    gint src_stride = gdk_pixbuf_get_rowstride(pixbuf);
+    gboolean alpha = gdk_pixbuf_get_has_alpha(pixbuf);
+    const guchar *src = gdk_pixbuf_read_pixels(pixbuf);
+
+    cairo_surface_t *surface = cairo_image_surface_create(alpha ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24, width, height);
+    cairo_surface_flush(surface);
+    guchar *dst = cairo_image_surface_get_data(surface);
+    gint dst_stride = cairo_image_surface_get_stride(surface);
+
+    for(gint y=0;y<height;y++) {
+        const guchar *s = src + (gsize)y * src_stride;
+        guint32 *d = (guint32*)(dst + (gsize)y * dst_stride);
+        for(gint x=0;x<width;x++, s+=channels) {
+            guint32 a = alpha ? s[3] : 0xff;
+            // cairo wants premultiplied alpha
+            guint32 r = alpha ? s[0] * a / 0xff : s[0];
+            guint32 g = alpha ? s[1] * a / 0xff : s[1];
+            guint32 b = alpha ? s[2] * a / 0xff : s[2];
+            d[x] = (a << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+
+    cairo_surface_mark_dirty(surface);
+    return surface;
+}
+
+cairo_surface_t *opdesk_webcam_decode(GBytes *data, gint max_width, gint max_height, GError **error) {
+    OPDeskWebcamSize max = { max_width, max_height };
+
+    GdkPixbufLoader *loader = gdk_pixbuf_loader_new();
+    g_signal_connect(loader, "size-prepared", G_CALLBACK(on_size_prepared), &max);
+
+    gboolean ok = gdk_pixbuf_loader_write_bytes(loader, data, error);
+    // always closed, even after an error
+    ok = gdk_pixbuf_loader_close(loader, ok ? error : NULL) && ok;
+
+    cairo_surface_t *surface = NULL;
+    GdkPixbuf *pixbuf = ok ? gdk_pixbuf_loader_get_pixbuf(loader) : NULL;
+    if(pixbuf) surface = surface_from_pixbuf(pixbuf);
+    else if(ok) g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Not an image");
+
+    g_object_unref(loader);
+    return surface;
+}
+
+typedef struct {
+    GBytes *data;
+    OPDeskWebcamSize size;
+} OPDeskWebcamDecodeData;
+
+static void opdesk_webcam_decode_data_free(OPDeskWebcamDecodeData *data) {
+    g_bytes_unref(data->data);
+    g_free(data);
+}
+
+static void decode_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    OPDeskWebcamDecodeData *data = task_data;
+    GError *err = NULL;
+    cairo_surface_t *surface = opdesk_webcam_decode(data->data, data->size.width, data->size.height, &err);
+    if(surface) g_task_return_pointer(task, surface, (GDestroyNotify)cairo_surface_destroy);
+    else g_task_return_error(task, err);
+}
+
+static void on_snapshot_decoded(OPDeskWebcam *webcam, GAsyncResult *result, gpointer user_data) {
+    OPDeskWebcamDecodeData *data = g_task_get_task_data(G_TASK(result));
+    OPDeskWebcamSize size = data->size;
+    webcam->decoding--;
+
+    GError *err = NULL;
+    cairo_surface_t *surface = g_task_propagate_pointer(G_TASK(result), &err);
+    if(!surface) {
+        g_warning("Couldn't decode webcam snapshot: %s", err->message);
+        g_error_free(err);
+        return;
+    }
+
+    opdesk_webcam_store(webcam, size, surface);
+    g_signal_emit(webcam, obj_signals[SNAPSHOT_READY], 0, size.width, size.height);
+}
+
+static void on_snapshot_fetched(SoupSession *session, SoupMessage *msg, OPDeskWebcam *webcam) {
+    webcam->fetching = NULL;
+
+    if(!SOUP_STATUS_IS_SUCCESSFUL(msg->status_code)) {
+        g_debug("Webcam snapshot failed: %u %s", msg->status_code, msg->reason_phrase);
+        g_array_set_size(webcam->wanted, 0);
+        g_object_unref(webcam);
+        return;
+    }
+
+    SoupBuffer *buffer = soup_message_body_flatten(msg->response_body);
+    GBytes *bytes = soup_buffer_get_as_bytes(buffer);
+    soup_buffer_free(buffer);
+
+    // decoding every size from the same download
+    for(guint w=0;w<webcam->wanted->len;w++) {
+        OPDeskWebcamDecodeData *data = g_malloc0(sizeof(OPDeskWebcamDecodeData));
+        data->data = g_bytes_ref(bytes);
+        data->size = g_array_index(webcam->wanted, OPDeskWebcamSize, w);
+
+        GTask *task = g_task_new(webcam, NULL, (GAsyncReadyCallback)on_snapshot_decoded, NULL);
+        g_task_set_task_data(task, data, (GDestroyNotify)opdesk_webcam_decode_data_free);
+        g_task_run_in_thread(task, decode_thread);
+        g_object_unref(task);
+        webcam->decoding++;
+    }
+    g_array_set_size(webcam->wanted, 0);
+    g_bytes_unref(bytes);
+
+    g_object_unref(webcam);
+}
+
+void opdesk_webcam_refresh(OPDeskWebcam *webcam, gint width, gint height) {
+    gboolean have = FALSE;
+    for(guint w=0;w<webcam->wanted->len && !have;w++) {
+        OPDeskWebcamSize *size = &g_array_index(webcam->wanted, OPDeskWebcamSize, w);
+        have = size->width==width && size->height==height;
+    }
+    if(!have) {
+        OPDeskWebcamSize size = { width, height };
+        g_array_append_val(webcam->wanted, size);
+    }
+
+    if(webcam->fetching) return;
+
+    const char *url = opdesk_webcam_get_snapshot_url(webcam);
+    if(!url) {
+        // keep what's wanted until the settings arrive, unless there's no webcam
+        if(webcam->resolved) g_array_set_size(webcam->wanted, 0);
+        return;
+    }
+
+    if(!snapshot_session) {
+        snapshot_session = soup_session_new_with_options(
+            "max-conns-per-host", SNAPSHOT_MAX_PER_HOST,
+            "timeout", SNAPSHOT_TIMEOUT,
+            NULL);
+    }
+
+    webcam->fetching = soup_message_new("GET", url);
+    if(!webcam->fetching) {
+        g_warning("Invalid webcam snapshot URL %s", url);
+        g_array_set_size(webcam->wanted, 0);
+        return;
+    }
+    soup_session_queue_message(snapshot_session, webcam->fetching, (SoupSessionCallback)on_snapshot_fetched, g_object_ref(webcam));
+}
@@ -0,0 +1,51 @@
+// Copyright 2021 Taylor Talkington
+//
+// This file is part of OctoPrint-Desktop.
+//
+// OctoPrint-Desktop is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OctoPrint-Desktop is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OctoPrint-Desktop.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <glib-object.h>
+#include <cairo.h>
+
+#include "server.h"
+
+G_BEGIN_DECLS
+
+/* A server's webcam snapshots. Snapshots are fetched in the background and decoded, scaled to the
+   size asked for, on worker threads. The most recently used sizes are kept ready to draw and
+   "snapshot-ready" (width, height) is emitted when a new one for that size is. */
+#define OPDESK_TYPE_WEBCAM opdesk_webcam_get_type()
+G_DECLARE_FINAL_TYPE (OPDeskWebcam, opdesk_webcam, OPDESK, WEBCAM, GObject)
+
+/* one per server, created on first use and owned by the server */
+OPDeskWebcam *opdesk_webcam_get_for_server(OPDeskServer *server);
+
+/* Fetches a new snapshot to fit within width x height, unless one is already on the way.
+   Does nothing until the snapshot URL is known */
+void opdesk_webcam_refresh(OPDeskWebcam *webcam, gint width, gint height);
+/* TRUE while a snapshot is being fetched or decoded */
+gboolean opdesk_webcam_is_busy(OPDeskWebcam *webcam);
+/* the latest snapshot for that size or NULL, owned by the webcam */
+cairo_surface_t *opdesk_webcam_get_snapshot(OPDeskWebcam *webcam, gint width, gint height);
+
+/* absolute URLs from the server config or OctoPrint's webcam settings.
+   NULL if the webcam is disabled or the settings haven't been fetched yet */
+const char *opdesk_webcam_get_snapshot_url(OPDeskWebcam *webcam);
+const char *opdesk_webcam_get_stream_url(OPDeskWebcam *webcam);
+
+/* Decodes an image, scaled down to fit within max_width x max_height (0 for no limit).
+   JPEGs are scaled while decoding. Safe to call from any thread */
+cairo_surface_t *opdesk_webcam_decode(GBytes *data, gint max_width, gint max_height, GError **error);
+
+G_END_DECLS